@@ -139,3 +139,168 @@ meta_create_texture (int                   width,
 
   return texture;
 }
+
+/* We only need a couple of entry points that Cogl doesn't wrap, so
+ * declare them with plain C types rather than pulling in the GL headers.
+ */
+#define META_GL_TEXTURE_BINDING_2D        0x8069
+#define META_GL_TEXTURE_RECTANGLE_ARB     0x84F5
+#define META_GL_TEXTURE_BINDING_RECTANGLE 0x84F6
+#define META_GL_MAX_FRAGMENT_UNIFORM_COMPONENTS 0x8B49
+#define META_GL_MAX_FRAGMENT_UNIFORM_VECTORS    0x8DFD
+
+/* The least GL_MAX_FRAGMENT_UNIFORM_VECTORS that GLES2 allows */
+#define META_GL_MIN_FRAGMENT_UNIFORM_VECTORS 16
+
+typedef void (* MetaGLBindTexture)       (unsigned int target,
+                                          unsigned int texture);
+typedef void (* MetaGLGetIntegerv)       (unsigned int pname,
+                                          int         *params);
+typedef unsigned int (* MetaGLGetError)  (void);
+typedef void (* MetaGLCopyTexSubImage2D) (unsigned int target,
+                                          int          level,
+                                          int          xoffset,
+                                          int          yoffset,
+                                          int          x,
+                                          int          y,
+                                          int          width,
+                                          int          height);
+
+/**
+ * meta_cogl_framebuffer_copy_to_texture:
+ * @framebuffer: the framebuffer to copy from
+ * @src_x: X coordinate of the area to copy, in framebuffer pixels
+ * @src_y: Y coordinate of the area to copy, from the top of @framebuffer
+ * @width: width of the area to copy
+ * @height: height of the area to copy
+ * @dest: an allocated 2D texture at least @width x @height in size
+ * @flipped: (out): set to %TRUE if the rows in @dest are bottom-up
+ *
+ * Copies an area of @framebuffer into the top-left corner of @dest
+ * without the pixel data ever leaving the GPU, unlike
+ * cogl_framebuffer_read_pixels(). The copy is done with
+ * glCopyTexSubImage2D() since Cogl has no public blit API.
+ *
+ * Onscreen framebuffers are stored bottom-up, and the copy doesn't
+ * undo that, so when @flipped is set the caller must invert the T
+ * texture coordinate when sampling @dest.
+ *
+ * Return value: %TRUE if the copy was issued
+ */
+gboolean
+meta_cogl_framebuffer_copy_to_texture (CoglFramebuffer *framebuffer,
+                                       int              src_x,
+                                       int              src_y,
+                                       int              width,
+                                       int              height,
+                                       CoglTexture     *dest,
+                                       gboolean        *flipped)
+{
+  static MetaGLBindTexture bind_texture = NULL;
+  static MetaGLGetIntegerv get_integerv = NULL;
+  static MetaGLCopyTexSubImage2D copy_tex_sub_image_2d = NULL;
+  static CoglPipeline *noop_pipeline = NULL;
+  unsigned int gl_handle, gl_target;
+  int old_binding = 0;
+  int gl_y;
+
+  if (G_UNLIKELY (copy_tex_sub_image_2d == NULL))
+    {
+      CoglContext *ctx =
+        clutter_backend_get_cogl_context (clutter_get_default_backend ());
+
+      bind_texture = (MetaGLBindTexture) cogl_get_proc_address ("glBindTexture");
+      get_integerv = (MetaGLGetIntegerv) cogl_get_proc_address ("glGetIntegerv");
+      copy_tex_sub_image_2d =
+        (MetaGLCopyTexSubImage2D) cogl_get_proc_address ("glCopyTexSubImage2D");
+
+      /* Fully transparent with premultiplied blending, so it leaves the
+       * destination untouched; drawing it is only a way to make Cogl
+       * bind the framebuffer we want to copy from. */
+      noop_pipeline = cogl_pipeline_new (ctx);
+      cogl_pipeline_set_color4ub (noop_pipeline, 0, 0, 0, 0);
+    }
+
+  if (bind_texture == NULL || get_integerv == NULL || copy_tex_sub_image_2d == NULL)
+    return FALSE;
+
+  if (!cogl_texture_allocate (dest, NULL))
+    return FALSE;
+
+  if (!cogl_texture_get_gl_texture (dest, &gl_handle, &gl_target))
+    return FALSE;
+
+  cogl_framebuffer_draw_rectangle (framebuffer, noop_pipeline,
+                                   src_x, src_y, src_x + 1, src_y + 1);
+  cogl_flush ();
+
+  if (cogl_is_onscreen (framebuffer))
+    {
+      gl_y = cogl_framebuffer_get_height (framebuffer) - (src_y + height);
+      *flipped = TRUE;
+    }
+  else
+    {
+      gl_y = src_y;
+      *flipped = FALSE;
+    }
+
+  /* Cogl caches texture bindings, so put back whatever it had bound */
+  get_integerv (gl_target == META_GL_TEXTURE_RECTANGLE_ARB ?
+                META_GL_TEXTURE_BINDING_RECTANGLE : META_GL_TEXTURE_BINDING_2D,
+                &old_binding);
+  bind_texture (gl_target, gl_handle);
+  copy_tex_sub_image_2d (gl_target, 0, 0, 0, src_x, gl_y, width, height);
+  bind_texture (gl_target, old_binding);
+
+  return TRUE;
+}
+
+/**
+ * meta_cogl_get_max_fragment_uniform_vectors:
+ *
+ * Returns how many vec4 uniforms a fragment shader may declare, from
+ * GL_MAX_FRAGMENT_UNIFORM_VECTORS where the driver knows it (GLES2 and
+ * GL 4.1) and from GL_MAX_FRAGMENT_UNIFORM_COMPONENTS otherwise. If
+ * neither can be queried, this is the 16 vectors GLES2 guarantees.
+ *
+ * The GL context must be current, which it is once Clutter is
+ * initialized.
+ *
+ * Return value: the number of fragment uniform vectors
+ */
+int
+meta_cogl_get_max_fragment_uniform_vectors (void)
+{
+  static int max_vectors = 0;
+
+  if (G_UNLIKELY (max_vectors == 0))
+    {
+      MetaGLGetIntegerv get_integerv;
+      MetaGLGetError get_error;
+      int value;
+
+      max_vectors = META_GL_MIN_FRAGMENT_UNIFORM_VECTORS;
+
+      get_integerv = (MetaGLGetIntegerv) cogl_get_proc_address ("glGetIntegerv");
+      get_error = (MetaGLGetError) cogl_get_proc_address ("glGetError");
+      if (get_integerv == NULL || get_error == NULL)
+        return max_vectors;
+
+      value = 0;
+      get_integerv (META_GL_MAX_FRAGMENT_UNIFORM_VECTORS, &value);
+      if (get_error () == 0 && value > 0)
+        {
+          max_vectors = value;
+          return max_vectors;
+        }
+
+      value = 0;
+      get_integerv (META_GL_MAX_FRAGMENT_UNIFORM_COMPONENTS, &value);
+      /* Don't leave an error behind for Cogl to trip over */
+      if (get_error () == 0 && value / 4 > 0)
+        max_vectors = value / 4;
+    }
+
+  return max_vectors;
+}
@@ -35,4 +35,14 @@ CoglTexture *meta_create_texture (int                   width,
                                   CoglTextureComponents components,
                                   MetaTextureFlags      flags);
 
+gboolean meta_cogl_framebuffer_copy_to_texture (CoglFramebuffer *framebuffer,
+                                                int              src_x,
+                                                int              src_y,
+                                                int              width,
+                                                int              height,
+                                                CoglTexture     *dest,
+                                                gboolean        *flipped);
+
+int meta_cogl_get_max_fragment_uniform_vectors (void);
+
 #endif /* __META_COGL_UTILS_H__ */
@@ -9,6 +9,7 @@
 #include <meta/display.h>
 #include "meta-plugin-manager.h"
 #include "meta-window-actor-private.h"
+#include "meta-blur-factory.h"
 #include <clutter/clutter.h>
 
 struct _MetaCompositor
@@ -39,7 +40,23 @@ struct _MetaCompositor
 
   MetaPluginManager *plugin_mgr;
 
+  /* MetaBlurMode for each monitor, by monitor number; monitors past
+   * the end use the last entry. Set from $META_BLUR_MODE. */
+  GArray *blur_modes;
+  /* Strength of the blurred backdrops; set from $META_BLUR_SIGMA */
+  gfloat  blur_sigma;
+
   gboolean frame_has_updated_xsurfaces;
+
+  /* Presentation of the last frame, from frame_callback() */
+  gint64 last_presentation_time;
+  gint   refresh_interval;
+
+  /* Frame messages of obscured windows are sent every this many
+   * refresh cycles. Set from $META_OBSCURED_FRAME_INTERVAL. */
+  guint  obscured_frame_interval;
+  guint  frame_messages_timer;
+  gint64 frame_messages_time;
 };
 
 /* Wait 2ms after vblank before starting to draw next frame */
@@ -55,7 +72,13 @@ void     meta_end_modal_for_plugin   (MetaCompositor   *compositor,
                                       MetaPlugin       *plugin,
                                       guint32           timestamp);
 
+MetaBlurMode meta_compositor_get_blur_mode (MetaCompositor *compositor,
+                                            int             monitor);
+
 gint64 meta_compositor_monotonic_time_to_server_time (MetaDisplay *display,
                                                       gint64       monotonic_time);
 
+gint64 meta_compositor_queue_frame_messages (MetaCompositor *compositor,
+                                             gint64          frame_drawn_time);
+
 #endif /* META_COMPOSITOR_PRIVATE_H */
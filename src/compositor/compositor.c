@@ -73,6 +73,10 @@
 #include <meta/meta-shadow-factory.h>
 #include "meta-window-actor-private.h"
 #include "meta-window-group.h"
+#include "meta-cullable.h"
+#include "meta-frame-timings.h"
+#include "meta-output-repaint.h"
+#include "meta-texture-tower.h"
 #include "window-private.h" /* to check window->hidden */
 #include "display-private.h" /* for meta_display_lookup_x_window() and meta_display_cancel_touch() */
 #include "util-private.h"
@@ -126,6 +130,9 @@ void
 meta_compositor_destroy (MetaCompositor *compositor)
 {
   clutter_threads_remove_repaint_func (compositor->repaint_func_id);
+  if (compositor->frame_messages_timer != 0)
+    g_source_remove (compositor->frame_messages_timer);
+  g_array_free (compositor->blur_modes, TRUE);
 }
 
 static void
@@ -395,15 +402,35 @@ after_stage_paint (ClutterStage *stage,
                    gpointer      data)
 {
   MetaCompositor *compositor = data;
+  MetaDisplay *display = compositor->display;
+  gint64 frame_counter;
+  guint32 damaged_outputs;
   GList *l;
 
+  meta_frame_timings_end_phase (META_FRAME_PHASE_STAGE_PAINT);
+  meta_frame_timings_begin_phase (META_FRAME_PHASE_POST_PAINT);
+
+  /* The _NET_WM_FRAME_DRAWN messages of all windows go out together */
+  meta_error_trap_push (display);
   for (l = compositor->windows; l; l = l->next)
     meta_window_actor_post_paint (l->data);
+  XFlush (display->xdisplay);
+  meta_error_trap_pop (display);
 
 #ifdef HAVE_WAYLAND
   if (meta_is_wayland_compositor ())
     meta_wayland_compositor_paint_finished (meta_wayland_compositor_get_default ());
 #endif
+
+  meta_frame_timings_end_phase (META_FRAME_PHASE_POST_PAINT);
+
+  /* The buffers haven't been swapped yet, so this is the counter the
+   * frame we just painted will be reported with in frame_callback() */
+  frame_counter = compositor->onscreen ?
+    cogl_onscreen_get_frame_counter (compositor->onscreen) : -1;
+
+  damaged_outputs = meta_output_repaint_end_frame (frame_counter);
+  meta_frame_timings_end_frame (frame_counter, damaged_outputs);
 }
 
 static void
@@ -864,6 +891,8 @@ sync_actor_stacking (MetaCompositor *compositor)
       return;
     }
 
+  meta_cullable_invalidate_culling ();
+
   /* reorder the actors by lowering them in turn to the bottom of the stack.
    * windows first, then background.
    *
@@ -988,6 +1017,122 @@ meta_compositor_sync_window_geometry (MetaCompositor *compositor,
   meta_window_actor_sync_actor_geometry (window_actor, did_placement);
 }
 
+static gint64
+get_refresh_interval (MetaCompositor *compositor)
+{
+  if (compositor->refresh_interval > 0)
+    return compositor->refresh_interval;
+  else
+    return G_USEC_PER_SEC / 60;
+}
+
+/* Rounds @time up to the next vblank, going by the presentation times
+ * of the frames; then leaves the frame callback for that vblank
+ * META_SYNC_DELAY to come in, like the master clock does */
+static gint64
+align_to_vblank (MetaCompositor *compositor,
+                 gint64          time)
+{
+  gint64 interval = get_refresh_interval (compositor);
+  gint64 last = compositor->last_presentation_time;
+
+  if (last != 0 && time > last)
+    time = last + (time - last + interval - 1) / interval * interval;
+
+  return time + 1000 * META_SYNC_DELAY;
+}
+
+static void schedule_frame_messages (MetaCompositor *compositor,
+                                     gint64          due);
+
+static gboolean
+send_frame_messages_timeout (gpointer data)
+{
+  MetaCompositor *compositor = data;
+  MetaDisplay *display = compositor->display;
+  gint64 now = g_get_monotonic_time ();
+  gint64 interval = get_refresh_interval (compositor);
+  gint64 next_due = G_MAXINT64;
+  GList *l;
+
+  compositor->frame_messages_timer = 0;
+
+  /* Messages due before the next vblank would only wait for it, so
+   * they are sent now, along with the others */
+  meta_error_trap_push (display);
+  for (l = compositor->windows; l; l = l->next)
+    {
+      gint64 due = meta_window_actor_send_queued_frame_messages (l->data,
+                                                                 now + interval / 2,
+                                                                 compositor->refresh_interval);
+      if (due != 0)
+        next_due = MIN (next_due, due);
+    }
+  XFlush (display->xdisplay);
+  meta_error_trap_pop (display);
+
+  if (next_due != G_MAXINT64)
+    schedule_frame_messages (compositor, next_due);
+
+  return FALSE;
+}
+
+static void
+schedule_frame_messages (MetaCompositor *compositor,
+                         gint64          due)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint64 time = align_to_vblank (compositor, MAX (due, now));
+
+  if (compositor->frame_messages_timer != 0)
+    {
+      if (compositor->frame_messages_time <= time)
+        return;
+
+      g_source_remove (compositor->frame_messages_timer);
+    }
+
+ /* The clutter master clock source has already been added with META_PRIORITY_REDRAW,
+  * so the timer will run *after* the clutter frame handling, if a frame is ready
+  * to be drawn when the timer expires.
+  */
+  compositor->frame_messages_time = time;
+  compositor->frame_messages_timer = g_timeout_add_full (META_PRIORITY_REDRAW,
+                                                         (time - now + 999) / 1000,
+                                                         send_frame_messages_timeout,
+                                                         compositor, NULL);
+  g_source_set_name_by_id (compositor->frame_messages_timer, "[mutter] send_frame_messages_timeout");
+}
+
+/**
+ * meta_compositor_queue_frame_messages:
+ * @compositor: a #MetaCompositor
+ * @frame_drawn_time: when the window was last sent _NET_WM_FRAME_DRAWN,
+ *   from g_get_monotonic_time()
+ *
+ * Windows that are obscured don't get painted, so the frames they
+ * draw don't get their _NET_WM_FRAME_DRAWN when painting is done. They
+ * still get it, and _NET_WM_FRAME_TIMINGS, but only every few refresh
+ * cycles ($META_OBSCURED_FRAME_INTERVAL, 6 by default), so that
+ * clients nobody can see don't draw at the full frame rate. The
+ * messages of all such windows are sent from a single timer, right
+ * after a vblank, in one flush.
+ *
+ * Return value: when the messages of the window are due, from
+ *   g_get_monotonic_time()
+ */
+gint64
+meta_compositor_queue_frame_messages (MetaCompositor *compositor,
+                                      gint64          frame_drawn_time)
+{
+  gint64 due;
+
+  due = frame_drawn_time + compositor->obscured_frame_interval * get_refresh_interval (compositor);
+  schedule_frame_messages (compositor, due);
+
+  return due;
+}
+
 static void
 frame_callback (CoglOnscreen  *onscreen,
                 CoglFrameEvent event,
@@ -995,11 +1140,13 @@ frame_callback (CoglOnscreen  *onscreen,
                 void          *user_data)
 {
   MetaCompositor *compositor = user_data;
+  MetaDisplay *display = compositor->display;
   GList *l;
 
   if (event == COGL_FRAME_EVENT_COMPLETE)
     {
       gint64 presentation_time_cogl = cogl_frame_info_get_presentation_time (frame_info);
+      float refresh_rate = cogl_frame_info_get_refresh_rate (frame_info);
       gint64 presentation_time;
 
       if (presentation_time_cogl != 0)
@@ -1025,16 +1172,81 @@ frame_callback (CoglOnscreen  *onscreen,
           presentation_time = 0;
         }
 
+      if (presentation_time != 0)
+        compositor->last_presentation_time = presentation_time;
+      /* 0.0 is a flag for not known, but sanity-check against other odd numbers */
+      if (refresh_rate >= 1.0)
+        compositor->refresh_interval = (int) (0.5 + G_USEC_PER_SEC / refresh_rate);
+
+      /* The _NET_WM_FRAME_TIMINGS messages of all windows go out together */
+      meta_error_trap_push (display);
       for (l = compositor->windows; l; l = l->next)
         meta_window_actor_frame_complete (l->data, frame_info, presentation_time);
+      XFlush (display->xdisplay);
+      meta_error_trap_pop (display);
+
+      meta_output_repaint_presented (cogl_frame_info_get_frame_counter (frame_info),
+                                     presentation_time);
+      meta_frame_timings_presented (cogl_frame_info_get_frame_counter (frame_info),
+                                    presentation_time,
+                                    cogl_frame_info_get_refresh_rate (frame_info));
     }
 }
 
+/* Finds the window that is topmost on each monitor, and picks one of
+ * those that wants to be unredirected; we can only unredirect one
+ * window at a time. Since a window that wants to be unredirected
+ * covers a whole monitor, it is enough that nothing above it is on
+ * that monitor. */
+static MetaWindow *
+find_window_to_unredirect (MetaCompositor *compositor)
+{
+  MetaScreen *screen = compositor->display->screen;
+  MetaWindow *candidate = NULL;
+  int n_monitors, i;
+
+  n_monitors = meta_screen_get_n_monitors (screen);
+
+  for (i = 0; i < n_monitors; i++)
+    {
+      MetaRectangle monitor_rect;
+      GList *l;
+
+      meta_screen_get_monitor_geometry (screen, i, &monitor_rect);
+
+      for (l = g_list_last (compositor->windows); l; l = l->prev)
+        {
+          MetaWindowActor *window_actor = l->data;
+          MetaWindow *window = meta_window_actor_get_meta_window (window_actor);
+          MetaRectangle window_rect;
+
+          if (!CLUTTER_ACTOR_IS_VISIBLE (window_actor))
+            continue;
+
+          meta_window_get_frame_rect (window, &window_rect);
+          if (!meta_rectangle_overlap (&window_rect, &monitor_rect))
+            continue;
+
+          if (meta_window_actor_should_unredirect (window_actor))
+            {
+              /* Keep the current one rather than switching */
+              if (window == compositor->unredirected_window)
+                return window;
+              if (candidate == NULL)
+                candidate = window;
+            }
+
+          break;
+        }
+    }
+
+  return candidate;
+}
+
 static void
 pre_paint_windows (MetaCompositor *compositor)
 {
   GList *l;
-  MetaWindowActor *top_window;
 
   if (compositor->onscreen == NULL)
     {
@@ -1045,20 +1257,30 @@ pre_paint_windows (MetaCompositor *compositor)
                                                                     NULL);
     }
 
+#ifdef HAVE_WAYLAND
+  if (meta_is_wayland_compositor ())
+    {
+      meta_frame_timings_begin_phase (META_FRAME_PHASE_PRE_PAINT);
+      meta_wayland_compositor_upload_damage (meta_wayland_compositor_get_default ());
+      meta_frame_timings_end_phase (META_FRAME_PHASE_PRE_PAINT);
+    }
+#endif
+
   if (compositor->windows == NULL)
     return;
 
-  top_window = g_list_last (compositor->windows)->data;
-
-  if (meta_window_actor_should_unredirect (top_window) &&
-      compositor->disable_unredirect_count == 0)
-    set_unredirected_window (compositor, meta_window_actor_get_meta_window (top_window));
+  if (compositor->disable_unredirect_count == 0)
+    set_unredirected_window (compositor, find_window_to_unredirect (compositor));
   else
     set_unredirected_window (compositor, NULL);
 
+  meta_frame_timings_begin_phase (META_FRAME_PHASE_PRE_PAINT);
+
   for (l = compositor->windows; l; l = l->next)
     meta_window_actor_pre_paint (l->data);
 
+  meta_frame_timings_end_phase (META_FRAME_PHASE_PRE_PAINT);
+
   if (compositor->frame_has_updated_xsurfaces)
     {
       /* We need to make sure that any X drawing that happens before
@@ -1081,7 +1303,9 @@ pre_paint_windows (MetaCompositor *compositor)
        * round trip request at this point is sufficient to flush the
        * GLX buffers.
        */
+      meta_frame_timings_begin_phase (META_FRAME_PHASE_XSYNC);
       XSync (compositor->display->xdisplay, False);
+      meta_frame_timings_end_phase (META_FRAME_PHASE_XSYNC);
 
       compositor->frame_has_updated_xsurfaces = FALSE;
     }
@@ -1091,7 +1315,10 @@ static gboolean
 meta_repaint_func (gpointer data)
 {
   MetaCompositor *compositor = data;
+  meta_frame_timings_begin_frame ();
+  meta_texture_tower_begin_frame ();
   pre_paint_windows (compositor);
+  meta_frame_timings_begin_phase (META_FRAME_PHASE_STAGE_PAINT);
   return TRUE;
 }
 
@@ -1105,6 +1332,61 @@ on_shadow_factory_changed (MetaShadowFactory *factory,
     meta_window_actor_invalidate_shadow (l->data);
 }
 
+/* Parses a comma-separated list of blur modes, one per monitor, e.g.
+ * "gaussian,dual-kawase" to trade blur quality for frame time on the
+ * second monitor only. */
+static GArray *
+parse_blur_modes (const char *str)
+{
+  GArray *modes = g_array_new (FALSE, FALSE, sizeof (MetaBlurMode));
+  char **names;
+  int i;
+
+  if (str == NULL)
+    return modes;
+
+  names = g_strsplit (str, ",", -1);
+  for (i = 0; names[i] != NULL; i++)
+    {
+      const char *name = g_strstrip (names[i]);
+      MetaBlurMode mode;
+
+      if (g_strcmp0 (name, "gaussian") == 0)
+        mode = META_BLUR_MODE_GAUSSIAN;
+      else if (g_strcmp0 (name, "dual-kawase") == 0)
+        mode = META_BLUR_MODE_DUAL_KAWASE;
+      else
+        {
+          meta_warning ("Unknown blur mode '%s' in META_BLUR_MODE\n", name);
+          mode = META_BLUR_MODE_GAUSSIAN;
+        }
+
+      g_array_append_val (modes, mode);
+    }
+  g_strfreev (names);
+
+  return modes;
+}
+
+MetaBlurMode
+meta_compositor_get_blur_mode (MetaCompositor *compositor,
+                               int             monitor)
+{
+  GArray *modes = compositor->blur_modes;
+
+  if (modes->len == 0)
+    return META_BLUR_MODE_GAUSSIAN;
+
+  return g_array_index (modes, MetaBlurMode, MIN ((guint) MAX (monitor, 0), modes->len - 1));
+}
+
+static void
+on_monitors_changed (MetaMonitorManager *manager,
+                     gpointer            user_data)
+{
+  meta_output_repaint_update_outputs (manager);
+}
+
 /**
  * meta_compositor_new: (skip)
  * @display:
@@ -1121,6 +1403,45 @@ meta_compositor_new (MetaDisplay *display)
   if (g_getenv("META_DISABLE_MIPMAPS"))
     compositor->no_mipmaps = TRUE;
 
+  compositor->blur_modes = parse_blur_modes (g_getenv ("META_BLUR_MODE"));
+
+  /* Standard deviation of the blur of the backdrops, in pixels. The
+   * upper bound is what the dual Kawase levels reach; the Gaussian
+   * mode gives way to those well before it on most GPUs, see
+   * meta_blur_set_sigma(). */
+  compositor->blur_sigma = META_BLUR_DEFAULT_SIGMA;
+  if (g_getenv ("META_BLUR_SIGMA"))
+    {
+      double sigma = g_ascii_strtod (g_getenv ("META_BLUR_SIGMA"), NULL);
+
+      if (sigma < 0.0 || sigma > META_BLUR_MAX_SIGMA)
+        meta_warning ("META_BLUR_SIGMA %g is out of range, using %g\n",
+                      sigma, CLAMP (sigma, 0.0, META_BLUR_MAX_SIGMA));
+      compositor->blur_sigma = CLAMP (sigma, 0.0, META_BLUR_MAX_SIGMA);
+    }
+
+  /* Number of refresh cycles between the frame messages of obscured
+   * windows, which throttles how fast they draw */
+  compositor->obscured_frame_interval = 6;
+  if (g_getenv ("META_OBSCURED_FRAME_INTERVAL"))
+    compositor->obscured_frame_interval =
+      MAX (1, g_ascii_strtoll (g_getenv ("META_OBSCURED_FRAME_INTERVAL"), NULL, 10));
+
+  /* Number of pixels of scaled down window textures to update per frame;
+   * spreads the work of updating them over several frames */
+  if (g_getenv ("META_MIPMAP_FRAME_BUDGET"))
+    meta_texture_tower_set_frame_budget (g_ascii_strtoll (g_getenv ("META_MIPMAP_FRAME_BUDGET"), NULL, 10));
+
+  /* Record how long each part of painting a frame takes; can also be
+   * switched on over D-Bus */
+  if (g_getenv ("META_FRAME_TIMINGS"))
+    meta_frame_timings_set_enabled (TRUE);
+  meta_frame_timings_init_dbus ();
+
+  meta_output_repaint_update_outputs (meta_monitor_manager_get ());
+  g_signal_connect (meta_monitor_manager_get (), "monitors-changed",
+                    G_CALLBACK (on_monitors_changed), NULL);
+
   g_signal_connect (meta_shadow_factory_get_default (),
                     "changed",
                     G_CALLBACK (on_shadow_factory_changed),
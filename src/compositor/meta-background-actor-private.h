@@ -7,5 +7,6 @@
 #include <meta/meta-background-actor.h>
 
 cairo_region_t *meta_background_actor_get_clip_region (MetaBackgroundActor *self);
+gboolean meta_background_actor_paints_within_clip (MetaBackgroundActor *self);
 
 #endif /* META_BACKGROUND_ACTOR_PRIVATE_H */
@@ -410,6 +410,10 @@ meta_background_actor_get_paint_volume (ClutterActor       *actor,
   return clutter_paint_volume_set_from_allocation (volume, actor);
 }
 
+/* Limit to how many separate rectangles we'll draw; beyond this just
+ * fall back and draw the whole thing */
+#define MAX_RECTS 64
+
 static void
 meta_background_actor_paint (ClutterActor *actor)
 {
@@ -432,10 +436,6 @@ meta_background_actor_paint (ClutterActor *actor)
   setup_pipeline (self, &actor_pixel_rect);
   set_glsl_parameters (self, &actor_pixel_rect);
 
-  /* Limit to how many separate rectangles we'll draw; beyond this just
-   * fall back and draw the whole thing */
-#define MAX_RECTS 64
-
   fb = cogl_get_draw_framebuffer ();
 
   /* Now figure out what to actually paint.
@@ -694,6 +694,22 @@ meta_background_actor_get_clip_region (MetaBackgroundActor *self)
   return priv->clip_region;
 }
 
+/**
+ * meta_background_actor_paints_within_clip:
+ * @self: a #MetaBackgroundActor
+ *
+ * Return value: %TRUE if the next paint of @self will be limited to
+ *   its clip region, rather than falling back to drawing everything.
+ */
+gboolean
+meta_background_actor_paints_within_clip (MetaBackgroundActor *self)
+{
+  MetaBackgroundActorPrivate *priv = self->priv;
+
+  return (priv->clip_region != NULL &&
+          cairo_region_num_rectangles (priv->clip_region) <= MAX_RECTS);
+}
+
 static void
 invalidate_pipeline (MetaBackgroundActor *self,
                      ChangedFlags         changed)
@@ -0,0 +1,337 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * MetaBackgroundDiskCache
+ *
+ * On-disk cache of prerendered backgrounds
+ *
+ * Copyright 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Prerendering a monitor's background needs the wallpaper to be
+ * decoded first, which at login or on a monitor change takes far
+ * longer than anything else we do. Since the result only depends on a
+ * handful of settings, we keep it on disk, under
+ * $XDG_CACHE_HOME/mutter/backgrounds, and map it back in next time.
+ *
+ * The caller describes everything the result depends on in a key
+ * string; the file is named after a checksum of the key, and holds
+ * the key itself to rule out collisions. The pixels are stored raw in
+ * the format of the texture, so loading is a single upload straight
+ * from the mapped file.
+ *
+ * Files are written on a worker thread. Only the most recently used
+ * few are kept, which is enough for the backgrounds of a couple of
+ * monitors and the lock screen.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include "meta-background-disk-cache.h"
+
+#define CACHE_MAGIC "MTRBGC01"
+
+/* Most recently used files kept */
+#define MAX_CACHED_BACKGROUNDS 16
+
+/* The pixels start at a multiple of this in the file */
+#define PIXEL_ALIGNMENT 16
+
+typedef struct
+{
+  char magic[8];
+  guint32 width;
+  guint32 height;
+  guint32 rowstride;
+  guint32 key_length;
+  /* followed by the key, then the pixels at the next multiple of
+   * PIXEL_ALIGNMENT */
+} CacheHeader;
+
+typedef struct
+{
+  char *path;
+  guchar *contents;
+  gsize length;
+} SaveData;
+
+static gsize
+get_pixels_offset (gsize key_length)
+{
+  gsize offset = sizeof (CacheHeader) + key_length;
+
+  return (offset + PIXEL_ALIGNMENT - 1) & ~(gsize) (PIXEL_ALIGNMENT - 1);
+}
+
+static char *
+get_cache_dir (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "mutter", "backgrounds", NULL);
+}
+
+static char *
+get_cache_path (const char *key)
+{
+  char *dir, *checksum, *path;
+
+  dir = get_cache_dir ();
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+  path = g_build_filename (dir, checksum, NULL);
+
+  g_free (checksum);
+  g_free (dir);
+
+  return path;
+}
+
+/**
+ * meta_background_disk_cache_contains:
+ * @key: a string describing the background
+ *
+ * Return value: %TRUE if there is a file for @key in the cache; it
+ *   may still fail to load
+ */
+gboolean
+meta_background_disk_cache_contains (const char *key)
+{
+  char *path = get_cache_path (key);
+  gboolean result;
+
+  result = g_file_test (path, G_FILE_TEST_IS_REGULAR);
+  g_free (path);
+
+  return result;
+}
+
+/**
+ * meta_background_disk_cache_load:
+ * @key: a string describing the background
+ * @texture: an RGBA texture to load into
+ *
+ * Fills @texture with the background cached for @key, if there is one
+ * of the same size.
+ *
+ * Return value: %TRUE if @texture was filled
+ */
+gboolean
+meta_background_disk_cache_load (const char  *key,
+                                 CoglTexture *texture)
+{
+  GMappedFile *file;
+  const CacheHeader *header;
+  const char *contents;
+  gsize length, key_length, offset;
+  char *path;
+  gboolean result = FALSE;
+
+  path = get_cache_path (key);
+  file = g_mapped_file_new (path, FALSE, NULL);
+  if (file == NULL)
+    goto out;
+
+  contents = g_mapped_file_get_contents (file);
+  length = g_mapped_file_get_length (file);
+  key_length = strlen (key);
+  offset = get_pixels_offset (key_length);
+
+  if (length < sizeof (CacheHeader))
+    goto out;
+
+  header = (const CacheHeader *) contents;
+
+  if (memcmp (header->magic, CACHE_MAGIC, sizeof (header->magic)) != 0 ||
+      header->width != (guint32) cogl_texture_get_width (texture) ||
+      header->height != (guint32) cogl_texture_get_height (texture) ||
+      header->rowstride < header->width * 4 ||
+      header->key_length != key_length ||
+      length != offset + (gsize) header->rowstride * header->height ||
+      memcmp (contents + sizeof (CacheHeader), key, key_length) != 0)
+    goto out;
+
+  if (!cogl_texture_set_region (texture,
+                                0, 0,
+                                0, 0,
+                                header->width, header->height,
+                                header->width, header->height,
+                                COGL_PIXEL_FORMAT_RGBA_8888_PRE,
+                                header->rowstride,
+                                (const guint8 *) contents + offset))
+    goto out;
+
+  /* Keeps the most recently used files when pruning */
+  g_utime (path, NULL);
+
+  result = TRUE;
+
+out:
+  if (file != NULL)
+    g_mapped_file_unref (file);
+  g_free (path);
+
+  return result;
+}
+
+typedef struct
+{
+  char *path;
+  time_t mtime;
+} CacheFile;
+
+static int
+compare_mtime (gconstpointer a,
+               gconstpointer b)
+{
+  const CacheFile *file_a = a;
+  const CacheFile *file_b = b;
+
+  /* Most recent first */
+  if (file_a->mtime != file_b->mtime)
+    return file_a->mtime > file_b->mtime ? -1 : 1;
+
+  return 0;
+}
+
+static void
+prune_cache (const char *dir)
+{
+  GDir *gdir;
+  GArray *files;
+  const char *name;
+  guint i;
+
+  gdir = g_dir_open (dir, 0, NULL);
+  if (gdir == NULL)
+    return;
+
+  files = g_array_new (FALSE, FALSE, sizeof (CacheFile));
+
+  while ((name = g_dir_read_name (gdir)))
+    {
+      CacheFile file;
+      GStatBuf buf;
+
+      file.path = g_build_filename (dir, name, NULL);
+      file.mtime = g_stat (file.path, &buf) == 0 ? buf.st_mtime : 0;
+      g_array_append_val (files, file);
+    }
+
+  g_dir_close (gdir);
+
+  g_array_sort (files, compare_mtime);
+
+  for (i = 0; i < files->len; i++)
+    {
+      CacheFile *file = &g_array_index (files, CacheFile, i);
+
+      if (i >= MAX_CACHED_BACKGROUNDS)
+        g_unlink (file->path);
+      g_free (file->path);
+    }
+
+  g_array_free (files, TRUE);
+}
+
+static void
+save_thread_func (GTask        *task,
+                  gpointer      source_object,
+                  gpointer      task_data,
+                  GCancellable *cancellable)
+{
+  SaveData *data = task_data;
+  GError *error = NULL;
+  char *dir;
+
+  dir = g_path_get_dirname (data->path);
+
+  if (g_mkdir_with_parents (dir, 0700) < 0 ||
+      !g_file_set_contents (data->path,
+                            (const char *) data->contents, data->length,
+                            &error))
+    {
+      g_warning ("Failed to cache background in %s: %s", data->path,
+                 error ? error->message : g_strerror (errno));
+      g_clear_error (&error);
+    }
+  else
+    {
+      prune_cache (dir);
+    }
+
+  g_free (dir);
+}
+
+static void
+save_data_free (SaveData *data)
+{
+  g_free (data->path);
+  g_free (data->contents);
+  g_slice_free (SaveData, data);
+}
+
+/**
+ * meta_background_disk_cache_save:
+ * @key: a string describing the background
+ * @framebuffer: the framebuffer the background was drawn into
+ *
+ * Reads back the contents of @framebuffer and stores them for @key.
+ * The file is written in the background.
+ */
+void
+meta_background_disk_cache_save (const char      *key,
+                                 CoglFramebuffer *framebuffer)
+{
+  SaveData *data;
+  CacheHeader *header;
+  GTask *task;
+  int width, height;
+  gsize key_length, offset;
+
+  width = cogl_framebuffer_get_width (framebuffer);
+  height = cogl_framebuffer_get_height (framebuffer);
+  key_length = strlen (key);
+  offset = get_pixels_offset (key_length);
+
+  data = g_slice_new0 (SaveData);
+  data->path = get_cache_path (key);
+  data->length = offset + (gsize) width * 4 * height;
+  data->contents = g_malloc0 (data->length);
+
+  header = (CacheHeader *) data->contents;
+  memcpy (header->magic, CACHE_MAGIC, sizeof (header->magic));
+  header->width = width;
+  header->height = height;
+  header->rowstride = width * 4;
+  header->key_length = key_length;
+  memcpy (data->contents + sizeof (CacheHeader), key, key_length);
+
+  if (!cogl_framebuffer_read_pixels (framebuffer, 0, 0, width, height,
+                                     COGL_PIXEL_FORMAT_RGBA_8888_PRE,
+                                     data->contents + offset))
+    {
+      save_data_free (data);
+      return;
+    }
+
+  task = g_task_new (NULL, NULL, NULL, NULL);
+  g_task_set_task_data (task, data, (GDestroyNotify) save_data_free);
+  g_task_run_in_thread (task, save_thread_func);
+  g_object_unref (task);
+}
@@ -0,0 +1,38 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * MetaBackgroundDiskCache
+ *
+ * On-disk cache of prerendered backgrounds
+ *
+ * Copyright 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __META_BACKGROUND_DISK_CACHE_H__
+#define __META_BACKGROUND_DISK_CACHE_H__
+
+#include <cogl/cogl.h>
+
+G_BEGIN_DECLS
+
+gboolean meta_background_disk_cache_contains (const char      *key);
+gboolean meta_background_disk_cache_load     (const char      *key,
+                                              CoglTexture     *texture);
+void     meta_background_disk_cache_save     (const char      *key,
+                                              CoglFramebuffer *framebuffer);
+
+G_END_DECLS
+
+#endif /* __META_BACKGROUND_DISK_CACHE_H__ */
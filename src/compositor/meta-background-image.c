@@ -24,6 +24,8 @@
 
 #include <config.h>
 
+#include <math.h>
+
 #include <gio/gio.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 #include <clutter/clutter.h>
@@ -38,10 +40,19 @@ enum
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
+/* How much we read from the file at a time while decoding */
+#define READ_CHUNK_SIZE (64 * 1024)
+
+/* How many bytes of the decoded image we upload to the texture in one
+ * main loop iteration; the rest waits for the next idle, so that a big
+ * image doesn't hold up the frames painted while it is uploaded. */
+#define UPLOAD_CHUNK_SIZE (2 * 1024 * 1024)
+
 struct _MetaBackgroundImageCache
 {
   GObject parent_instance;
 
+  /* filename => GList of MetaBackgroundImage loaded at different sizes */
   GHashTable *images;
 };
 
@@ -54,10 +65,18 @@ struct _MetaBackgroundImage
 {
   GObject parent_instance;
   char *filename;
+  /* The size the image must cover, or 0x0 for full size */
+  int width;
+  int height;
   MetaBackgroundImageCache *cache;
   gboolean in_cache;
   gboolean loaded;
   CoglTexture *texture;
+
+  /* While the decoded image is being uploaded */
+  GdkPixbuf *pixbuf;
+  CoglTexture *upload_texture;
+  int upload_row;
 };
 
 struct _MetaBackgroundImageClass
@@ -70,7 +89,33 @@ G_DEFINE_TYPE (MetaBackgroundImageCache, meta_background_image_cache, G_TYPE_OBJ
 static void
 meta_background_image_cache_init (MetaBackgroundImageCache *cache)
 {
-  cache->images = g_hash_table_new (g_str_hash, g_str_equal);
+  cache->images = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free, NULL);
+}
+
+static void
+cache_add_image (MetaBackgroundImageCache *cache,
+                 MetaBackgroundImage      *image)
+{
+  GList *images = g_hash_table_lookup (cache->images, image->filename);
+
+  images = g_list_prepend (images, image);
+  g_hash_table_replace (cache->images, g_strdup (image->filename), images);
+  image->in_cache = TRUE;
+}
+
+static void
+cache_remove_image (MetaBackgroundImageCache *cache,
+                    MetaBackgroundImage      *image)
+{
+  GList *images = g_hash_table_lookup (cache->images, image->filename);
+
+  images = g_list_remove (images, image);
+  if (images != NULL)
+    g_hash_table_replace (cache->images, g_strdup (image->filename), images);
+  else
+    g_hash_table_remove (cache->images, image->filename);
+  image->in_cache = FALSE;
 }
 
 static void
@@ -83,8 +128,15 @@ meta_background_image_cache_finalize (GObject *object)
   g_hash_table_iter_init (&iter, cache->images);
   while (g_hash_table_iter_next (&iter, &key, &value))
     {
-      MetaBackgroundImage *image = value;
-      image->in_cache = FALSE;
+      GList *l;
+
+      for (l = value; l; l = l->next)
+        {
+          MetaBackgroundImage *image = l->data;
+          image->in_cache = FALSE;
+        }
+
+      g_list_free (value);
     }
 
   g_hash_table_destroy (cache->images);
@@ -116,6 +168,31 @@ meta_background_image_cache_get_default (void)
   return cache;
 }
 
+static void
+on_size_prepared (GdkPixbufLoader     *loader,
+                  int                  width,
+                  int                  height,
+                  MetaBackgroundImage *image)
+{
+  double scale;
+
+  if (image->width <= 0 || image->height <= 0)
+    return;
+
+  /* The smallest size that still covers the requested one; we
+   * never scale up, that is better left to the GPU. */
+  scale = MAX ((double) image->width / width, (double) image->height / height);
+  if (scale >= 1.0)
+    return;
+
+  gdk_pixbuf_loader_set_size (loader,
+                              MAX (1, (int) ceil (width * scale)),
+                              MAX (1, (int) ceil (height * scale)));
+}
+
+/* Decodes the file as it is read, so that loaders that support it
+ * (JPEG in particular) can scale while decoding instead of producing
+ * a full size image first. */
 static void
 load_file (GTask               *task,
            MetaBackgroundImage *image,
@@ -123,20 +200,124 @@ load_file (GTask               *task,
            GCancellable        *cancellable)
 {
   GError *error = NULL;
+  GFile *file;
+  GFileInputStream *stream;
+  GdkPixbufLoader *loader;
   GdkPixbuf *pixbuf;
+  guchar *buffer;
+  gssize n_read;
 
-  pixbuf = gdk_pixbuf_new_from_file (image->filename,
-                                     &error);
+  file = g_file_new_for_path (image->filename);
+  stream = g_file_read (file, cancellable, &error);
+  g_object_unref (file);
 
-  if (pixbuf == NULL)
+  if (stream == NULL)
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  loader = gdk_pixbuf_loader_new ();
+  g_signal_connect (loader, "size-prepared",
+                    G_CALLBACK (on_size_prepared), image);
+
+  buffer = g_malloc (READ_CHUNK_SIZE);
+
+  do
     {
+      n_read = g_input_stream_read (G_INPUT_STREAM (stream),
+                                    buffer, READ_CHUNK_SIZE,
+                                    cancellable, &error);
+      if (n_read > 0 &&
+          !gdk_pixbuf_loader_write (loader, buffer, n_read, &error))
+        n_read = -1;
+    }
+  while (n_read > 0);
+
+  g_free (buffer);
+  g_object_unref (stream);
+
+  /* Closing is needed even on error, to release the loader's state */
+  if (n_read < 0)
+    gdk_pixbuf_loader_close (loader, NULL);
+  else
+    gdk_pixbuf_loader_close (loader, &error);
+
+  if (error != NULL)
+    {
+      g_object_unref (loader);
       g_task_return_error (task, error);
       return;
     }
 
+  pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+  if (pixbuf == NULL)
+    {
+      g_object_unref (loader);
+      g_task_return_new_error (task, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+                               "Image has no data");
+      return;
+    }
+
+  g_object_ref (pixbuf);
+  g_object_unref (loader);
+
   g_task_return_pointer (task, pixbuf, (GDestroyNotify) g_object_unref);
 }
 
+static void
+finish_loading (MetaBackgroundImage *image)
+{
+  image->loaded = TRUE;
+  g_signal_emit (image, signals[LOADED], 0);
+}
+
+static gboolean
+upload_chunk (gpointer user_data)
+{
+  MetaBackgroundImage *image = user_data;
+  GdkPixbuf *pixbuf = image->pixbuf;
+  int width, height, row_stride, n_rows;
+  gboolean has_alpha;
+  CoglError *catch_error = NULL;
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+  row_stride = gdk_pixbuf_get_rowstride (pixbuf);
+  has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+
+  n_rows = MAX (1, UPLOAD_CHUNK_SIZE / row_stride);
+  n_rows = MIN (n_rows, height - image->upload_row);
+
+  if (!cogl_texture_set_region (image->upload_texture,
+                                0, 0,
+                                0, image->upload_row,
+                                width, n_rows,
+                                width, n_rows,
+                                has_alpha ? COGL_PIXEL_FORMAT_RGBA_8888 : COGL_PIXEL_FORMAT_RGB_888,
+                                row_stride,
+                                gdk_pixbuf_get_pixels (pixbuf) + image->upload_row * row_stride))
+    {
+      g_warning ("Failed to create texture for background");
+      cogl_object_unref (image->upload_texture);
+      image->upload_texture = NULL;
+    }
+  else
+    {
+      image->upload_row += n_rows;
+      if (image->upload_row < height)
+        return G_SOURCE_CONTINUE;
+
+      image->texture = image->upload_texture;
+      image->upload_texture = NULL;
+    }
+
+  g_clear_object (&image->pixbuf);
+  finish_loading (image);
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
 file_loaded (GObject      *source_object,
              GAsyncResult *result,
@@ -145,11 +326,8 @@ file_loaded (GObject      *source_object,
   MetaBackgroundImage *image = META_BACKGROUND_IMAGE (source_object);
   GError *error = NULL;
   GTask *task;
-  CoglTexture *texture;
   GdkPixbuf *pixbuf;
-  int width, height, row_stride;
-  guchar *pixels;
-  gboolean has_alpha;
+  guint id;
 
   task = G_TASK (result);
   pixbuf = g_task_propagate_pointer (task, &error);
@@ -159,37 +337,22 @@ file_loaded (GObject      *source_object,
       g_warning ("Failed to load background '%s': %s",
                  image->filename, error->message);
       g_clear_error (&error);
-      goto out;
-    }
-
-  width = gdk_pixbuf_get_width (pixbuf);
-  height = gdk_pixbuf_get_height (pixbuf);
-  row_stride = gdk_pixbuf_get_rowstride (pixbuf);
-  pixels = gdk_pixbuf_get_pixels (pixbuf);
-  has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
-
-  texture = meta_create_texture (width, height,
-                                 has_alpha ? COGL_TEXTURE_COMPONENTS_RGBA : COGL_TEXTURE_COMPONENTS_RGB,
-                                 META_TEXTURE_ALLOW_SLICING);
-
-  if (!cogl_texture_set_data (texture,
-                              has_alpha ? COGL_PIXEL_FORMAT_RGBA_8888 : COGL_PIXEL_FORMAT_RGB_888,
-                              row_stride,
-                              pixels, 0,
-                              NULL))
-    {
-      g_warning ("Failed to create texture for background");
-      cogl_object_unref (texture);
+      finish_loading (image);
+      return;
     }
 
-  image->texture = texture;
-
-out:
-  if (pixbuf != NULL)
-    g_object_unref (pixbuf);
-
-  image->loaded = TRUE;
-  g_signal_emit (image, signals[LOADED], 0);
+  image->pixbuf = pixbuf;
+  image->upload_row = 0;
+  image->upload_texture =
+    meta_create_texture (gdk_pixbuf_get_width (pixbuf),
+                         gdk_pixbuf_get_height (pixbuf),
+                         gdk_pixbuf_get_has_alpha (pixbuf) ? COGL_TEXTURE_COMPONENTS_RGBA : COGL_TEXTURE_COMPONENTS_RGB,
+                         META_TEXTURE_ALLOW_SLICING);
+
+  /* The image is kept alive until it is uploaded, as it is while loading */
+  id = g_idle_add_full (G_PRIORITY_DEFAULT_IDLE, upload_chunk,
+                        g_object_ref (image), g_object_unref);
+  g_source_set_name_by_id (id, "[mutter] upload_chunk");
 }
 
 /**
@@ -210,22 +373,65 @@ out:
 MetaBackgroundImage *
 meta_background_image_cache_load (MetaBackgroundImageCache *cache,
                                   const char               *filename)
+{
+  return meta_background_image_cache_load_for_size (cache, filename, 0, 0);
+}
+
+static gboolean
+image_covers_size (MetaBackgroundImage *image,
+                   int                  width,
+                   int                  height)
+{
+  if (image->width <= 0 || image->height <= 0)
+    return TRUE;
+
+  if (width <= 0 || height <= 0)
+    return FALSE;
+
+  return image->width >= width && image->height >= height;
+}
+
+/**
+ * meta_background_image_cache_load_for_size:
+ * @cache: a #MetaBackgroundImageCache
+ * @filename: filename to load
+ * @width: width the image needs to cover, or 0
+ * @height: height the image needs to cover, or 0
+ *
+ * Like meta_background_image_cache_load(), but if the image is larger
+ * than needed, it is scaled down while decoding, keeping its aspect
+ * ratio, to the smallest size that covers @width by @height. If @width
+ * or @height is 0, the image is loaded at full size. An image that was
+ * already loaded at a size at least as large is reused.
+ *
+ * Return value: (transfer full): a #MetaBackgroundImage to dereference to get the loaded texture
+ */
+MetaBackgroundImage *
+meta_background_image_cache_load_for_size (MetaBackgroundImageCache *cache,
+                                           const char               *filename,
+                                           int                       width,
+                                           int                       height)
 {
   MetaBackgroundImage *image;
   GTask *task;
+  GList *l;
 
   g_return_val_if_fail (META_IS_BACKGROUND_IMAGE_CACHE (cache), NULL);
   g_return_val_if_fail (filename != NULL, NULL);
 
-  image = g_hash_table_lookup (cache->images, filename);
-  if (image != NULL)
-    return g_object_ref (image);
+  for (l = g_hash_table_lookup (cache->images, filename); l; l = l->next)
+    {
+      image = l->data;
+      if (image_covers_size (image, width, height))
+        return g_object_ref (image);
+    }
 
   image = g_object_new (META_TYPE_BACKGROUND_IMAGE, NULL);
   image->cache = cache;
-  image->in_cache = TRUE;
   image->filename = g_strdup (filename);
-  g_hash_table_insert (cache->images, image->filename, image);
+  image->width = MAX (width, 0);
+  image->height = MAX (height, 0);
+  cache_add_image (cache, image);
 
   task = g_task_new (image, NULL, file_loaded, NULL);
 
@@ -247,17 +453,23 @@ void
 meta_background_image_cache_purge (MetaBackgroundImageCache *cache,
                                    const char               *filename)
 {
-  MetaBackgroundImage *image;
+  GList *images, *l;
 
   g_return_if_fail (META_IS_BACKGROUND_IMAGE_CACHE (cache));
   g_return_if_fail (filename != NULL);
 
-  image = g_hash_table_lookup (cache->images, filename);
-  if (image == NULL)
+  images = g_hash_table_lookup (cache->images, filename);
+  if (images == NULL)
     return;
 
-  g_hash_table_remove (cache->images, image->filename);
-  image->in_cache = FALSE;
+  for (l = images; l; l = l->next)
+    {
+      MetaBackgroundImage *image = l->data;
+      image->in_cache = FALSE;
+    }
+
+  g_hash_table_remove (cache->images, filename);
+  g_list_free (images);
 }
 
 G_DEFINE_TYPE (MetaBackgroundImage, meta_background_image, G_TYPE_OBJECT);
@@ -273,7 +485,7 @@ meta_background_image_finalize (GObject *object)
   MetaBackgroundImage *image = META_BACKGROUND_IMAGE (object);
 
   if (image->in_cache)
-    g_hash_table_remove (image->cache->images, image->filename);
+    cache_remove_image (image->cache, image);
 
   if (image->texture)
     cogl_object_unref (image->texture);
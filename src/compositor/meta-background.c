@@ -17,9 +17,12 @@
  * along with this program; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <glib/gstdio.h>
+
 #include <meta/meta-background.h>
 #include <meta/meta-background-image.h>
 #include "meta-background-private.h"
+#include "meta-background-disk-cache.h"
 #include "cogl-utils.h"
 
 enum
@@ -37,6 +40,8 @@ struct _MetaBackgroundMonitor
   gboolean dirty;
   CoglTexture *texture;
   CoglOffscreen *fbo;
+  /* The disk cache key of what texture holds, if any */
+  char *key;
 };
 
 struct _MetaBackgroundPrivate
@@ -55,6 +60,10 @@ struct _MetaBackgroundPrivate
   char *filename2;
   MetaBackgroundImage *background_image2;
 
+  /* The size the images were loaded to cover, 0x0 for full size */
+  int image_width;
+  int image_height;
+
   CoglTexture *color_texture;
   CoglTexture *wallpaper_texture;
 
@@ -91,6 +100,8 @@ free_fbos (MetaBackground *self)
           cogl_object_unref (monitor->texture);
           monitor->texture = NULL;
         }
+      g_free (monitor->key);
+      monitor->key = NULL;
     }
 }
 
@@ -120,6 +131,11 @@ free_wallpaper_texture (MetaBackground *self)
   priv->wallpaper_allocation_failed = FALSE;
 }
 
+static gboolean update_image_size (MetaBackground *self);
+static gboolean is_cached         (MetaBackground *self);
+static void     drop_images       (MetaBackground *self);
+static void     load_images       (MetaBackground *self);
+
 static void
 on_monitors_changed (MetaScreen     *screen,
                      MetaBackground *self)
@@ -140,6 +156,13 @@ on_monitors_changed (MetaScreen     *screen,
 
       for (i = 0; i < priv->n_monitors; i++)
         priv->monitors[i].dirty = TRUE;
+
+      /* A bigger monitor may need a bigger version of the images */
+      if (update_image_size (self))
+        drop_images (self);
+
+      if (!is_cached (self))
+        load_images (self);
     }
 }
 
@@ -210,6 +233,10 @@ need_prerender (MetaBackground *self)
   CoglTexture *texture1 = priv->background_image1 ? meta_background_image_get_texture (priv->background_image1) : NULL;
   CoglTexture *texture2 = priv->background_image2 ? meta_background_image_get_texture (priv->background_image2) : NULL;
 
+  /* Not loading the image because the monitors are in the disk cache */
+  if (priv->filename1 != NULL && priv->background_image1 == NULL)
+    return TRUE;
+
   if (texture1 == NULL && texture2 == NULL)
     return FALSE;
 
@@ -241,6 +268,115 @@ on_background_loaded (MetaBackgroundImage *image,
   mark_changed (self);
 }
 
+/* Works out how big the images have to be for the current style and
+ * monitors; a 0x0 size means at full size. Returns %TRUE if the images
+ * that were loaded so far are too small. */
+static gboolean
+update_image_size (MetaBackground *self)
+{
+  MetaBackgroundPrivate *priv = self->priv;
+  int width = 0, height = 0;
+  int i;
+
+  if (priv->screen == NULL)
+    return FALSE;
+
+  switch (priv->style)
+    {
+    case G_DESKTOP_BACKGROUND_STYLE_STRETCHED:
+    case G_DESKTOP_BACKGROUND_STYLE_SCALED:
+    case G_DESKTOP_BACKGROUND_STYLE_ZOOM:
+      /* Each monitor shows the whole image scaled to (at most) its size */
+      for (i = 0; i < priv->n_monitors; i++)
+        {
+          MetaRectangle geometry;
+
+          meta_screen_get_monitor_geometry (priv->screen, i, &geometry);
+          width = MAX (width, geometry.width);
+          height = MAX (height, geometry.height);
+        }
+      break;
+    case G_DESKTOP_BACKGROUND_STYLE_SPANNED:
+      meta_screen_get_size (priv->screen, &width, &height);
+      break;
+    case G_DESKTOP_BACKGROUND_STYLE_WALLPAPER:
+    case G_DESKTOP_BACKGROUND_STYLE_CENTERED:
+    case G_DESKTOP_BACKGROUND_STYLE_NONE:
+    default:
+      /* The image is drawn at its own size */
+      break;
+    }
+
+  if (priv->image_width == 0 || priv->image_height == 0)
+    {
+      /* Full size covers everything, but the first time around we
+       * haven't loaded anything yet */
+      if (priv->background_image1 != NULL || priv->background_image2 != NULL)
+        return FALSE;
+    }
+  else if (width != 0 && height != 0 &&
+           width <= priv->image_width && height <= priv->image_height)
+    return FALSE;
+
+  priv->image_width = width;
+  priv->image_height = height;
+
+  return TRUE;
+}
+
+static void
+drop_image (MetaBackground       *self,
+            MetaBackgroundImage **imagep)
+{
+  if (*imagep)
+    {
+      g_signal_handlers_disconnect_by_func (*imagep,
+                                            (gpointer)on_background_loaded,
+                                            self);
+      g_object_unref (*imagep);
+      *imagep = NULL;
+    }
+}
+
+static void
+drop_images (MetaBackground *self)
+{
+  MetaBackgroundPrivate *priv = self->priv;
+
+  drop_image (self, &priv->background_image1);
+  drop_image (self, &priv->background_image2);
+}
+
+static void
+load_image (MetaBackground       *self,
+            const char           *filename,
+            MetaBackgroundImage **imagep)
+{
+  MetaBackgroundPrivate *priv = self->priv;
+  MetaBackgroundImageCache *cache;
+
+  if (filename == NULL || *imagep != NULL)
+    return;
+
+  cache = meta_background_image_cache_get_default ();
+  *imagep = meta_background_image_cache_load_for_size (cache, filename,
+                                                       priv->image_width,
+                                                       priv->image_height);
+  g_signal_connect (*imagep, "loaded",
+                    G_CALLBACK (on_background_loaded), self);
+}
+
+/* Starts loading the images that aren't loaded yet; they are only
+ * loaded when some monitor isn't in the disk cache. */
+static void
+load_images (MetaBackground *self)
+{
+  MetaBackgroundPrivate *priv = self->priv;
+
+  load_image (self, priv->filename1, &priv->background_image1);
+  load_image (self, priv->filename2, &priv->background_image2);
+}
+
 static void
 set_filename (MetaBackground       *self,
               char                **filenamep,
@@ -252,23 +388,90 @@ set_filename (MetaBackground       *self,
       g_free (*filenamep);
       *filenamep = g_strdup (filename);
 
-      if (*imagep)
-        {
-          g_signal_handlers_disconnect_by_func (*imagep,
-                                                (gpointer)on_background_loaded,
-                                                self);
-          g_object_unref (*imagep);
-          *imagep = NULL;
-        }
+      drop_image (self, imagep);
+    }
+}
 
-      if (filename)
-        {
-          MetaBackgroundImageCache *cache = meta_background_image_cache_get_default ();
-          *imagep = meta_background_image_cache_load (cache, filename);
-          g_signal_connect (*imagep, "loaded",
-                            G_CALLBACK (on_background_loaded), self);
-        }
+/* The disk cache key for the prerendered background of a monitor;
+ * it covers everything that goes into drawing it. Returns %NULL if
+ * the background isn't worth caching. */
+static char *
+get_cache_key (MetaBackground        *self,
+               cairo_rectangle_int_t *monitor_area)
+{
+  MetaBackgroundPrivate *priv = self->priv;
+  GStatBuf buf;
+  int screen_width, screen_height;
+
+  /* Cross-fades change every frame, and tiled wallpapers are drawn
+   * straight from the image */
+  if (priv->filename1 == NULL || priv->filename2 != NULL ||
+      priv->blend_factor != 0.0 ||
+      priv->style == G_DESKTOP_BACKGROUND_STYLE_WALLPAPER)
+    return NULL;
+
+  if (g_stat (priv->filename1, &buf) < 0)
+    return NULL;
+
+  meta_screen_get_size (priv->screen, &screen_width, &screen_height);
+
+  return g_strdup_printf ("%s %" G_GINT64_FORMAT " %" G_GINT64_FORMAT
+                          " %d %d %02x%02x%02x %02x%02x%02x"
+                          " %dx%d %d,%d %dx%d",
+                          priv->filename1,
+                          (gint64) buf.st_mtime, (gint64) buf.st_size,
+                          priv->style, priv->shading_direction,
+                          priv->color.red, priv->color.green, priv->color.blue,
+                          priv->second_color.red, priv->second_color.green,
+                          priv->second_color.blue,
+                          screen_width, screen_height,
+                          monitor_area->x, monitor_area->y,
+                          monitor_area->width, monitor_area->height);
+}
+
+static void
+get_monitor_area (MetaBackground        *self,
+                  int                    monitor_index,
+                  cairo_rectangle_int_t *monitor_area)
+{
+  MetaRectangle geometry;
+
+  meta_screen_get_monitor_geometry (self->priv->screen, monitor_index, &geometry);
+  monitor_area->x = geometry.x;
+  monitor_area->y = geometry.y;
+  monitor_area->width = geometry.width;
+  monitor_area->height = geometry.height;
+}
+
+/* Whether all monitors can be drawn from the disk cache */
+static gboolean
+is_cached (MetaBackground *self)
+{
+  MetaBackgroundPrivate *priv = self->priv;
+  int i;
+
+  if (priv->n_monitors == 0)
+    return FALSE;
+
+  for (i = 0; i < priv->n_monitors; i++)
+    {
+      cairo_rectangle_int_t monitor_area;
+      char *key;
+      gboolean cached;
+
+      get_monitor_area (self, i, &monitor_area);
+      key = get_cache_key (self, &monitor_area);
+      if (key == NULL)
+        return FALSE;
+
+      cached = meta_background_disk_cache_contains (key);
+      g_free (key);
+
+      if (!cached)
+        return FALSE;
     }
+
+  return TRUE;
 }
 
 static void
@@ -677,6 +880,28 @@ get_wrap_mode (GDesktopBackgroundStyle style)
     }
 }
 
+static gboolean
+load_cached_monitor (MetaBackgroundMonitor *monitor,
+                     cairo_rectangle_int_t *monitor_area,
+                     const char            *key)
+{
+  if (monitor->texture == NULL)
+    {
+      monitor->texture = meta_create_texture (monitor_area->width, monitor_area->height,
+                                              COGL_TEXTURE_COMPONENTS_RGBA,
+                                              META_TEXTURE_FLAGS_NONE);
+      monitor->fbo = cogl_offscreen_new_with_texture (monitor->texture);
+    }
+
+  if (!meta_background_disk_cache_load (key, monitor->texture))
+    return FALSE;
+
+  g_free (monitor->key);
+  monitor->key = g_strdup (key);
+
+  return TRUE;
+}
+
 CoglTexture *
 meta_background_get_texture (MetaBackground         *self,
                              int                     monitor_index,
@@ -685,7 +910,6 @@ meta_background_get_texture (MetaBackground         *self,
 {
   MetaBackgroundPrivate *priv;
   MetaBackgroundMonitor *monitor;
-  MetaRectangle geometry;
   cairo_rectangle_int_t monitor_area;
   CoglTexture *texture1, *texture2;
 
@@ -695,11 +919,28 @@ meta_background_get_texture (MetaBackground         *self,
 
   monitor = &priv->monitors[monitor_index];
 
-  meta_screen_get_monitor_geometry (priv->screen, monitor_index, &geometry);
-  monitor_area.x = geometry.x;
-  monitor_area.y = geometry.y;
-  monitor_area.width = geometry.width;
-  monitor_area.height = geometry.height;
+  get_monitor_area (self, monitor_index, &monitor_area);
+
+  if (monitor->dirty)
+    {
+      char *key = get_cache_key (self, &monitor_area);
+
+      if (key != NULL)
+        {
+          if (monitor->texture != NULL && g_strcmp0 (key, monitor->key) == 0)
+            monitor->dirty = FALSE;
+          else if (load_cached_monitor (monitor, &monitor_area, key))
+            monitor->dirty = FALSE;
+          else
+            load_images (self);
+
+          g_free (key);
+        }
+    }
+
+  /* Drawn from the disk cache, possibly without the images loaded */
+  if (!monitor->dirty && monitor->key != NULL)
+    goto out;
 
   texture1 = priv->background_image1 ? meta_background_image_get_texture (priv->background_image1) : NULL;
   texture2 = priv->background_image2 ? meta_background_image_get_texture (priv->background_image2) : NULL;
@@ -810,9 +1051,21 @@ meta_background_get_texture (MetaBackground         *self,
           cogl_object_unref (pipeline);
         }
 
+      g_free (monitor->key);
+      monitor->key = NULL;
+
+      if (texture1 != NULL)
+        {
+          monitor->key = get_cache_key (self, &monitor_area);
+          if (monitor->key != NULL)
+            meta_background_disk_cache_save (monitor->key,
+                                             COGL_FRAMEBUFFER (monitor->fbo));
+        }
+
       monitor->dirty = FALSE;
     }
 
+out:
   if (texture_area)
     set_texture_area_from_monitor_area (&monitor_area, texture_area);
 
@@ -863,6 +1116,10 @@ meta_background_set_gradient (MetaBackground            *self,
 
   free_color_texture (self);
   free_wallpaper_texture (self);
+
+  if (!is_cached (self))
+    load_images (self);
+
   mark_changed (self);
 }
 
@@ -884,17 +1141,26 @@ meta_background_set_blend (MetaBackground          *self,
                            GDesktopBackgroundStyle  style)
 {
   MetaBackgroundPrivate *priv;
+  gboolean reload;
 
   g_return_if_fail (META_IS_BACKGROUND (self));
   g_return_if_fail (blend_factor >= 0.0 && blend_factor <= 1.0);
 
   priv = self->priv;
 
+  /* The style decides which size the images are loaded at */
+  priv->style = style;
+  reload = update_image_size (self);
+
   set_filename (self, &priv->filename1, &priv->background_image1, filename1);
   set_filename (self, &priv->filename2, &priv->background_image2, filename2);
+  if (reload)
+    drop_images (self);
 
   priv->blend_factor = blend_factor;
-  priv->style = style;
+
+  if (!is_cached (self))
+    load_images (self);
 
   free_wallpaper_texture (self);
   mark_changed (self);
@@ -3,103 +3,147 @@
 #include <math.h>
 #include <string.h>
 
+#include <gdk/gdk.h> /* for gdk_rectangle_intersect() */
+
+#include "clutter-utils.h"
 #include "cogl-utils.h"
+#include <meta/util.h>
 #include "meta-blur-factory.h"
 #include "region-utils.h"
 
-
-#define BLUR_PADDING    2
-static const gchar *box_blur_glsl_declarations =
-"uniform vec2 pixel_step;\n";
-#define SAMPLE(offx, offy) \
-  "cogl_texel += texture2D (cogl_sampler, cogl_tex_coord.st + pixel_step * " \
-  "vec2 (" G_STRINGIFY (offx) ", " G_STRINGIFY (offy) "));\n"
-static const gchar *box_blur_glsl_shader =
-"  cogl_texel = texture2D (cogl_sampler, cogl_tex_coord.st);\n"
-  SAMPLE (-1.0, -1.0)
-  SAMPLE ( 0.0, -1.0)
-  SAMPLE (+1.0, -1.0)
-  SAMPLE (-1.0,  0.0)
-  SAMPLE (+1.0,  0.0)
-  SAMPLE (-1.0, +1.0)
-  SAMPLE ( 0.0, +1.0)
-  SAMPLE (+1.0, +1.0)
-"  cogl_texel /= 9.0;\n";
-#undef SAMPLE
-
-//"
+/* Dual filter ("dual Kawase") blur: each downsampling pass halves the
+ * resolution, and the matching upsampling passes bring it back up, so
+ * the blur radius doubles with every level at roughly constant cost.
+ * half_pixel is half a texel of the texture being sampled, scaled by
+ * the sample offset.
+ *
+ * The textures are bigger than what they hold (see TEXTURE_SIZE_STEP),
+ * so CLAMP_TO_EDGE doesn't keep the samples from reaching the stale
+ * texels beyond the right and bottom of the data; all the shaders clamp
+ * their coordinates to uv_max, the center of the last valid texel,
+ * instead. The left and top of the data are the edges of the texture. */
+static const gchar *kawase_glsl_declarations =
+"uniform vec2 half_pixel;\n"
+"uniform vec2 uv_max;\n";
+
+#define KAWASE_SAMPLE(offset) \
+  "texture2D (cogl_sampler, min (uv + " offset ", uv_max))"
+
+static const gchar *kawase_down_glsl_shader =
+"  vec2 uv = cogl_tex_coord.st;\n"
+"  cogl_texel = texture2D (cogl_sampler, min (uv, uv_max)) * 4.0;\n"
+"  cogl_texel += " KAWASE_SAMPLE ("-half_pixel") ";\n"
+"  cogl_texel += " KAWASE_SAMPLE ("half_pixel") ";\n"
+"  cogl_texel += " KAWASE_SAMPLE ("vec2 (half_pixel.x, -half_pixel.y)") ";\n"
+"  cogl_texel += " KAWASE_SAMPLE ("vec2 (-half_pixel.x, half_pixel.y)") ";\n"
+"  cogl_texel /= 8.0;\n";
+
+static const gchar *kawase_up_glsl_shader =
+"  vec2 uv = cogl_tex_coord.st;\n"
+"  cogl_texel = " KAWASE_SAMPLE ("vec2 (-half_pixel.x * 2.0, 0.0)") ";\n"
+"  cogl_texel += " KAWASE_SAMPLE ("vec2 (-half_pixel.x, half_pixel.y)") " * 2.0;\n"
+"  cogl_texel += " KAWASE_SAMPLE ("vec2 (0.0, half_pixel.y * 2.0)") ";\n"
+"  cogl_texel += " KAWASE_SAMPLE ("vec2 (half_pixel.x, half_pixel.y)") " * 2.0;\n"
+"  cogl_texel += " KAWASE_SAMPLE ("vec2 (half_pixel.x * 2.0, 0.0)") ";\n"
+"  cogl_texel += " KAWASE_SAMPLE ("vec2 (half_pixel.x, -half_pixel.y)") " * 2.0;\n"
+"  cogl_texel += " KAWASE_SAMPLE ("vec2 (0.0, -half_pixel.y * 2.0)") ";\n"
+"  cogl_texel += " KAWASE_SAMPLE ("vec2 (-half_pixel.x, -half_pixel.y)") " * 2.0;\n"
+"  cogl_texel /= 12.0;\n";
+
+#undef KAWASE_SAMPLE
+
+/* Number of half-resolution levels we are prepared to go down; with
+ * TEXTURE_SIZE_STEP at 64 every level has an exact integer size. */
+#define MAX_KAWASE_LEVELS 5
 
 struct _MetaBlur
 {
-  int ref_count;
+  GObject parent;
 
-  CoglTexture *texture;
   gint radius;
   gfloat sigma;
-
-  CoglPipeline *pipeline;
-
-  gboolean vertical_texture_dirty;
+  /* Whether the Gaussian kernel for sigma has more factors than a
+   * fragment shader can hold, in which case radius is capped and the
+   * dual Kawase mode is used instead */
+  gboolean gaussian_too_large;
+
+  /* The backdrop is copied into horizontal_texture, blurred
+   * horizontally into vertical_texture through vertical_fbo, and then
+   * blurred vertically back into horizontal_texture through
+   * horizontal_fbo, where it is kept as the cached result that gets
+   * drawn onto the stage. All of these live on the GPU and are kept
+   * across paints; they are only reallocated when a backdrop doesn't
+   * fit, so steady-state painting allocates nothing.
+   */
   CoglHandle horizontal_texture;
+  CoglHandle horizontal_fbo;
   CoglHandle vertical_texture;
   CoglHandle vertical_fbo;
 
+  CoglPipeline *output_pipeline;
+
+  MetaBlurMode mode;
+
+  /* META_BLUR_MODE_DUAL_KAWASE: level_textures[i] holds level i + 1
+   * of the pyramid, at 1 / 2^(i + 1) of the size of horizontal_texture.
+   * down_pipelines[i] renders level i into level i + 1, and
+   * up_pipelines[i] renders level i + 1 back into level i, level 0
+   * being horizontal_texture itself. */
+  CoglHandle level_textures[MAX_KAWASE_LEVELS];
+  CoglHandle level_fbos[MAX_KAWASE_LEVELS];
+  CoglPipeline *down_pipelines[MAX_KAWASE_LEVELS];
+  CoglPipeline *up_pipelines[MAX_KAWASE_LEVELS];
+  int n_levels;
+  float kawase_offset;
+
   CoglPipeline *horizontal_pipeline;
   gint horizontal_pixel_step_uniform;
   gint horizontal_factors_uniform;
-  
+
   CoglPipeline *vertical_pipeline;
   gint vertical_pixel_step_uniform;
   gint vertical_factors_uniform;
 
-  /* The outer order is the distance the shadow extends outside the window
-   * shape; the inner border is the unscaled portion inside the window
-   * shape */
-
+  /* Allocated size of the offscreen textures; this is rounded up
+   * from the backdrop size so that resizing a window doesn't
+   * reallocate them on every frame. */
   guint tex_width;
   guint tex_height;
 
-  guint scale_width : 1;
-  guint scale_height : 1;
-  gint pixel_step_uniform;
-  CoglSnippet * snippet;
-
+  /* The areas, in framebuffer pixels, that the cached result in
+   * horizontal_texture was computed for; see meta_blur_paint() */
+  cairo_rectangle_int_t cached_paint_rect;
+  cairo_rectangle_int_t cached_backdrop_rect;
+  /* Whether horizontal_texture holds a result at all, and whether it
+   * is still up to date */
+  gboolean has_result;
+  gboolean cache_valid;
+
+  guint cache_hits;
+  guint cache_misses;
 };
 
-enum
-{
-PROP_0,
-PROP_SIGMA,
-PROP_LAST
-};
+/* Totals over all MetaBlur instances, for monitoring */
+static guint total_cache_hits;
+static guint total_cache_misses;
 
-MetaBlur * 
-meta_blur_new(void) {
-  return g_object_new (META_TYPE_BLUR, NULL);
-}
+/* Granularity of the offscreen texture allocations */
+#define TEXTURE_SIZE_STEP 64
 
-static void meta_blur_class_init(MetaBlurClass * klass) {};
+/* Fragment uniform vectors the Gaussian shader needs besides factors:
+ * pixel_step, uv_max and whatever Cogl adds for the layer and the
+ * pipeline */
+#define GAUSSIAN_RESERVED_UNIFORM_VECTORS 8
 
+static void meta_blur_set_sigma_real (MetaBlur *self,
+                                      gfloat    sigma);
 
 G_DEFINE_TYPE (MetaBlur, meta_blur, G_TYPE_OBJECT);
 
-static void
-make_blur (MetaBlur *self)
+MetaBlur *
+meta_blur_new (void)
 {
-  ClutterBackend *backend = clutter_get_default_backend ();
-  CoglContext *ctx = clutter_backend_get_cogl_context (backend);
-  self->pipeline = cogl_pipeline_new (ctx);
-
-  CoglSnippet * snippet = cogl_snippet_new (COGL_SNIPPET_HOOK_TEXTURE_LOOKUP,
-                              box_blur_glsl_declarations,
-                              NULL);
-  cogl_snippet_set_replace (snippet, box_blur_glsl_shader);
-  cogl_pipeline_add_layer_snippet (self->pipeline, 0, snippet);
-  cogl_object_unref (snippet);
-
-  cogl_pipeline_set_layer_null_texture (self->pipeline,
-                                        0, /* layer number */
-                                        COGL_TEXTURE_TYPE_2D);
+  return g_object_new (META_TYPE_BLUR, NULL);
 }
 
 static CoglPipeline *
@@ -112,6 +156,7 @@ get_blur_pipeline(MetaBlur * self, int radius) {
 
   g_string_append_printf (source,
                           "uniform vec2 pixel_step;\n"
+                          "uniform vec2 uv_max;\n"
                           "uniform float factors[%i];\n",
                           radius * 2 + 1);
 
@@ -143,13 +188,13 @@ get_blur_pipeline(MetaBlur * self, int radius) {
 
     g_string_append_printf (source,
                             " texture2D (cogl_sampler, "
-                            "cogl_tex_coord.st");
+                            "min (cogl_tex_coord.st");
     if (i != radius)
       g_string_append_printf (source,
                               " + pixel_step * %f",
                               (float) (i - radius));
     g_string_append_printf (source,
-                            ") * factors[%i];\n",
+                            ", uv_max)) * factors[%i];\n",
                             i);
   }
   cogl_snippet_set_replace (snippet, source->str);
@@ -166,6 +211,10 @@ get_blur_pipeline(MetaBlur * self, int radius) {
 static void
 update_horizontal_pipeline_texture (MetaBlur *self) {
   float pixel_step[2];
+
+  if (self->horizontal_texture == NULL)
+    return;
+
   cogl_pipeline_set_layer_texture (self->horizontal_pipeline,
     0, /* layer_num */
     self->horizontal_texture);
@@ -182,6 +231,10 @@ update_horizontal_pipeline_texture (MetaBlur *self) {
 static void
 update_vertical_pipeline_texture (MetaBlur *self) {
   float pixel_step[2];
+
+  if (self->vertical_texture == NULL)
+    return;
+
   cogl_pipeline_set_layer_texture (self->vertical_pipeline,
     0, /* layer_num */
     self->vertical_texture);
@@ -195,121 +248,698 @@ update_vertical_pipeline_texture (MetaBlur *self) {
 }
 
 static void
-meta_blur_post_paint(MetaBlur * self) {
-  CoglHandle horizontal_texture;
+free_kawase_levels (MetaBlur *self)
+{
+  int i;
 
-  horizontal_texture =
-    self->texture;
-
-  if (horizontal_texture != self->horizontal_texture) {
-    if (self->horizontal_texture)
-      cogl_object_unref (self->horizontal_texture);
-    self->horizontal_texture = cogl_object_ref (horizontal_texture);
-
-    self->tex_width = cogl_texture_get_width (horizontal_texture);
-    self->tex_height = cogl_texture_get_height (horizontal_texture);
-
-    update_horizontal_pipeline_texture (self);
-
-    if (self->vertical_texture == NULL ||
-        self->tex_width != cogl_texture_get_width (self->vertical_texture) ||
-        self->tex_height != cogl_texture_get_height (self->vertical_texture))
-      {
-        if (self->vertical_texture) {
-            cogl_object_unref (self->vertical_texture);
-            cogl_object_unref (self->vertical_fbo);
-          }
-
-        self->vertical_texture =
-          cogl_texture_new_with_size (self->tex_width, self->tex_height,
-                                      COGL_TEXTURE_NO_SLICING,
-                                      COGL_PIXEL_FORMAT_RGBA_8888_PRE);
-        self->vertical_fbo =
-          cogl_offscreen_new_to_texture (self->vertical_texture);
-
-        update_vertical_pipeline_texture (self);
-      }
-  }
-  self->vertical_texture_dirty = TRUE;
+  for (i = 0; i < MAX_KAWASE_LEVELS; i++)
+    {
+      g_clear_pointer (&self->level_fbos[i], cogl_object_unref);
+      g_clear_pointer (&self->level_textures[i], cogl_object_unref);
+      g_clear_pointer (&self->down_pipelines[i], cogl_object_unref);
+      g_clear_pointer (&self->up_pipelines[i], cogl_object_unref);
+    }
 }
 
-void
-meta_blur_paint (MetaBlur          *self,
-                   int             window_x,
-                   int             window_y,
-                   int             window_width,
-                   int             window_height,
-                   guint8          opacity,
-                   cairo_region_t *clip,
-                   gboolean        clip_strictly)
+static void
+free_textures (MetaBlur *self)
 {
-  if(self->pipeline == NULL) {
-    make_blur(self);
-  }
+  free_kawase_levels (self);
+  g_clear_pointer (&self->horizontal_fbo, cogl_object_unref);
+  g_clear_pointer (&self->horizontal_texture, cogl_object_unref);
+  g_clear_pointer (&self->vertical_fbo, cogl_object_unref);
+  g_clear_pointer (&self->vertical_texture, cogl_object_unref);
+  self->tex_width = 0;
+  self->tex_height = 0;
+  self->has_result = FALSE;
+  self->cache_valid = FALSE;
+}
 
-  guchar * pixels;
-  pixels = g_malloc0(window_width * window_height * 4);
-
-  cogl_read_pixels(
-    window_x, 
-    window_y, 
-    window_width, 
-    window_height, 
-    COGL_READ_PIXELS_COLOR_BUFFER,
-    COGL_PIXEL_FORMAT_RGBA_8888_PRE,
-    (guchar *) pixels);
-  int i = 0;
-  for(i = 0; i < window_width * window_height * 4; i += 4) {
-    pixels[i] = 0;
-  }
-  
-  self->texture = cogl_texture_new_from_data(
-    window_width, 
-    window_height,
-    COGL_TEXTURE_NO_SLICING,
-    COGL_PIXEL_FORMAT_RGBA_8888_PRE,
-    COGL_PIXEL_FORMAT_RGBA_8888_PRE,
-    0,
-    pixels
-  );
-
-  self->pixel_step_uniform =
-    cogl_pipeline_get_uniform_location (self->pipeline, "pixel_step");
-
-  gint tex_width = cogl_texture_get_width (self->texture);
-  gint tex_height = cogl_texture_get_height (self->texture);
+/* Makes sure the offscreen textures can hold a backdrop of the given
+ * size, reallocating them only if they are too small. */
+static gboolean
+ensure_textures (MetaBlur *self,
+                 int       width,
+                 int       height)
+{
+  CoglContext *ctx;
+  guint tex_width, tex_height;
+
+  if (self->horizontal_texture != NULL &&
+      width <= self->tex_width && height <= self->tex_height)
+    return TRUE;
+
+  ctx = clutter_backend_get_cogl_context (clutter_get_default_backend ());
+
+  tex_width = MAX (self->tex_width, (guint) width);
+  tex_height = MAX (self->tex_height, (guint) height);
+  tex_width = (tex_width + TEXTURE_SIZE_STEP - 1) & ~(TEXTURE_SIZE_STEP - 1);
+  tex_height = (tex_height + TEXTURE_SIZE_STEP - 1) & ~(TEXTURE_SIZE_STEP - 1);
 
+  free_textures (self);
+
+  self->horizontal_texture =
+    COGL_TEXTURE (cogl_texture_2d_new_with_size (ctx, tex_width, tex_height));
+  self->vertical_texture =
+    COGL_TEXTURE (cogl_texture_2d_new_with_size (ctx, tex_width, tex_height));
+
+  if (!cogl_texture_allocate (self->horizontal_texture, NULL) ||
+      !cogl_texture_allocate (self->vertical_texture, NULL))
+    {
+      free_textures (self);
+      return FALSE;
+    }
+
+  self->horizontal_fbo = cogl_offscreen_new_to_texture (self->horizontal_texture);
+  self->vertical_fbo = cogl_offscreen_new_to_texture (self->vertical_texture);
   self->tex_width = tex_width;
   self->tex_height = tex_height;
-  
-  // if (self->vertical_texture_dirty) {
-  //   cogl_framebuffer_draw_rectangle (self->vertical_fbo,
-  //                                    self->horizontal_pipeline,
-  //                                    -1.0f, 1.0f, 1.0f, -1.0f);
-
-  //   self->vertical_texture_dirty = FALSE;
-  // }
-
-  gint paint_opacity = 255;
-  cogl_pipeline_set_color4ub (self->vertical_pipeline,
-                              paint_opacity,
-                              paint_opacity,
-                              paint_opacity,
-                              paint_opacity);
-
-  cogl_framebuffer_draw_rectangle (cogl_get_draw_framebuffer (),
-                                   self->vertical_pipeline,
-                                   0, 0,
-                                   self->tex_width ,self->tex_height);
-  meta_blur_post_paint(self);
+
+  update_horizontal_pipeline_texture (self);
+  update_vertical_pipeline_texture (self);
+
+  if (self->output_pipeline == NULL)
+    {
+      self->output_pipeline = meta_create_texture_pipeline (NULL);
+      cogl_pipeline_set_layer_filters (self->output_pipeline, 0,
+                                       COGL_PIPELINE_FILTER_NEAREST,
+                                       COGL_PIPELINE_FILTER_NEAREST);
+    }
+  cogl_pipeline_set_layer_texture (self->output_pipeline, 0,
+                                   self->horizontal_texture);
+
+  return TRUE;
+}
+
+static CoglPipeline *
+get_kawase_pipeline (const gchar *shader)
+{
+  CoglContext *ctx =
+    clutter_backend_get_cogl_context (clutter_get_default_backend ());
+  CoglPipeline *pipeline;
+  CoglSnippet *snippet;
+
+  pipeline = cogl_pipeline_new (ctx);
+  cogl_pipeline_set_layer_null_texture (pipeline,
+                                        0, /* layer_num */
+                                        COGL_TEXTURE_TYPE_2D);
+  cogl_pipeline_set_layer_wrap_mode (pipeline,
+                                     0, /* layer_num */
+                                     COGL_PIPELINE_WRAP_MODE_CLAMP_TO_EDGE);
+  /* The samples fall between texels, so bilinear filtering does half
+   * of the work for us */
+  cogl_pipeline_set_layer_filters (pipeline,
+                                   0, /* layer_num */
+                                   COGL_PIPELINE_FILTER_LINEAR,
+                                   COGL_PIPELINE_FILTER_LINEAR);
+  cogl_pipeline_set_blend (pipeline, "RGBA = ADD (SRC_COLOR, 0)", NULL);
+
+  snippet = cogl_snippet_new (COGL_SNIPPET_HOOK_TEXTURE_LOOKUP,
+                              kawase_glsl_declarations,
+                              NULL);
+  cogl_snippet_set_replace (snippet, shader);
+  cogl_pipeline_add_layer_snippet (pipeline, 0, snippet);
+  cogl_object_unref (snippet);
+
+  return pipeline;
+}
+
+static void
+set_half_pixel (CoglPipeline *pipeline,
+                CoglTexture  *texture,
+                float         offset)
+{
+  float half_pixel[2];
+
+  half_pixel[0] = offset * 0.5f / cogl_texture_get_width (texture);
+  half_pixel[1] = offset * 0.5f / cogl_texture_get_height (texture);
+  cogl_pipeline_set_uniform_float (pipeline,
+                                   cogl_pipeline_get_uniform_location (pipeline,
+                                                                       "half_pixel"),
+                                   2, /* n_components */
+                                   1, /* count */
+                                   half_pixel);
 }
 
+/* Limits the samples of @pipeline to the top-left @width x @height
+ * texels of @texture, which are the ones holding data */
+static void
+set_uv_max (CoglPipeline *pipeline,
+            CoglTexture  *texture,
+            int           width,
+            int           height)
+{
+  float uv_max[2];
+
+  uv_max[0] = (width - 0.5f) / cogl_texture_get_width (texture);
+  uv_max[1] = (height - 0.5f) / cogl_texture_get_height (texture);
+  cogl_pipeline_set_uniform_float (pipeline,
+                                   cogl_pipeline_get_uniform_location (pipeline,
+                                                                       "uv_max"),
+                                   2, /* n_components */
+                                   1, /* count */
+                                   uv_max);
+}
+
+static void
+update_kawase_pipelines (MetaBlur *self)
+{
+  int i;
+
+  for (i = 0; i < MAX_KAWASE_LEVELS && self->down_pipelines[i] != NULL; i++)
+    {
+      CoglTexture *upper = i == 0 ? self->horizontal_texture : self->level_textures[i - 1];
+
+      set_half_pixel (self->down_pipelines[i], upper, self->kawase_offset);
+      set_half_pixel (self->up_pipelines[i], self->level_textures[i], self->kawase_offset);
+    }
+}
+
+/* Allocates the downsampled levels for the current horizontal_texture;
+ * like the full size textures, they are kept until that is reallocated. */
+static gboolean
+ensure_kawase_levels (MetaBlur *self)
+{
+  CoglContext *ctx;
+  CoglPipeline *down_template, *up_template;
+  int i;
+
+  if (self->level_textures[0] != NULL)
+    return TRUE;
+
+  ctx = clutter_backend_get_cogl_context (clutter_get_default_backend ());
+  down_template = get_kawase_pipeline (kawase_down_glsl_shader);
+  up_template = get_kawase_pipeline (kawase_up_glsl_shader);
+
+  for (i = 0; i < MAX_KAWASE_LEVELS; i++)
+    {
+      CoglTexture *upper = i == 0 ? self->horizontal_texture : self->level_textures[i - 1];
+      CoglTexture *texture;
+
+      texture = COGL_TEXTURE (cogl_texture_2d_new_with_size (ctx,
+                                                             self->tex_width >> (i + 1),
+                                                             self->tex_height >> (i + 1)));
+      if (!cogl_texture_allocate (texture, NULL))
+        {
+          cogl_object_unref (texture);
+          free_kawase_levels (self);
+          cogl_object_unref (down_template);
+          cogl_object_unref (up_template);
+          return FALSE;
+        }
+
+      self->level_textures[i] = texture;
+      self->level_fbos[i] = cogl_offscreen_new_to_texture (texture);
+
+      self->down_pipelines[i] = cogl_pipeline_copy (down_template);
+      cogl_pipeline_set_layer_texture (self->down_pipelines[i], 0, upper);
+
+      self->up_pipelines[i] = cogl_pipeline_copy (up_template);
+      cogl_pipeline_set_layer_texture (self->up_pipelines[i], 0, texture);
+    }
+
+  cogl_object_unref (down_template);
+  cogl_object_unref (up_template);
+
+  update_kawase_pipelines (self);
+
+  return TRUE;
+}
+
+/* Draws @src_rect of the texture in @pipeline, which is
+ * @tex_width x @tex_height, into @dst_rect of @fbo, which is
+ * @fbo_width x @fbo_height. Rectangles are in texels. The offscreens
+ * use an identity projection, so the destination is in GL coordinates. */
+static void
+draw_scaled_pass (CoglFramebuffer       *fbo,
+                  int                    fbo_width,
+                  int                    fbo_height,
+                  cairo_rectangle_int_t *dst_rect,
+                  CoglPipeline          *pipeline,
+                  int                    tex_width,
+                  int                    tex_height,
+                  cairo_rectangle_int_t *src_rect,
+                  gboolean               flipped)
+{
+  float x1, y1, x2, y2;
+  float s1, t1, s2, t2;
+
+  x1 = -1.0f + 2.0f * dst_rect->x / fbo_width;
+  y1 = 1.0f - 2.0f * dst_rect->y / fbo_height;
+  x2 = -1.0f + 2.0f * (dst_rect->x + dst_rect->width) / fbo_width;
+  y2 = 1.0f - 2.0f * (dst_rect->y + dst_rect->height) / fbo_height;
+
+  s1 = (float) src_rect->x / tex_width;
+  s2 = (float) (src_rect->x + src_rect->width) / tex_width;
+  t1 = (float) src_rect->y / tex_height;
+  t2 = (float) (src_rect->y + src_rect->height) / tex_height;
+
+  if (flipped)
+    {
+      float tmp = t1;
+      t1 = t2;
+      t2 = tmp;
+    }
+
+  cogl_framebuffer_draw_textured_rectangle (fbo, pipeline,
+                                            x1, y1, x2, y2,
+                                            s1, t1, s2, t2);
+
+  /* The passes ping-pong between the same textures, so don't leave it
+   * to Cogl to pick the order in which the journals get flushed */
+  cogl_flush ();
+}
+
+/* Runs one blur pass over @rect, given in texels of the full size
+ * offscreen textures, reading and writing the same area. */
+static void
+draw_pass (MetaBlur              *self,
+           CoglFramebuffer       *fbo,
+           CoglPipeline          *pipeline,
+           cairo_rectangle_int_t *rect,
+           gboolean               flipped)
+{
+  draw_scaled_pass (fbo, self->tex_width, self->tex_height, rect,
+                    pipeline, self->tex_width, self->tex_height, rect,
+                    flipped);
+}
+
+/* Runs the dual filter over the backdrop in horizontal_texture, going
+ * down n_levels levels and back up, leaving the result in
+ * horizontal_texture. */
+static gboolean
+run_kawase_passes (MetaBlur              *self,
+                   cairo_rectangle_int_t *backdrop,
+                   gboolean               flipped)
+{
+  cairo_rectangle_int_t rects[MAX_KAWASE_LEVELS + 1];
+  int i;
+
+  if (!ensure_kawase_levels (self))
+    return FALSE;
+
+  rects[0] = *backdrop;
+  for (i = 1; i <= self->n_levels; i++)
+    {
+      rects[i].x = 0;
+      rects[i].y = 0;
+      rects[i].width = MAX (1, rects[i - 1].width / 2);
+      rects[i].height = MAX (1, rects[i - 1].height / 2);
+    }
+
+  for (i = 0; i < self->n_levels; i++)
+    {
+      CoglTexture *upper = i == 0 ? self->horizontal_texture : self->level_textures[i - 1];
+
+      set_uv_max (self->down_pipelines[i], upper, rects[i].width, rects[i].height);
+      set_uv_max (self->up_pipelines[i], self->level_textures[i],
+                  rects[i + 1].width, rects[i + 1].height);
+    }
+
+  for (i = 0; i < self->n_levels; i++)
+    draw_scaled_pass (self->level_fbos[i],
+                      self->tex_width >> (i + 1), self->tex_height >> (i + 1),
+                      &rects[i + 1],
+                      self->down_pipelines[i],
+                      self->tex_width >> i, self->tex_height >> i,
+                      &rects[i],
+                      i == 0 && flipped);
+
+  for (i = self->n_levels - 1; i >= 0; i--)
+    draw_scaled_pass (i == 0 ? self->horizontal_fbo : self->level_fbos[i - 1],
+                      self->tex_width >> i, self->tex_height >> i,
+                      &rects[i],
+                      self->up_pipelines[i],
+                      self->tex_width >> (i + 1), self->tex_height >> (i + 1),
+                      &rects[i + 1],
+                      FALSE);
+
+  return TRUE;
+}
+
+/* Picks the number of levels and the sample offset for the dual
+ * Kawase mode: every level doubles the spread of the blur, and the
+ * offset, kept within [1, 2] where the filter doesn't show artifacts
+ * yet, covers what is in between. */
+static void
+update_kawase_params (MetaBlur *self)
+{
+  int n_levels = 1;
+
+  while (n_levels < MAX_KAWASE_LEVELS && (1 << (n_levels + 1)) <= self->sigma)
+    n_levels++;
+
+  self->n_levels = n_levels;
+  self->kawase_offset = CLAMP (self->sigma / (1 << n_levels), 1.0f, 2.0f);
+
+  update_kawase_pipelines (self);
+}
+
+/* The mode the blur is actually done in */
+static MetaBlurMode
+get_effective_mode (MetaBlur *self)
+{
+  if (self->gaussian_too_large)
+    return META_BLUR_MODE_DUAL_KAWASE;
+  else
+    return self->mode;
+}
+
+/* How far outside the blurred area the blur samples, in pixels */
+static int
+get_backdrop_margin (MetaBlur *self)
+{
+  if (get_effective_mode (self) == META_BLUR_MODE_DUAL_KAWASE)
+    return (int) ceilf (self->kawase_offset * (1 << (self->n_levels + 1)));
+  else
+    return self->radius;
+}
+
+static gboolean
+rectangle_equal (const cairo_rectangle_int_t *a,
+                 const cairo_rectangle_int_t *b)
+{
+  return (a->x == b->x && a->y == b->y &&
+          a->width == b->width && a->height == b->height);
+}
+
+static gboolean
+rectangle_contains (const cairo_rectangle_int_t *outer,
+                    const cairo_rectangle_int_t *inner)
+{
+  return (inner->x >= outer->x && inner->y >= outer->y &&
+          inner->x + inner->width <= outer->x + outer->width &&
+          inner->y + inner->height <= outer->y + outer->height);
+}
+
+/* Computes the blurred backdrop into horizontal_texture; returns
+ * FALSE if the backdrop couldn't be copied. */
+static gboolean
+update_blurred_backdrop (MetaBlur              *self,
+                         CoglFramebuffer       *fb,
+                         cairo_rectangle_int_t *paint_rect,
+                         cairo_rectangle_int_t *backdrop_rect)
+{
+  cairo_rectangle_int_t rect;
+  gboolean flipped;
+
+  if (!ensure_textures (self, backdrop_rect->width, backdrop_rect->height))
+    return FALSE;
+
+  if (!meta_cogl_framebuffer_copy_to_texture (fb,
+                                              backdrop_rect->x, backdrop_rect->y,
+                                              backdrop_rect->width, backdrop_rect->height,
+                                              self->horizontal_texture,
+                                              &flipped))
+    return FALSE;
+
+  rect.x = 0;
+  rect.y = 0;
+  rect.width = backdrop_rect->width;
+  rect.height = backdrop_rect->height;
+
+  if (get_effective_mode (self) == META_BLUR_MODE_DUAL_KAWASE)
+    return run_kawase_passes (self, &rect, flipped);
+
+  /* Both passes read what was copied, or blurred horizontally, over
+   * the whole backdrop */
+  set_uv_max (self->horizontal_pipeline, self->horizontal_texture,
+              rect.width, rect.height);
+  set_uv_max (self->vertical_pipeline, self->vertical_texture,
+              rect.width, rect.height);
+
+  /* Horizontal pass over the whole backdrop, so the vertical pass has
+   * the margin to sample from */
+  draw_pass (self, self->vertical_fbo, self->horizontal_pipeline, &rect, flipped);
+
+  /* Vertical pass only over the part we paint */
+  rect.x = paint_rect->x - backdrop_rect->x;
+  rect.y = paint_rect->y - backdrop_rect->y;
+  rect.width = paint_rect->width;
+  rect.height = paint_rect->height;
+  draw_pass (self, self->horizontal_fbo, self->vertical_pipeline, &rect, FALSE);
+
+  return TRUE;
+}
+
+/**
+ * meta_blur_paint:
+ * @self: a #MetaBlur
+ * @window_x: x position of the blurred area, in actor coordinates
+ * @window_y: y position of the blurred area, in actor coordinates
+ * @window_width: width of the blurred area
+ * @window_height: height of the blurred area
+ * @opacity: opacity to paint the blurred backdrop with
+ * @damage: (allow-none): bounds of the stage damage being repainted,
+ *   in framebuffer pixels, or %NULL if all of the framebuffer is
+ * @visible: (allow-none): if not %NULL, the region, in actor
+ *   coordinates, of the area that isn't obscured, regardless of @damage
+ * @clip: (allow-none): if not %NULL, the region, in actor coordinates,
+ *   to limit painting to, usually @visible within @damage
+ * @clip_strictly: currently unused; @clip is always honoured
+ * @redraw_rect: (out): set, when %FALSE is returned, to the area of the
+ *   framebuffer that needs to be redrawn for the result to be updated
+ *
+ * Paints a blurred copy of what has already been painted beneath the
+ * given area. The blurred result is cached, and only recomputed when
+ * the area moves or resizes, when meta_blur_invalidate() is called, or
+ * when @damage touches the backdrop the result was computed from.
+ *
+ * Outside of @damage, the framebuffer still holds the previous frame,
+ * including the blurred area itself, so the result is only recomputed
+ * when @damage covers all of the backdrop. Until then, the last result
+ * is painted where it still overlaps the area.
+ *
+ * With @visible, only its bounding box within the area is read back
+ * and blurred, and nothing at all is done if the area is not visible.
+ * That is what the result is cached for, so that it isn't recomputed
+ * whenever a redraw with a different @clip comes along.
+ *
+ * Return value: %FALSE if the result is out of date and the caller
+ *   should queue a redraw of @redraw_rect
+ */
+gboolean
+meta_blur_paint (MetaBlur              *self,
+                 int                    window_x,
+                 int                    window_y,
+                 int                    window_width,
+                 int                    window_height,
+                 guint8                 opacity,
+                 cairo_rectangle_int_t *damage,
+                 cairo_region_t        *visible,
+                 cairo_region_t        *clip,
+                 gboolean               clip_strictly,
+                 cairo_rectangle_int_t *redraw_rect)
+{
+  CoglFramebuffer *fb = cogl_get_draw_framebuffer ();
+  cairo_rectangle_int_t fb_rect, paint_rect, backdrop_rect, damaged;
+  cairo_rectangle_int_t actor_rect, result_rect;
+  cairo_region_t *paint_region;
+  gboolean up_to_date = TRUE;
+  float *coords;
+  int n_rects;
+  int x_origin, y_origin;
+  int margin;
+  int i;
+
+  if (window_width <= 0 || window_height <= 0 || opacity == 0)
+    return TRUE;
+
+  /* We can only sample the backdrop when we know where the window ends
+   * up in framebuffer pixels; blurring inside a scaled clone or during
+   * a transformed effect is skipped. */
+  if (!meta_actor_painting_untransformed (window_x + window_width,
+                                          window_y + window_height,
+                                          &x_origin, &y_origin))
+    return TRUE;
+
+  fb_rect.x = 0;
+  fb_rect.y = 0;
+  fb_rect.width = cogl_framebuffer_get_width (fb);
+  fb_rect.height = cogl_framebuffer_get_height (fb);
+
+  /* The part of the window we actually paint, in framebuffer pixels */
+  paint_rect.x = x_origin + window_x;
+  paint_rect.y = y_origin + window_y;
+  paint_rect.width = window_width;
+  paint_rect.height = window_height;
+  if (!gdk_rectangle_intersect (&paint_rect, &fb_rect, &paint_rect))
+    return TRUE;
+
+  actor_rect = paint_rect;
+  actor_rect.x -= x_origin;
+  actor_rect.y -= y_origin;
+
+  paint_region = cairo_region_create_rectangle (&actor_rect);
+
+  if (visible != NULL)
+    {
+      cairo_rectangle_int_t extents;
+
+      /* Windows above us may already have been drawn by the window
+       * group, so keep to the parts that are really visible; only
+       * those need to be read back and blurred. */
+      cairo_region_intersect (paint_region, visible);
+
+      if (cairo_region_is_empty (paint_region))
+        {
+          /* We won't see what changes beneath us until we are
+           * visible again */
+          self->cache_valid = FALSE;
+          cairo_region_destroy (paint_region);
+          return TRUE;
+        }
+
+      cairo_region_get_extents (paint_region, &extents);
+      paint_rect.x = x_origin + extents.x;
+      paint_rect.y = y_origin + extents.y;
+      paint_rect.width = extents.width;
+      paint_rect.height = extents.height;
+    }
+
+  if (clip != NULL)
+    cairo_region_intersect (paint_region, clip);
+
+  /* Sample a margin of the real backdrop around the window so that the
+   * kernel doesn't fade out at the window edges. */
+  margin = get_backdrop_margin (self);
+  backdrop_rect.x = paint_rect.x - margin;
+  backdrop_rect.y = paint_rect.y - margin;
+  backdrop_rect.width = paint_rect.width + 2 * margin;
+  backdrop_rect.height = paint_rect.height + 2 * margin;
+  gdk_rectangle_intersect (&backdrop_rect, &fb_rect, &backdrop_rect);
+
+  if (self->cache_valid &&
+      (!rectangle_equal (&paint_rect, &self->cached_paint_rect) ||
+       !rectangle_equal (&backdrop_rect, &self->cached_backdrop_rect) ||
+       damage == NULL ||
+       gdk_rectangle_intersect (damage, &backdrop_rect, &damaged)))
+    self->cache_valid = FALSE;
+
+  /* Nothing to paint in this redraw */
+  if (cairo_region_is_empty (paint_region))
+    goto out;
+
+  if (self->cache_valid)
+    {
+      self->cache_hits++;
+      total_cache_hits++;
+    }
+  else if (damage != NULL && !rectangle_contains (damage, &backdrop_rect))
+    {
+      /* Reading the backdrop back now would blur our own output of the
+       * last frame; have all of it redrawn instead, and make do with
+       * the last result until then. */
+      *redraw_rect = backdrop_rect;
+      up_to_date = FALSE;
+
+      if (!self->has_result)
+        goto out;
+    }
+  else
+    {
+      self->cache_misses++;
+      total_cache_misses++;
+
+      if (!update_blurred_backdrop (self, fb, &paint_rect, &backdrop_rect))
+        goto out;
+
+      self->cached_paint_rect = paint_rect;
+      self->cached_backdrop_rect = backdrop_rect;
+      self->has_result = TRUE;
+      self->cache_valid = TRUE;
+    }
+
+  /* What we have of the result, in actor coordinates; that is all of
+   * the visible area unless we are using an older result */
+  result_rect = self->cached_paint_rect;
+  result_rect.x -= x_origin;
+  result_rect.y -= y_origin;
+  cairo_region_intersect_rectangle (paint_region, &result_rect);
+
+  cogl_pipeline_set_color4ub (self->output_pipeline,
+                              opacity, opacity, opacity, opacity);
+
+  n_rects = cairo_region_num_rectangles (paint_region);
+  coords = g_new (float, n_rects * 8);
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+      float *c = coords + i * 8;
+
+      cairo_region_get_rectangle (paint_region, i, &rect);
+
+      c[0] = rect.x;
+      c[1] = rect.y;
+      c[2] = rect.x + rect.width;
+      c[3] = rect.y + rect.height;
+      c[4] = (float) (x_origin + rect.x - self->cached_backdrop_rect.x) / self->tex_width;
+      c[5] = (float) (y_origin + rect.y - self->cached_backdrop_rect.y) / self->tex_height;
+      c[6] = c[4] + (float) rect.width / self->tex_width;
+      c[7] = c[5] + (float) rect.height / self->tex_height;
+    }
+
+  cogl_framebuffer_draw_textured_rectangles (fb, self->output_pipeline,
+                                             coords, n_rects);
+
+  g_free (coords);
+
+out:
+  cairo_region_destroy (paint_region);
+
+  return up_to_date;
+}
+
+/**
+ * meta_blur_invalidate:
+ * @self: a #MetaBlur
+ *
+ * Drops the cached blurred backdrop, so that it is recomputed the next
+ * time meta_blur_paint() is called.
+ */
+void
+meta_blur_invalidate (MetaBlur *self)
+{
+  self->cache_valid = FALSE;
+}
+
+/**
+ * meta_blur_get_cache_stats:
+ * @self: (allow-none): a #MetaBlur, or %NULL for the totals over all
+ *   instances
+ * @hits: (out) (allow-none): number of paints that reused the cached result
+ * @misses: (out) (allow-none): number of paints that recomputed it
+ */
+void
+meta_blur_get_cache_stats (MetaBlur *self,
+                           guint    *hits,
+                           guint    *misses)
+{
+  if (hits)
+    *hits = self ? self->cache_hits : total_cache_hits;
+  if (misses)
+    *misses = self ? self->cache_misses : total_cache_misses;
+}
+
+/* The largest Gaussian radius whose factors[] array fits in the
+ * fragment uniforms; drivers may spend a whole vector on every float
+ * of an array, so count one per factor. */
+static int
+get_max_gaussian_radius (void)
+{
+  int n_factors = (meta_cogl_get_max_fragment_uniform_vectors () -
+                   GAUSSIAN_RESERVED_UNIFORM_VECTORS);
+
+  return MAX ((n_factors - 1) / 2, 0);
+}
 
 static void
 meta_blur_set_sigma_real (MetaBlur *self,
                           gfloat sigma)
 {
-  int radius;
+  static gboolean warned_too_large = FALSE;
+  int radius, max_radius;
   float *factors;
   float sum = 0.0f;
   int i;
@@ -321,6 +951,25 @@ meta_blur_set_sigma_real (MetaBlur *self,
      ⌈6σ⌉×⌈6σ⌉ gives good enough results in practice */
   radius = floorf (ceilf (6 * sigma) / 2.0f);
 
+  /* A kernel with more factors than the fragment uniforms hold would
+   * fail to link, so keep the Gaussian pipeline within the limit and
+   * blur with the dual Kawase mode, which has no such limit, instead */
+  max_radius = get_max_gaussian_radius ();
+  self->gaussian_too_large = radius > max_radius;
+  if (self->gaussian_too_large)
+    {
+      if (!warned_too_large && self->mode != META_BLUR_MODE_DUAL_KAWASE)
+        {
+          meta_warning ("Blur sigma %g needs a Gaussian kernel of radius %d, "
+                        "but the fragment shaders here only hold one of "
+                        "radius %d (sigma %g); using the dual Kawase blur "
+                        "instead\n",
+                        sigma, radius, max_radius, (2 * max_radius + 1) / 6.0);
+          warned_too_large = TRUE;
+        }
+      radius = max_radius;
+    }
+
   if (self->horizontal_pipeline && radius != self->radius)
     {
       cogl_object_unref (self->horizontal_pipeline);
@@ -353,12 +1002,16 @@ meta_blur_set_sigma_real (MetaBlur *self,
                                             "factors");
       update_vertical_pipeline_texture (self);
 
-      /* To avoid needing to clear the vertical texture we going to
-         disable blending in the horizontal pipeline and just fill it
-         with the horizontal texture */
+      /* To avoid needing to clear the offscreen textures we going to
+         disable blending in both passes and just fill them */
       cogl_pipeline_set_blend (self->horizontal_pipeline,
                                "RGBA = ADD (SRC_COLOR, 0)",
                                NULL);
+      cogl_pipeline_set_blend (self->vertical_pipeline,
+                               "RGBA = ADD (SRC_COLOR, 0)",
+                               NULL);
+
+      cogl_object_unref (base_pipeline);
     }
 
   factors = g_alloca (sizeof (float) * (radius * 2 + 1));
@@ -392,14 +1045,72 @@ meta_blur_set_sigma_real (MetaBlur *self,
   self->sigma = sigma;
   self->radius = radius;
 
-  self->vertical_texture_dirty = TRUE;
+  update_kawase_params (self);
+
+  self->cache_valid = FALSE;
 }
 
-static void meta_blur_init(MetaBlur * klass) {
-    meta_blur_set_sigma_real (klass, 0.84089642f);
-    self->texture = cogl_texture_new_from_data(
-      0, 0, COGL_TEXTURE_NO_SLICING, COGL_PIXEL_FORMAT_RGBA_8888_PRE, COGL_PIXEL_FORMAT_RGBA_8888_PRE, 0, NULL);
-    );
-    meta_blur_post_paint(self);
-};
+/**
+ * meta_blur_set_sigma:
+ * @self: a #MetaBlur
+ * @sigma: standard deviation of the Gaussian blur to apply, in pixels
+ *
+ * Sets the blur strength. The Gaussian mode uses kernels of about
+ * 3 * @sigma on either side at full resolution, so its cost grows with
+ * @sigma; the dual Kawase mode approximates it with more downsampled
+ * levels instead, up to a fixed maximum. When the Gaussian kernel for
+ * @sigma has more factors than the GPU allows in a fragment shader,
+ * the dual Kawase mode is used regardless of meta_blur_set_mode().
+ */
+void
+meta_blur_set_sigma (MetaBlur *self,
+                     gfloat    sigma)
+{
+  meta_blur_set_sigma_real (self, sigma);
+}
+
+/**
+ * meta_blur_set_mode:
+ * @self: a #MetaBlur
+ * @mode: the #MetaBlurMode to use
+ *
+ * Selects between the full resolution Gaussian blur and the cheaper
+ * downsampled dual Kawase approximation.
+ */
+void
+meta_blur_set_mode (MetaBlur     *self,
+                    MetaBlurMode  mode)
+{
+  if (self->mode == mode)
+    return;
+
+  self->mode = mode;
+  self->cache_valid = FALSE;
+}
 
+static void
+meta_blur_finalize (GObject *object)
+{
+  MetaBlur *self = META_BLUR (object);
+
+  free_textures (self);
+  g_clear_pointer (&self->horizontal_pipeline, cogl_object_unref);
+  g_clear_pointer (&self->vertical_pipeline, cogl_object_unref);
+  g_clear_pointer (&self->output_pipeline, cogl_object_unref);
+
+  G_OBJECT_CLASS (meta_blur_parent_class)->finalize (object);
+}
+
+static void
+meta_blur_class_init (MetaBlurClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = meta_blur_finalize;
+}
+
+static void
+meta_blur_init (MetaBlur *self)
+{
+  meta_blur_set_sigma_real (self, META_BLUR_DEFAULT_SIGMA);
+}
@@ -7,6 +7,24 @@
 #include <meta/meta-shadow-factory.h>
 
 typedef struct _MetaBlur MetaBlur;
+
+/* The blur strength of a new #MetaBlur; see meta_blur_set_sigma() */
+#define META_BLUR_DEFAULT_SIGMA 0.84089642f
+
+/* The largest blur strength worth asking for: where the dual Kawase
+ * levels run out */
+#define META_BLUR_MAX_SIGMA 64.0f
+
+/**
+ * MetaBlurMode:
+ * @META_BLUR_MODE_GAUSSIAN: separable Gaussian at full resolution
+ * @META_BLUR_MODE_DUAL_KAWASE: dual filter over a downsampled pyramid;
+ *   a large radius at near-constant cost, at some loss of quality
+ */
+typedef enum {
+  META_BLUR_MODE_GAUSSIAN,
+  META_BLUR_MODE_DUAL_KAWASE
+} MetaBlurMode;
 typedef struct _MetaBlurClass MetaBlurClass;
 
 struct _MetaBlurClass {
@@ -23,13 +41,27 @@ struct _MetaBlurClass {
 GType meta_blur_get_type(void);
 MetaBlur * meta_blur_new(void);
 
-void        meta_blur_paint       (MetaBlur           *shadow,
-                                     int                    window_x,
-                                     int                    window_y,
-                                     int                    window_width,
-                                     int                    window_height,
-                                     guint8                 opacity,
-                                     cairo_region_t        *clip,
-                                     gboolean               clip_strictly);
+gboolean    meta_blur_paint       (MetaBlur              *self,
+                                   int                    window_x,
+                                   int                    window_y,
+                                   int                    window_width,
+                                   int                    window_height,
+                                   guint8                 opacity,
+                                   cairo_rectangle_int_t *damage,
+                                   cairo_region_t        *visible,
+                                   cairo_region_t        *clip,
+                                   gboolean               clip_strictly,
+                                   cairo_rectangle_int_t *redraw_rect);
+
+void        meta_blur_invalidate  (MetaBlur              *self);
+
+void        meta_blur_set_sigma   (MetaBlur              *self,
+                                   gfloat                 sigma);
+void        meta_blur_set_mode    (MetaBlur              *self,
+                                   MetaBlurMode           mode);
+
+void        meta_blur_get_cache_stats (MetaBlur *self,
+                                       guint    *hits,
+                                       guint    *misses);
 
 #endif
\ No newline at end of file
@@ -24,9 +24,12 @@
 #include "config.h"
 #include "meta-cullable.h"
 #include "clutter-utils.h"
+#include "meta-frame-timings.h"
 
 G_DEFINE_INTERFACE (MetaCullable, meta_cullable, CLUTTER_TYPE_ACTOR);
 
+static guint culling_serial;
+
 /**
  * SECTION:meta-cullable
  * @title: MetaCullable
@@ -44,6 +47,18 @@ G_DEFINE_INTERFACE (MetaCullable, meta_cullable, CLUTTER_TYPE_ACTOR);
  * and ask each actor to "cull itself out". We pass in a region it can copy
  * to clip its drawing to, and the actor can subtract its fully opaque pixels
  * so that actors underneath know not to draw there as well.
+ *
+ * Actors that also draw outside of their contents, like the shadow and
+ * blurred backdrop of a window, can use meta_cullable_clip_bounds() to
+ * find out what part of that drawing is still visible, so that work on
+ * obscured parts, or on a window that is covered completely, is
+ * skipped.
+ *
+ * #MetaWindowGroup keeps what each of its children left visible of the
+ * stage from one frame to the next, as long as nothing in the scene
+ * changed. Changes it can't see from the actors' geometry, like a new
+ * opaque region, have to be reported with
+ * meta_cullable_invalidate_culling().
  */
 
 /**
@@ -122,6 +137,103 @@ meta_cullable_cull_out_children (MetaCullable   *cullable,
     }
 }
 
+static guint64
+get_region_area (cairo_region_t *region)
+{
+  guint64 area = 0;
+  int n_rects, i;
+
+  n_rects = cairo_region_num_rectangles (region);
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+
+      cairo_region_get_rectangle (region, i, &rect);
+      area += (guint64) rect.width * rect.height;
+    }
+
+  return area;
+}
+
+/* Gets the area of @bounds within the stage clip; @bounds is in the
+ * space of @cullable, which is being culled. When a clone of the window
+ * group is painted this only approximates it, but it is only used for
+ * the frame timings. */
+static guint64
+get_redrawn_area (MetaCullable                *cullable,
+                  const cairo_rectangle_int_t *bounds)
+{
+  ClutterActor *actor = CLUTTER_ACTOR (cullable);
+  ClutterActor *stage = clutter_actor_get_stage (actor);
+  cairo_rectangle_int_t redraw_clip;
+  int x, y, x1, y1, x2, y2;
+
+  if (stage == NULL || !meta_actor_is_untransformed (actor, &x, &y))
+    return (guint64) bounds->width * bounds->height;
+
+  clutter_stage_get_redraw_clip_bounds (CLUTTER_STAGE (stage), &redraw_clip);
+
+  x1 = MAX (bounds->x, redraw_clip.x - x);
+  y1 = MAX (bounds->y, redraw_clip.y - y);
+  x2 = MIN (bounds->x + bounds->width, redraw_clip.x - x + redraw_clip.width);
+  y2 = MIN (bounds->y + bounds->height, redraw_clip.y - y + redraw_clip.height);
+
+  if (x2 <= x1 || y2 <= y1)
+    return 0;
+
+  return (guint64) (x2 - x1) * (y2 - y1);
+}
+
+/**
+ * meta_cullable_clip_bounds:
+ * @cullable: The #MetaCullable being culled
+ * @unobscured_region: The unobscured region, as passed into cull_out()
+ * @clip_region: The clip region, as passed into cull_out()
+ * @bounds: the area an actor draws to beyond its contents, in the
+ *   same space as @clip_region
+ * @visible_region: (out) (transfer full) (allow-none): set to the part
+ *   of @bounds within @unobscured_region, which unlike the return value
+ *   doesn't depend on the stage clip
+ *
+ * This is a helper method for actors that draw more than their
+ * contents, e.g. a shadow, and want to limit that drawing to what
+ * is not obscured. The pixels of @bounds within the stage clip that
+ * turned out visible and obscured are counted for the frame timings.
+ *
+ * Returns: (transfer full): the part of @bounds within @clip_region;
+ *   empty if nothing of it needs to be drawn
+ */
+cairo_region_t *
+meta_cullable_clip_bounds (MetaCullable                *cullable,
+                           cairo_region_t              *unobscured_region,
+                           cairo_region_t              *clip_region,
+                           const cairo_rectangle_int_t *bounds,
+                           cairo_region_t             **visible_region)
+{
+  cairo_region_t *region;
+
+  region = cairo_region_create_rectangle (bounds);
+  cairo_region_intersect (region, clip_region);
+
+  if (visible_region)
+    {
+      *visible_region = cairo_region_create_rectangle (bounds);
+      cairo_region_intersect (*visible_region, unobscured_region);
+    }
+
+  if (meta_frame_timings_get_enabled ())
+    {
+      guint64 painted = get_region_area (region);
+      guint64 redrawn = get_redrawn_area (cullable, bounds);
+
+      /* What is outside of the stage clip wasn't going to be painted
+       * anyway, so it doesn't count as culled */
+      meta_frame_timings_add_pixels (painted, redrawn > painted ? redrawn - painted : 0);
+    }
+
+  return region;
+}
+
 /**
  * meta_cullable_reset_culling_children:
  * @cullable: The #MetaCullable
@@ -199,3 +311,28 @@ meta_cullable_reset_culling (MetaCullable *cullable)
 {
   META_CULLABLE_GET_IFACE (cullable)->reset_culling (cullable);
 }
+
+/**
+ * meta_cullable_invalidate_culling:
+ *
+ * Tells whoever keeps the results of culling across frames that they
+ * can no longer be used, e.g. because a cullable's opaque region
+ * changed or the stacking order was changed.
+ */
+void
+meta_cullable_invalidate_culling (void)
+{
+  culling_serial++;
+}
+
+/**
+ * meta_cullable_get_culling_serial:
+ *
+ * Return value: a number that changes each time
+ *   meta_cullable_invalidate_culling() is called
+ */
+guint
+meta_cullable_get_culling_serial (void)
+{
+  return culling_serial;
+}
@@ -54,11 +54,19 @@ void meta_cullable_cull_out (MetaCullable   *cullable,
                              cairo_region_t *clip_region);
 void meta_cullable_reset_culling (MetaCullable *cullable);
 
+void  meta_cullable_invalidate_culling (void);
+guint meta_cullable_get_culling_serial (void);
+
 /* Utility methods for implementations */
 void meta_cullable_cull_out_children (MetaCullable   *cullable,
                                       cairo_region_t *unobscured_region,
                                       cairo_region_t *clip_region);
 void meta_cullable_reset_culling_children (MetaCullable *cullable);
+cairo_region_t *meta_cullable_clip_bounds (MetaCullable                *cullable,
+                                           cairo_region_t              *unobscured_region,
+                                           cairo_region_t              *clip_region,
+                                           const cairo_rectangle_int_t *bounds,
+                                           cairo_region_t             **visible_region);
 
 G_END_DECLS
 
@@ -0,0 +1,501 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * MetaFrameTimings
+ *
+ * Recording where the time of each frame went
+ *
+ * Copyright 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * SECTION:meta-frame-timings
+ * @title: MetaFrameTimings
+ * @short_description: Per-frame timing of the compositor paint cycle
+ *
+ * When enabled, the compositor records how long each #MetaFramePhase
+ * took for the most recent frames, along with the presentation time
+ * Cogl reports for them once they reach the screen. The records are
+ * kept in a fixed-size ring, so recording a frame never allocates.
+ *
+ * The records can be read over D-Bus, through the
+ * org.gnome.Mutter.FrameTimings interface, or written to a file in the
+ * cache directory with meta_frame_timings_dump(). Recording is off
+ * unless $META_FRAME_TIMINGS is set or it is switched on over D-Bus.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include "meta-frame-timings.h"
+#include "meta-output-repaint.h"
+#include "meta-unredirect-policy.h"
+#include "meta-dbus-frame-timings.h"
+
+#include <meta/main.h> /* for meta_get_replace_current_wm () */
+#include <meta/util.h>
+
+/* Number of frames we keep; a bit more than 8 seconds at 60Hz */
+#define N_RECORDED_FRAMES 512
+
+typedef struct
+{
+  gint64 frame_counter;
+  gint64 start_time;
+  gint64 end_time;
+  gint64 presentation_time;
+  float refresh_rate;
+  guint32 damaged_outputs;
+  guint64 painted_pixels;
+  guint64 culled_pixels;
+  guint32 durations[META_N_FRAME_PHASES];
+} MetaFrameTiming;
+
+static const char * const phase_names[META_N_FRAME_PHASES + 1] = {
+  "pre-paint",
+  "xsync",
+  "stage-paint",
+  "cull",
+  "shadows",
+  "blur",
+  "post-paint",
+  NULL
+};
+
+static gboolean enabled;
+
+static MetaFrameTiming frames[N_RECORDED_FRAMES];
+static guint n_frames;
+static guint next_frame;
+
+/* The frame being recorded; only added to frames[] once it is done */
+static MetaFrameTiming current;
+static gboolean in_frame;
+static gint64 phase_start[META_N_FRAME_PHASES];
+
+static MetaDBusFrameTimings *dbus_skeleton;
+
+void
+meta_frame_timings_set_enabled (gboolean value)
+{
+  value = value != FALSE;
+
+  if (enabled == value)
+    return;
+
+  enabled = value;
+  in_frame = FALSE;
+
+  if (dbus_skeleton)
+    meta_dbus_frame_timings_set_enabled (dbus_skeleton, enabled);
+}
+
+gboolean
+meta_frame_timings_get_enabled (void)
+{
+  return enabled;
+}
+
+/**
+ * meta_frame_timings_begin_frame:
+ *
+ * Starts recording a new frame. A frame that was begun but never
+ * ended, because nothing ended up being painted, is dropped.
+ */
+void
+meta_frame_timings_begin_frame (void)
+{
+  if (!enabled)
+    return;
+
+  memset (&current, 0, sizeof (current));
+  memset (phase_start, 0, sizeof (phase_start));
+  current.frame_counter = -1;
+  current.start_time = g_get_monotonic_time ();
+  in_frame = TRUE;
+}
+
+/**
+ * meta_frame_timings_end_frame:
+ * @frame_counter: the Cogl frame counter the frame will be presented
+ *   with, or -1
+ * @damaged_outputs: the outputs the frame repainted, as a bitmask of
+ *   their monitor numbers
+ *
+ * Finishes recording the current frame and adds it to the ring.
+ */
+void
+meta_frame_timings_end_frame (gint64  frame_counter,
+                              guint32 damaged_outputs)
+{
+  if (!in_frame)
+    return;
+
+  current.end_time = g_get_monotonic_time ();
+  current.frame_counter = frame_counter;
+  current.damaged_outputs = damaged_outputs;
+
+  frames[next_frame] = current;
+  next_frame = (next_frame + 1) % N_RECORDED_FRAMES;
+  n_frames = MIN (n_frames + 1, N_RECORDED_FRAMES);
+
+  in_frame = FALSE;
+}
+
+/**
+ * meta_frame_timings_begin_phase:
+ * @phase: a #MetaFramePhase
+ *
+ * Starts timing @phase. A phase may be begun and ended several times
+ * in a frame, e.g. once for each window, and the durations add up.
+ */
+void
+meta_frame_timings_begin_phase (MetaFramePhase phase)
+{
+  if (!in_frame)
+    return;
+
+  phase_start[phase] = g_get_monotonic_time ();
+}
+
+void
+meta_frame_timings_end_phase (MetaFramePhase phase)
+{
+  if (!in_frame || phase_start[phase] == 0)
+    return;
+
+  current.durations[phase] += g_get_monotonic_time () - phase_start[phase];
+  phase_start[phase] = 0;
+}
+
+/**
+ * meta_frame_timings_add_pixels:
+ * @painted_pixels: pixels of shadows and blurred backdrops that were
+ *   painted
+ * @culled_pixels: pixels of them that were skipped because they were
+ *   obscured
+ *
+ * Accounts the result of culling to the current frame.
+ */
+void
+meta_frame_timings_add_pixels (guint64 painted_pixels,
+                               guint64 culled_pixels)
+{
+  if (!in_frame)
+    return;
+
+  current.painted_pixels += painted_pixels;
+  current.culled_pixels += culled_pixels;
+}
+
+/**
+ * meta_frame_timings_presented:
+ * @frame_counter: the Cogl frame counter of the presented frame
+ * @presentation_time: when the frame was presented, in the time base
+ *   of g_get_monotonic_time(), or 0 if not known
+ * @refresh_rate: the refresh rate of the output, or 0 if not known
+ *
+ * Records when a frame reached the screen.
+ */
+void
+meta_frame_timings_presented (gint64 frame_counter,
+                              gint64 presentation_time,
+                              float  refresh_rate)
+{
+  guint i;
+
+  if (!enabled || frame_counter < 0)
+    return;
+
+  /* The frame is normally one of the last few, so search backwards */
+  for (i = 1; i <= n_frames; i++)
+    {
+      MetaFrameTiming *frame = &frames[(next_frame + N_RECORDED_FRAMES - i) % N_RECORDED_FRAMES];
+
+      if (frame->frame_counter == frame_counter)
+        {
+          frame->presentation_time = presentation_time;
+          frame->refresh_rate = refresh_rate;
+          return;
+        }
+      else if (frame->frame_counter >= 0 && frame->frame_counter < frame_counter)
+        return;
+    }
+}
+
+static MetaFrameTiming *
+get_frame (guint i)
+{
+  return &frames[(next_frame + N_RECORDED_FRAMES - n_frames + i) % N_RECORDED_FRAMES];
+}
+
+/**
+ * meta_frame_timings_dump:
+ * @error: return location for a #GError
+ *
+ * Writes the recorded frames to frame-timings.txt in the mutter
+ * directory of the user's cache directory, oldest first, as a line of
+ * space separated numbers per frame. The first line is a comment
+ * naming the columns. The file is replaced each time; where it goes
+ * is not up to the caller, as this can be asked for over D-Bus.
+ *
+ * Return value: the name of the file written, to be freed with
+ *   g_free(), or %NULL on failure
+ */
+char *
+meta_frame_timings_dump (GError **error)
+{
+  GString *str;
+  char *dirname, *filename;
+  gboolean result;
+  guint i, j;
+
+  str = g_string_new ("# frame-counter start-time end-time presentation-time refresh-rate damaged-outputs painted-pixels culled-pixels");
+  for (j = 0; j < META_N_FRAME_PHASES; j++)
+    g_string_append_printf (str, " %s", phase_names[j]);
+  g_string_append_c (str, '\n');
+
+  for (i = 0; i < n_frames; i++)
+    {
+      MetaFrameTiming *frame = get_frame (i);
+      char rate[G_ASCII_DTOSTR_BUF_SIZE];
+
+      g_string_append_printf (str,
+                              "%" G_GINT64_FORMAT " %" G_GINT64_FORMAT
+                              " %" G_GINT64_FORMAT " %" G_GINT64_FORMAT " %s %#x"
+                              " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+                              frame->frame_counter, frame->start_time,
+                              frame->end_time, frame->presentation_time,
+                              g_ascii_dtostr (rate, sizeof (rate), frame->refresh_rate),
+                              frame->damaged_outputs,
+                              frame->painted_pixels, frame->culled_pixels);
+
+      for (j = 0; j < META_N_FRAME_PHASES; j++)
+        g_string_append_printf (str, " %u", frame->durations[j]);
+      g_string_append_c (str, '\n');
+    }
+
+  dirname = g_build_filename (g_get_user_cache_dir (), "mutter", NULL);
+  filename = g_build_filename (dirname, "frame-timings.txt", NULL);
+
+  if (g_mkdir_with_parents (dirname, 0700) != 0)
+    {
+      int errsv = errno;
+
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                   "Failed to create %s: %s", dirname, g_strerror (errsv));
+      result = FALSE;
+    }
+  else
+    {
+      result = g_file_set_contents (filename, str->str, str->len, error);
+    }
+
+  g_string_free (str, TRUE);
+  g_free (dirname);
+
+  if (!result)
+    {
+      g_free (filename);
+      return NULL;
+    }
+
+  return filename;
+}
+
+static gboolean
+handle_get_phase_names (MetaDBusFrameTimings  *skeleton,
+                        GDBusMethodInvocation *invocation)
+{
+  meta_dbus_frame_timings_complete_get_phase_names (skeleton, invocation, phase_names);
+  return TRUE;
+}
+
+static gboolean
+handle_get_frames (MetaDBusFrameTimings  *skeleton,
+                   GDBusMethodInvocation *invocation)
+{
+  GVariantBuilder builder;
+  guint i, j;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(xxxxduttau)"));
+
+  for (i = 0; i < n_frames; i++)
+    {
+      MetaFrameTiming *frame = get_frame (i);
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("(xxxxduttau)"));
+      g_variant_builder_add (&builder, "x", frame->frame_counter);
+      g_variant_builder_add (&builder, "x", frame->start_time);
+      g_variant_builder_add (&builder, "x", frame->end_time);
+      g_variant_builder_add (&builder, "x", frame->presentation_time);
+      g_variant_builder_add (&builder, "d", (double) frame->refresh_rate);
+      g_variant_builder_add (&builder, "u", frame->damaged_outputs);
+      g_variant_builder_add (&builder, "t", frame->painted_pixels);
+      g_variant_builder_add (&builder, "t", frame->culled_pixels);
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("au"));
+      for (j = 0; j < META_N_FRAME_PHASES; j++)
+        g_variant_builder_add (&builder, "u", frame->durations[j]);
+      g_variant_builder_close (&builder);
+
+      g_variant_builder_close (&builder);
+    }
+
+  meta_dbus_frame_timings_complete_get_frames (skeleton, invocation,
+                                               g_variant_builder_end (&builder));
+  return TRUE;
+}
+
+static gboolean
+handle_get_outputs (MetaDBusFrameTimings  *skeleton,
+                    GDBusMethodInvocation *invocation)
+{
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(iiiiduuxx)"));
+
+  for (i = 0; i < meta_output_repaint_get_n_outputs (); i++)
+    {
+      MetaOutputRepaintStats stats;
+
+      meta_output_repaint_get_stats (i, &stats);
+      g_variant_builder_add (&builder, "(iiiiduuxx)",
+                             stats.rect.x, stats.rect.y,
+                             stats.rect.width, stats.rect.height,
+                             (double) stats.refresh_rate,
+                             stats.n_damaged_frames,
+                             stats.n_presented_frames,
+                             stats.last_presentation_time,
+                             stats.mean_interval);
+    }
+
+  meta_dbus_frame_timings_complete_get_outputs (skeleton, invocation,
+                                                g_variant_builder_end (&builder));
+  return TRUE;
+}
+
+static gboolean
+handle_get_unredirect_stats (MetaDBusFrameTimings  *skeleton,
+                             GDBusMethodInvocation *invocation)
+{
+  MetaUnredirectStats stats;
+
+  meta_unredirect_policy_get_stats (NULL, g_get_monotonic_time (), &stats);
+  meta_dbus_frame_timings_complete_get_unredirect_stats (skeleton, invocation,
+                                                         stats.n_unredirects,
+                                                         stats.n_redirects,
+                                                         stats.unredirected_time);
+  return TRUE;
+}
+
+static gboolean
+handle_dump_to_file (MetaDBusFrameTimings  *skeleton,
+                     GDBusMethodInvocation *invocation)
+{
+  GError *error = NULL;
+  char *filename;
+
+  filename = meta_frame_timings_dump (&error);
+  if (filename == NULL)
+    {
+      g_dbus_method_invocation_return_gerror (invocation, error);
+      g_error_free (error);
+      return TRUE;
+    }
+
+  meta_dbus_frame_timings_complete_dump_to_file (skeleton, invocation, filename);
+  g_free (filename);
+  return TRUE;
+}
+
+static void
+on_enabled_changed (MetaDBusFrameTimings *skeleton,
+                    GParamSpec           *pspec,
+                    gpointer              user_data)
+{
+  meta_frame_timings_set_enabled (meta_dbus_frame_timings_get_enabled (skeleton));
+}
+
+static void
+on_bus_acquired (GDBusConnection *connection,
+                 const char      *name,
+                 gpointer         user_data)
+{
+  GError *error = NULL;
+
+  dbus_skeleton = meta_dbus_frame_timings_skeleton_new ();
+  meta_dbus_frame_timings_set_enabled (dbus_skeleton, enabled);
+
+  g_signal_connect (dbus_skeleton, "handle-get-phase-names",
+                    G_CALLBACK (handle_get_phase_names), NULL);
+  g_signal_connect (dbus_skeleton, "handle-get-frames",
+                    G_CALLBACK (handle_get_frames), NULL);
+  g_signal_connect (dbus_skeleton, "handle-get-outputs",
+                    G_CALLBACK (handle_get_outputs), NULL);
+  g_signal_connect (dbus_skeleton, "handle-get-unredirect-stats",
+                    G_CALLBACK (handle_get_unredirect_stats), NULL);
+  g_signal_connect (dbus_skeleton, "handle-dump-to-file",
+                    G_CALLBACK (handle_dump_to_file), NULL);
+  g_signal_connect (dbus_skeleton, "notify::enabled",
+                    G_CALLBACK (on_enabled_changed), NULL);
+
+  if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (dbus_skeleton),
+                                         connection,
+                                         "/org/gnome/Mutter/FrameTimings",
+                                         &error))
+    {
+      meta_warning ("Failed to export frame timings object: %s\n", error->message);
+      g_error_free (error);
+    }
+}
+
+static void
+on_name_acquired (GDBusConnection *connection,
+                  const char      *name,
+                  gpointer         user_data)
+{
+  meta_verbose ("Acquired name %s\n", name);
+}
+
+static void
+on_name_lost (GDBusConnection *connection,
+              const char      *name,
+              gpointer         user_data)
+{
+  meta_verbose ("Lost or failed to acquire name %s\n", name);
+}
+
+void
+meta_frame_timings_init_dbus (void)
+{
+  static int dbus_name_id;
+
+  if (dbus_name_id > 0)
+    return;
+
+  dbus_name_id = g_bus_own_name (G_BUS_TYPE_SESSION,
+                                 "org.gnome.Mutter.FrameTimings",
+                                 G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT |
+                                 (meta_get_replace_current_wm () ?
+                                  G_BUS_NAME_OWNER_FLAGS_REPLACE : 0),
+                                 on_bus_acquired,
+                                 on_name_acquired,
+                                 on_name_lost,
+                                 NULL, NULL);
+}
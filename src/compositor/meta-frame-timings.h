@@ -0,0 +1,78 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * MetaFrameTimings
+ *
+ * Recording where the time of each frame went
+ *
+ * Copyright 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __META_FRAME_TIMINGS_H__
+#define __META_FRAME_TIMINGS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * MetaFramePhase:
+ * @META_FRAME_PHASE_PRE_PAINT: processing damage and updating window
+ *   textures before painting
+ * @META_FRAME_PHASE_XSYNC: the round trip that makes X drawing visible
+ *   to GL
+ * @META_FRAME_PHASE_STAGE_PAINT: layout and paint of the stage; includes
+ *   the phases below
+ * @META_FRAME_PHASE_CULL: culling out obscured parts of windows
+ * @META_FRAME_PHASE_SHADOWS: painting window shadows
+ * @META_FRAME_PHASE_BLUR: painting blurred backdrops
+ * @META_FRAME_PHASE_POST_PAINT: sending frame completion to clients
+ *
+ * The parts of a frame that are timed separately.
+ */
+typedef enum
+{
+  META_FRAME_PHASE_PRE_PAINT,
+  META_FRAME_PHASE_XSYNC,
+  META_FRAME_PHASE_STAGE_PAINT,
+  META_FRAME_PHASE_CULL,
+  META_FRAME_PHASE_SHADOWS,
+  META_FRAME_PHASE_BLUR,
+  META_FRAME_PHASE_POST_PAINT,
+
+  META_N_FRAME_PHASES
+} MetaFramePhase;
+
+void     meta_frame_timings_set_enabled (gboolean        enabled);
+gboolean meta_frame_timings_get_enabled (void);
+
+void     meta_frame_timings_begin_frame (void);
+void     meta_frame_timings_end_frame   (gint64          frame_counter,
+                                         guint32         damaged_outputs);
+void     meta_frame_timings_begin_phase (MetaFramePhase  phase);
+void     meta_frame_timings_end_phase   (MetaFramePhase  phase);
+void     meta_frame_timings_add_pixels  (guint64         painted_pixels,
+                                         guint64         culled_pixels);
+void     meta_frame_timings_presented   (gint64          frame_counter,
+                                         gint64          presentation_time,
+                                         float           refresh_rate);
+
+char    *meta_frame_timings_dump        (GError        **error);
+
+void     meta_frame_timings_init_dbus   (void);
+
+G_END_DECLS
+
+#endif /* __META_FRAME_TIMINGS_H__ */
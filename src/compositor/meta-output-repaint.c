@@ -0,0 +1,238 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * MetaOutputRepaint
+ *
+ * Tracking which outputs each frame repaints
+ *
+ * Copyright 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The whole stage is painted and presented as one, on a single frame
+ * clock; that clock follows the fastest output. Damage is routed to
+ * the outputs it falls on, using the logical monitor layout, and each
+ * painted frame remembers which outputs it carried damage for, so
+ * that when Cogl reports the frame as presented, that is accounted to
+ * those outputs.
+ *
+ * Cogl only reports presentation times for the one onscreen of the
+ * stage, which is synced to a single CRTC. So the presentation times
+ * kept for an output are those of the stage clock, not the phase of
+ * the output's own vblank; they are statistics, and not something to
+ * pace repaints of other outputs by.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "meta-output-repaint.h"
+
+/* Outputs are tracked in a bitmask */
+#define MAX_OUTPUTS 32
+
+/* Frames painted but not reported as presented yet */
+#define N_PENDING_FRAMES 16
+
+typedef struct
+{
+  gint64 frame_counter;
+  guint32 outputs;
+} PendingFrame;
+
+static MetaOutputRepaintStats outputs[MAX_OUTPUTS];
+static guint n_outputs;
+
+/* Outputs damaged since the last frame was painted */
+static guint32 damaged_outputs;
+
+static PendingFrame pending_frames[N_PENDING_FRAMES];
+static guint next_pending_frame;
+
+static float
+get_refresh_rate (MetaMonitorManager *manager,
+                  MetaMonitorInfo    *info)
+{
+  MetaOutput *manager_outputs;
+  unsigned int n_manager_outputs, i;
+
+  manager_outputs = meta_monitor_manager_get_outputs (manager, &n_manager_outputs);
+
+  for (i = 0; i < n_manager_outputs; i++)
+    {
+      MetaOutput *output = &manager_outputs[i];
+
+      if (output->winsys_id == info->winsys_id &&
+          output->crtc != NULL &&
+          output->crtc->current_mode != NULL)
+        return output->crtc->current_mode->refresh_rate;
+    }
+
+  return 0;
+}
+
+/**
+ * meta_output_repaint_update_outputs:
+ * @manager: the #MetaMonitorManager
+ *
+ * Picks up a new monitor layout. The statistics start over.
+ */
+void
+meta_output_repaint_update_outputs (MetaMonitorManager *manager)
+{
+  MetaMonitorInfo *infos;
+  unsigned int n_infos, i;
+
+  infos = meta_monitor_manager_get_monitor_infos (manager, &n_infos);
+
+  n_outputs = MIN (n_infos, MAX_OUTPUTS);
+  for (i = 0; i < n_outputs; i++)
+    {
+      MetaOutputRepaintStats *stats = &outputs[i];
+
+      memset (stats, 0, sizeof (*stats));
+      stats->rect = infos[i].rect;
+      stats->refresh_rate = get_refresh_rate (manager, &infos[i]);
+    }
+
+  /* Output numbers of frames in flight no longer mean anything */
+  damaged_outputs = 0;
+  for (i = 0; i < N_PENDING_FRAMES; i++)
+    pending_frames[i].outputs = 0;
+}
+
+/**
+ * meta_output_repaint_add_damage:
+ * @rect: a damaged area, in stage coordinates
+ *
+ * Records that the next frame has to repaint @rect.
+ */
+void
+meta_output_repaint_add_damage (const cairo_rectangle_int_t *rect)
+{
+  MetaRectangle damage_rect = { rect->x, rect->y, rect->width, rect->height };
+  guint i;
+
+  for (i = 0; i < n_outputs; i++)
+    {
+      if (meta_rectangle_overlap (&outputs[i].rect, &damage_rect))
+        damaged_outputs |= 1u << i;
+    }
+}
+
+/**
+ * meta_output_repaint_end_frame:
+ * @frame_counter: the Cogl frame counter the frame will be presented
+ *   with, or -1
+ *
+ * Finishes a painted frame, which carries the damage recorded since
+ * the previous one.
+ *
+ * Return value: the outputs the frame repainted, as a bitmask of
+ *   their monitor numbers
+ */
+guint32
+meta_output_repaint_end_frame (gint64 frame_counter)
+{
+  guint32 frame_outputs = damaged_outputs;
+  guint i;
+
+  damaged_outputs = 0;
+
+  for (i = 0; i < n_outputs; i++)
+    {
+      if (frame_outputs & (1u << i))
+        outputs[i].n_damaged_frames++;
+    }
+
+  if (frame_counter >= 0 && frame_outputs != 0)
+    {
+      PendingFrame *frame = &pending_frames[next_pending_frame];
+
+      frame->frame_counter = frame_counter;
+      frame->outputs = frame_outputs;
+      next_pending_frame = (next_pending_frame + 1) % N_PENDING_FRAMES;
+    }
+
+  return frame_outputs;
+}
+
+/**
+ * meta_output_repaint_presented:
+ * @frame_counter: the Cogl frame counter of the presented frame
+ * @presentation_time: when the frame was presented, in the time base
+ *   of g_get_monotonic_time(), or 0 if not known
+ *
+ * Accounts the presentation of a frame to the outputs it repainted.
+ */
+void
+meta_output_repaint_presented (gint64 frame_counter,
+                               gint64 presentation_time)
+{
+  guint i, j;
+
+  for (i = 0; i < N_PENDING_FRAMES; i++)
+    {
+      PendingFrame *frame = &pending_frames[i];
+
+      if (frame->outputs == 0 || frame->frame_counter != frame_counter)
+        continue;
+
+      for (j = 0; j < n_outputs; j++)
+        {
+          MetaOutputRepaintStats *stats = &outputs[j];
+
+          if (!(frame->outputs & (1u << j)))
+            continue;
+
+          stats->n_presented_frames++;
+
+          if (presentation_time == 0)
+            continue;
+
+          if (stats->last_presentation_time != 0 &&
+              presentation_time > stats->last_presentation_time)
+            {
+              gint64 interval = presentation_time - stats->last_presentation_time;
+
+              if (stats->mean_interval == 0)
+                stats->mean_interval = interval;
+              else
+                stats->mean_interval = (7 * stats->mean_interval + interval) / 8;
+            }
+
+          stats->last_presentation_time = presentation_time;
+        }
+
+      frame->outputs = 0;
+      return;
+    }
+}
+
+guint
+meta_output_repaint_get_n_outputs (void)
+{
+  return n_outputs;
+}
+
+void
+meta_output_repaint_get_stats (guint                   output,
+                               MetaOutputRepaintStats *stats)
+{
+  g_return_if_fail (output < n_outputs);
+
+  *stats = outputs[output];
+}
@@ -0,0 +1,67 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * MetaOutputRepaint
+ *
+ * Tracking which outputs each frame repaints
+ *
+ * Copyright 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __META_OUTPUT_REPAINT_H__
+#define __META_OUTPUT_REPAINT_H__
+
+#include <cairo.h>
+#include <meta/boxes.h>
+#include "meta-monitor-manager.h"
+
+G_BEGIN_DECLS
+
+/**
+ * MetaOutputRepaintStats:
+ * @rect: the area of the output, in stage coordinates
+ * @refresh_rate: the refresh rate of the output's mode, or 0
+ * @n_damaged_frames: frames painted with damage on the output
+ * @n_presented_frames: how many of those were reported as presented
+ * @last_presentation_time: when the last of those was presented, in
+ *   the time base of g_get_monotonic_time(); this comes from the stage
+ *   clock, not from the output's own vblank
+ * @mean_interval: the average time between two of those frames being
+ *   presented, in microseconds, or 0 if not known yet
+ */
+typedef struct
+{
+  MetaRectangle rect;
+  float refresh_rate;
+  guint n_damaged_frames;
+  guint n_presented_frames;
+  gint64 last_presentation_time;
+  gint64 mean_interval;
+} MetaOutputRepaintStats;
+
+void     meta_output_repaint_update_outputs (MetaMonitorManager          *manager);
+
+void     meta_output_repaint_add_damage     (const cairo_rectangle_int_t *rect);
+guint32  meta_output_repaint_end_frame      (gint64                       frame_counter);
+void     meta_output_repaint_presented      (gint64                       frame_counter,
+                                             gint64                       presentation_time);
+
+guint    meta_output_repaint_get_n_outputs  (void);
+void     meta_output_repaint_get_stats      (guint                        output,
+                                             MetaOutputRepaintStats      *stats);
+
+G_END_DECLS
+
+#endif /* __META_OUTPUT_REPAINT_H__ */
@@ -0,0 +1,534 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * MetaShadowAtlas
+ *
+ * Shared textures for packing many small shadow images
+ *
+ * Copyright 2010 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <string.h>
+
+#include "cogl-utils.h"
+#include "meta-shadow-atlas.h"
+
+/* Each page is a square A8 texture of this size */
+#define PAGE_SIZE 1024
+
+/* Images that are larger than this (including the border) in either
+ * direction are not put into the atlas; this keeps a single large
+ * shaped window from using up most of a page */
+#define MAX_SLOT_SIZE (PAGE_SIZE / 4)
+
+/* Shelf heights are rounded up to a multiple of this, so that images
+ * of similar sizes end up on the same shelf */
+#define SHELF_HEIGHT_STEP 4
+
+/* Pages are allocated in horizontal shelves, each of which has a list of
+ * free spans. Shadows for the same shape with different parameters
+ * tend to have similar heights, so this simple scheme packs them well
+ * enough, and freeing a slot just returns its span to the shelf.
+ */
+typedef struct _MetaShadowAtlasPage  MetaShadowAtlasPage;
+typedef struct _MetaShadowAtlasShelf MetaShadowAtlasShelf;
+
+typedef struct
+{
+  int x;
+  int width;
+} MetaShadowAtlasSpan;
+
+struct _MetaShadowAtlasShelf
+{
+  int y;
+  int height;
+  GArray *free_spans; /* MetaShadowAtlasSpan, sorted by x */
+  int n_slots;
+};
+
+struct _MetaShadowAtlasPage
+{
+  MetaShadowAtlas *atlas; /* NULL once the atlas has been freed */
+  CoglTexture *texture;
+  CoglPipeline *pipeline;
+
+  /* Copies of pipeline with the color set to each opacity, so that
+   * shadows painted with the same opacity share a pipeline */
+  CoglPipeline *opacity_pipelines[256];
+
+  GPtrArray *shelves;
+  int shelf_end;
+  int n_slots;
+};
+
+struct _MetaShadowAtlasSlot
+{
+  MetaShadowAtlasPage *page;
+  MetaShadowAtlasShelf *shelf;
+
+  /* The allocated area, including the border */
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+struct _MetaShadowAtlas
+{
+  GList *pages;
+};
+
+static MetaShadowAtlasShelf *
+shelf_new (int y,
+           int height)
+{
+  MetaShadowAtlasShelf *shelf = g_slice_new0 (MetaShadowAtlasShelf);
+  MetaShadowAtlasSpan span = { 0, PAGE_SIZE };
+
+  shelf->y = y;
+  shelf->height = height;
+  shelf->free_spans = g_array_new (FALSE, FALSE, sizeof (MetaShadowAtlasSpan));
+  g_array_append_val (shelf->free_spans, span);
+
+  return shelf;
+}
+
+static void
+shelf_free (MetaShadowAtlasShelf *shelf)
+{
+  g_array_free (shelf->free_spans, TRUE);
+  g_slice_free (MetaShadowAtlasShelf, shelf);
+}
+
+/* Returns the x position of a newly allocated span, or -1 */
+static int
+shelf_allocate (MetaShadowAtlasShelf *shelf,
+                int                   width)
+{
+  guint i;
+
+  for (i = 0; i < shelf->free_spans->len; i++)
+    {
+      MetaShadowAtlasSpan *span = &g_array_index (shelf->free_spans, MetaShadowAtlasSpan, i);
+      int x = span->x;
+
+      if (span->width < width)
+        continue;
+
+      if (span->width == width)
+        g_array_remove_index (shelf->free_spans, i);
+      else
+        {
+          span->x += width;
+          span->width -= width;
+        }
+
+      shelf->n_slots++;
+
+      return x;
+    }
+
+  return -1;
+}
+
+static void
+shelf_release (MetaShadowAtlasShelf *shelf,
+               int                   x,
+               int                   width)
+{
+  MetaShadowAtlasSpan span = { x, width };
+  MetaShadowAtlasSpan *prev = NULL, *next = NULL;
+  guint i;
+
+  for (i = 0; i < shelf->free_spans->len; i++)
+    if (g_array_index (shelf->free_spans, MetaShadowAtlasSpan, i).x > x)
+      break;
+
+  if (i > 0)
+    prev = &g_array_index (shelf->free_spans, MetaShadowAtlasSpan, i - 1);
+  if (i < shelf->free_spans->len)
+    next = &g_array_index (shelf->free_spans, MetaShadowAtlasSpan, i);
+
+  if (prev && prev->x + prev->width == x)
+    {
+      prev->width += width;
+
+      if (next && next->x == prev->x + prev->width)
+        {
+          prev->width += next->width;
+          g_array_remove_index (shelf->free_spans, i);
+        }
+    }
+  else if (next && x + width == next->x)
+    {
+      next->x = x;
+      next->width += width;
+    }
+  else
+    {
+      g_array_insert_val (shelf->free_spans, i, span);
+    }
+
+  shelf->n_slots--;
+}
+
+static MetaShadowAtlasPage *
+page_new (MetaShadowAtlas *atlas)
+{
+  ClutterBackend *backend = clutter_get_default_backend ();
+  CoglContext *ctx = clutter_backend_get_cogl_context (backend);
+  MetaShadowAtlasPage *page = g_slice_new0 (MetaShadowAtlasPage);
+
+  page->atlas = atlas;
+  page->texture = COGL_TEXTURE (cogl_texture_2d_new_with_size (ctx, PAGE_SIZE, PAGE_SIZE));
+  cogl_texture_set_components (page->texture, COGL_TEXTURE_COMPONENTS_A);
+  page->pipeline = meta_create_texture_pipeline (page->texture);
+  page->shelves = g_ptr_array_new_with_free_func ((GDestroyNotify) shelf_free);
+
+  return page;
+}
+
+static void
+page_free (MetaShadowAtlasPage *page)
+{
+  int i;
+
+  for (i = 0; i < 256; i++)
+    if (page->opacity_pipelines[i])
+      cogl_object_unref (page->opacity_pipelines[i]);
+
+  cogl_object_unref (page->pipeline);
+  cogl_object_unref (page->texture);
+  g_ptr_array_free (page->shelves, TRUE);
+
+  g_slice_free (MetaShadowAtlasPage, page);
+}
+
+static gboolean
+shelf_has_space (MetaShadowAtlasShelf *shelf,
+                 int                   width)
+{
+  guint i;
+
+  for (i = 0; i < shelf->free_spans->len; i++)
+    if (g_array_index (shelf->free_spans, MetaShadowAtlasSpan, i).width >= width)
+      return TRUE;
+
+  return FALSE;
+}
+
+static gboolean
+page_allocate (MetaShadowAtlasPage   *page,
+               int                    width,
+               int                    height,
+               MetaShadowAtlasShelf **shelf_out,
+               int                   *x_out)
+{
+  MetaShadowAtlasShelf *best = NULL;
+  int shelf_height;
+  guint i;
+
+  /* Use the shortest shelf the image fits on without wasting more
+   * than half of the shelf height */
+  for (i = 0; i < page->shelves->len; i++)
+    {
+      MetaShadowAtlasShelf *shelf = g_ptr_array_index (page->shelves, i);
+
+      if (shelf->height < height || shelf->height > 2 * height)
+        continue;
+
+      if (best && best->height <= shelf->height)
+        continue;
+
+      if (shelf_has_space (shelf, width))
+        best = shelf;
+    }
+
+  if (best == NULL)
+    {
+      shelf_height = (height + SHELF_HEIGHT_STEP - 1) & ~(SHELF_HEIGHT_STEP - 1);
+      if (page->shelf_end + shelf_height > PAGE_SIZE)
+        return FALSE;
+
+      best = shelf_new (page->shelf_end, shelf_height);
+      g_ptr_array_add (page->shelves, best);
+      page->shelf_end += shelf_height;
+    }
+
+  *shelf_out = best;
+  *x_out = shelf_allocate (best, width);
+
+  return TRUE;
+}
+
+/* Drops empty shelves from the end of the page, so that their
+ * space can be used for shelves of a different height */
+static void
+page_trim_shelves (MetaShadowAtlasPage *page)
+{
+  while (page->shelves->len > 0)
+    {
+      MetaShadowAtlasShelf *shelf = g_ptr_array_index (page->shelves,
+                                                       page->shelves->len - 1);
+      if (shelf->n_slots > 0)
+        break;
+
+      page->shelf_end = shelf->y;
+      g_ptr_array_remove_index (page->shelves, page->shelves->len - 1);
+    }
+}
+
+/**
+ * meta_shadow_atlas_new:
+ *
+ * Creates a new, empty, shadow atlas; no textures are allocated
+ * until the first image is added.
+ *
+ * Return value: the new atlas. Free with meta_shadow_atlas_free()
+ */
+MetaShadowAtlas *
+meta_shadow_atlas_new (void)
+{
+  return g_slice_new0 (MetaShadowAtlas);
+}
+
+/**
+ * meta_shadow_atlas_free:
+ * @atlas: a #MetaShadowAtlas
+ *
+ * Frees the atlas. Pages that still hold images are kept until the
+ * last of their slots is freed with meta_shadow_atlas_slot_free().
+ */
+void
+meta_shadow_atlas_free (MetaShadowAtlas *atlas)
+{
+  GList *l;
+
+  for (l = atlas->pages; l; l = l->next)
+    {
+      MetaShadowAtlasPage *page = l->data;
+
+      if (page->n_slots == 0)
+        page_free (page);
+      else
+        page->atlas = NULL;
+    }
+
+  g_list_free (atlas->pages);
+  g_slice_free (MetaShadowAtlas, atlas);
+}
+
+/* Copies the image into a buffer with a one pixel border that repeats
+ * the edge pixels, then uploads that to the page.
+ */
+static void
+upload_slot (MetaShadowAtlasSlot *slot,
+             int                  width,
+             int                  height,
+             int                  rowstride,
+             const guchar        *data)
+{
+  int padded_width = width + 2;
+  int padded_height = height + 2;
+  guchar *buffer = g_malloc (padded_width * padded_height);
+  int j;
+
+  for (j = 0; j < padded_height; j++)
+    {
+      const guchar *src = data + CLAMP (j - 1, 0, height - 1) * rowstride;
+      guchar *dest = buffer + j * padded_width;
+
+      dest[0] = src[0];
+      memcpy (dest + 1, src, width);
+      dest[width + 1] = src[width - 1];
+    }
+
+  cogl_texture_set_region (slot->page->texture,
+                           0, 0, /* src_x/y */
+                           slot->x, slot->y, /* dst_x/y */
+                           padded_width, padded_height, /* dst_width/height */
+                           padded_width, padded_height, /* width/height */
+                           COGL_PIXEL_FORMAT_A_8,
+                           padded_width, buffer);
+
+  g_free (buffer);
+}
+
+/**
+ * meta_shadow_atlas_add:
+ * @atlas: a #MetaShadowAtlas
+ * @width: width of the image
+ * @height: height of the image
+ * @rowstride: rowstride of @data
+ * @data: the pixels of the image, in %COGL_PIXEL_FORMAT_A_8
+ *
+ * Finds space for an image in the atlas, allocating a new page if
+ * necessary, and uploads the image.
+ *
+ * Return value: a newly allocated slot, or %NULL if the image is too
+ *  large to be put into the atlas. Free with meta_shadow_atlas_slot_free()
+ */
+MetaShadowAtlasSlot *
+meta_shadow_atlas_add (MetaShadowAtlas *atlas,
+                       int              width,
+                       int              height,
+                       int              rowstride,
+                       const guchar    *data)
+{
+  MetaShadowAtlasSlot *slot;
+  MetaShadowAtlasPage *page = NULL;
+  MetaShadowAtlasShelf *shelf = NULL;
+  int padded_width = width + 2;
+  int padded_height = height + 2;
+  int x = 0;
+  GList *l;
+
+  if (width <= 0 || height <= 0 ||
+      padded_width > MAX_SLOT_SIZE || padded_height > MAX_SLOT_SIZE)
+    return NULL;
+
+  for (l = atlas->pages; l; l = l->next)
+    {
+      if (page_allocate (l->data, padded_width, padded_height, &shelf, &x))
+        {
+          page = l->data;
+          break;
+        }
+    }
+
+  if (page == NULL)
+    {
+      page = page_new (atlas);
+      atlas->pages = g_list_append (atlas->pages, page);
+
+      if (!page_allocate (page, padded_width, padded_height, &shelf, &x))
+        g_assert_not_reached ();
+    }
+
+  page->n_slots++;
+
+  slot = g_slice_new0 (MetaShadowAtlasSlot);
+  slot->page = page;
+  slot->shelf = shelf;
+  slot->x = x;
+  slot->y = shelf->y;
+  slot->width = padded_width;
+  slot->height = padded_height;
+
+  upload_slot (slot, width, height, rowstride, data);
+
+  return slot;
+}
+
+/**
+ * meta_shadow_atlas_slot_free:
+ * @slot: a #MetaShadowAtlasSlot
+ *
+ * Returns the space used by the slot to its page. Once a page is
+ * empty its texture is freed, unless it is the only page left in
+ * the atlas.
+ */
+void
+meta_shadow_atlas_slot_free (MetaShadowAtlasSlot *slot)
+{
+  MetaShadowAtlasPage *page = slot->page;
+  MetaShadowAtlas *atlas = page->atlas;
+
+  shelf_release (slot->shelf, slot->x, slot->width);
+  page_trim_shelves (page);
+  page->n_slots--;
+
+  g_slice_free (MetaShadowAtlasSlot, slot);
+
+  if (page->n_slots > 0)
+    return;
+
+  if (atlas == NULL)
+    {
+      page_free (page);
+    }
+  else if (atlas->pages->next != NULL)
+    {
+      atlas->pages = g_list_remove (atlas->pages, page);
+      page_free (page);
+    }
+}
+
+/**
+ * meta_shadow_atlas_slot_get_pipeline:
+ * @slot: a #MetaShadowAtlasSlot
+ * @opacity: opacity to paint with
+ *
+ * Gets a pipeline that draws from the page of the atlas holding the
+ * slot, with the color set to @opacity. The pipeline is shared with
+ * all other slots on the same page.
+ *
+ * Return value: (transfer none): the pipeline
+ */
+CoglPipeline *
+meta_shadow_atlas_slot_get_pipeline (MetaShadowAtlasSlot *slot,
+                                     guint8               opacity)
+{
+  MetaShadowAtlasPage *page = slot->page;
+
+  if (page->opacity_pipelines[opacity] == NULL)
+    {
+      CoglPipeline *pipeline = cogl_pipeline_copy (page->pipeline);
+
+      cogl_pipeline_set_color4ub (pipeline, opacity, opacity, opacity, opacity);
+      page->opacity_pipelines[opacity] = pipeline;
+    }
+
+  return page->opacity_pipelines[opacity];
+}
+
+/**
+ * meta_shadow_atlas_slot_get_coords:
+ * @slot: a #MetaShadowAtlasSlot
+ * @tx1: (out): texture coordinate of the left edge of the image
+ * @ty1: (out): texture coordinate of the top edge of the image
+ * @tx2: (out): texture coordinate of the right edge of the image
+ * @ty2: (out): texture coordinate of the bottom edge of the image
+ *
+ * Gets the normalized texture coordinates of the image within the
+ * page texture, not including the border.
+ */
+void
+meta_shadow_atlas_slot_get_coords (MetaShadowAtlasSlot *slot,
+                                   float               *tx1,
+                                   float               *ty1,
+                                   float               *tx2,
+                                   float               *ty2)
+{
+  *tx1 = (slot->x + 1) / (float) PAGE_SIZE;
+  *ty1 = (slot->y + 1) / (float) PAGE_SIZE;
+  *tx2 = (slot->x + slot->width - 1) / (float) PAGE_SIZE;
+  *ty2 = (slot->y + slot->height - 1) / (float) PAGE_SIZE;
+}
+
+/**
+ * meta_shadow_atlas_get_texture_size:
+ * @atlas: a #MetaShadowAtlas
+ *
+ * Return value: the number of bytes of texture memory used by the
+ *  pages of the atlas
+ */
+gsize
+meta_shadow_atlas_get_texture_size (MetaShadowAtlas *atlas)
+{
+  return (gsize) g_list_length (atlas->pages) * PAGE_SIZE * PAGE_SIZE;
+}
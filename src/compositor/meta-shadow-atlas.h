@@ -0,0 +1,68 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * MetaShadowAtlas
+ *
+ * Shared textures for packing many small shadow images
+ *
+ * Copyright 2010 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __META_SHADOW_ATLAS_H__
+#define __META_SHADOW_ATLAS_H__
+
+#include <clutter/clutter.h>
+
+G_BEGIN_DECLS
+
+/**
+ * SECTION:MetaShadowAtlas
+ * @short_description: shared textures for small shadow images
+ *
+ * A #MetaShadowAtlas packs the alpha-only images created by
+ * #MetaShadowFactory into a few large textures, so that drawing the
+ * shadows of many windows doesn't require a separate texture and
+ * pipeline for each of them. Each image is surrounded by a one pixel
+ * border that repeats its edge pixels, so that linear filtering at
+ * the edge of a stretched slice doesn't pick up its neighbours.
+ *
+ * Pages of the atlas are allocated as needed and freed once the last
+ * image on them is removed; a page also stays alive as long as it
+ * has images on it, even if the atlas itself is freed.
+ */
+
+typedef struct _MetaShadowAtlas     MetaShadowAtlas;
+typedef struct _MetaShadowAtlasSlot MetaShadowAtlasSlot;
+
+MetaShadowAtlas     *meta_shadow_atlas_new               (void);
+void                 meta_shadow_atlas_free              (MetaShadowAtlas     *atlas);
+MetaShadowAtlasSlot *meta_shadow_atlas_add               (MetaShadowAtlas     *atlas,
+                                                          int                  width,
+                                                          int                  height,
+                                                          int                  rowstride,
+                                                          const guchar        *data);
+void                 meta_shadow_atlas_slot_free         (MetaShadowAtlasSlot *slot);
+CoglPipeline        *meta_shadow_atlas_slot_get_pipeline (MetaShadowAtlasSlot *slot,
+                                                          guint8               opacity);
+void                 meta_shadow_atlas_slot_get_coords   (MetaShadowAtlasSlot *slot,
+                                                          float               *tx1,
+                                                          float               *ty1,
+                                                          float               *tx2,
+                                                          float               *ty2);
+gsize                meta_shadow_atlas_get_texture_size  (MetaShadowAtlas     *atlas);
+
+G_END_DECLS
+
+#endif /* __META_SHADOW_ATLAS_H__ */
@@ -63,4 +63,31 @@ MetaShadow *meta_shadow_factory_get_shadow (MetaShadowFactory *factory,
                                             const char        *class_name,
                                             gboolean           focused);
 
+/* The box blur that shadows are made with; the vectorized versions
+ * are tested against the scalar one */
+typedef enum
+{
+  META_SHADOW_BLUR_SCALAR,
+  META_SHADOW_BLUR_SSE2,
+  META_SHADOW_BLUR_AVX2
+} MetaShadowBlurImpl;
+
+gboolean meta_shadow_blur_impl_usable (MetaShadowBlurImpl  impl,
+                                       int                 buffer_width,
+                                       int                 buffer_height,
+                                       int                 d);
+guchar  *meta_shadow_flip_buffer      (MetaShadowBlurImpl  impl,
+                                       guchar             *buffer,
+                                       int                 width,
+                                       int                 height);
+guchar  *meta_shadow_blur_buffer      (MetaShadowBlurImpl  impl,
+                                       guchar             *buffer,
+                                       int                 buffer_width,
+                                       int                 buffer_height,
+                                       cairo_region_t     *row_convolve_region,
+                                       cairo_region_t     *column_convolve_region,
+                                       int                 x_offset,
+                                       int                 y_offset,
+                                       int                 d);
+
 #endif /* __META_SHADOW_FACTORY_PRIVATE_H__ */
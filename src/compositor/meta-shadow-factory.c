@@ -27,9 +27,15 @@
 #include <string.h>
 
 #include "cogl-utils.h"
+#include "meta-shadow-atlas.h"
 #include "meta-shadow-factory-private.h"
 #include "region-utils.h"
 
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define HAVE_SHADOW_SIMD 1
+#include <immintrin.h>
+#endif
+
 /* This file implements blurring the shape of a window to produce a
  * shadow texture. The details are discussed below; a quick summary
  * of the optimizations we use:
@@ -48,6 +54,13 @@
  *   in blocks, blur rows again, and then transpose back.
  *
  * - We approximate the 1D gaussian blur as 3 successive box filters.
+ *
+ * - Small shadow images are packed into a shared atlas, so that the
+ *   shadows of different windows are drawn from the same texture
+ *   with the same pipeline.
+ *
+ * - Where SSE2 or AVX2 is available, we blur many columns at once
+ *   using vector registers, and transpose using 16x16 blocks.
  */
 
 typedef struct _MetaShadowCacheKey  MetaShadowCacheKey;
@@ -66,8 +79,17 @@ struct _MetaShadow
 
   MetaShadowFactory *factory;
   MetaShadowCacheKey key;
+
+  /* Either atlas_slot is set, or texture and pipeline are */
+  MetaShadowAtlasSlot *atlas_slot;
   CoglTexture *texture;
   CoglPipeline *pipeline;
+  int texture_width;
+  int texture_height;
+
+  /* Link in the factory's queue of released shadows, while
+   * ref_count is 0 */
+  GList released_link;
 
   /* The outer order is the distance the shadow extends outside the window
    * shape; the inner border is the unscaled portion inside the window
@@ -83,6 +105,7 @@ struct _MetaShadow
 
   guint scale_width : 1;
   guint scale_height : 1;
+  guint cacheable : 1;
 };
 
 struct _MetaShadowClassInfo
@@ -100,8 +123,24 @@ struct _MetaShadowFactory
    * by the factory, they are simply removed from the table when freed */
   GHashTable *shadows;
 
+  /* Shadows in the table that are no longer referenced, most recently
+   * released first. They are freed starting from the tail when the
+   * size of their textures exceeds max_released_size. */
+  GQueue released;
+  gsize released_size;
+  gsize max_released_size;
+
+  /* Size of the shadow textures that are not in the atlas */
+  gsize texture_size;
+
+  guint n_hits;
+  guint n_revived;
+  guint n_misses;
+
   /* class name => MetaShadowClassInfo */
   GHashTable *shadow_classes;
+
+  MetaShadowAtlas *atlas;
 };
 
 struct _MetaShadowFactoryClass
@@ -118,6 +157,9 @@ enum
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
+/* Default limit for the texture memory of released shadows */
+#define DEFAULT_MAX_RELEASED_SIZE (4 * 1024 * 1024)
+
 /* The first element in this array also defines the default parameters
  * for newly created classes */
 MetaShadowClassInfo default_shadow_classes[] = {
@@ -163,24 +205,122 @@ meta_shadow_ref (MetaShadow *shadow)
   return shadow;
 }
 
+static gsize
+meta_shadow_get_texture_size (MetaShadow *shadow)
+{
+  return (gsize) shadow->texture_width * shadow->texture_height;
+}
+
+static void
+meta_shadow_free (MetaShadow *shadow)
+{
+  if (shadow->factory)
+    {
+      if (shadow->cacheable)
+        g_hash_table_remove (shadow->factory->shadows,
+                             &shadow->key);
+
+      if (!shadow->atlas_slot)
+        shadow->factory->texture_size -= meta_shadow_get_texture_size (shadow);
+    }
+
+  meta_window_shape_unref (shadow->key.shape);
+
+  if (shadow->atlas_slot)
+    {
+      meta_shadow_atlas_slot_free (shadow->atlas_slot);
+    }
+  else
+    {
+      cogl_object_unref (shadow->texture);
+      cogl_object_unref (shadow->pipeline);
+    }
+
+  g_slice_free (MetaShadow, shadow);
+}
+
+static void
+trim_released_shadows (MetaShadowFactory *factory)
+{
+  while (factory->released_size > factory->max_released_size)
+    {
+      GList *link = g_queue_pop_tail_link (&factory->released);
+      MetaShadow *shadow = link->data;
+
+      factory->released_size -= meta_shadow_get_texture_size (shadow);
+      meta_shadow_free (shadow);
+    }
+}
+
 void
 meta_shadow_unref (MetaShadow *shadow)
 {
   shadow->ref_count--;
   if (shadow->ref_count == 0)
     {
-      if (shadow->factory)
+      MetaShadowFactory *factory = shadow->factory;
+
+      /* Rather than freeing shadows that could be shared as soon as
+       * they are released, keep them around for a while, since the same
+       * shapes are frequently needed again soon, e.g. when windows are
+       * closed and reopened */
+      if (factory && shadow->cacheable)
         {
-          g_hash_table_remove (shadow->factory->shadows,
-                               &shadow->key);
+          g_queue_push_head_link (&factory->released, &shadow->released_link);
+          factory->released_size += meta_shadow_get_texture_size (shadow);
+          trim_released_shadows (factory);
         }
+      else
+        {
+          meta_shadow_free (shadow);
+        }
+    }
+}
 
-      meta_window_shape_unref (shadow->key.shape);
-      cogl_object_unref (shadow->texture);
-      cogl_object_unref (shadow->pipeline);
+#define MAX_BATCHED_RECTS 16
 
-      g_slice_free (MetaShadow, shadow);
-    }
+/* Rectangles to be drawn with a single call to
+ * cogl_rectangles_with_texture_coords() */
+typedef struct
+{
+  float coords[MAX_BATCHED_RECTS * 8];
+  int n_rects;
+} MetaShadowRectBatch;
+
+static void
+rect_batch_flush (MetaShadowRectBatch *batch)
+{
+  if (batch->n_rects > 0)
+    cogl_rectangles_with_texture_coords (batch->coords, batch->n_rects);
+
+  batch->n_rects = 0;
+}
+
+static void
+rect_batch_add (MetaShadowRectBatch *batch,
+                float                x1,
+                float                y1,
+                float                x2,
+                float                y2,
+                float                tx1,
+                float                ty1,
+                float                tx2,
+                float                ty2)
+{
+  float *v = batch->coords + 8 * batch->n_rects;
+
+  v[0] = x1;
+  v[1] = y1;
+  v[2] = x2;
+  v[3] = y2;
+  v[4] = tx1;
+  v[5] = ty1;
+  v[6] = tx2;
+  v[7] = ty2;
+
+  batch->n_rects++;
+  if (batch->n_rects == MAX_BATCHED_RECTS)
+    rect_batch_flush (batch);
 }
 
 /**
@@ -199,6 +339,9 @@ meta_shadow_unref (MetaShadow *shadow)
  * size of the region. (Since a #MetaShadow can be shared between
  * different sizes with the same extracted #MetaWindowShape the
  * size needs to be passed in here.)
+ *
+ * Shadows that are stored in the atlas of their factory and painted
+ * with the same opacity share a pipeline, so Cogl can batch them.
  */
 void
 meta_shadow_paint (MetaShadow     *shadow,
@@ -210,8 +353,11 @@ meta_shadow_paint (MetaShadow     *shadow,
                    cairo_region_t *clip,
                    gboolean        clip_strictly)
 {
-  float texture_width = cogl_texture_get_width (shadow->texture);
-  float texture_height = cogl_texture_get_height (shadow->texture);
+  float texture_width = shadow->texture_width;
+  float texture_height = shadow->texture_height;
+  float tx1 = 0., ty1 = 0., tx2 = 1., ty2 = 1.;
+  MetaShadowRectBatch batch;
+  CoglPipeline *pipeline;
   int i, j;
   float src_x[4];
   float src_y[4];
@@ -219,10 +365,23 @@ meta_shadow_paint (MetaShadow     *shadow,
   int dest_y[4];
   int n_x, n_y;
 
-  cogl_pipeline_set_color4ub (shadow->pipeline,
-                              opacity, opacity, opacity, opacity);
+  if (clip && cairo_region_is_empty (clip))
+    return;
 
-  cogl_set_source (shadow->pipeline);
+  if (shadow->atlas_slot)
+    {
+      pipeline = meta_shadow_atlas_slot_get_pipeline (shadow->atlas_slot, opacity);
+      meta_shadow_atlas_slot_get_coords (shadow->atlas_slot, &tx1, &ty1, &tx2, &ty2);
+    }
+  else
+    {
+      pipeline = shadow->pipeline;
+      cogl_pipeline_set_color4ub (pipeline,
+                                  opacity, opacity, opacity, opacity);
+    }
+
+  cogl_set_source (pipeline);
+  batch.n_rects = 0;
 
   if (shadow->scale_width)
     {
@@ -274,6 +433,12 @@ meta_shadow_paint (MetaShadow     *shadow,
       dest_y[1] = window_y + window_height + shadow->outer_border_bottom;
     }
 
+  /* Map to the part of the texture holding the shadow */
+  for (i = 0; i <= n_x; i++)
+    src_x[i] = tx1 + src_x[i] * (tx2 - tx1);
+  for (j = 0; j <= n_y; j++)
+    src_y[j] = ty1 + src_y[j] * (ty2 - ty1);
+
   for (j = 0; j < n_y; j++)
     {
       cairo_rectangle_int_t dest_rect;
@@ -307,10 +472,11 @@ meta_shadow_paint (MetaShadow     *shadow,
           if (overlap == CAIRO_REGION_OVERLAP_IN ||
               (overlap == CAIRO_REGION_OVERLAP_PART && !clip_strictly))
             {
-              cogl_rectangle_with_texture_coords (dest_x[i], dest_y[j],
-                                                  dest_x[i + 1], dest_y[j + 1],
-                                                  src_x[i], src_y[j],
-                                                  src_x[i + 1], src_y[j + 1]);
+              rect_batch_add (&batch,
+                              dest_x[i], dest_y[j],
+                              dest_x[i + 1], dest_y[j + 1],
+                              src_x[i], src_y[j],
+                              src_x[i + 1], src_y[j + 1]);
             }
           else if (overlap == CAIRO_REGION_OVERLAP_PART)
             {
@@ -341,15 +507,18 @@ meta_shadow_paint (MetaShadow     *shadow,
                   src_y2 = (src_y[j] * (dest_rect.y + dest_rect.height - (rect.y + rect.height)) +
                             src_y[j + 1] * (rect.y + rect.height - dest_rect.y)) / dest_rect.height;
 
-                  cogl_rectangle_with_texture_coords (rect.x, rect.y,
-                                                      rect.x + rect.width, rect.y + rect.height,
-                                                      src_x1, src_y1, src_x2, src_y2);
+                  rect_batch_add (&batch,
+                                  rect.x, rect.y,
+                                  rect.x + rect.width, rect.y + rect.height,
+                                  src_x1, src_y1, src_x2, src_y2);
                 }
 
               cairo_region_destroy (intersection);
             }
         }
     }
+
+  rect_batch_flush (&batch);
 }
 
 /**
@@ -397,6 +566,11 @@ meta_shadow_factory_init (MetaShadowFactory *factory)
                                                    NULL,
                                                    (GDestroyNotify)meta_shadow_class_info_free);
 
+  factory->atlas = meta_shadow_atlas_new ();
+
+  g_queue_init (&factory->released);
+  factory->max_released_size = DEFAULT_MAX_RELEASED_SIZE;
+
   for (i = 0; i < G_N_ELEMENTS (default_shadow_classes); i++)
     {
       MetaShadowClassInfo *class_info = g_slice_new (MetaShadowClassInfo);
@@ -415,6 +589,11 @@ meta_shadow_factory_finalize (GObject *object)
   MetaShadowFactory *factory = META_SHADOW_FACTORY (object);
   GHashTableIter iter;
   gpointer key, value;
+  GList *link;
+
+  /* Free the shadows that are only kept by us */
+  while ((link = g_queue_pop_head_link (&factory->released)) != NULL)
+    meta_shadow_free (link->data);
 
   /* Detach from the shadows in the table so we won't try to
    * remove them when they're freed. */
@@ -427,6 +606,7 @@ meta_shadow_factory_finalize (GObject *object)
 
   g_hash_table_destroy (factory->shadows);
   g_hash_table_destroy (factory->shadow_classes);
+  meta_shadow_atlas_free (factory->atlas);
 
   G_OBJECT_CLASS (meta_shadow_factory_parent_class)->finalize (object);
 }
@@ -541,10 +721,8 @@ blur_xspan (guchar *row,
    * be well predicted and there are enough different possibilities
    * that trying to write this as a series of unconditional loops
    * is hard and not an obvious win. The main slow down here seems
-   * to be the integer division per pixel; one possible optimization
-   * would be to accumulate into two 16-bit integer buffers and
-   * only divide down after all three passes. (SSE parallel implementation
-   * of the divide step is possible.)
+   * to be the integer division per pixel; blur_strip_sse2() replaces
+   * it with a multiplication.
    */
   for (i = x0 - d + offset; i < x1 + offset; i++)
     {
@@ -700,6 +878,620 @@ flip_buffer (guchar *buffer,
 #undef BLOCK_SIZE
 }
 
+/* The box blurs above are written for clarity and are the reference
+ * for the vectorized versions below. With SSE2 or AVX2 available we
+ * instead blur the columns of the image in place, a strip of 16 or 32
+ * columns at a time: the sliding window sums for all the columns in a
+ * strip live in 16-bit lanes of a vector register, and adding a row
+ * to or removing a row from the window is a single load and add. The
+ * horizontal blur is then done as a vertical blur of the transposed
+ * image. The division by d is replaced by a multiplication with a
+ * precomputed reciprocal that gives exactly the same result as the
+ * integer division for all the sums that can occur, so the output
+ * is identical to that of the scalar code.
+ */
+
+#ifdef HAVE_SHADOW_SIMD
+
+/* Largest filter width for which the window sum plus rounding term
+ * still fits into an unsigned 16-bit lane */
+#define MAX_SIMD_FILTER_SIZE 256
+
+typedef struct
+{
+  int multiplier;
+  int shift;
+} MetaBoxDivisor;
+
+/* Division of a 16-bit n by a constant d >= 2 as
+ *
+ *   t = (n * multiplier) >> 16
+ *   q = (t + ((n - t) >> 1)) >> shift
+ *
+ * which is exact for all 0 <= n < 65536; see Granlund and Montgomery,
+ * "Division by Invariant Integers using Multiplication".
+ */
+static void
+box_divisor_init (MetaBoxDivisor *divisor,
+                  int             d)
+{
+  int l = 0;
+
+  while ((1 << l) < d)
+    l++;
+
+  divisor->multiplier = (int)((((guint32)1 << 16) * (((guint32)1 << l) - d)) / d + 1);
+  divisor->shift = l - 1;
+}
+
+static gboolean
+cpu_supports_impl (MetaShadowBlurImpl impl)
+{
+  __builtin_cpu_init ();
+
+  switch (impl)
+    {
+    case META_SHADOW_BLUR_AVX2:
+      return __builtin_cpu_supports ("avx2");
+    case META_SHADOW_BLUR_SSE2:
+      return __builtin_cpu_supports ("sse2");
+    default:
+      return TRUE;
+    }
+}
+
+static MetaShadowBlurImpl
+get_blur_impl (void)
+{
+  static MetaShadowBlurImpl impl;
+  static gboolean initialized = FALSE;
+
+  if (!initialized)
+    {
+      impl = META_SHADOW_BLUR_SCALAR;
+
+      if (!g_getenv ("META_DISABLE_SHADOW_SIMD"))
+        {
+          if (cpu_supports_impl (META_SHADOW_BLUR_AVX2))
+            impl = META_SHADOW_BLUR_AVX2;
+          else if (cpu_supports_impl (META_SHADOW_BLUR_SSE2))
+            impl = META_SHADOW_BLUR_SSE2;
+        }
+
+      initialized = TRUE;
+    }
+
+  return impl;
+}
+
+static int
+get_strip_width (MetaShadowBlurImpl impl)
+{
+  return impl == META_SHADOW_BLUR_AVX2 ? 32 : 16;
+}
+
+/* One box blur pass over rows y0..y1 of a strip of 16 columns; this
+ * is the same sliding window as blur_xspan(), except that the window
+ * moves down and src and dst are separate buffers with the same
+ * contents outside of y0..y1.
+ */
+__attribute__ ((target ("sse2"))) static void
+blur_strip_sse2 (const guchar         *src,
+                 guchar               *dst,
+                 int                   n_rows,
+                 int                   y0,
+                 int                   y1,
+                 int                   d,
+                 int                   shift,
+                 const MetaBoxDivisor *divisor)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i round = _mm_set1_epi16 (d / 2);
+  const __m128i multiplier = _mm_set1_epi16 ((short) divisor->multiplier);
+  const __m128i shift_count = _mm_cvtsi32_si128 (divisor->shift);
+  __m128i sum_lo = zero;
+  __m128i sum_hi = zero;
+  int offset;
+  int i;
+
+  if (d % 2 == 1)
+    offset = d / 2;
+  else
+    offset = (d - shift) / 2;
+
+  for (i = y0 - d + offset; i < y1 + offset; i++)
+    {
+      if (i >= 0 && i < n_rows)
+        {
+          __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i * 16));
+
+          sum_lo = _mm_add_epi16 (sum_lo, _mm_unpacklo_epi8 (v, zero));
+          sum_hi = _mm_add_epi16 (sum_hi, _mm_unpackhi_epi8 (v, zero));
+        }
+
+      if (i >= y0 + offset)
+        {
+          __m128i n_lo, n_hi, t_lo, t_hi;
+
+          if (i >= d)
+            {
+              __m128i v = _mm_loadu_si128 ((const __m128i *) (src + (i - d) * 16));
+
+              sum_lo = _mm_sub_epi16 (sum_lo, _mm_unpacklo_epi8 (v, zero));
+              sum_hi = _mm_sub_epi16 (sum_hi, _mm_unpackhi_epi8 (v, zero));
+            }
+
+          n_lo = _mm_add_epi16 (sum_lo, round);
+          n_hi = _mm_add_epi16 (sum_hi, round);
+          t_lo = _mm_mulhi_epu16 (n_lo, multiplier);
+          t_hi = _mm_mulhi_epu16 (n_hi, multiplier);
+          t_lo = _mm_add_epi16 (t_lo, _mm_srli_epi16 (_mm_sub_epi16 (n_lo, t_lo), 1));
+          t_hi = _mm_add_epi16 (t_hi, _mm_srli_epi16 (_mm_sub_epi16 (n_hi, t_hi), 1));
+          t_lo = _mm_srl_epi16 (t_lo, shift_count);
+          t_hi = _mm_srl_epi16 (t_hi, shift_count);
+
+          _mm_storeu_si128 ((__m128i *) (dst + (i - offset) * 16),
+                            _mm_packus_epi16 (t_lo, t_hi));
+        }
+    }
+}
+
+/* As blur_strip_sse2(), for a strip of 32 columns. The unpack and
+ * pack instructions work within 128-bit lanes, so they undo each
+ * other and the column order is preserved.
+ */
+__attribute__ ((target ("avx2"))) static void
+blur_strip_avx2 (const guchar         *src,
+                 guchar               *dst,
+                 int                   n_rows,
+                 int                   y0,
+                 int                   y1,
+                 int                   d,
+                 int                   shift,
+                 const MetaBoxDivisor *divisor)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i round = _mm256_set1_epi16 (d / 2);
+  const __m256i multiplier = _mm256_set1_epi16 ((short) divisor->multiplier);
+  const __m128i shift_count = _mm_cvtsi32_si128 (divisor->shift);
+  __m256i sum_lo = zero;
+  __m256i sum_hi = zero;
+  int offset;
+  int i;
+
+  if (d % 2 == 1)
+    offset = d / 2;
+  else
+    offset = (d - shift) / 2;
+
+  for (i = y0 - d + offset; i < y1 + offset; i++)
+    {
+      if (i >= 0 && i < n_rows)
+        {
+          __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i * 32));
+
+          sum_lo = _mm256_add_epi16 (sum_lo, _mm256_unpacklo_epi8 (v, zero));
+          sum_hi = _mm256_add_epi16 (sum_hi, _mm256_unpackhi_epi8 (v, zero));
+        }
+
+      if (i >= y0 + offset)
+        {
+          __m256i n_lo, n_hi, t_lo, t_hi;
+
+          if (i >= d)
+            {
+              __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + (i - d) * 32));
+
+              sum_lo = _mm256_sub_epi16 (sum_lo, _mm256_unpacklo_epi8 (v, zero));
+              sum_hi = _mm256_sub_epi16 (sum_hi, _mm256_unpackhi_epi8 (v, zero));
+            }
+
+          n_lo = _mm256_add_epi16 (sum_lo, round);
+          n_hi = _mm256_add_epi16 (sum_hi, round);
+          t_lo = _mm256_mulhi_epu16 (n_lo, multiplier);
+          t_hi = _mm256_mulhi_epu16 (n_hi, multiplier);
+          t_lo = _mm256_add_epi16 (t_lo, _mm256_srli_epi16 (_mm256_sub_epi16 (n_lo, t_lo), 1));
+          t_hi = _mm256_add_epi16 (t_hi, _mm256_srli_epi16 (_mm256_sub_epi16 (n_hi, t_hi), 1));
+          t_lo = _mm256_srl_epi16 (t_lo, shift_count);
+          t_hi = _mm256_srl_epi16 (t_hi, shift_count);
+
+          _mm256_storeu_si256 ((__m256i *) (dst + (i - offset) * 32),
+                               _mm256_packus_epi16 (t_lo, t_hi));
+        }
+    }
+}
+
+static void
+blur_strip (MetaShadowBlurImpl    impl,
+            const guchar         *src,
+            guchar               *dst,
+            int                   n_rows,
+            int                   y0,
+            int                   y1,
+            int                   d,
+            int                   shift,
+            const MetaBoxDivisor *divisor)
+{
+  if (impl == META_SHADOW_BLUR_AVX2)
+    blur_strip_avx2 (src, dst, n_rows, y0, y1, d, shift, divisor);
+  else
+    blur_strip_sse2 (src, dst, n_rows, y0, y1, d, shift, divisor);
+}
+
+/* Blurs columns x0..x1 of the buffer between rows y0 and y1 with the
+ * same three passes as blur_rows(). Each strip of columns is copied into
+ * a contiguous scratch buffer so that the passes only touch
+ * strip_width * n_rows bytes. Strips that would run past the right edge
+ * of the buffer are moved left; the extra columns are computed but not
+ * copied back, so it doesn't matter that they may already be blurred.
+ */
+static void
+blur_column_span (MetaShadowBlurImpl  impl,
+                  guchar             *buffer,
+                  int                 buffer_width,
+                  int                 buffer_height,
+                  int                 x0,
+                  int                 x1,
+                  int                 y0,
+                  int                 y1,
+                  int                 d,
+                  guchar             *strip_a,
+                  guchar             *strip_b)
+{
+  int strip_width = get_strip_width (impl);
+  int row_start = MAX (0, y0 - d - 1);
+  int row_end = MIN (buffer_height, y1 + d + 1);
+  MetaBoxDivisor divisor, divisor_1;
+  int x;
+
+  box_divisor_init (&divisor, d);
+  box_divisor_init (&divisor_1, d + 1);
+
+  for (x = x0; x < x1; x += strip_width)
+    {
+      int strip_x = MIN (x, buffer_width - strip_width);
+      int copy_width = MIN (strip_width, x1 - x);
+      int j;
+
+      for (j = row_start; j < row_end; j++)
+        {
+          memcpy (strip_a + j * strip_width,
+                  buffer + j * buffer_width + strip_x, strip_width);
+          memcpy (strip_b + j * strip_width,
+                  buffer + j * buffer_width + strip_x, strip_width);
+        }
+
+      /* See blur_rows() for the choice of the three passes */
+      if (d % 2 == 1)
+        {
+          blur_strip (impl, strip_a, strip_b, buffer_height, y0, y1, d, 0, &divisor);
+          blur_strip (impl, strip_b, strip_a, buffer_height, y0, y1, d, 0, &divisor);
+          blur_strip (impl, strip_a, strip_b, buffer_height, y0, y1, d, 0, &divisor);
+        }
+      else
+        {
+          blur_strip (impl, strip_a, strip_b, buffer_height, y0, y1, d, 1, &divisor);
+          blur_strip (impl, strip_b, strip_a, buffer_height, y0, y1, d, -1, &divisor);
+          blur_strip (impl, strip_a, strip_b, buffer_height, y0, y1, d + 1, 0, &divisor_1);
+        }
+
+      for (j = y0; j < y1; j++)
+        memcpy (buffer + j * buffer_width + x,
+                strip_b + j * strip_width + (x - strip_x), copy_width);
+    }
+}
+
+/* Like blur_rows(), but blurs along the columns of the buffer, with
+ * the x and y coordinates of convolve_region interchanged; this is the
+ * same as flipping the buffer, calling blur_rows() and flipping back.
+ * The buffer must be at least get_strip_width() wide, and d + 1 must
+ * not be larger than MAX_SIMD_FILTER_SIZE.
+ */
+static void
+blur_columns (MetaShadowBlurImpl  impl,
+              cairo_region_t     *convolve_region,
+              int                 x_offset,
+              int                 y_offset,
+              guchar             *buffer,
+              int                 buffer_width,
+              int                 buffer_height,
+              int                 d)
+{
+  int strip_width = get_strip_width (impl);
+  guchar *strip_a;
+  guchar *strip_b;
+  int n_rectangles;
+  int i;
+
+  strip_a = g_malloc (2 * strip_width * buffer_height);
+  strip_b = strip_a + strip_width * buffer_height;
+
+  n_rectangles = cairo_region_num_rectangles (convolve_region);
+  for (i = 0; i < n_rectangles; i++)
+    {
+      cairo_rectangle_int_t rect;
+
+      cairo_region_get_rectangle (convolve_region, i, &rect);
+
+      blur_column_span (impl, buffer, buffer_width, buffer_height,
+                        y_offset + rect.y, y_offset + rect.y + rect.height,
+                        x_offset + rect.x, x_offset + rect.x + rect.width,
+                        d, strip_a, strip_b);
+    }
+
+  g_free (strip_a);
+}
+
+/* Transposes a 16x16 block of bytes with four rounds of interleaving,
+ * each of which doubles the size of the units that are in the right
+ * place. All loads happen before the first store, so src and dst may
+ * be the same block.
+ */
+__attribute__ ((target ("sse2"))) static void
+transpose_block_sse2 (const guchar *src,
+                      int           src_stride,
+                      guchar       *dst,
+                      int           dst_stride)
+{
+  __m128i a[16], b[16];
+  int k;
+
+  for (k = 0; k < 16; k++)
+    a[k] = _mm_loadu_si128 ((const __m128i *) (src + k * src_stride));
+
+  /* Pairs of rows, 8 columns of 2 bytes each */
+  for (k = 0; k < 8; k++)
+    {
+      b[2 * k] = _mm_unpacklo_epi8 (a[2 * k], a[2 * k + 1]);
+      b[2 * k + 1] = _mm_unpackhi_epi8 (a[2 * k], a[2 * k + 1]);
+    }
+
+  /* Groups of 4 rows, 4 columns of 4 bytes each */
+  for (k = 0; k < 4; k++)
+    {
+      a[4 * k] = _mm_unpacklo_epi16 (b[4 * k], b[4 * k + 2]);
+      a[4 * k + 1] = _mm_unpackhi_epi16 (b[4 * k], b[4 * k + 2]);
+      a[4 * k + 2] = _mm_unpacklo_epi16 (b[4 * k + 1], b[4 * k + 3]);
+      a[4 * k + 3] = _mm_unpackhi_epi16 (b[4 * k + 1], b[4 * k + 3]);
+    }
+
+  /* Groups of 8 rows, 2 columns of 8 bytes each */
+  for (k = 0; k < 4; k++)
+    {
+      b[2 * k] = _mm_unpacklo_epi32 (a[k], a[k + 4]);
+      b[2 * k + 1] = _mm_unpackhi_epi32 (a[k], a[k + 4]);
+      b[2 * k + 8] = _mm_unpacklo_epi32 (a[k + 8], a[k + 12]);
+      b[2 * k + 9] = _mm_unpackhi_epi32 (a[k + 8], a[k + 12]);
+    }
+
+  /* All 16 rows, one column each */
+  for (k = 0; k < 8; k++)
+    {
+      _mm_storeu_si128 ((__m128i *) (dst + (2 * k) * dst_stride),
+                        _mm_unpacklo_epi64 (b[k], b[k + 8]));
+      _mm_storeu_si128 ((__m128i *) (dst + (2 * k + 1) * dst_stride),
+                        _mm_unpackhi_epi64 (b[k], b[k + 8]));
+    }
+}
+
+/* A version of flip_buffer() that transposes whole 16x16 blocks with
+ * transpose_block_sse2(); partial blocks at the edges are done a byte
+ * at a time.
+ */
+static guchar *
+flip_buffer_simd (guchar *buffer,
+                  int     width,
+                  int     height)
+{
+#define BLOCK_SIZE 16
+
+  if (width == height)
+    {
+      guchar tmp_block[BLOCK_SIZE * BLOCK_SIZE];
+      int i0, j0;
+
+      for (j0 = 0; j0 < height; j0 += BLOCK_SIZE)
+        for (i0 = 0; i0 <= j0; i0 += BLOCK_SIZE)
+          {
+            int max_j = MIN(j0 + BLOCK_SIZE, height);
+            int max_i = MIN(i0 + BLOCK_SIZE, width);
+            int i, j;
+
+            if (max_j - j0 == BLOCK_SIZE && max_i - i0 == BLOCK_SIZE)
+              {
+                guchar *block = buffer + j0 * width + i0;
+                guchar *mirror = buffer + i0 * width + j0;
+
+                if (i0 == j0)
+                  {
+                    transpose_block_sse2 (block, width, block, width);
+                  }
+                else
+                  {
+                    transpose_block_sse2 (block, width, tmp_block, BLOCK_SIZE);
+                    transpose_block_sse2 (mirror, width, block, width);
+                    for (j = 0; j < BLOCK_SIZE; j++)
+                      memcpy (mirror + j * width, tmp_block + j * BLOCK_SIZE, BLOCK_SIZE);
+                  }
+              }
+            else
+              {
+                for (j = j0; j < max_j; j++)
+                  for (i = i0; i < (i0 == j0 ? j : max_i); i++)
+                    {
+                      guchar tmp = buffer[j * width + i];
+                      buffer[j * width + i] = buffer[i * width + j];
+                      buffer[i * width + j] = tmp;
+                    }
+              }
+          }
+
+      return buffer;
+    }
+  else
+    {
+      guchar *new_buffer = g_malloc (height * width);
+      int i0, j0;
+
+      for (i0 = 0; i0 < width; i0 += BLOCK_SIZE)
+        for (j0 = 0; j0 < height; j0 += BLOCK_SIZE)
+          {
+            int max_j = MIN(j0 + BLOCK_SIZE, height);
+            int max_i = MIN(i0 + BLOCK_SIZE, width);
+            int i, j;
+
+            if (max_j - j0 == BLOCK_SIZE && max_i - i0 == BLOCK_SIZE)
+              {
+                transpose_block_sse2 (buffer + j0 * width + i0, width,
+                                      new_buffer + i0 * height + j0, height);
+              }
+            else
+              {
+                for (i = i0; i < max_i; i++)
+                  for (j = j0; j < max_j; j++)
+                    new_buffer[i * height + j] = buffer[j * width + i];
+              }
+          }
+
+      g_free (buffer);
+
+      return new_buffer;
+    }
+#undef BLOCK_SIZE
+}
+
+#endif /* HAVE_SHADOW_SIMD */
+
+/**
+ * meta_shadow_blur_impl_usable:
+ * @impl: an implementation of the box blur
+ * @buffer_width: width of the buffer to blur
+ * @buffer_height: height of the buffer to blur
+ * @d: the box filter size
+ *
+ * The vectorized blur works on whole strips of columns, the window
+ * sums have to fit in 16 bits, and the division by d is only replaced
+ * by a multiplication for d >= 2; so it can only be used for some
+ * buffers and filter sizes, and only if the CPU supports the
+ * instructions.
+ *
+ * Return value: whether @impl can blur such a buffer
+ */
+gboolean
+meta_shadow_blur_impl_usable (MetaShadowBlurImpl impl,
+                              int                buffer_width,
+                              int                buffer_height,
+                              int                d)
+{
+  if (impl == META_SHADOW_BLUR_SCALAR)
+    return TRUE;
+
+#ifdef HAVE_SHADOW_SIMD
+  return (cpu_supports_impl (impl) &&
+          d >= 2 && d + 1 <= MAX_SIMD_FILTER_SIZE &&
+          MIN (buffer_width, buffer_height) >= get_strip_width (impl));
+#else
+  return FALSE;
+#endif
+}
+
+/**
+ * meta_shadow_flip_buffer:
+ * @impl: the implementation to use, which must be usable for the buffer
+ * @buffer: a buffer of @width by @height bytes
+ * @width: width of the buffer
+ * @height: height of the buffer
+ *
+ * Swaps the rows and columns of @buffer, see flip_buffer().
+ *
+ * Return value: the flipped buffer, which is either @buffer or a newly
+ *   allocated one, in which case @buffer has been freed
+ */
+guchar *
+meta_shadow_flip_buffer (MetaShadowBlurImpl impl,
+                         guchar            *buffer,
+                         int                width,
+                         int                height)
+{
+#ifdef HAVE_SHADOW_SIMD
+  if (impl != META_SHADOW_BLUR_SCALAR)
+    return flip_buffer_simd (buffer, width, height);
+#endif
+
+  return flip_buffer (buffer, width, height);
+}
+
+/**
+ * meta_shadow_blur_buffer:
+ * @impl: the implementation to use, which must be usable for the buffer
+ * @buffer: a buffer of @buffer_width by @buffer_height bytes
+ * @buffer_width: width of the buffer
+ * @buffer_height: height of the buffer
+ * @row_convolve_region: the area to blur horizontally
+ * @column_convolve_region: the area to blur vertically
+ * @x_offset: offset between the x coordinates of the regions and the buffer
+ * @y_offset: offset between the y coordinates of the regions and the buffer
+ * @d: the box filter size
+ *
+ * Blurs the columns, and then the rows of @buffer with three box
+ * filter passes each. All implementations give the same result.
+ *
+ * Return value: the blurred buffer, which is either @buffer or a newly
+ *   allocated one, in which case @buffer has been freed
+ */
+guchar *
+meta_shadow_blur_buffer (MetaShadowBlurImpl  impl,
+                         guchar             *buffer,
+                         int                 buffer_width,
+                         int                 buffer_height,
+                         cairo_region_t     *row_convolve_region,
+                         cairo_region_t     *column_convolve_region,
+                         int                 x_offset,
+                         int                 y_offset,
+                         int                 d)
+{
+  if (impl == META_SHADOW_BLUR_SCALAR)
+    {
+      /* Step 2: swap rows and columns */
+      buffer = flip_buffer (buffer, buffer_width, buffer_height);
+
+      /* Step 3: blur rows (really columns) */
+      blur_rows (column_convolve_region, y_offset, x_offset,
+                 buffer, buffer_height, buffer_width,
+                 d);
+
+      /* Step 4: swap rows and columns */
+      buffer = flip_buffer (buffer, buffer_height, buffer_width);
+
+      /* Step 5: blur rows */
+      blur_rows (row_convolve_region, x_offset, y_offset,
+                 buffer, buffer_width, buffer_height,
+                 d);
+    }
+#ifdef HAVE_SHADOW_SIMD
+  else
+    {
+      /* Step 2: blur columns, in place */
+      blur_columns (impl, column_convolve_region, y_offset, x_offset,
+                    buffer, buffer_width, buffer_height,
+                    d);
+
+      /* Step 3: swap rows and columns */
+      buffer = flip_buffer_simd (buffer, buffer_width, buffer_height);
+
+      /* Step 4: blur columns (really rows) */
+      blur_columns (impl, row_convolve_region, x_offset, y_offset,
+                    buffer, buffer_height, buffer_width,
+                    d);
+
+      /* Step 5: swap rows and columns */
+      buffer = flip_buffer_simd (buffer, buffer_height, buffer_width);
+    }
+#endif
+
+  return buffer;
+}
+
 static void
 make_shadow (MetaShadow     *shadow,
              cairo_region_t *region)
@@ -712,11 +1504,13 @@ make_shadow (MetaShadow     *shadow,
   cairo_region_t *row_convolve_region;
   cairo_region_t *column_convolve_region;
   guchar *buffer;
+  guchar *pixels;
   int buffer_width;
   int buffer_height;
   int x_offset;
   int y_offset;
   int n_rectangles, j, k;
+  MetaShadowBlurImpl impl = META_SHADOW_BLUR_SCALAR;
 
   cairo_region_get_extents (region, &extents);
 
@@ -746,6 +1540,12 @@ make_shadow (MetaShadow     *shadow,
 
   buffer = g_malloc0 (buffer_width * buffer_height);
 
+#ifdef HAVE_SHADOW_SIMD
+  impl = get_blur_impl ();
+#endif
+  if (!meta_shadow_blur_impl_usable (impl, buffer_width, buffer_height, d))
+    impl = META_SHADOW_BLUR_SCALAR;
+
   /* Blurring with multiple box-blur passes is fast, but (especially for
    * large shadow sizes) we can improve efficiency by restricting the blur
    * to the region that actually needs to be blurred.
@@ -768,21 +1568,10 @@ make_shadow (MetaShadow     *shadow,
         memset (buffer + buffer_width * j + x_offset + rect.x, 255, rect.width);
     }
 
-  /* Step 2: swap rows and columns */
-  buffer = flip_buffer (buffer, buffer_width, buffer_height);
-
-  /* Step 3: blur rows (really columns) */
-  blur_rows (column_convolve_region, y_offset, x_offset,
-             buffer, buffer_height, buffer_width,
-             d);
-
-  /* Step 4: swap rows and columns */
-  buffer = flip_buffer (buffer, buffer_height, buffer_width);
-
-  /* Step 5: blur rows */
-  blur_rows (row_convolve_region, x_offset, y_offset,
-             buffer, buffer_width, buffer_height,
-             d);
+  /* Steps 2 to 5: blur the columns and the rows */
+  buffer = meta_shadow_blur_buffer (impl, buffer, buffer_width, buffer_height,
+                                    row_convolve_region, column_convolve_region,
+                                    x_offset, y_offset, d);
 
   /* Step 6: fade out the top, if applicable */
   if (shadow->key.top_fade >= 0)
@@ -795,21 +1584,37 @@ make_shadow (MetaShadow     *shadow,
    * in the case of top_fade >= 0. We also account for padding at the left for symmetry
    * though that doesn't currently occur.
    */
-  shadow->texture = COGL_TEXTURE (cogl_texture_2d_new_from_data (ctx,
-                                                                 shadow->outer_border_left + extents.width + shadow->outer_border_right,
-                                                                 shadow->outer_border_top + extents.height + shadow->outer_border_bottom,
-                                                                 COGL_PIXEL_FORMAT_A_8,
-                                                                 buffer_width,
-                                                                 (buffer +
-                                                                  (y_offset - shadow->outer_border_top) * buffer_width +
-                                                                  (x_offset - shadow->outer_border_left)),
-                                                                 NULL));
+  shadow->texture_width = shadow->outer_border_left + extents.width + shadow->outer_border_right;
+  shadow->texture_height = shadow->outer_border_top + extents.height + shadow->outer_border_bottom;
+  pixels = (buffer +
+            (y_offset - shadow->outer_border_top) * buffer_width +
+            (x_offset - shadow->outer_border_left));
+
+  if (shadow->factory)
+    shadow->atlas_slot = meta_shadow_atlas_add (shadow->factory->atlas,
+                                                shadow->texture_width,
+                                                shadow->texture_height,
+                                                buffer_width, pixels);
+
+  /* Too large for the atlas */
+  if (shadow->atlas_slot == NULL)
+    {
+      shadow->texture = COGL_TEXTURE (cogl_texture_2d_new_from_data (ctx,
+                                                                     shadow->texture_width,
+                                                                     shadow->texture_height,
+                                                                     COGL_PIXEL_FORMAT_A_8,
+                                                                     buffer_width,
+                                                                     pixels,
+                                                                     NULL));
+      shadow->pipeline = meta_create_texture_pipeline (shadow->texture);
+
+      if (shadow->factory)
+        shadow->factory->texture_size += meta_shadow_get_texture_size (shadow);
+    }
 
   cairo_region_destroy (row_convolve_region);
   cairo_region_destroy (column_convolve_region);
   g_free (buffer);
-
-  shadow->pipeline = meta_create_texture_pipeline (shadow->texture);
 }
 
 static MetaShadowParams *
@@ -899,10 +1704,9 @@ meta_shadow_factory_get_shadow (MetaShadowFactory *factory,
    *
    * For smaller sizes, we create a separate shadow image for each size;
    * since we assume that there will be little reuse, we don't try to
-   * cache such images but just recreate them. (Since the current cache
-   * policy is to only keep around referenced shadows, there wouldn't
-   * be any harm in caching them, it would just make the book-keeping
-   * a bit tricker.)
+   * cache such images but just recreate them. (Keeping them around
+   * after they are released would mostly fill the cache of released
+   * shadows with sizes that are never used again.)
    *
    * In the case where we are fading a the top, that also has to fit
    * within the top unscaled border.
@@ -938,13 +1742,30 @@ meta_shadow_factory_get_shadow (MetaShadowFactory *factory,
 
       shadow = g_hash_table_lookup (factory->shadows, &key);
       if (shadow)
-        return meta_shadow_ref (shadow);
+        {
+          if (shadow->ref_count == 0)
+            {
+              g_queue_unlink (&factory->released, &shadow->released_link);
+              factory->released_size -= meta_shadow_get_texture_size (shadow);
+              factory->n_revived++;
+            }
+          else
+            {
+              factory->n_hits++;
+            }
+
+          return meta_shadow_ref (shadow);
+        }
+
+      factory->n_misses++;
     }
 
   shadow = g_slice_new0 (MetaShadow);
 
   shadow->ref_count = 1;
   shadow->factory = factory;
+  shadow->cacheable = cacheable;
+  shadow->released_link.data = shadow;
   shadow->key.shape = meta_window_shape_ref (shape);
   shadow->key.radius = params->radius;
   shadow->key.top_fade = params->top_fade;
@@ -1048,3 +1869,69 @@ meta_shadow_factory_get_params (MetaShadowFactory *factory,
   if (params)
     *params = *stored_params;
 }
+
+/**
+ * meta_shadow_factory_set_max_released_size:
+ * @factory: a #MetaShadowFactory
+ * @max_size: maximum size in bytes
+ *
+ * Shadows that are no longer used are kept around so they can be
+ * reused without being recomputed if a window with the same shape
+ * appears again. This sets a limit for the texture memory used by
+ * such shadows; the least recently released ones are freed first.
+ * A limit of 0 frees shadows as soon as they are no longer used.
+ */
+void
+meta_shadow_factory_set_max_released_size (MetaShadowFactory *factory,
+                                           gsize              max_size)
+{
+  g_return_if_fail (META_IS_SHADOW_FACTORY (factory));
+
+  factory->max_released_size = max_size;
+  trim_released_shadows (factory);
+}
+
+/**
+ * meta_shadow_factory_get_texture_memory:
+ * @factory: a #MetaShadowFactory
+ *
+ * Gets the amount of texture memory currently used for the shadows
+ * of @factory, including the shadows that are kept around after being
+ * released.
+ *
+ * Return value: the size in bytes
+ */
+gsize
+meta_shadow_factory_get_texture_memory (MetaShadowFactory *factory)
+{
+  g_return_val_if_fail (META_IS_SHADOW_FACTORY (factory), 0);
+
+  return factory->texture_size + meta_shadow_atlas_get_texture_size (factory->atlas);
+}
+
+/**
+ * meta_shadow_factory_get_cache_stats:
+ * @factory: a #MetaShadowFactory
+ * @n_hits: (out) (allow-none): number of lookups that found a shadow in use
+ * @n_revived: (out) (allow-none): number of lookups that found a released shadow
+ * @n_misses: (out) (allow-none): number of lookups that had to create a shadow
+ *
+ * Gets counters for the lookups of shadows that can be shared between
+ * windows. Shadows for windows that are too small to share a shadow
+ * are always created from scratch and are not counted.
+ */
+void
+meta_shadow_factory_get_cache_stats (MetaShadowFactory *factory,
+                                     guint             *n_hits,
+                                     guint             *n_revived,
+                                     guint             *n_misses)
+{
+  g_return_if_fail (META_IS_SHADOW_FACTORY (factory));
+
+  if (n_hits)
+    *n_hits = factory->n_hits;
+  if (n_revived)
+    *n_revived = factory->n_revived;
+  if (n_misses)
+    *n_misses = factory->n_misses;
+}
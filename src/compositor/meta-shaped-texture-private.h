@@ -34,4 +34,25 @@ void meta_shaped_texture_set_texture (MetaShapedTexture *stex,
                                       CoglTexture       *texture);
 gboolean meta_shaped_texture_is_obscured (MetaShapedTexture *self);
 
+typedef struct {
+  CoglTexture *texture;
+  guint first_rect;
+  guint n_rects;
+} MetaOpaqueBatchRun;
+
+/* Opaque rectangles of several shaped textures, drawn in one go by
+ * MetaWindowGroup; coords holds 8 floats per rectangle, in the layout
+ * of cogl_framebuffer_draw_textured_rectangles() */
+typedef struct {
+  GArray *runs;
+  GArray *coords;
+} MetaOpaqueBatch;
+
+gboolean meta_shaped_texture_add_to_batch (MetaShapedTexture *stex,
+                                           int                x_offset,
+                                           int                y_offset,
+                                           MetaOpaqueBatch   *batch);
+void     meta_opaque_batch_paint          (MetaOpaqueBatch   *batch,
+                                           CoglFramebuffer   *fb);
+
 #endif
@@ -37,6 +37,7 @@
 #include "meta-texture-tower.h"
 
 #include "meta-cullable.h"
+#include "meta-output-repaint.h"
 
 
 static void meta_shaped_texture_dispose  (GObject    *object);
@@ -88,6 +89,10 @@ struct _MetaShapedTexturePrivate
 
   guint create_mipmaps : 1;
 
+  /* Set by meta_shaped_texture_add_to_batch() until culling is reset */
+  guint opaque_batched : 1;
+  guint clip_strictly : 1;
+
 // stuff for shader:
 
   gint blur_pixel_step_uniform;
@@ -391,7 +396,13 @@ meta_shaped_texture_paint (ClutterActor *actor)
    * support for TFP textures will result in fallbacks to XGetImage.
    */
   if (priv->create_mipmaps)
-    paint_tex = meta_texture_tower_get_paint_texture (priv->paint_tower);
+    {
+      paint_tex = meta_texture_tower_get_paint_texture (priv->paint_tower);
+
+      /* Keep painting until the scaled down texture is up to date */
+      if (meta_texture_tower_is_updating (priv->paint_tower))
+        clutter_actor_queue_redraw (actor);
+    }
   else
     paint_tex = COGL_TEXTURE (priv->texture);
 
@@ -443,10 +454,11 @@ meta_shaped_texture_paint (ClutterActor *actor)
     }
 
   /* Limit to how many separate rectangles we'll draw; beyond this just
-   * fall back and draw the whole thing */
+   * fall back and draw the whole thing. That isn't possible when the
+   * window group already drew things above us ahead of time. */
 #define MAX_RECTS 16
 
-  if (blended_region != NULL)
+  if (blended_region != NULL && !priv->clip_strictly)
     {
       int n_rects = cairo_region_num_rectangles (blended_region);
       if (n_rects > MAX_RECTS)
@@ -459,8 +471,9 @@ meta_shaped_texture_paint (ClutterActor *actor)
         }
     }
 
-  /* First, paint the unblended parts, which are part of the opaque region. */
-  if (use_opaque_region)
+  /* First, paint the unblended parts, which are part of the opaque region,
+   * unless the window group already drew them in a batch. */
+  if (use_opaque_region && !priv->opaque_batched)
     {
       CoglPipeline *opaque_pipeline;
       cairo_region_t *region;
@@ -721,6 +734,34 @@ meta_shaped_texture_is_obscured (MetaShapedTexture *self)
     return FALSE;
 }
 
+/* Queues a redraw of @clip, and routes the damage to the outputs it
+ * falls on, in stage coordinates */
+static void
+queue_damage_redraw (MetaShapedTexture     *stex,
+                     cairo_rectangle_int_t *clip)
+{
+  ClutterActor *actor = CLUTTER_ACTOR (stex);
+  cairo_rectangle_int_t stage_rect = *clip;
+  int x_origin, y_origin;
+
+  if (meta_actor_is_untransformed (actor, &x_origin, &y_origin))
+    {
+      stage_rect.x += x_origin;
+      stage_rect.y += y_origin;
+    }
+  else
+    {
+      gfloat actor_x, actor_y;
+
+      clutter_actor_get_transformed_position (actor, &actor_x, &actor_y);
+      stage_rect.x += (int) actor_x;
+      stage_rect.y += (int) actor_y;
+    }
+
+  meta_output_repaint_add_damage (&stage_rect);
+  clutter_actor_queue_redraw_with_clip (actor, clip);
+}
+
 /**
  * meta_shaped_texture_update_area:
  * @stex: #MetaShapedTexture
@@ -767,7 +808,7 @@ meta_shaped_texture_update_area (MetaShapedTexture *stex,
         {
           cairo_rectangle_int_t damage_rect;
           cairo_region_get_extents (intersection, &damage_rect);
-          clutter_actor_queue_redraw_with_clip (CLUTTER_ACTOR (stex), &damage_rect);
+          queue_damage_redraw (stex, &damage_rect);
           cairo_region_destroy (intersection);
           return TRUE;
         }
@@ -777,7 +818,7 @@ meta_shaped_texture_update_area (MetaShapedTexture *stex,
     }
   else
     {
-      clutter_actor_queue_redraw_with_clip (CLUTTER_ACTOR (stex), &clip);
+      queue_damage_redraw (stex, &clip);
       return TRUE;
     }
 }
@@ -830,6 +871,10 @@ meta_shaped_texture_set_opaque_region (MetaShapedTexture *stex,
 
   priv = stex->priv;
 
+  /* Clients tend to set the same region over and over */
+  if (!cairo_region_equal (priv->opaque_region, opaque_region))
+    meta_cullable_invalidate_culling ();
+
   if (priv->opaque_region)
     cairo_region_destroy (priv->opaque_region);
 
@@ -965,7 +1010,12 @@ static void
 meta_shaped_texture_reset_culling (MetaCullable *cullable)
 {
   MetaShapedTexture *self = META_SHAPED_TEXTURE (cullable);
+  MetaShapedTexturePrivate *priv = self->priv;
+
   set_clip_region (self, NULL);
+
+  priv->opaque_batched = FALSE;
+  priv->clip_strictly = FALSE;
 }
 
 static void
@@ -975,6 +1025,139 @@ cullable_iface_init (MetaCullableInterface *iface)
   iface->reset_culling = meta_shaped_texture_reset_culling;
 }
 
+/**
+ * meta_shaped_texture_add_to_batch:
+ * @stex: a #MetaShapedTexture that has been culled
+ * @x_offset: x position of @stex in the coordinates the batch is drawn in
+ * @y_offset: y position of @stex in the coordinates the batch is drawn in
+ * @batch: a #MetaOpaqueBatch
+ *
+ * Called by #MetaWindowGroup between culling and painting, for each
+ * texture from the bottom of the stack up. The visible part of the
+ * opaque region is added to @batch, and the texture's own paint will
+ * skip it. Since the batch is drawn before anything else, the texture
+ * is also told to never draw outside of its clip region, even if that
+ * means drawing a lot of rectangles.
+ *
+ * Return value: %FALSE if the paint of @stex can't be limited to its
+ *   clip region, in which case nothing above it may be added to @batch.
+ */
+gboolean
+meta_shaped_texture_add_to_batch (MetaShapedTexture *stex,
+                                  int                x_offset,
+                                  int                y_offset,
+                                  MetaOpaqueBatch   *batch)
+{
+  MetaShapedTexturePrivate *priv = stex->priv;
+  MetaOpaqueBatchRun run;
+  CoglTexture *paint_tex;
+  ClutterActorBox alloc;
+  cairo_region_t *region;
+  float width, height;
+  int n_rects;
+  int i;
+
+  if (priv->clip_region == NULL)
+    return FALSE;
+
+  priv->clip_strictly = TRUE;
+
+  if (priv->opaque_region == NULL ||
+      cairo_region_is_empty (priv->clip_region) ||
+      clutter_actor_get_paint_opacity (CLUTTER_ACTOR (stex)) != 0xff)
+    return TRUE;
+
+  /* Painting untransformed, so this is the unscaled texture */
+  if (priv->create_mipmaps)
+    paint_tex = meta_texture_tower_get_paint_texture (priv->paint_tower);
+  else
+    paint_tex = COGL_TEXTURE (priv->texture);
+
+  if (paint_tex == NULL || priv->tex_width == 0 || priv->tex_height == 0)
+    return TRUE;
+
+  region = cairo_region_copy (priv->clip_region);
+  cairo_region_intersect (region, priv->opaque_region);
+
+  clutter_actor_get_allocation_box (CLUTTER_ACTOR (stex), &alloc);
+  width = alloc.x2 - alloc.x1;
+  height = alloc.y2 - alloc.y1;
+
+  run.texture = paint_tex;
+  run.first_rect = batch->coords->len / 8;
+  run.n_rects = n_rects = cairo_region_num_rectangles (region);
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+      float coords[8];
+
+      cairo_region_get_rectangle (region, i, &rect);
+
+      coords[0] = x_offset + rect.x;
+      coords[1] = y_offset + rect.y;
+      coords[2] = x_offset + rect.x + rect.width;
+      coords[3] = y_offset + rect.y + rect.height;
+      coords[4] = rect.x / width;
+      coords[5] = rect.y / height;
+      coords[6] = (rect.x + rect.width) / width;
+      coords[7] = (rect.y + rect.height) / height;
+
+      g_array_append_vals (batch->coords, coords, 8);
+    }
+
+  cairo_region_destroy (region);
+
+  if (n_rects > 0)
+    g_array_append_val (batch->runs, run);
+
+  priv->opaque_batched = TRUE;
+
+  return TRUE;
+}
+
+/**
+ * meta_opaque_batch_paint:
+ * @batch: a #MetaOpaqueBatch
+ * @fb: the framebuffer to draw to
+ *
+ * Draws the rectangles collected by meta_shaped_texture_add_to_batch().
+ * All of them use copies of the same unblended pipeline template, and
+ * the rectangles of each texture are drawn with a single call, so Cogl
+ * can put them into a single batch in its journal.
+ */
+void
+meta_opaque_batch_paint (MetaOpaqueBatch *batch,
+                         CoglFramebuffer *fb)
+{
+  CoglContext *ctx;
+  guint i;
+
+  if (batch->runs->len == 0)
+    return;
+
+  ctx = clutter_backend_get_cogl_context (clutter_get_default_backend ());
+
+  for (i = 0; i < batch->runs->len; i++)
+    {
+      MetaOpaqueBatchRun *run = &g_array_index (batch->runs, MetaOpaqueBatchRun, i);
+      CoglPipeline *pipeline;
+
+      pipeline = get_unblended_pipeline (ctx);
+      cogl_pipeline_set_layer_texture (pipeline, 0, run->texture);
+      cogl_pipeline_set_layer_filters (pipeline, 0,
+                                       COGL_PIPELINE_FILTER_NEAREST,
+                                       COGL_PIPELINE_FILTER_NEAREST);
+
+      cogl_framebuffer_draw_textured_rectangles (fb, pipeline,
+                                                 &g_array_index (batch->coords, float,
+                                                                 run->first_rect * 8),
+                                                 run->n_rects);
+
+      cogl_object_unref (pipeline);
+    }
+}
+
 ClutterActor *
 meta_shaped_texture_new (void)
 {
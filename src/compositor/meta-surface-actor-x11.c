@@ -34,6 +34,7 @@
 #include "window-private.h"
 #include "meta-shaped-texture-private.h"
 #include "meta-cullable.h"
+#include "meta-unredirect-policy.h"
 #include "x11/window-x11.h"
 
 struct _MetaSurfaceActorX11Private
@@ -50,8 +51,7 @@ struct _MetaSurfaceActorX11Private
   int last_height;
 
   /* This is used to detect fullscreen windows that need to be unredirected */
-  guint full_damage_frames_count;
-  guint does_full_damage  : 1;
+  MetaUnredirectPolicy *unredirect_policy;
 
   /* Other state... */
   guint received_damage : 1;
@@ -188,21 +188,40 @@ meta_surface_actor_x11_process_damage (MetaSurfaceActor *actor,
 
   priv->received_damage = TRUE;
 
-  if (meta_window_is_fullscreen (priv->window) && !priv->unredirected && !priv->does_full_damage)
+  if (meta_window_is_monitor_sized (priv->window))
     {
       MetaRectangle window_rect;
+      MetaRectangle damage_rect = { x, y, width, height };
+      MetaRectangle covered;
+      float coverage = 0;
+
+      /* Damage is relative to the window */
       meta_window_get_frame_rect (priv->window, &window_rect);
+      window_rect.x = window_rect.y = 0;
+
+      if (window_rect.width > 0 && window_rect.height > 0 &&
+          meta_rectangle_intersect (&window_rect, &damage_rect, &covered))
+        coverage = (float) meta_rectangle_area (&covered) / meta_rectangle_area (&window_rect);
+
+      meta_unredirect_policy_add_damage (priv->unredirect_policy,
+                                         g_get_monotonic_time (), coverage);
+    }
+  else
+    {
+      meta_unredirect_policy_reset (priv->unredirect_policy);
+    }
 
-      if (window_rect.x == x &&
-          window_rect.y == y &&
-          window_rect.width == width &&
-          window_rect.height == height)
-        priv->full_damage_frames_count++;
-      else
-        priv->full_damage_frames_count = 0;
+  if (priv->unredirected)
+    {
+      MetaDisplay *display = priv->display;
 
-      if (priv->full_damage_frames_count >= 100)
-        priv->does_full_damage = TRUE;
+      /* Nothing repaints us to subtract the damage in pre-paint, and we
+       * want to hear about the next frame to know whether to stay
+       * unredirected */
+      meta_error_trap_push (display);
+      XDamageSubtract (meta_display_get_xdisplay (display), priv->damage, None, None);
+      meta_error_trap_pop (display);
+      priv->received_damage = FALSE;
     }
 
   if (!is_visible (self))
@@ -267,10 +286,8 @@ meta_surface_actor_x11_should_unredirect (MetaSurfaceActor *actor)
   if (meta_window_is_override_redirect (window))
     return TRUE;
 
-  if (priv->does_full_damage)
-    return TRUE;
-
-  return FALSE;
+  return meta_unredirect_policy_wants_unredirect (priv->unredirect_policy,
+                                                  g_get_monotonic_time ());
 }
 
 static void
@@ -302,12 +319,27 @@ meta_surface_actor_x11_set_unredirected (MetaSurfaceActor *actor,
 {
   MetaSurfaceActorX11 *self = META_SURFACE_ACTOR_X11 (actor);
   MetaSurfaceActorX11Private *priv = meta_surface_actor_x11_get_instance_private (self);
+  MetaUnredirectStats stats;
 
   if (priv->unredirected == unredirected)
     return;
 
   priv->unredirected = unredirected;
   sync_unredirected (self);
+
+  meta_unredirect_policy_set_unredirected (priv->unredirect_policy, unredirected,
+                                           g_get_monotonic_time ());
+
+  meta_unredirect_policy_get_stats (priv->unredirect_policy,
+                                    g_get_monotonic_time (), &stats);
+  meta_topic (META_DEBUG_COMPOSITOR,
+              "%s %s: %.0f damage events/s covering %.0f%%, "
+              "unredirected %u and redirected %u times, for %.1fs\n",
+              unredirected ? "Unredirecting" : "Redirecting",
+              priv->window->desc,
+              stats.damage_rate, stats.coverage * 100,
+              stats.n_unredirects, stats.n_redirects,
+              stats.unredirected_time / (double) G_USEC_PER_SEC);
 }
 
 static gboolean
@@ -330,6 +362,17 @@ meta_surface_actor_x11_dispose (GObject *object)
   G_OBJECT_CLASS (meta_surface_actor_x11_parent_class)->dispose (object);
 }
 
+static void
+meta_surface_actor_x11_finalize (GObject *object)
+{
+  MetaSurfaceActorX11 *self = META_SURFACE_ACTOR_X11 (object);
+  MetaSurfaceActorX11Private *priv = meta_surface_actor_x11_get_instance_private (self);
+
+  meta_unredirect_policy_free (priv->unredirect_policy);
+
+  G_OBJECT_CLASS (meta_surface_actor_x11_parent_class)->finalize (object);
+}
+
 static MetaWindow *
 meta_surface_actor_x11_get_window (MetaSurfaceActor *actor)
 {
@@ -345,6 +388,7 @@ meta_surface_actor_x11_class_init (MetaSurfaceActorX11Class *klass)
   MetaSurfaceActorClass *surface_actor_class = META_SURFACE_ACTOR_CLASS (klass);
 
   object_class->dispose = meta_surface_actor_x11_dispose;
+  object_class->finalize = meta_surface_actor_x11_finalize;
 
   surface_actor_class->process_damage = meta_surface_actor_x11_process_damage;
   surface_actor_class->pre_paint = meta_surface_actor_x11_pre_paint;
@@ -364,6 +408,7 @@ meta_surface_actor_x11_init (MetaSurfaceActorX11 *self)
 
   priv->last_width = -1;
   priv->last_height = -1;
+  priv->unredirect_policy = meta_unredirect_policy_new ();
 }
 
 static void
@@ -61,8 +61,62 @@ struct _MetaTextureTower
   CoglOffscreen *fbos[MAX_TEXTURE_LEVELS];
   Box invalid[MAX_TEXTURE_LEVELS];
   CoglPipeline *pipeline_template;
+
+  /* With a frame budget set, levels are redrawn into back_textures a band
+   * at a time, and swapped with textures once completely redrawn; until
+   * then the old contents of textures are painted. */
+  CoglTexture *back_textures[MAX_TEXTURE_LEVELS];
+  CoglOffscreen *back_fbos[MAX_TEXTURE_LEVELS];
+  /* Area of the back texture being redrawn, and how far we've got */
+  Box rebuild[MAX_TEXTURE_LEVELS];
+  int rebuild_y[MAX_TEXTURE_LEVELS];
+  /* Area where the back texture is older than the front texture */
+  Box stale[MAX_TEXTURE_LEVELS];
+
+  /* Whether the last texture returned for painting was out of date */
+  gboolean painted_stale;
+
+  MetaTextureTowerStats stats;
 };
 
+/* Number of pixels of all towers that may be redrawn per frame; 0 means
+ * that levels are brought up to date completely when painted. */
+static int frame_budget = 0;
+static int frame_budget_remaining = 0;
+
+static gboolean
+box_is_empty (Box *box)
+{
+  return box->x1 == box->x2 || box->y1 == box->y2;
+}
+
+static void
+box_union (Box *dest,
+           Box *src)
+{
+  if (box_is_empty (src))
+    return;
+
+  if (box_is_empty (dest))
+    {
+      *dest = *src;
+    }
+  else
+    {
+      dest->x1 = MIN (dest->x1, src->x1);
+      dest->y1 = MIN (dest->y1, src->y1);
+      dest->x2 = MAX (dest->x2, src->x2);
+      dest->y2 = MAX (dest->y2, src->y2);
+    }
+}
+
+static void
+box_clear (Box *box)
+{
+  box->x1 = box->x2 = 0;
+  box->y1 = box->y2 = 0;
+}
+
 /**
  * meta_texture_tower_new:
  *
@@ -136,6 +190,21 @@ meta_texture_tower_set_base_texture (MetaTextureTower *tower,
               cogl_object_unref (tower->fbos[i]);
               tower->fbos[i] = NULL;
             }
+
+          if (tower->back_textures[i] != NULL)
+            {
+              cogl_object_unref (tower->back_textures[i]);
+              tower->back_textures[i] = NULL;
+            }
+
+          if (tower->back_fbos[i] != NULL)
+            {
+              cogl_object_unref (tower->back_fbos[i]);
+              tower->back_fbos[i] = NULL;
+            }
+
+          box_clear (&tower->rebuild[i]);
+          box_clear (&tower->stale[i]);
         }
 
       cogl_object_unref (tower->textures[0]);
@@ -209,18 +278,7 @@ meta_texture_tower_update_area (MetaTextureTower *tower,
       invalid.x2 = MIN (texture_width, (invalid.x2 + 1) / 2);
       invalid.y2 = MIN (texture_height, (invalid.y2 + 1) / 2);
 
-      if (tower->invalid[i].x1 == tower->invalid[i].x2 ||
-          tower->invalid[i].y1 == tower->invalid[i].y2)
-        {
-          tower->invalid[i] = invalid;
-        }
-      else
-        {
-          tower->invalid[i].x1 = MIN (tower->invalid[i].x1, invalid.x1);
-          tower->invalid[i].y1 = MIN (tower->invalid[i].y1, invalid.y1);
-          tower->invalid[i].x2 = MAX (tower->invalid[i].x2, invalid.x2);
-          tower->invalid[i].y2 = MAX (tower->invalid[i].y2, invalid.y2);
-        }
+      box_union (&tower->invalid[i], &invalid);
     }
 }
 
@@ -350,7 +408,7 @@ is_power_of_two (int x)
   return (x & (x - 1)) == 0;
 }
 
-static void
+static CoglTexture *
 texture_tower_create_texture (MetaTextureTower *tower,
                               int               level,
                               int               width,
@@ -362,45 +420,43 @@ texture_tower_create_texture (MetaTextureTower *tower,
       ClutterBackend *backend = clutter_get_default_backend ();
       CoglContext *context = clutter_backend_get_cogl_context (backend);
 
-      tower->textures[level] = cogl_texture_rectangle_new_with_size (context, width, height);
+      return cogl_texture_rectangle_new_with_size (context, width, height);
     }
   else
     {
-      tower->textures[level] = cogl_texture_new_with_size (width, height,
-                                                           COGL_TEXTURE_NO_AUTO_MIPMAP,
-                                                           TEXTURE_FORMAT);
+      return cogl_texture_new_with_size (width, height,
+                                         COGL_TEXTURE_NO_AUTO_MIPMAP,
+                                         TEXTURE_FORMAT);
     }
-
-  tower->invalid[level].x1 = 0;
-  tower->invalid[level].y1 = 0;
-  tower->invalid[level].x2 = width;
-  tower->invalid[level].y2 = height;
 }
 
-static void
-texture_tower_revalidate (MetaTextureTower *tower,
-                          int               level)
+/* Draws the given area of dest_texture, which is a texture for @level,
+ * from the texture for the level above */
+static gboolean
+texture_tower_draw_area (MetaTextureTower  *tower,
+                         int                level,
+                         CoglTexture       *dest_texture,
+                         CoglOffscreen    **fbo,
+                         Box               *area)
 {
   CoglTexture *source_texture = tower->textures[level - 1];
   int source_texture_width = cogl_texture_get_width (source_texture);
   int source_texture_height = cogl_texture_get_height (source_texture);
-  CoglTexture *dest_texture = tower->textures[level];
   int dest_texture_width = cogl_texture_get_width (dest_texture);
   int dest_texture_height = cogl_texture_get_height (dest_texture);
-  Box *invalid = &tower->invalid[level];
   CoglFramebuffer *fb;
   CoglError *catch_error = NULL;
   CoglPipeline *pipeline;
 
-  if (tower->fbos[level] == NULL)
-    tower->fbos[level] = cogl_offscreen_new_with_texture (dest_texture);
+  if (*fbo == NULL)
+    *fbo = cogl_offscreen_new_with_texture (dest_texture);
 
-  fb = COGL_FRAMEBUFFER (tower->fbos[level]);
+  fb = COGL_FRAMEBUFFER (*fbo);
 
   if (!cogl_framebuffer_allocate (fb, &catch_error))
     {
       cogl_error_free (catch_error);
-      return;
+      return FALSE;
     }
 
   cogl_framebuffer_orthographic (fb, 0, 0, dest_texture_width, dest_texture_height, -1., 1.);
@@ -417,17 +473,113 @@ texture_tower_revalidate (MetaTextureTower *tower,
   cogl_pipeline_set_layer_texture (pipeline, 0, tower->textures[level - 1]);
 
   cogl_framebuffer_draw_textured_rectangle (fb, pipeline,
-                                            invalid->x1, invalid->y1,
-                                            invalid->x2, invalid->y2,
-                                            (2. * invalid->x1) / source_texture_width,
-                                            (2. * invalid->y1) / source_texture_height,
-                                            (2. * invalid->x2) / source_texture_width,
-                                            (2. * invalid->y2) / source_texture_height);
+                                            area->x1, area->y1,
+                                            area->x2, area->y2,
+                                            (2. * area->x1) / source_texture_width,
+                                            (2. * area->y1) / source_texture_height,
+                                            (2. * area->x2) / source_texture_width,
+                                            (2. * area->y2) / source_texture_height);
 
   cogl_object_unref (pipeline);
 
-  tower->invalid[level].x1 = tower->invalid[level].x2 = 0;
-  tower->invalid[level].y1 = tower->invalid[level].y2 = 0;
+  tower->stats.n_passes++;
+  tower->stats.n_pixels_drawn += (guint64) (area->x2 - area->x1) * (area->y2 - area->y1);
+
+  return TRUE;
+}
+
+static void
+texture_tower_revalidate (MetaTextureTower *tower,
+                          int               level)
+{
+  if (texture_tower_draw_area (tower, level,
+                               tower->textures[level], &tower->fbos[level],
+                               &tower->invalid[level]))
+    {
+      box_clear (&tower->invalid[level]);
+      tower->stats.n_rebuilds++;
+    }
+}
+
+/* Continues redrawing @level into its back texture, within what's left
+ * of the frame budget, and swaps it to the front once done.
+ *
+ * Returns: %TRUE if the front texture for the level is up to date
+ */
+static gboolean
+texture_tower_revalidate_incremental (MetaTextureTower *tower,
+                                      int               level,
+                                      int               width,
+                                      int               height)
+{
+  Box *rebuild = &tower->rebuild[level];
+  CoglTexture *tmp_texture;
+  CoglOffscreen *tmp_fbo;
+
+  if (box_is_empty (rebuild))
+    {
+      if (tower->textures[level] != NULL && box_is_empty (&tower->invalid[level]))
+        return TRUE;
+
+      if (frame_budget_remaining <= 0)
+        return FALSE;
+
+      if (tower->back_textures[level] == NULL)
+        {
+          tower->back_textures[level] = texture_tower_create_texture (tower, level, width, height);
+          rebuild->x1 = 0;
+          rebuild->y1 = 0;
+          rebuild->x2 = width;
+          rebuild->y2 = height;
+        }
+      else
+        {
+          *rebuild = tower->invalid[level];
+          box_union (rebuild, &tower->stale[level]);
+        }
+
+      box_clear (&tower->invalid[level]);
+      box_clear (&tower->stale[level]);
+      tower->rebuild_y[level] = rebuild->y1;
+    }
+
+  while (tower->rebuild_y[level] < rebuild->y2 && frame_budget_remaining > 0)
+    {
+      int rebuild_width = rebuild->x2 - rebuild->x1;
+      int n_rows = MAX (1, frame_budget_remaining / rebuild_width);
+      Box band;
+
+      band.x1 = rebuild->x1;
+      band.x2 = rebuild->x2;
+      band.y1 = tower->rebuild_y[level];
+      band.y2 = MIN (rebuild->y2, band.y1 + n_rows);
+
+      if (!texture_tower_draw_area (tower, level,
+                                    tower->back_textures[level], &tower->back_fbos[level],
+                                    &band))
+        return FALSE;
+
+      frame_budget_remaining -= rebuild_width * (band.y2 - band.y1);
+      tower->rebuild_y[level] = band.y2;
+    }
+
+  if (tower->rebuild_y[level] < rebuild->y2)
+    return FALSE;
+
+  tmp_texture = tower->textures[level];
+  tmp_fbo = tower->fbos[level];
+  tower->textures[level] = tower->back_textures[level];
+  tower->fbos[level] = tower->back_fbos[level];
+  tower->back_textures[level] = tmp_texture;
+  tower->back_fbos[level] = tmp_fbo;
+
+  /* The old front texture doesn't have what we just drew */
+  tower->stale[level] = *rebuild;
+  box_clear (rebuild);
+
+  tower->stats.n_rebuilds++;
+
+  return box_is_empty (&tower->invalid[level]);
 }
 
 /**
@@ -462,6 +614,36 @@ meta_texture_tower_get_paint_texture (MetaTextureTower *tower)
     return NULL;
   level = MIN (level, tower->n_levels - 1);
 
+  if (frame_budget > 0)
+    {
+      int target_level = level;
+      int i;
+
+      for (i = 1; i <= target_level; i++)
+        {
+          texture_width = MAX (1, texture_width / 2);
+          texture_height = MAX (1, texture_height / 2);
+
+          if (!texture_tower_revalidate_incremental (tower, i, texture_width, texture_height))
+            break;
+        }
+
+      /* Until the level has been drawn for the first time, use the
+       * closest larger level that we have */
+      while (level > 0 && tower->textures[level] == NULL)
+        level--;
+
+      tower->painted_stale = (level != target_level ||
+                              !box_is_empty (&tower->invalid[level]) ||
+                              !box_is_empty (&tower->rebuild[level]));
+      if (tower->painted_stale)
+        tower->stats.n_stale_paints++;
+
+      return tower->textures[level];
+    }
+
+  tower->painted_stale = FALSE;
+
   if (tower->textures[level] == NULL ||
       (tower->invalid[level].x2 != tower->invalid[level].x1 &&
        tower->invalid[level].y2 != tower->invalid[level].y1))
@@ -475,7 +657,12 @@ meta_texture_tower_get_paint_texture (MetaTextureTower *tower)
          texture_height = MAX (1, texture_height / 2);
 
          if (tower->textures[i] == NULL)
-           texture_tower_create_texture (tower, i, texture_width, texture_height);
+           {
+             Box all = { 0, 0, texture_width, texture_height };
+
+             tower->textures[i] = texture_tower_create_texture (tower, i, texture_width, texture_height);
+             tower->invalid[i] = all;
+           }
        }
 
       for (i = 1; i <= level; i++)
@@ -488,3 +675,71 @@ meta_texture_tower_get_paint_texture (MetaTextureTower *tower)
 
   return tower->textures[level];
 }
+
+/**
+ * meta_texture_tower_is_updating:
+ * @tower: a #MetaTextureTower
+ *
+ * Checks whether the texture returned by the last call to
+ * meta_texture_tower_get_paint_texture() was out of date because the
+ * frame budget ran out; if so, the caller should paint again so that
+ * the update can continue.
+ *
+ * Return value: %TRUE if there's more work to do
+ */
+gboolean
+meta_texture_tower_is_updating (MetaTextureTower *tower)
+{
+  g_return_val_if_fail (tower != NULL, FALSE);
+
+  return tower->painted_stale;
+}
+
+/**
+ * meta_texture_tower_get_stats:
+ * @tower: a #MetaTextureTower
+ * @stats: (out caller-allocates): location to store the statistics
+ *
+ * Gets counters of the work done to keep the levels of the tower
+ * up to date.
+ */
+void
+meta_texture_tower_get_stats (MetaTextureTower      *tower,
+                              MetaTextureTowerStats *stats)
+{
+  g_return_if_fail (tower != NULL);
+
+  *stats = tower->stats;
+}
+
+/**
+ * meta_texture_tower_set_frame_budget:
+ * @n_pixels: number of pixels that may be redrawn per frame, or 0
+ *
+ * Sets how much work all towers together may do per frame to bring
+ * scaled down levels up to date. With a budget, levels are redrawn
+ * incrementally over several frames, and the previous contents of a
+ * level are painted until it has been redrawn completely. A budget
+ * of 0, the default, redraws levels completely when they are painted.
+ *
+ * The budget is in pixels rather than time, since the actual drawing
+ * happens asynchronously on the GPU.
+ */
+void
+meta_texture_tower_set_frame_budget (int n_pixels)
+{
+  frame_budget = MAX (0, n_pixels);
+  frame_budget_remaining = frame_budget;
+}
+
+/**
+ * meta_texture_tower_begin_frame:
+ *
+ * Resets the frame budget set with meta_texture_tower_set_frame_budget();
+ * this should be called once before painting each frame.
+ */
+void
+meta_texture_tower_begin_frame (void)
+{
+  frame_budget_remaining = frame_budget;
+}
@@ -51,6 +51,22 @@ G_BEGIN_DECLS
 
 typedef struct _MetaTextureTower MetaTextureTower;
 
+/**
+ * MetaTextureTowerStats:
+ * @n_rebuilds: number of times a level was brought completely up to date
+ * @n_passes: number of draws into levels
+ * @n_stale_paints: number of times an out of date level, or a larger level
+ *  than the one wanted, was returned for painting
+ * @n_pixels_drawn: total number of pixels drawn into levels
+ */
+typedef struct
+{
+  guint n_rebuilds;
+  guint n_passes;
+  guint n_stale_paints;
+  guint64 n_pixels_drawn;
+} MetaTextureTowerStats;
+
 MetaTextureTower *meta_texture_tower_new               (void);
 void              meta_texture_tower_free              (MetaTextureTower *tower);
 void              meta_texture_tower_set_base_texture  (MetaTextureTower *tower,
@@ -61,6 +77,12 @@ void              meta_texture_tower_update_area       (MetaTextureTower *tower,
                                                         int               width,
                                                         int               height);
 CoglTexture      *meta_texture_tower_get_paint_texture (MetaTextureTower *tower);
+gboolean          meta_texture_tower_is_updating       (MetaTextureTower *tower);
+void              meta_texture_tower_get_stats         (MetaTextureTower      *tower,
+                                                        MetaTextureTowerStats *stats);
+
+void              meta_texture_tower_set_frame_budget  (int               n_pixels);
+void              meta_texture_tower_begin_frame       (void);
 
 G_BEGIN_DECLS
 
@@ -0,0 +1,309 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * MetaUnredirectPolicy
+ *
+ * Deciding when a window is worth unredirecting
+ *
+ * Copyright 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A monitor-sized window that redraws most of itself many times a
+ * second - a game or a video player - is cheaper to show unredirected
+ * than to composite. We look at the damage it reported over the last
+ * second: how often it reported damage, and how much of the window
+ * each report covered on average.
+ *
+ * To keep windows from flapping in and out of unredirection, the
+ * thresholds for unredirecting are higher than for going back, and a
+ * window stays in either state for a while before it can change
+ * again. A window that stops drawing altogether stays unredirected,
+ * since leaving it so costs nothing.
+ */
+
+#include <config.h>
+
+#include "meta-unredirect-policy.h"
+
+/* The sliding window of time we look at */
+#define SAMPLE_WINDOW G_USEC_PER_SEC
+
+/* If a window sends more damage events than this in SAMPLE_WINDOW,
+ * the oldest ones are forgotten early; that still leaves the rate
+ * high enough to count as busy */
+#define MAX_SAMPLES 128
+
+#define UNREDIRECT_MIN_RATE     20.0
+#define UNREDIRECT_MIN_COVERAGE 0.8
+
+#define REDIRECT_MIN_RATE       10.0
+#define REDIRECT_MAX_COVERAGE   0.4
+
+/* How long a window stays in a state before the damage can change it */
+#define MIN_STATE_TIME (2 * G_USEC_PER_SEC)
+
+typedef struct
+{
+  gint64 time;
+  float coverage;
+} DamageSample;
+
+struct _MetaUnredirectPolicy
+{
+  DamageSample samples[MAX_SAMPLES];
+  guint first_sample;
+  guint n_samples;
+
+  /* When we started looking at the damage of the window */
+  gint64 observed_since;
+
+  gboolean wants_unredirect;
+  gint64 last_change_time;
+
+  gboolean unredirected;
+  gint64 unredirected_since;
+
+  guint n_unredirects;
+  guint n_redirects;
+  gint64 unredirected_time;
+};
+
+/* Totals over all windows, for monitoring. The windows unredirected
+ * right now have been so for n_unredirected * now -
+ * unredirected_since_sum in all. */
+static guint total_unredirects;
+static guint total_redirects;
+static gint64 total_unredirected_time;
+static guint n_unredirected;
+static gint64 unredirected_since_sum;
+
+MetaUnredirectPolicy *
+meta_unredirect_policy_new (void)
+{
+  return g_slice_new0 (MetaUnredirectPolicy);
+}
+
+void
+meta_unredirect_policy_free (MetaUnredirectPolicy *policy)
+{
+  /* A window that goes away unredirected isn't redirected, but its
+   * time stops counting */
+  if (policy->unredirected)
+    {
+      total_unredirected_time += g_get_monotonic_time () - policy->unredirected_since;
+      n_unredirected--;
+      unredirected_since_sum -= policy->unredirected_since;
+    }
+
+  g_slice_free (MetaUnredirectPolicy, policy);
+}
+
+/**
+ * meta_unredirect_policy_add_damage:
+ * @policy: a #MetaUnredirectPolicy
+ * @time: when the damage was reported, from g_get_monotonic_time()
+ * @coverage: the fraction of the window that was damaged, 0 to 1
+ *
+ * Records a damage event of the window.
+ */
+void
+meta_unredirect_policy_add_damage (MetaUnredirectPolicy *policy,
+                                   gint64                time,
+                                   float                 coverage)
+{
+  DamageSample *sample;
+
+  if (policy->n_samples == MAX_SAMPLES)
+    {
+      policy->first_sample = (policy->first_sample + 1) % MAX_SAMPLES;
+      policy->n_samples--;
+    }
+
+  sample = &policy->samples[(policy->first_sample + policy->n_samples) % MAX_SAMPLES];
+  sample->time = time;
+  sample->coverage = CLAMP (coverage, 0.0, 1.0);
+  policy->n_samples++;
+
+  if (policy->observed_since == 0)
+    policy->observed_since = time;
+}
+
+/**
+ * meta_unredirect_policy_reset:
+ * @policy: a #MetaUnredirectPolicy
+ *
+ * Forgets the damage seen so far; used when the window stops being
+ * a candidate for unredirection, so that it has to prove itself again
+ * once it is one.
+ */
+void
+meta_unredirect_policy_reset (MetaUnredirectPolicy *policy)
+{
+  policy->first_sample = 0;
+  policy->n_samples = 0;
+  policy->observed_since = 0;
+  policy->wants_unredirect = FALSE;
+}
+
+static void
+expire_samples (MetaUnredirectPolicy *policy,
+                gint64                now)
+{
+  while (policy->n_samples > 0 &&
+         policy->samples[policy->first_sample].time < now - SAMPLE_WINDOW)
+    {
+      policy->first_sample = (policy->first_sample + 1) % MAX_SAMPLES;
+      policy->n_samples--;
+    }
+}
+
+static void
+compute_damage (MetaUnredirectPolicy *policy,
+                gint64                now,
+                float                *rate,
+                float                *coverage)
+{
+  float total = 0;
+  guint i;
+
+  expire_samples (policy, now);
+
+  for (i = 0; i < policy->n_samples; i++)
+    total += policy->samples[(policy->first_sample + i) % MAX_SAMPLES].coverage;
+
+  *rate = policy->n_samples * (float) G_USEC_PER_SEC / SAMPLE_WINDOW;
+  *coverage = policy->n_samples > 0 ? total / policy->n_samples : 0;
+}
+
+/**
+ * meta_unredirect_policy_wants_unredirect:
+ * @policy: a #MetaUnredirectPolicy
+ * @now: the current time, from g_get_monotonic_time()
+ *
+ * Return value: %TRUE if the damage of the window makes it worth
+ *   unredirecting
+ */
+gboolean
+meta_unredirect_policy_wants_unredirect (MetaUnredirectPolicy *policy,
+                                         gint64                now)
+{
+  float rate, coverage;
+
+  if (now - policy->last_change_time < MIN_STATE_TIME)
+    return policy->wants_unredirect;
+
+  compute_damage (policy, now, &rate, &coverage);
+
+  if (!policy->wants_unredirect)
+    {
+      if (policy->observed_since != 0 &&
+          now - policy->observed_since >= SAMPLE_WINDOW &&
+          rate >= UNREDIRECT_MIN_RATE &&
+          coverage >= UNREDIRECT_MIN_COVERAGE)
+        {
+          policy->wants_unredirect = TRUE;
+          policy->last_change_time = now;
+        }
+    }
+  else
+    {
+      if (rate >= REDIRECT_MIN_RATE &&
+          coverage < REDIRECT_MAX_COVERAGE)
+        {
+          policy->wants_unredirect = FALSE;
+          policy->last_change_time = now;
+        }
+    }
+
+  return policy->wants_unredirect;
+}
+
+/**
+ * meta_unredirect_policy_set_unredirected:
+ * @policy: a #MetaUnredirectPolicy
+ * @unredirected: whether the window is now unredirected
+ * @now: the current time, from g_get_monotonic_time()
+ *
+ * Tells @policy about the state of the window, for the statistics.
+ */
+void
+meta_unredirect_policy_set_unredirected (MetaUnredirectPolicy *policy,
+                                         gboolean              unredirected,
+                                         gint64                now)
+{
+  unredirected = unredirected != FALSE;
+
+  if (policy->unredirected == unredirected)
+    return;
+
+  policy->unredirected = unredirected;
+
+  if (unredirected)
+    {
+      policy->n_unredirects++;
+      policy->unredirected_since = now;
+
+      total_unredirects++;
+      n_unredirected++;
+      unredirected_since_sum += now;
+    }
+  else
+    {
+      policy->n_redirects++;
+      policy->unredirected_time += now - policy->unredirected_since;
+
+      total_redirects++;
+      total_unredirected_time += now - policy->unredirected_since;
+      n_unredirected--;
+      unredirected_since_sum -= policy->unredirected_since;
+    }
+}
+
+/**
+ * meta_unredirect_policy_get_stats:
+ * @policy: (allow-none): a #MetaUnredirectPolicy, or %NULL
+ * @now: the current time, from g_get_monotonic_time()
+ * @stats: (out): where to store the statistics
+ *
+ * Gets how often the window of @policy was unredirected and redirected
+ * again, how long it spent unredirected, and its recent damage. If
+ * @policy is %NULL, the counts and time are totals over all windows
+ * since the compositor started, and the damage is left at 0.
+ */
+void
+meta_unredirect_policy_get_stats (MetaUnredirectPolicy *policy,
+                                  gint64                now,
+                                  MetaUnredirectStats  *stats)
+{
+  if (policy == NULL)
+    {
+      stats->n_unredirects = total_unredirects;
+      stats->n_redirects = total_redirects;
+      stats->unredirected_time = (total_unredirected_time +
+                                  n_unredirected * now - unredirected_since_sum);
+      stats->damage_rate = 0;
+      stats->coverage = 0;
+      return;
+    }
+
+  stats->n_unredirects = policy->n_unredirects;
+  stats->n_redirects = policy->n_redirects;
+  stats->unredirected_time = policy->unredirected_time;
+  if (policy->unredirected)
+    stats->unredirected_time += now - policy->unredirected_since;
+
+  compute_damage (policy, now, &stats->damage_rate, &stats->coverage);
+}
@@ -0,0 +1,71 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * MetaUnredirectPolicy
+ *
+ * Deciding when a window is worth unredirecting
+ *
+ * Copyright 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __META_UNREDIRECT_POLICY_H__
+#define __META_UNREDIRECT_POLICY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _MetaUnredirectPolicy MetaUnredirectPolicy;
+
+/**
+ * MetaUnredirectStats:
+ * @n_unredirects: how many times the window was unredirected
+ * @n_redirects: how many times it was redirected again
+ * @unredirected_time: total time the window spent unredirected, in
+ *   microseconds
+ * @damage_rate: damage events per second over the last window of time
+ * @coverage: average fraction of the window covered by those events
+ *
+ * Statistics kept for each window by #MetaUnredirectPolicy, and over
+ * all windows; see meta_unredirect_policy_get_stats().
+ */
+typedef struct
+{
+  guint n_unredirects;
+  guint n_redirects;
+  gint64 unredirected_time;
+  float damage_rate;
+  float coverage;
+} MetaUnredirectStats;
+
+MetaUnredirectPolicy *meta_unredirect_policy_new               (void);
+void                  meta_unredirect_policy_free              (MetaUnredirectPolicy *policy);
+
+void                  meta_unredirect_policy_add_damage        (MetaUnredirectPolicy *policy,
+                                                                gint64                time,
+                                                                float                 coverage);
+void                  meta_unredirect_policy_reset             (MetaUnredirectPolicy *policy);
+gboolean              meta_unredirect_policy_wants_unredirect  (MetaUnredirectPolicy *policy,
+                                                                gint64                now);
+void                  meta_unredirect_policy_set_unredirected  (MetaUnredirectPolicy *policy,
+                                                                gboolean              unredirected,
+                                                                gint64                now);
+void                  meta_unredirect_policy_get_stats         (MetaUnredirectPolicy *policy,
+                                                                gint64                now,
+                                                                MetaUnredirectStats  *stats);
+
+G_END_DECLS
+
+#endif /* __META_UNREDIRECT_POLICY_H__ */
@@ -33,9 +33,16 @@ void meta_window_actor_post_paint     (MetaWindowActor    *self);
 void meta_window_actor_frame_complete (MetaWindowActor    *self,
                                        CoglFrameInfo      *frame_info,
                                        gint64              presentation_time);
+gint64 meta_window_actor_send_queued_frame_messages (MetaWindowActor *self,
+                                                     gint64           deadline,
+                                                     gint             refresh_interval);
 
 void meta_window_actor_invalidate_shadow (MetaWindowActor *self);
 
+void meta_window_actor_get_blur_cache_stats (MetaWindowActor *self,
+                                             guint           *hits,
+                                             guint           *misses);
+
 void meta_window_actor_get_shape_bounds (MetaWindowActor       *self,
                                           cairo_rectangle_int_t *bounds);
 
@@ -17,6 +17,7 @@
 
 #include <meta/display.h>
 #include <meta/errors.h>
+#include <meta/prefs.h>
 #include "frame.h"
 #include <meta/window.h>
 #include <meta/meta-shaped-texture.h>
@@ -25,10 +26,11 @@
 #include "meta-shaped-texture-private.h"
 #include "meta-shadow-factory-private.h"
 #include "meta-blur-factory.h"
+#include "meta-frame-timings.h"
+#include "meta-output-repaint.h"
 #include "meta-window-actor-private.h"
 #include "meta-texture-rectangle.h"
 #include "region-utils.h"
-#include "meta-monitor-manager.h"
 #include "meta-cullable.h"
 
 #include "meta-surface-actor.h"
@@ -71,12 +73,18 @@ struct _MetaWindowActorPrivate
   cairo_region_t   *shape_region;
   /* The region we should clip to when painting the shadow */
   cairo_region_t   *shadow_clip;
+  /* The same, without the stage clip applied; the blurred backdrop is
+   * computed for it so that it doesn't change with every redraw */
+  cairo_region_t   *shadow_visible;
 
   /* Extracted size-invariant shape used for shadows */
   MetaWindowShape  *shadow_shape;
   char *            shadow_class;
 
-  guint             send_frame_messages_timer;
+  /* When the frame messages of the window, obscured when it drew its
+   * last frame, are due to be sent by the compositor; 0 if none are
+   * queued */
+  gint64            frame_messages_due;
   gint64            frame_drawn_time;
 
   guint             repaint_scheduled_id;
@@ -452,19 +460,17 @@ meta_window_actor_dispose (GObject *object)
 
   priv->disposed = TRUE;
 
-  if (priv->send_frame_messages_timer != 0)
-    {
-      g_source_remove (priv->send_frame_messages_timer);
-      priv->send_frame_messages_timer = 0;
-    }
+  priv->frame_messages_due = 0;
 
   g_clear_pointer (&priv->shape_region, cairo_region_destroy);
   g_clear_pointer (&priv->shadow_clip, cairo_region_destroy);
+  g_clear_pointer (&priv->shadow_visible, cairo_region_destroy);
 
   g_clear_pointer (&priv->shadow_class, g_free);
   g_clear_pointer (&priv->focused_shadow, meta_shadow_unref);
   g_clear_pointer (&priv->unfocused_shadow, meta_shadow_unref);
   g_clear_pointer (&priv->shadow_shape, meta_window_shape_unref);
+  g_clear_object (&priv->blur);
 
   compositor->windows = g_list_remove (compositor->windows, (gconstpointer) self);
 
@@ -666,21 +672,28 @@ meta_window_actor_paint (ClutterActor *actor)
   gboolean appears_focused = meta_window_appears_focused (priv->window);
   MetaShadow *shadow = appears_focused ? priv->focused_shadow : priv->unfocused_shadow;
   MetaBlur *blur = priv->blur;
- /* This window got damage when obscured; we set up a timer
-  * to send frame completion events, but since we're drawing
-  * the window now (for some other reason) cancel the timer
-  * and send the completion events normally */
-  if (priv->send_frame_messages_timer != 0)
+ /* This window got damage when obscured; we queued its frame
+  * completion events with the compositor, but since we're drawing
+  * the window now (for some other reason) take them back and send
+  * the completion events normally */
+  priv->frame_messages_due = 0;
+
+  /* An empty visible region means windows above cover all of the
+   * shadow and the backdrop; don't even set them up. The backdrop can
+   * change unseen until we are visible again, though. */
+  if (shadow != NULL &&
+      priv->shadow_visible && cairo_region_is_empty (priv->shadow_visible))
     {
-      g_source_remove (priv->send_frame_messages_timer);
-      priv->send_frame_messages_timer = 0;
+      meta_blur_invalidate (blur);
     }
-
-  if (shadow != NULL)
+  else if (shadow != NULL)
     {
       MetaShadowParams params;
       cairo_rectangle_int_t shape_bounds;
+      cairo_rectangle_int_t stage_damage, blur_redraw;
       cairo_region_t *clip = priv->shadow_clip;
+      cairo_region_t *visible = priv->shadow_visible;
+      ClutterActor *stage = clutter_actor_get_stage (actor);
       MetaWindow *window = priv->window;
 
       meta_window_actor_get_shape_bounds (self, &shape_bounds);
@@ -700,25 +713,45 @@ meta_window_actor_paint (ClutterActor *actor)
           cairo_region_subtract (clip, frame_bounds);
         }
 
-      meta_shadow_paint (shadow,
-                         params.x_offset + shape_bounds.x,
-                         params.y_offset + shape_bounds.y,
-                         shape_bounds.width,
-                         shape_bounds.height,
-                         (clutter_actor_get_paint_opacity (actor) * params.opacity * window->opacity) / (255 * 255),
-                         clip,
-                         clip_shadow_under_window (self)); /* clip_strictly - not just as an optimization */
-      meta_blur_paint(
-        blur,
-        params.x_offset + shape_bounds.x,
-        params.y_offset + shape_bounds.y,
-        shape_bounds.width,
-        shape_bounds.height,
-        255,
-        clip,
-        TRUE
-      );
+      if (visible == NULL)
+        visible = clip;
+
+      /* An empty clip means nothing of the shadow is in the stage clip */
+      if (!(clip && cairo_region_is_empty (clip)))
+        {
+          meta_frame_timings_begin_phase (META_FRAME_PHASE_SHADOWS);
+          meta_shadow_paint (shadow,
+                             params.x_offset + shape_bounds.x,
+                             params.y_offset + shape_bounds.y,
+                             shape_bounds.width,
+                             shape_bounds.height,
+                             (clutter_actor_get_paint_opacity (actor) * params.opacity * window->opacity) / (255 * 255),
+                             clip,
+                             clip_shadow_under_window (self)); /* clip_strictly - not just as an optimization */
+          meta_frame_timings_end_phase (META_FRAME_PHASE_SHADOWS);
+        }
 
+      meta_frame_timings_begin_phase (META_FRAME_PHASE_BLUR);
+      meta_blur_set_mode (blur,
+                          meta_compositor_get_blur_mode (priv->compositor,
+                                                         window->monitor ? window->monitor->number : 0));
+      meta_blur_set_sigma (blur, priv->compositor->blur_sigma);
+      clutter_stage_get_redraw_clip_bounds (CLUTTER_STAGE (stage), &stage_damage);
+      /* The blurred backdrop can only be updated from a redraw that
+       * covers all of it */
+      if (!meta_blur_paint (blur,
+                            params.x_offset + shape_bounds.x,
+                            params.y_offset + shape_bounds.y,
+                            shape_bounds.width,
+                            shape_bounds.height,
+                            255,
+                            &stage_damage,
+                            visible,
+                            clip,
+                            TRUE,
+                            &blur_redraw))
+        clutter_actor_queue_redraw_with_clip (stage, &blur_redraw);
+      meta_frame_timings_end_phase (META_FRAME_PHASE_BLUR);
 
       if (clip && clip != priv->shadow_clip)
         cairo_region_destroy (clip);
@@ -882,58 +915,64 @@ meta_window_actor_is_destroyed (MetaWindowActor *self)
   return self->priv->disposed || self->priv->needs_destroy;
 }
 
-static gboolean
-send_frame_messages_timeout (gpointer data)
+/**
+ * meta_window_actor_send_queued_frame_messages:
+ * @self: a #MetaWindowActor
+ * @deadline: send the messages if they are due by this time, from
+ *   g_get_monotonic_time()
+ * @refresh_interval: the refresh interval of the stage, in microseconds
+ *
+ * Sends the frame messages queued for a window that was obscured when
+ * it drew its last frame, if they are due. The messages are not
+ * flushed; the caller sends those of all windows together.
+ *
+ * Return value: when the messages are due, if they are still queued,
+ *   or 0
+ */
+gint64
+meta_window_actor_send_queued_frame_messages (MetaWindowActor *self,
+                                              gint64           deadline,
+                                              gint             refresh_interval)
 {
-  MetaWindowActor *self = (MetaWindowActor *) data;
   MetaWindowActorPrivate *priv = self->priv;
-  FrameData *frame = g_slice_new0 (FrameData);
+  FrameData *frame;
+
+  if (priv->frame_messages_due == 0)
+    return 0;
+
+  if (priv->frame_messages_due > deadline)
+    return priv->frame_messages_due;
 
+  frame = g_slice_new0 (FrameData);
   frame->sync_request_serial = priv->window->sync_request_serial;
 
+  /* The frame is never presented, but the client can still pace
+   * itself by the refresh interval */
   do_send_frame_drawn (self, frame);
-  do_send_frame_timings (self, frame, 0, 0);
+  do_send_frame_timings (self, frame, refresh_interval, 0);
 
   priv->needs_frame_drawn = FALSE;
-  priv->send_frame_messages_timer = 0;
+  priv->frame_messages_due = 0;
   frame_data_free (frame);
 
-  return FALSE;
+  return 0;
 }
 
 static void
-queue_send_frame_messages_timeout (MetaWindowActor *self)
+queue_frame_messages (MetaWindowActor *self)
 {
   MetaWindowActorPrivate *priv = self->priv;
   MetaDisplay *display = meta_window_get_display (priv->window);
-  gint64 current_time = meta_compositor_monotonic_time_to_server_time (display, g_get_monotonic_time ());
-  MetaMonitorManager *monitor_manager = meta_monitor_manager_get ();
-  MetaWindow *window = priv->window;
+  gint64 now = g_get_monotonic_time ();
+  gint64 since_drawn;
 
-  MetaOutput *outputs;
-  guint n_outputs, i;
-  float refresh_rate = 60.0f;
-  gint interval, offset;
-
-  outputs = meta_monitor_manager_get_outputs (monitor_manager, &n_outputs);
-  for (i = 0; i < n_outputs; i++)
-    {
-      if (outputs[i].winsys_id == window->monitor->winsys_id && outputs[i].crtc)
-        {
-          refresh_rate = outputs[i].crtc->current_mode->refresh_rate;
-          break;
-        }
-    }
-
-  interval = (int)(1000000 / refresh_rate) * 6;
-  offset = MAX (0, priv->frame_drawn_time + interval - current_time) / 1000;
+  /* Already queued; the client is drawing faster than we send them */
+  if (priv->frame_messages_due != 0)
+    return;
 
- /* The clutter master clock source has already been added with META_PRIORITY_REDRAW,
-  * so the timer will run *after* the clutter frame handling, if a frame is ready
-  * to be drawn when the timer expires.
-  */
-  priv->send_frame_messages_timer = g_timeout_add_full (META_PRIORITY_REDRAW, offset, send_frame_messages_timeout, self, NULL);
-  g_source_set_name_by_id (priv->send_frame_messages_timer, "[mutter] send_frame_messages_timeout");
+  since_drawn = meta_compositor_monotonic_time_to_server_time (display, now) - priv->frame_drawn_time;
+  priv->frame_messages_due = meta_compositor_queue_frame_messages (priv->compositor,
+                                                                   now - since_drawn);
 }
 
 void
@@ -975,11 +1014,12 @@ meta_window_actor_queue_frame_drawn (MetaWindowActor *self,
        * pre_paint/post_paint functions get called, enabling us to
        * send a _NET_WM_FRAME_DRAWN. We do a 1-pixel redraw to get
        * consistent timing with non-empty frames. If the window
-       * is completely obscured we fire off the send_frame_messages timeout.
+       * is completely obscured the compositor sends the messages at
+       * a lower rate instead.
        */
       if (is_obscured)
         {
-          queue_send_frame_messages_timeout (self);
+          queue_frame_messages (self);
         }
       else
         {
@@ -1194,11 +1234,7 @@ meta_window_actor_destroy (MetaWindowActor *self)
 
   meta_window_set_compositor_private (window, NULL);
 
-  if (priv->send_frame_messages_timer != 0)
-    {
-      g_source_remove (priv->send_frame_messages_timer);
-      priv->send_frame_messages_timer = 0;
-    }
+  priv->frame_messages_due = 0;
 
   if (window_type == META_WINDOW_DROPDOWN_MENU ||
       window_type == META_WINDOW_POPUP_MENU ||
@@ -1249,12 +1285,53 @@ meta_window_actor_sync_actor_geometry (MetaWindowActor *self,
   if (meta_window_actor_effect_in_progress (self))
     return;
 
+  if (CLUTTER_ACTOR_IS_VISIBLE (self))
+    {
+      ClutterActorBox box;
+      cairo_rectangle_int_t old_rect, new_rect;
+
+      clutter_actor_get_allocation_box (CLUTTER_ACTOR (self), &box);
+      old_rect.x = box.x1;
+      old_rect.y = box.y1;
+      old_rect.width = box.x2 - box.x1;
+      old_rect.height = box.y2 - box.y1;
+
+      new_rect.x = window_rect.x;
+      new_rect.y = window_rect.y;
+      new_rect.width = window_rect.width;
+      new_rect.height = window_rect.height;
+
+      /* Moving or resizing repaints both where the window was and
+       * where it is now, and changes what it covers */
+      if (old_rect.x != new_rect.x || old_rect.y != new_rect.y ||
+          old_rect.width != new_rect.width || old_rect.height != new_rect.height)
+        {
+          meta_output_repaint_add_damage (&old_rect);
+          meta_output_repaint_add_damage (&new_rect);
+          meta_cullable_invalidate_culling ();
+        }
+    }
+
   clutter_actor_set_position (CLUTTER_ACTOR (self),
                               window_rect.x, window_rect.y);
   clutter_actor_set_size (CLUTTER_ACTOR (self),
                           window_rect.width, window_rect.height);
 }
 
+/**
+ * meta_window_actor_get_blur_cache_stats:
+ * @self: a #MetaWindowActor
+ * @hits: (out) (allow-none): paints that reused the cached blurred backdrop
+ * @misses: (out) (allow-none): paints that had to recompute it
+ */
+void
+meta_window_actor_get_blur_cache_stats (MetaWindowActor *self,
+                                        guint           *hits,
+                                        guint           *misses)
+{
+  meta_blur_get_cache_stats (self->priv->blur, hits, misses);
+}
+
 void
 meta_window_actor_show (MetaWindowActor   *self,
                         MetaCompEffect     effect)
@@ -1480,8 +1557,9 @@ see_region (cairo_region_t *region,
 /**
  * meta_window_actor_set_clip_region_beneath:
  * @self: a #MetaWindowActor
- * @clip_region: the region of the screen that isn't completely
- *  obscured beneath the main window texture.
+ * @unobscured_beneath: the region of the screen that isn't completely
+ *  obscured beneath the main window texture, regardless of the stage clip
+ * @beneath_region: the same, limited to the stage clip
  *
  * Provides a hint as to what areas need to be drawn *beneath*
  * the main window texture.  This is the relevant clip region
@@ -1491,6 +1569,7 @@ see_region (cairo_region_t *region,
  */
 static void
 meta_window_actor_set_clip_region_beneath (MetaWindowActor *self,
+                                           cairo_region_t  *unobscured_beneath,
                                            cairo_region_t  *beneath_region)
 {
   MetaWindowActorPrivate *priv = self->priv;
@@ -1499,19 +1578,28 @@ meta_window_actor_set_clip_region_beneath (MetaWindowActor *self,
   if (appears_focused ? priv->focused_shadow : priv->unfocused_shadow)
     {
       g_clear_pointer (&priv->shadow_clip, cairo_region_destroy);
+      g_clear_pointer (&priv->shadow_visible, cairo_region_destroy);
 
       if (beneath_region)
         {
-          priv->shadow_clip = cairo_region_copy (beneath_region);
+          cairo_rectangle_int_t bounds;
+
+          /* Also covers the blurred backdrop, which is drawn in the
+           * window's rectangle, inside the shadow */
+          meta_window_actor_get_shadow_bounds (self, appears_focused, &bounds);
+          priv->shadow_clip = meta_cullable_clip_bounds (META_CULLABLE (self),
+                                                         unobscured_beneath,
+                                                         beneath_region,
+                                                         &bounds,
+                                                         &priv->shadow_visible);
 
           if (clip_shadow_under_window (self))
             {
               cairo_region_t *frame_bounds = meta_window_get_frame_bounds (priv->window);
               cairo_region_subtract (priv->shadow_clip, frame_bounds);
+              cairo_region_subtract (priv->shadow_visible, frame_bounds);
             }
         }
-      else
-        priv->shadow_clip = NULL;
     }
 }
 
@@ -1523,7 +1611,7 @@ meta_window_actor_cull_out (MetaCullable   *cullable,
   MetaWindowActor *self = META_WINDOW_ACTOR (cullable);
 
   meta_cullable_cull_out_children (cullable, unobscured_region, clip_region);
-  meta_window_actor_set_clip_region_beneath (self, clip_region);
+  meta_window_actor_set_clip_region_beneath (self, unobscured_region, clip_region);
 }
 
 static void
@@ -1533,6 +1621,7 @@ meta_window_actor_reset_culling (MetaCullable *cullable)
   MetaWindowActorPrivate *priv = self->priv;
 
   g_clear_pointer (&priv->shadow_clip, cairo_region_destroy);
+  g_clear_pointer (&priv->shadow_visible, cairo_region_destroy);
 
   meta_cullable_reset_culling_children (cullable);
 }
@@ -1634,6 +1723,80 @@ meta_window_actor_sync_visibility (MetaWindowActor *self)
     }
 }
 
+/* Loads 8 bytes of mask data as a word, for testing runs of 0x00 or
+ * 0xff bytes at once */
+static inline guint64
+load_mask_word (const guchar *p)
+{
+  guint64 word;
+
+  memcpy (&word, p, sizeof (word));
+  return word;
+}
+
+/* Stores the runs of fully opaque pixels between x0 and x1 in @row
+ * to @spans, as pairs of start and end positions */
+static void
+scan_row_spans (const guchar *row,
+                int           x0,
+                int           x1,
+                GArray       *spans)
+{
+  int x = x0;
+
+  g_array_set_size (spans, 0);
+
+  while (x < x1)
+    {
+      int run_start;
+
+      /* Skip transparent pixels a word at a time */
+      while (x + 8 <= x1 && load_mask_word (row + x) == 0)
+        x += 8;
+
+      if (x >= x1)
+        break;
+
+      if (row[x] != 255)
+        {
+          x++;
+          continue;
+        }
+
+      run_start = x;
+      while (x + 8 <= x1 && load_mask_word (row + x) == G_MAXUINT64)
+        x += 8;
+      while (x < x1 && row[x] == 255)
+        x++;
+
+      g_array_append_val (spans, run_start);
+      g_array_append_val (spans, x);
+    }
+}
+
+static void
+add_row_spans (MetaRegionBuilder *builder,
+               GArray            *spans,
+               int                y,
+               int                height)
+{
+  guint i;
+
+  for (i = 0; i < spans->len; i += 2)
+    {
+      int x = g_array_index (spans, int, i);
+      int x2 = g_array_index (spans, int, i + 1);
+
+      meta_region_builder_add_rectangle (builder, x, y, x2 - x, height);
+    }
+}
+
+/* Computes the region of fully opaque pixels in the mask within
+ * @scan_area. Consecutive rows with the same runs are combined into
+ * a single rectangle per run, which keeps the number of rectangles
+ * passed to the region builder small for the typical frame mask,
+ * where only the rows with rounded corners differ from each other.
+ */
 static cairo_region_t *
 scan_visible_region (guchar         *mask_data,
                      int             stride,
@@ -1641,36 +1804,228 @@ scan_visible_region (guchar         *mask_data,
 {
   int i, n_rects = cairo_region_num_rectangles (scan_area);
   MetaRegionBuilder builder;
+  GArray *spans, *prev_spans;
 
   meta_region_builder_init (&builder);
 
+  spans = g_array_new (FALSE, FALSE, sizeof (int));
+  prev_spans = g_array_new (FALSE, FALSE, sizeof (int));
+
   for (i = 0; i < n_rects; i++)
     {
-      int x, y;
       cairo_rectangle_int_t rect;
+      int y, run_y;
 
       cairo_region_get_rectangle (scan_area, i, &rect);
 
-      for (y = rect.y; y < (rect.y + rect.height); y++)
+      g_array_set_size (prev_spans, 0);
+      run_y = rect.y;
+
+      for (y = rect.y; y < rect.y + rect.height; y++)
         {
-          for (x = rect.x; x < (rect.x + rect.width); x++)
-            {
-              int x2 = x;
-              while (mask_data[y * stride + x2] == 255 && x2 < (rect.x + rect.width))
-                x2++;
-
-              if (x2 > x)
-                {
-                  meta_region_builder_add_rectangle (&builder, x, y, x2 - x, 1);
-                  x = x2;
-                }
-            }
+          GArray *tmp;
+
+          scan_row_spans (mask_data + y * stride, rect.x, rect.x + rect.width, spans);
+
+          if (y > rect.y &&
+              spans->len == prev_spans->len &&
+              memcmp (spans->data, prev_spans->data, spans->len * sizeof (int)) == 0)
+            continue;
+
+          add_row_spans (&builder, prev_spans, run_y, y - run_y);
+          run_y = y;
+
+          tmp = prev_spans;
+          prev_spans = spans;
+          spans = tmp;
         }
+
+      add_row_spans (&builder, prev_spans, run_y, rect.y + rect.height - run_y);
     }
 
+  g_array_free (spans, TRUE);
+  g_array_free (prev_spans, TRUE);
+
   return meta_region_builder_finish (&builder);
 }
 
+/* Scratch buffer for building masks. The mask data is copied into a
+ * texture before build_and_scan_frame_mask() returns, so a single buffer
+ * can be reused for all windows rather than allocating a new one for
+ * each reshape. It is replaced by a smaller one once it is more than
+ * MASK_SCRATCH_SHRINK_FACTOR times the size needed, so that a single
+ * huge window doesn't leave a huge buffer behind for good. */
+#define MASK_SCRATCH_SHRINK_FACTOR 4
+
+static guchar *mask_scratch = NULL;
+static gsize mask_scratch_size = 0;
+
+static guchar *
+get_cleared_mask_scratch (gsize size)
+{
+  if (size > mask_scratch_size ||
+      size < mask_scratch_size / MASK_SCRATCH_SHRINK_FACTOR)
+    {
+      g_free (mask_scratch);
+      mask_scratch = g_malloc (size);
+      mask_scratch_size = size;
+    }
+
+  memset (mask_scratch, 0, size);
+
+  return mask_scratch;
+}
+
+/* The frame mask only depends on the frame style and the geometry,
+ * so we keep the frame part of recently created masks around; windows
+ * with the same decorations and size, or a window that is reshaped
+ * without being resized, can then reuse it without painting it with
+ * cairo and scanning it again. */
+#define MAX_CACHED_FRAME_MASKS 8
+
+typedef struct
+{
+  MetaFrameType type;
+  MetaFrameFlags flags;
+  char *theme;
+  int width;
+  int height;
+  cairo_rectangle_int_t client_area;
+
+  /* The part of the mask outside of client_area */
+  cairo_region_t *paint_region;
+  /* Pixels of the rectangles of paint_region, packed row by row */
+  guchar *data;
+  /* Fully opaque part of paint_region */
+  cairo_region_t *visible_region;
+} MetaFrameMask;
+
+/* Most recently used first */
+static GQueue frame_mask_cache = G_QUEUE_INIT;
+
+static void
+frame_mask_free (MetaFrameMask *frame_mask)
+{
+  g_free (frame_mask->theme);
+  cairo_region_destroy (frame_mask->paint_region);
+  cairo_region_destroy (frame_mask->visible_region);
+  g_free (frame_mask->data);
+  g_slice_free (MetaFrameMask, frame_mask);
+}
+
+static MetaFrameMask *
+lookup_frame_mask (MetaWindow            *window,
+                   int                    width,
+                   int                    height,
+                   cairo_rectangle_int_t *client_area)
+{
+  MetaFrameType type = meta_window_get_frame_type (window);
+  MetaFrameFlags flags = meta_frame_get_flags (window->frame);
+  const char *theme = meta_prefs_get_theme ();
+  GList *l;
+
+  for (l = frame_mask_cache.head; l; l = l->next)
+    {
+      MetaFrameMask *frame_mask = l->data;
+
+      if (frame_mask->type == type &&
+          frame_mask->flags == flags &&
+          frame_mask->width == width &&
+          frame_mask->height == height &&
+          frame_mask->client_area.x == client_area->x &&
+          frame_mask->client_area.y == client_area->y &&
+          frame_mask->client_area.width == client_area->width &&
+          frame_mask->client_area.height == client_area->height &&
+          g_strcmp0 (frame_mask->theme, theme) == 0)
+        {
+          g_queue_unlink (&frame_mask_cache, l);
+          g_queue_push_head_link (&frame_mask_cache, l);
+
+          return frame_mask;
+        }
+    }
+
+  return NULL;
+}
+
+/* Copies the frame part of a freshly painted mask into the cache;
+ * takes ownership of @paint_region and @visible_region */
+static MetaFrameMask *
+cache_frame_mask (MetaWindow            *window,
+                  int                    width,
+                  int                    height,
+                  cairo_rectangle_int_t *client_area,
+                  cairo_region_t        *paint_region,
+                  cairo_region_t        *visible_region,
+                  const guchar          *mask_data,
+                  int                    stride)
+{
+  MetaFrameMask *frame_mask = g_slice_new0 (MetaFrameMask);
+  int i, n_rects = cairo_region_num_rectangles (paint_region);
+  gsize size = 0;
+  guchar *p;
+
+  frame_mask->type = meta_window_get_frame_type (window);
+  frame_mask->flags = meta_frame_get_flags (window->frame);
+  frame_mask->theme = g_strdup (meta_prefs_get_theme ());
+  frame_mask->width = width;
+  frame_mask->height = height;
+  frame_mask->client_area = *client_area;
+  frame_mask->paint_region = paint_region;
+  frame_mask->visible_region = visible_region;
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+
+      cairo_region_get_rectangle (paint_region, i, &rect);
+      size += (gsize) rect.width * rect.height;
+    }
+
+  p = frame_mask->data = g_malloc (size);
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+      int y;
+
+      cairo_region_get_rectangle (paint_region, i, &rect);
+      for (y = rect.y; y < rect.y + rect.height; y++)
+        {
+          memcpy (p, mask_data + y * stride + rect.x, rect.width);
+          p += rect.width;
+        }
+    }
+
+  g_queue_push_head (&frame_mask_cache, frame_mask);
+  if (frame_mask_cache.length > MAX_CACHED_FRAME_MASKS)
+    frame_mask_free (g_queue_pop_tail (&frame_mask_cache));
+
+  return frame_mask;
+}
+
+static void
+frame_mask_copy_to (MetaFrameMask *frame_mask,
+                    guchar        *mask_data,
+                    int            stride)
+{
+  int i, n_rects = cairo_region_num_rectangles (frame_mask->paint_region);
+  const guchar *p = frame_mask->data;
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+      int y;
+
+      cairo_region_get_rectangle (frame_mask->paint_region, i, &rect);
+      for (y = rect.y; y < rect.y + rect.height; y++)
+        {
+          memcpy (mask_data + y * stride + rect.x, p, rect.width);
+          p += rect.width;
+        }
+    }
+}
+
 static void
 build_and_scan_frame_mask (MetaWindowActor       *self,
                            cairo_rectangle_int_t *client_area,
@@ -1702,7 +2057,7 @@ build_and_scan_frame_mask (MetaWindowActor       *self,
   stride = cairo_format_stride_for_width (CAIRO_FORMAT_A8, tex_width);
 
   /* Create data for an empty image */
-  mask_data = g_malloc0 (stride * tex_height);
+  mask_data = get_cleared_mask_scratch (stride * tex_height);
 
   surface = cairo_image_surface_create_for_data (mask_data,
                                                  CAIRO_FORMAT_A8,
@@ -1716,23 +2071,41 @@ build_and_scan_frame_mask (MetaWindowActor       *self,
 
   if (priv->window->frame != NULL)
     {
-      cairo_region_t *frame_paint_region, *scanned_region;
-      cairo_rectangle_int_t rect = { 0, 0, tex_width, tex_height };
+      MetaFrameMask *frame_mask;
 
-      /* Make sure we don't paint the frame over the client window. */
-      frame_paint_region = cairo_region_create_rectangle (&rect);
-      cairo_region_subtract_rectangle (frame_paint_region, client_area);
+      frame_mask = lookup_frame_mask (priv->window, tex_width, tex_height, client_area);
 
-      gdk_cairo_region (cr, frame_paint_region);
-      cairo_clip (cr);
+      cairo_surface_flush (surface);
 
-      meta_frame_get_mask (priv->window->frame, cr);
+      if (frame_mask != NULL)
+        {
+          /* The shape of the client doesn't extend into the frame, so
+           * the frame part of the mask can simply be copied over */
+          frame_mask_copy_to (frame_mask, mask_data, stride);
+        }
+      else
+        {
+          cairo_region_t *frame_paint_region, *scanned_region;
+          cairo_rectangle_int_t rect = { 0, 0, tex_width, tex_height };
 
-      cairo_surface_flush (surface);
-      scanned_region = scan_visible_region (mask_data, stride, frame_paint_region);
-      cairo_region_union (shape_region, scanned_region);
-      cairo_region_destroy (scanned_region);
-      cairo_region_destroy (frame_paint_region);
+          /* Make sure we don't paint the frame over the client window. */
+          frame_paint_region = cairo_region_create_rectangle (&rect);
+          cairo_region_subtract_rectangle (frame_paint_region, client_area);
+
+          gdk_cairo_region (cr, frame_paint_region);
+          cairo_clip (cr);
+
+          meta_frame_get_mask (priv->window->frame, cr);
+
+          cairo_surface_flush (surface);
+          scanned_region = scan_visible_region (mask_data, stride, frame_paint_region);
+
+          frame_mask = cache_frame_mask (priv->window, tex_width, tex_height, client_area,
+                                         frame_paint_region, scanned_region,
+                                         mask_data, stride);
+        }
+
+      cairo_region_union (shape_region, frame_mask->visible_region);
     }
 
   cairo_destroy (cr);
@@ -1760,8 +2133,6 @@ build_and_scan_frame_mask (MetaWindowActor       *self,
   meta_shaped_texture_set_mask_texture (stex, mask_texture);
   if (mask_texture)
     cogl_object_unref (mask_texture);
-
-  g_free (mask_data);
 }
 
 static void
@@ -1961,10 +2332,9 @@ do_send_frame_drawn (MetaWindowActor *self, FrameData *frame)
   ev.data.l[2] = frame->frame_drawn_time & G_GUINT64_CONSTANT(0xffffffff);
   ev.data.l[3] = frame->frame_drawn_time >> 32;
 
-  meta_error_trap_push (display);
+  /* Flushed by the compositor, along with the messages for other
+   * windows, under an error trap */
   XSendEvent (xdisplay, ev.window, False, 0, (XEvent*) &ev);
-  XFlush (xdisplay);
-  meta_error_trap_pop (display);
 }
 
 void
@@ -1978,10 +2348,10 @@ meta_window_actor_post_paint (MetaWindowActor *self)
     return;
 
  /* This window had damage, but wasn't actually redrawn because
-  * it is obscured. So we should wait until timer expiration
-  * before sending _NET_WM_FRAME_* messages.
+  * it is obscured. So we should wait for the compositor to send
+  * the _NET_WM_FRAME_* messages.
   */
-  if (priv->send_frame_messages_timer != 0)
+  if (priv->frame_messages_due != 0)
     return;
 
   if (priv->needs_frame_drawn)
@@ -2031,10 +2401,9 @@ do_send_frame_timings (MetaWindowActor  *self,
   ev.data.l[3] = refresh_interval;
   ev.data.l[4] = 1000 * META_SYNC_DELAY;
 
-  meta_error_trap_push (display);
+  /* Flushed by the compositor, along with the messages for other
+   * windows, under an error trap */
   XSendEvent (xdisplay, ev.window, False, 0, (XEvent*) &ev);
-  XFlush (xdisplay);
-  meta_error_trap_pop (display);
 }
 
 static void
@@ -4,26 +4,58 @@
 
 #define _ISOC99_SOURCE /* for roundf */
 #include <math.h>
+#include <string.h>
 
 #include <gdk/gdk.h> /* for gdk_rectangle_intersect() */
 
 #include "clutter-utils.h"
 #include "compositor-private.h"
+#include "meta-background-actor-private.h"
+#include "meta-frame-timings.h"
+#include "meta-shaped-texture-private.h"
+#include "meta-surface-actor.h"
 #include "meta-window-actor-private.h"
 #include "meta-window-group.h"
 #include "window-private.h"
 #include "meta-cullable.h"
+#include <meta/meta-background-group.h>
 
 struct _MetaWindowGroupClass
 {
   ClutterActorClass parent_class;
 };
 
+/* What culling depends on for one cullable actor */
+typedef struct
+{
+  ClutterActor *actor;
+  float x, y;
+  float width, height;
+  guint8 opacity;
+  guint8 visible;
+  guint8 has_effects;
+  guint8 untransformed;
+} CulledActor;
+
 struct _MetaWindowGroup
 {
   ClutterActor parent;
 
   MetaScreen *screen;
+
+  /* For each child, top to bottom, the part of the stage left visible
+   * by the children above it, or %NULL if it wasn't culled; kept for
+   * as long as the scene stays the same. */
+  GPtrArray *visible_regions;
+  gboolean visible_regions_valid;
+  guint culling_serial;
+  cairo_rectangle_int_t culled_stage_rect;
+  guint8 culled_paint_opacity;
+
+  /* The state of all the cullable actors the regions were computed
+   * for, and scratch space to compare the current state with */
+  GArray *culled_actors;
+  GArray *current_actors;
 };
 
 static void cullable_iface_init (MetaCullableInterface *iface);
@@ -52,11 +84,235 @@ cullable_iface_init (MetaCullableInterface *iface)
   iface->reset_culling = meta_window_group_reset_culling;
 }
 
+/* The same tests as meta_cullable_cull_out_children() */
+static gboolean
+child_needs_culling (ClutterActor *child)
+{
+  return (CLUTTER_ACTOR_IS_VISIBLE (child) &&
+          !clutter_actor_has_effects (child) &&
+          meta_actor_is_untransformed (child, NULL, NULL));
+}
+
+static void
+get_culled_actors (ClutterActor *actor,
+                   GArray       *culled_actors)
+{
+  ClutterActor *child;
+  ClutterActorIter iter;
+
+  clutter_actor_iter_init (&iter, actor);
+  while (clutter_actor_iter_prev (&iter, &child))
+    {
+      CulledActor culled;
+
+      if (!META_IS_CULLABLE (child))
+        continue;
+
+      /* Compared with memcmp(), so clear the padding too */
+      memset (&culled, 0, sizeof (culled));
+      culled.actor = child;
+      clutter_actor_get_position (child, &culled.x, &culled.y);
+      clutter_actor_get_size (child, &culled.width, &culled.height);
+      culled.opacity = clutter_actor_get_opacity (child);
+      culled.visible = CLUTTER_ACTOR_IS_VISIBLE (child) != FALSE;
+      culled.has_effects = clutter_actor_has_effects (child) != FALSE;
+      culled.untransformed = meta_actor_is_untransformed (child, NULL, NULL) != FALSE;
+      g_array_append_val (culled_actors, culled);
+
+      get_culled_actors (child, culled_actors);
+    }
+}
+
+/* Checks whether the visible regions of the last frame can be used
+ * again. Restacks and opaque region changes are reported to us through
+ * meta_cullable_invalidate_culling(), but actors are also moved,
+ * faded or transformed by plugins behind our back, so we also compare
+ * the geometry of everything that was culled. That is cheap next to
+ * culling: no regions are involved.
+ */
+static gboolean
+check_visible_regions (MetaWindowGroup             *window_group,
+                       const cairo_rectangle_int_t *stage_rect)
+{
+  GArray *tmp;
+  guint8 paint_opacity;
+  gboolean valid;
+
+  /* Our own opacity decides whether the opaque regions count */
+  paint_opacity = clutter_actor_get_paint_opacity (CLUTTER_ACTOR (window_group));
+
+  g_array_set_size (window_group->current_actors, 0);
+  get_culled_actors (CLUTTER_ACTOR (window_group), window_group->current_actors);
+
+  valid = (window_group->visible_regions_valid &&
+           window_group->culling_serial == meta_cullable_get_culling_serial () &&
+           window_group->culled_stage_rect.width == stage_rect->width &&
+           window_group->culled_stage_rect.height == stage_rect->height &&
+           window_group->culled_paint_opacity == paint_opacity &&
+           window_group->culled_actors->len == window_group->current_actors->len &&
+           memcmp (window_group->culled_actors->data,
+                   window_group->current_actors->data,
+                   window_group->current_actors->len * sizeof (CulledActor)) == 0);
+
+  window_group->culled_paint_opacity = paint_opacity;
+
+  tmp = window_group->culled_actors;
+  window_group->culled_actors = window_group->current_actors;
+  window_group->current_actors = tmp;
+
+  return valid;
+}
+
+/* Does the same as meta_cullable_cull_out_children(), but remembers
+ * what each child left visible, so that next frame, if nothing
+ * changed, we can hand every child its region straight away instead
+ * of subtracting the opaque regions of all the windows above it again.
+ * Only the stage clip, which changes every frame, is applied anew.
+ */
+static void
+cull_out_children_incrementally (MetaWindowGroup             *window_group,
+                                 const cairo_rectangle_int_t *stage_rect,
+                                 cairo_region_t              *clip_region)
+{
+  ClutterActor *actor = CLUTTER_ACTOR (window_group);
+  ClutterActor *child;
+  ClutterActorIter iter;
+  cairo_region_t *unobscured_region = NULL;
+  gboolean reuse;
+  guint i = 0;
+
+  reuse = check_visible_regions (window_group, stage_rect);
+
+  if (!reuse)
+    {
+      g_ptr_array_set_size (window_group->visible_regions, 0);
+      unobscured_region = cairo_region_create_rectangle (stage_rect);
+    }
+
+  clutter_actor_iter_init (&iter, actor);
+  while (clutter_actor_iter_prev (&iter, &child))
+    {
+      cairo_region_t *child_unobscured, *child_clip;
+      float x, y;
+
+      if (!META_IS_CULLABLE (child))
+        continue;
+
+      if (reuse)
+        {
+          cairo_region_t *region = g_ptr_array_index (window_group->visible_regions, i++);
+
+          child_unobscured = region ? cairo_region_copy (region) : NULL;
+        }
+      else if (child_needs_culling (child))
+        {
+          g_ptr_array_add (window_group->visible_regions,
+                           cairo_region_copy (unobscured_region));
+
+          /* The child subtracts what it covers, for the ones below */
+          child_unobscured = unobscured_region;
+        }
+      else
+        {
+          g_ptr_array_add (window_group->visible_regions, NULL);
+          child_unobscured = NULL;
+        }
+
+      if (child_unobscured == NULL)
+        {
+          meta_cullable_cull_out (META_CULLABLE (child), NULL, NULL);
+          continue;
+        }
+
+      child_clip = cairo_region_copy (child_unobscured);
+      cairo_region_intersect (child_clip, clip_region);
+
+      clutter_actor_get_position (child, &x, &y);
+
+      /* Temporarily move to the coordinate system of the actor */
+      cairo_region_translate (child_unobscured, - x, - y);
+      cairo_region_translate (child_clip, - x, - y);
+
+      meta_cullable_cull_out (META_CULLABLE (child), child_unobscured, child_clip);
+
+      cairo_region_destroy (child_clip);
+
+      if (child_unobscured == unobscured_region)
+        cairo_region_translate (unobscured_region, x, y);
+      else
+        cairo_region_destroy (child_unobscured);
+    }
+
+  if (!reuse)
+    {
+      cairo_region_destroy (unobscured_region);
+
+      window_group->visible_regions_valid = TRUE;
+      window_group->culling_serial = meta_cullable_get_culling_serial ();
+      window_group->culled_stage_rect = *stage_rect;
+    }
+}
+
+/* Walks the children of @actor from the bottom up, adding the opaque
+ * parts of the shaped textures to @batch. Drawing those first is only
+ * correct if everything that is painted later stays within its clip
+ * region, so we stop at the first actor we can't be sure about: its
+ * paint could cover what we would have drawn above it. Returns %FALSE
+ * if we stopped.
+ */
+static gboolean
+add_children_to_batch (ClutterActor    *actor,
+                       int              x_offset,
+                       int              y_offset,
+                       MetaOpaqueBatch *batch)
+{
+  ClutterActor *child;
+  ClutterActorIter iter;
+
+  clutter_actor_iter_init (&iter, actor);
+  while (clutter_actor_iter_next (&iter, &child))
+    {
+      float x, y;
+      gboolean ok;
+
+      if (!CLUTTER_ACTOR_IS_VISIBLE (child))
+        continue;
+
+      /* The same tests as meta_cullable_cull_out_children(); if they
+       * fail the child wasn't given a clip region. */
+      if (!META_IS_CULLABLE (child) ||
+          clutter_actor_has_effects (child) ||
+          !meta_actor_is_untransformed (child, NULL, NULL))
+        return FALSE;
+
+      clutter_actor_get_position (child, &x, &y);
+      x += x_offset;
+      y += y_offset;
+
+      if (META_IS_SHAPED_TEXTURE (child))
+        ok = meta_shaped_texture_add_to_batch (META_SHAPED_TEXTURE (child), x, y, batch);
+      else if (META_IS_BACKGROUND_ACTOR (child))
+        ok = meta_background_actor_paints_within_clip (META_BACKGROUND_ACTOR (child));
+      else if (META_IS_WINDOW_ACTOR (child) ||
+               META_IS_SURFACE_ACTOR (child) ||
+               META_IS_BACKGROUND_GROUP (child))
+        ok = add_children_to_batch (child, x, y, batch);
+      else
+        ok = FALSE;
+
+      if (!ok)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 static void
 meta_window_group_paint (ClutterActor *actor)
 {
   cairo_region_t *clip_region;
   cairo_region_t *unobscured_region;
+  MetaOpaqueBatch batch;
   cairo_rectangle_int_t visible_rect, clip_rect;
   int paint_x_offset, paint_y_offset;
   int paint_x_origin, paint_y_origin;
@@ -92,8 +348,6 @@ meta_window_group_paint (ClutterActor *actor)
   visible_rect.width = clutter_actor_get_width (CLUTTER_ACTOR (stage));
   visible_rect.height = clutter_actor_get_height (CLUTTER_ACTOR (stage));
 
-  unobscured_region = cairo_region_create_rectangle (&visible_rect);
-
   /* Get the clipped redraw bounds from Clutter so that we can avoid
    * painting shadows on windows that don't need to be painted in this
    * frame. In the case of a multihead setup with mismatched monitor
@@ -109,11 +363,37 @@ meta_window_group_paint (ClutterActor *actor)
   paint_y_offset = paint_y_origin - actor_y_origin;
   cairo_region_translate (clip_region, -paint_x_offset, -paint_y_offset);
 
-  meta_cullable_cull_out (META_CULLABLE (window_group), unobscured_region, clip_region);
+  meta_frame_timings_begin_phase (META_FRAME_PHASE_CULL);
+
+  /* What we keep from frame to frame is in our own coordinates, which
+   * are only those of the stage when we aren't painted in a clone */
+  if (paint_x_offset == 0 && paint_y_offset == 0)
+    {
+      cull_out_children_incrementally (window_group, &visible_rect, clip_region);
+    }
+  else
+    {
+      unobscured_region = cairo_region_create_rectangle (&visible_rect);
+      meta_cullable_cull_out (META_CULLABLE (window_group), unobscured_region, clip_region);
+      cairo_region_destroy (unobscured_region);
+    }
+
+  meta_frame_timings_end_phase (META_FRAME_PHASE_CULL);
 
-  cairo_region_destroy (unobscured_region);
   cairo_region_destroy (clip_region);
 
+  /* With the culling done, the opaque parts of the windows don't overlap
+   * each other or anything beneath them that is painted, so draw them
+   * all first, instead of switching pipelines for each window. */
+  batch.runs = g_array_new (FALSE, FALSE, sizeof (MetaOpaqueBatchRun));
+  batch.coords = g_array_new (FALSE, FALSE, sizeof (float));
+
+  add_children_to_batch (actor, 0, 0, &batch);
+  meta_opaque_batch_paint (&batch, cogl_get_draw_framebuffer ());
+
+  g_array_free (batch.runs, TRUE);
+  g_array_free (batch.coords, TRUE);
+
   CLUTTER_ACTOR_CLASS (meta_window_group_parent_class)->paint (actor);
 
   meta_cullable_reset_culling (META_CULLABLE (window_group));
@@ -145,11 +425,26 @@ meta_window_group_get_paint_volume (ClutterActor       *self,
   return TRUE;
 }
 
+static void
+meta_window_group_finalize (GObject *object)
+{
+  MetaWindowGroup *window_group = META_WINDOW_GROUP (object);
+
+  g_ptr_array_unref (window_group->visible_regions);
+  g_array_unref (window_group->culled_actors);
+  g_array_unref (window_group->current_actors);
+
+  G_OBJECT_CLASS (meta_window_group_parent_class)->finalize (object);
+}
+
 static void
 meta_window_group_class_init (MetaWindowGroupClass *klass)
 {
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
   ClutterActorClass *actor_class = CLUTTER_ACTOR_CLASS (klass);
 
+  object_class->finalize = meta_window_group_finalize;
+
   actor_class->paint = meta_window_group_paint;
   actor_class->get_paint_volume = meta_window_group_get_paint_volume;
 }
@@ -157,6 +452,10 @@ meta_window_group_class_init (MetaWindowGroupClass *klass)
 static void
 meta_window_group_init (MetaWindowGroup *window_group)
 {
+  window_group->visible_regions =
+    g_ptr_array_new_with_free_func ((GDestroyNotify) cairo_region_destroy);
+  window_group->culled_actors = g_array_new (FALSE, FALSE, sizeof (CulledActor));
+  window_group->current_actors = g_array_new (FALSE, FALSE, sizeof (CulledActor));
 }
 
 ClutterActor *
@@ -13,7 +13,9 @@
  * This class is a subclass of ClutterActor with special handling for
  * #MetaCullable when painting children. It uses code similar to
  * meta_cullable_cull_out_children(), but also has additional special
- * cases for the undirected window, and similar.
+ * cases for the undirected window, and similar. What each child leaves
+ * visible is kept from one frame to the next while the scene doesn't
+ * change, see meta_cullable_invalidate_culling().
  */
 
 #define META_TYPE_WINDOW_GROUP            (meta_window_group_get_type ())
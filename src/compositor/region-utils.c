@@ -21,21 +21,744 @@
 #include "region-utils.h"
 
 #include <math.h>
+#include <string.h>
+
+/* MetaBandRegion */
+
+/* The set operations are the band sweep used by pixman (and X before
+ * it): walk the bands of both regions from top to bottom, split them
+ * where the other region's bands start or end, and combine the
+ * rectangles of each pair of overlapping bands left to right. The
+ * result is written to the spare array of the region, which then
+ * becomes the region's own; so in steady state no memory is allocated
+ * at all.
+ */
+
+typedef struct
+{
+  MetaRegionBox *boxes;
+  int n_boxes;
+  int size;
+
+  /* Start of the last finished band, or -1, and of the current one */
+  int prev_band;
+  int cur_band;
+} BoxWriter;
+
+typedef void (*BandOverlapFunc) (BoxWriter           *writer,
+                                 const MetaRegionBox *b1,
+                                 const MetaRegionBox *end1,
+                                 const MetaRegionBox *b2,
+                                 const MetaRegionBox *end2,
+                                 int                  y1,
+                                 int                  y2);
+
+static void
+ensure_boxes (MetaRegionBox **boxes,
+              int            *size,
+              int             needed)
+{
+  if (*size >= needed)
+    return;
+
+  *size = MAX (needed, MAX (*size * 2, 16));
+  *boxes = g_renew (MetaRegionBox, *boxes, *size);
+}
+
+static inline void
+writer_add (BoxWriter *writer,
+            int        x1,
+            int        y1,
+            int        x2,
+            int        y2)
+{
+  MetaRegionBox *box;
+
+  if (G_UNLIKELY (writer->n_boxes == writer->size))
+    ensure_boxes (&writer->boxes, &writer->size, writer->n_boxes + 1);
+
+  box = &writer->boxes[writer->n_boxes++];
+  box->x1 = x1;
+  box->y1 = y1;
+  box->x2 = x2;
+  box->y2 = y2;
+}
+
+static inline void
+writer_begin_band (BoxWriter *writer)
+{
+  writer->cur_band = writer->n_boxes;
+}
+
+/* If the band just written directly continues the one above with the
+ * same rectangles, extends that one instead; that keeps the region in
+ * the same canonical form as cairo's. */
+static void
+writer_end_band (BoxWriter *writer)
+{
+  MetaRegionBox *prev, *cur;
+  int n, i;
+
+  n = writer->n_boxes - writer->cur_band;
+  if (n == 0)
+    return;
+
+  if (writer->prev_band >= 0 &&
+      writer->cur_band - writer->prev_band == n)
+    {
+      prev = &writer->boxes[writer->prev_band];
+      cur = &writer->boxes[writer->cur_band];
+
+      if (prev->y2 == cur->y1)
+        {
+          for (i = 0; i < n; i++)
+            {
+              if (prev[i].x1 != cur[i].x1 || prev[i].x2 != cur[i].x2)
+                break;
+            }
+
+          if (i == n)
+            {
+              for (i = 0; i < n; i++)
+                prev[i].y2 = cur[i].y2;
+
+              writer->n_boxes = writer->cur_band;
+              return;
+            }
+        }
+    }
+
+  writer->prev_band = writer->cur_band;
+}
+
+static const MetaRegionBox *
+find_band_end (const MetaRegionBox *box,
+               const MetaRegionBox *end)
+{
+  int y1 = box->y1;
+
+  while (box < end && box->y1 == y1)
+    box++;
+
+  return box;
+}
+
+static void
+append_band (BoxWriter           *writer,
+             const MetaRegionBox *box,
+             const MetaRegionBox *end,
+             int                  y1,
+             int                  y2)
+{
+  writer_begin_band (writer);
+
+  for (; box < end; box++)
+    writer_add (writer, box->x1, y1, box->x2, y2);
+
+  writer_end_band (writer);
+}
+
+static void
+union_bands (BoxWriter           *writer,
+             const MetaRegionBox *b1,
+             const MetaRegionBox *end1,
+             const MetaRegionBox *b2,
+             const MetaRegionBox *end2,
+             int                  y1,
+             int                  y2)
+{
+  gboolean have_span = FALSE;
+  int x1 = 0, x2 = 0;
+
+  while (b1 < end1 || b2 < end2)
+    {
+      const MetaRegionBox *box;
+
+      if (b2 == end2 || (b1 < end1 && b1->x1 < b2->x1))
+        box = b1++;
+      else
+        box = b2++;
+
+      if (have_span && box->x1 <= x2)
+        {
+          x2 = MAX (x2, box->x2);
+        }
+      else
+        {
+          if (have_span)
+            writer_add (writer, x1, y1, x2, y2);
+
+          x1 = box->x1;
+          x2 = box->x2;
+          have_span = TRUE;
+        }
+    }
+
+  if (have_span)
+    writer_add (writer, x1, y1, x2, y2);
+}
+
+static void
+intersect_bands (BoxWriter           *writer,
+                 const MetaRegionBox *b1,
+                 const MetaRegionBox *end1,
+                 const MetaRegionBox *b2,
+                 const MetaRegionBox *end2,
+                 int                  y1,
+                 int                  y2)
+{
+  while (b1 < end1 && b2 < end2)
+    {
+      int x1 = MAX (b1->x1, b2->x1);
+      int x2 = MIN (b1->x2, b2->x2);
+
+      if (x1 < x2)
+        writer_add (writer, x1, y1, x2, y2);
+
+      if (b1->x2 < b2->x2)
+        b1++;
+      else if (b2->x2 < b1->x2)
+        b2++;
+      else
+        {
+          b1++;
+          b2++;
+        }
+    }
+}
+
+static void
+subtract_bands (BoxWriter           *writer,
+                const MetaRegionBox *b1,
+                const MetaRegionBox *end1,
+                const MetaRegionBox *b2,
+                const MetaRegionBox *end2,
+                int                  y1,
+                int                  y2)
+{
+  int x1;
+
+  if (b1 == end1)
+    return;
+
+  /* The left edge of what is left of *b1 */
+  x1 = b1->x1;
+
+  while (b1 < end1 && b2 < end2)
+    {
+      if (b2->x2 <= x1)
+        {
+          /* Entirely to the left */
+          b2++;
+        }
+      else if (b2->x1 <= x1)
+        {
+          /* Covers the left part; it may also cover the next ones */
+          x1 = b2->x2;
+          if (x1 >= b1->x2)
+            {
+              if (++b1 < end1)
+                x1 = b1->x1;
+            }
+          else
+            b2++;
+        }
+      else if (b2->x1 < b1->x2)
+        {
+          /* Cuts into the middle */
+          writer_add (writer, x1, y1, b2->x1, y2);
+
+          x1 = b2->x2;
+          if (x1 >= b1->x2)
+            {
+              if (++b1 < end1)
+                x1 = b1->x1;
+            }
+          else
+            b2++;
+        }
+      else
+        {
+          /* Entirely to the right */
+          writer_add (writer, x1, y1, b1->x2, y2);
+          if (++b1 < end1)
+            x1 = b1->x1;
+        }
+    }
+
+  while (b1 < end1)
+    {
+      writer_add (writer, x1, y1, b1->x2, y2);
+      if (++b1 < end1)
+        x1 = b1->x1;
+    }
+}
+
+static void
+region_op (MetaBandRegion       *region,
+           const MetaBandRegion *other,
+           BandOverlapFunc       overlap_func,
+           gboolean              append_non1,
+           gboolean              append_non2)
+{
+  const MetaRegionBox *r1 = region->boxes;
+  const MetaRegionBox *end1 = r1 + region->n_boxes;
+  const MetaRegionBox *r2 = other->boxes;
+  const MetaRegionBox *end2 = r2 + other->n_boxes;
+  int r1y1, r2y1;
+  BoxWriter writer;
+  MetaRegionBox *tmp;
+
+  writer.boxes = region->spare;
+  writer.size = region->spare_size;
+  writer.n_boxes = 0;
+  writer.prev_band = -1;
+  writer.cur_band = 0;
+
+  /* The top of what is left of the current band of each region */
+  r1y1 = r1 < end1 ? r1->y1 : 0;
+  r2y1 = r2 < end2 ? r2->y1 : 0;
+
+  while (r1 < end1 && r2 < end2)
+    {
+      const MetaRegionBox *band_end1 = find_band_end (r1, end1);
+      const MetaRegionBox *band_end2 = find_band_end (r2, end2);
+      int r1y2 = r1->y2;
+      int r2y2 = r2->y2;
+      int ytop, ybot;
+
+      /* First the part of a band above the other region's band */
+      if (r1y1 < r2y1)
+        {
+          if (append_non1)
+            append_band (&writer, r1, band_end1, r1y1, MIN (r1y2, r2y1));
+          ytop = r2y1;
+        }
+      else if (r2y1 < r1y1)
+        {
+          if (append_non2)
+            append_band (&writer, r2, band_end2, r2y1, MIN (r2y2, r1y1));
+          ytop = r1y1;
+        }
+      else
+        {
+          ytop = r1y1;
+        }
+
+      /* Then the part where the bands overlap */
+      ybot = MIN (r1y2, r2y2);
+      if (ybot > ytop)
+        {
+          writer_begin_band (&writer);
+          overlap_func (&writer, r1, band_end1, r2, band_end2, ytop, ybot);
+          writer_end_band (&writer);
+        }
+
+      if (r1y2 == ybot)
+        {
+          r1 = band_end1;
+          if (r1 < end1)
+            r1y1 = r1->y1;
+        }
+      else
+        r1y1 = MAX (r1y1, ybot);
+
+      if (r2y2 == ybot)
+        {
+          r2 = band_end2;
+          if (r2 < end2)
+            r2y1 = r2->y1;
+        }
+      else
+        r2y1 = MAX (r2y1, ybot);
+    }
+
+  if (append_non1)
+    {
+      while (r1 < end1)
+        {
+          const MetaRegionBox *band_end1 = find_band_end (r1, end1);
+
+          append_band (&writer, r1, band_end1, r1y1, r1->y2);
+          r1 = band_end1;
+          if (r1 < end1)
+            r1y1 = r1->y1;
+        }
+    }
+
+  if (append_non2)
+    {
+      while (r2 < end2)
+        {
+          const MetaRegionBox *band_end2 = find_band_end (r2, end2);
+
+          append_band (&writer, r2, band_end2, r2y1, r2->y2);
+          r2 = band_end2;
+          if (r2 < end2)
+            r2y1 = r2->y1;
+        }
+    }
+
+  tmp = region->boxes;
+  region->spare = tmp;
+  region->spare_size = region->size;
+  region->boxes = writer.boxes;
+  region->size = writer.size;
+  region->n_boxes = writer.n_boxes;
+}
+
+void
+meta_band_region_init (MetaBandRegion *region)
+{
+  region->boxes = NULL;
+  region->n_boxes = 0;
+  region->size = 0;
+  region->spare = NULL;
+  region->spare_size = 0;
+}
+
+void
+meta_band_region_fini (MetaBandRegion *region)
+{
+  g_free (region->boxes);
+  g_free (region->spare);
+  meta_band_region_init (region);
+}
+
+/**
+ * meta_band_region_set_empty:
+ * @region: a #MetaBandRegion
+ *
+ * Empties @region, keeping its memory around for reuse.
+ */
+void
+meta_band_region_set_empty (MetaBandRegion *region)
+{
+  region->n_boxes = 0;
+}
+
+void
+meta_band_region_set_rectangle (MetaBandRegion              *region,
+                                const cairo_rectangle_int_t *rect)
+{
+  region->n_boxes = 0;
+
+  if (rect->width <= 0 || rect->height <= 0)
+    return;
+
+  ensure_boxes (&region->boxes, &region->size, 1);
+  region->boxes[0].x1 = rect->x;
+  region->boxes[0].y1 = rect->y;
+  region->boxes[0].x2 = rect->x + rect->width;
+  region->boxes[0].y2 = rect->y + rect->height;
+  region->n_boxes = 1;
+}
+
+/**
+ * meta_band_region_set_from_cairo:
+ * @region: a #MetaBandRegion
+ * @cairo_region: a #cairo_region_t
+ *
+ * Sets @region to the same area as @cairo_region. The rectangles of a
+ * #cairo_region_t are already banded, so this is a plain copy.
+ */
+void
+meta_band_region_set_from_cairo (MetaBandRegion *region,
+                                 cairo_region_t *cairo_region)
+{
+  int n, i;
+
+  n = cairo_region_num_rectangles (cairo_region);
+  ensure_boxes (&region->boxes, &region->size, n);
+
+  for (i = 0; i < n; i++)
+    {
+      cairo_rectangle_int_t rect;
+      MetaRegionBox *box = &region->boxes[i];
+
+      cairo_region_get_rectangle (cairo_region, i, &rect);
+      box->x1 = rect.x;
+      box->y1 = rect.y;
+      box->x2 = rect.x + rect.width;
+      box->y2 = rect.y + rect.height;
+    }
+
+  region->n_boxes = n;
+}
+
+void
+meta_band_region_copy (MetaBandRegion       *dest,
+                       const MetaBandRegion *src)
+{
+  if (dest == src)
+    return;
+
+  ensure_boxes (&dest->boxes, &dest->size, src->n_boxes);
+  memcpy (dest->boxes, src->boxes, src->n_boxes * sizeof (MetaRegionBox));
+  dest->n_boxes = src->n_boxes;
+}
+
+/**
+ * meta_band_region_to_cairo:
+ * @region: a #MetaBandRegion
+ *
+ * Return value: (transfer full): a new #cairo_region_t with the same
+ *   area as @region
+ */
+cairo_region_t *
+meta_band_region_to_cairo (const MetaBandRegion *region)
+{
+  cairo_rectangle_int_t *rects;
+  cairo_region_t *result;
+  int i;
+
+  if (region->n_boxes == 0)
+    return cairo_region_create ();
+
+  rects = g_new (cairo_rectangle_int_t, region->n_boxes);
+  for (i = 0; i < region->n_boxes; i++)
+    {
+      const MetaRegionBox *box = &region->boxes[i];
+
+      rects[i].x = box->x1;
+      rects[i].y = box->y1;
+      rects[i].width = box->x2 - box->x1;
+      rects[i].height = box->y2 - box->y1;
+    }
+
+  result = cairo_region_create_rectangles (rects, region->n_boxes);
+  g_free (rects);
+
+  return result;
+}
+
+gboolean
+meta_band_region_is_empty (const MetaBandRegion *region)
+{
+  return region->n_boxes == 0;
+}
+
+void
+meta_band_region_get_extents (const MetaBandRegion  *region,
+                              cairo_rectangle_int_t *extents)
+{
+  int x1, x2, i;
+
+  if (region->n_boxes == 0)
+    {
+      extents->x = extents->y = extents->width = extents->height = 0;
+      return;
+    }
+
+  x1 = region->boxes[0].x1;
+  x2 = region->boxes[0].x2;
+  for (i = 1; i < region->n_boxes; i++)
+    {
+      x1 = MIN (x1, region->boxes[i].x1);
+      x2 = MAX (x2, region->boxes[i].x2);
+    }
+
+  extents->x = x1;
+  extents->y = region->boxes[0].y1;
+  extents->width = x2 - x1;
+  extents->height = region->boxes[region->n_boxes - 1].y2 - extents->y;
+}
+
+void
+meta_band_region_union (MetaBandRegion       *region,
+                        const MetaBandRegion *other)
+{
+  if (other->n_boxes == 0 || region == other)
+    return;
+
+  if (region->n_boxes == 0)
+    {
+      meta_band_region_copy (region, other);
+      return;
+    }
+
+  region_op (region, other, union_bands, TRUE, TRUE);
+}
+
+/* If the last band of @region now has the same rectangles as the band
+ * directly above it, extends that one instead, like writer_end_band() */
+static void
+coalesce_last_band (MetaBandRegion *region)
+{
+  MetaRegionBox *boxes = region->boxes;
+  int n_boxes = region->n_boxes;
+  int cur_band, prev_band, i;
+
+  if (n_boxes < 2)
+    return;
+
+  cur_band = n_boxes - 1;
+  while (cur_band > 0 && boxes[cur_band - 1].y1 == boxes[n_boxes - 1].y1)
+    cur_band--;
+
+  /* The band above has to touch this one and have as many rectangles */
+  prev_band = cur_band - (n_boxes - cur_band);
+  if (prev_band < 0 ||
+      boxes[cur_band - 1].y2 != boxes[cur_band].y1 ||
+      boxes[prev_band].y1 != boxes[cur_band - 1].y1 ||
+      (prev_band > 0 && boxes[prev_band - 1].y1 == boxes[prev_band].y1))
+    return;
+
+  for (i = 0; i < n_boxes - cur_band; i++)
+    {
+      if (boxes[prev_band + i].x1 != boxes[cur_band + i].x1 ||
+          boxes[prev_band + i].x2 != boxes[cur_band + i].x2)
+        return;
+    }
+
+  for (i = 0; i < n_boxes - cur_band; i++)
+    boxes[prev_band + i].y2 = boxes[cur_band + i].y2;
+
+  region->n_boxes = cur_band;
+}
+
+/* Adds @rect to @region if that can be done by appending it, which is
+ * the case when rectangles are added in band order, as when scanning
+ * an image. Returns %FALSE if a real union is needed. */
+static gboolean
+append_rectangle (MetaBandRegion *region,
+                  int             x1,
+                  int             y1,
+                  int             x2,
+                  int             y2)
+{
+  MetaRegionBox *last;
+
+  if (region->n_boxes > 0)
+    {
+      last = &region->boxes[region->n_boxes - 1];
+
+      if (y1 == last->y1 && y2 == last->y2)
+        {
+          /* Same band, further right */
+          if (x1 < last->x1)
+            return FALSE;
+
+          if (x1 <= last->x2)
+            {
+              last->x2 = MAX (last->x2, x2);
+              coalesce_last_band (region);
+              return TRUE;
+            }
+        }
+      else if (y1 < last->y2)
+        {
+          return FALSE;
+        }
+    }
+
+  ensure_boxes (&region->boxes, &region->size, region->n_boxes + 1);
+  last = &region->boxes[region->n_boxes++];
+  last->x1 = x1;
+  last->y1 = y1;
+  last->x2 = x2;
+  last->y2 = y2;
+  coalesce_last_band (region);
+
+  return TRUE;
+}
+
+void
+meta_band_region_union_rectangle (MetaBandRegion              *region,
+                                  const cairo_rectangle_int_t *rect)
+{
+  MetaBandRegion other;
+  MetaRegionBox box;
+
+  if (rect->width <= 0 || rect->height <= 0)
+    return;
+
+  box.x1 = rect->x;
+  box.y1 = rect->y;
+  box.x2 = rect->x + rect->width;
+  box.y2 = rect->y + rect->height;
+
+  if (append_rectangle (region, box.x1, box.y1, box.x2, box.y2))
+    return;
+
+  meta_band_region_init (&other);
+  other.boxes = &box;
+  other.n_boxes = 1;
+
+  region_op (region, &other, union_bands, TRUE, TRUE);
+}
+
+void
+meta_band_region_intersect (MetaBandRegion       *region,
+                            const MetaBandRegion *other)
+{
+  if (region == other)
+    return;
+
+  if (region->n_boxes == 0 || other->n_boxes == 0)
+    {
+      region->n_boxes = 0;
+      return;
+    }
+
+  region_op (region, other, intersect_bands, FALSE, FALSE);
+}
+
+void
+meta_band_region_subtract (MetaBandRegion       *region,
+                           const MetaBandRegion *other)
+{
+  if (region == other)
+    {
+      region->n_boxes = 0;
+      return;
+    }
+
+  if (region->n_boxes == 0 || other->n_boxes == 0)
+    return;
+
+  region_op (region, other, subtract_bands, TRUE, FALSE);
+}
+
+/* Adds (dx1, dy1, dx2, dy2) to every box. Written as a flat loop over
+ * the coordinates, so that the compiler vectorizes it. */
+static void
+offset_boxes (MetaRegionBox *boxes,
+              int            n_boxes,
+              int            dx1,
+              int            dy1,
+              int            dx2,
+              int            dy2)
+{
+  int *coords = (int *) boxes;
+  const int offsets[4] = { dx1, dy1, dx2, dy2 };
+  int i;
+
+  G_STATIC_ASSERT (sizeof (MetaRegionBox) == 4 * sizeof (int));
+
+  for (i = 0; i < 4 * n_boxes; i++)
+    coords[i] += offsets[i & 3];
+}
+
+void
+meta_band_region_translate (MetaBandRegion *region,
+                            int             dx,
+                            int             dy)
+{
+  offset_boxes (region->boxes, region->n_boxes, dx, dy, dx, dy);
+}
 
 /* MetaRegionBuilder */
 
 /* Various algorithms in this file require unioning together a set of rectangles
  * that are unsorted or overlap; unioning such a set of rectangles 1-by-1
- * using cairo_region_union_rectangle() produces O(N^2) behavior (if the union
- * adds or removes rectangles in the middle of the region, then it has to
- * move all the rectangles after that.) To avoid this behavior, MetaRegionBuilder
- * creates regions for small groups of rectangles and merges them together in
- * a binary tree.
+ * produces O(N^2) behavior (if the union adds or removes rectangles in the
+ * middle of the region, then it has to move all the rectangles after that.)
+ * To avoid this behavior, MetaRegionBuilder creates regions for small groups
+ * of rectangles and merges them together in a binary tree.
  *
- * Possible improvement: From a glance at the code, accumulating all the rectangles
- *  into a flat array and then calling the (not usefully documented)
- *  cairo_region_create_rectangles() would have the same behavior and would be
- *  simpler and a bit more efficient.
+ * Rectangles that arrive in band order, as when scanning an image row by
+ * row, are simply appended, and never need to be merged.
  */
 
 /* Optimium performance seems to be with MAX_CHUNK_RECTANGLES=4; 8 is about 10% slower.
@@ -47,10 +770,20 @@ meta_region_builder_init (MetaRegionBuilder *builder)
 {
   int i;
   for (i = 0; i < META_REGION_BUILDER_MAX_LEVELS; i++)
-    builder->levels[i] = NULL;
+    meta_band_region_init (&builder->levels[i]);
   builder->n_levels = 1;
 }
 
+static void
+swap_regions (MetaBandRegion *a,
+              MetaBandRegion *b)
+{
+  MetaBandRegion tmp = *a;
+
+  *a = *b;
+  *b = tmp;
+}
+
 void
 meta_region_builder_add_rectangle (MetaRegionBuilder *builder,
                                    int                x,
@@ -61,67 +794,75 @@ meta_region_builder_add_rectangle (MetaRegionBuilder *builder,
   cairo_rectangle_int_t rect;
   int i;
 
-  if (builder->levels[0] == NULL)
-    builder->levels[0] = cairo_region_create ();
+  if (width <= 0 || height <= 0)
+    return;
+
+  if (append_rectangle (&builder->levels[0], x, y, x + width, y + height))
+    return;
 
   rect.x = x;
   rect.y = y;
   rect.width = width;
   rect.height = height;
 
-  cairo_region_union_rectangle (builder->levels[0], &rect);
-  if (cairo_region_num_rectangles (builder->levels[0]) >= MAX_CHUNK_RECTANGLES)
+  meta_band_region_union_rectangle (&builder->levels[0], &rect);
+  if (builder->levels[0].n_boxes < MAX_CHUNK_RECTANGLES)
+    return;
+
+  for (i = 1; i < META_REGION_BUILDER_MAX_LEVELS; i++)
     {
-      for (i = 1; i < builder->n_levels + 1; i++)
+      MetaBandRegion *level = &builder->levels[i];
+      MetaBandRegion *below = &builder->levels[i - 1];
+
+      if (meta_band_region_is_empty (level))
         {
-          if (builder->levels[i] == NULL)
-            {
-              if (i < META_REGION_BUILDER_MAX_LEVELS)
-                {
-                  builder->levels[i] = builder->levels[i - 1];
-                  builder->levels[i - 1] = NULL;
-                  if (i == builder->n_levels)
-                    builder->n_levels++;
-                }
-
-              break;
-            }
-          else
-            {
-              cairo_region_union (builder->levels[i], builder->levels[i - 1]);
-              cairo_region_destroy (builder->levels[i - 1]);
-              builder->levels[i - 1] = NULL;
-            }
+          /* Also hands the memory of the free slot down for reuse */
+          swap_regions (level, below);
+          if (i == builder->n_levels)
+            builder->n_levels++;
+
+          return;
         }
+
+      meta_band_region_union (level, below);
+      meta_band_region_set_empty (below);
     }
 }
 
-cairo_region_t *
-meta_region_builder_finish (MetaRegionBuilder *builder)
+static void
+builder_finish (MetaRegionBuilder *builder,
+                MetaBandRegion    *result)
 {
-  cairo_region_t *result = NULL;
   int i;
 
+  meta_band_region_set_empty (result);
+
   for (i = 0; i < builder->n_levels; i++)
     {
-      if (builder->levels[i])
-        {
-          if (result == NULL)
-            result = builder->levels[i];
-          else
-            {
-              cairo_region_union(result, builder->levels[i]);
-              cairo_region_destroy (builder->levels[i]);
-            }
-        }
-    }
+      MetaBandRegion *level = &builder->levels[i];
 
-  if (result == NULL)
-    result = cairo_region_create ();
+      if (meta_band_region_is_empty (result))
+        swap_regions (result, level);
+      else
+        meta_band_region_union (result, level);
 
-  return result;
+      meta_band_region_fini (level);
+    }
 }
 
+cairo_region_t *
+meta_region_builder_finish (MetaRegionBuilder *builder)
+{
+  MetaBandRegion result;
+  cairo_region_t *region;
+
+  meta_band_region_init (&result);
+  builder_finish (builder, &result);
+  region = meta_band_region_to_cairo (&result);
+  meta_band_region_fini (&result);
+
+  return region;
+}
 
 /* MetaRegionIterator */
 
@@ -172,6 +913,46 @@ meta_region_iterator_next (MetaRegionIterator *iter)
     }
 }
 
+/* MetaBandRegionIterator */
+
+void
+meta_band_region_iterator_init (MetaBandRegionIterator *iter,
+                                const MetaBandRegion   *region)
+{
+  iter->region = region;
+  iter->i = -1;
+  iter->line_end = TRUE;
+
+  meta_band_region_iterator_next (iter);
+}
+
+gboolean
+meta_band_region_iterator_at_end (MetaBandRegionIterator *iter)
+{
+  return iter->i >= iter->region->n_boxes;
+}
+
+void
+meta_band_region_iterator_next (MetaBandRegionIterator *iter)
+{
+  const MetaRegionBox *boxes = iter->region->boxes;
+  int n_boxes = iter->region->n_boxes;
+  const MetaRegionBox *box;
+
+  iter->i++;
+  if (iter->i >= n_boxes)
+    return;
+
+  box = &boxes[iter->i];
+  iter->rectangle.x = box->x1;
+  iter->rectangle.y = box->y1;
+  iter->rectangle.width = box->x2 - box->x1;
+  iter->rectangle.height = box->y2 - box->y1;
+
+  iter->line_start = iter->line_end;
+  iter->line_end = iter->i + 1 >= n_boxes || boxes[iter->i + 1].y1 != box->y1;
+}
+
 static void
 add_expanded_rect (MetaRegionBuilder  *builder,
                    int                 x,
@@ -192,49 +973,112 @@ add_expanded_rect (MetaRegionBuilder  *builder,
                                        width + 2 * x_amount, height + 2 * y_amount);
 }
 
-static cairo_region_t *
-expand_region (cairo_region_t *region,
-               int             x_amount,
-               int             y_amount,
-               gboolean        flip)
+static void
+expand_region (const MetaBandRegion *region,
+               int                   x_amount,
+               int                   y_amount,
+               gboolean              flip,
+               MetaBandRegion       *result)
 {
   MetaRegionBuilder builder;
-  int n;
   int i;
 
   meta_region_builder_init (&builder);
 
-  n = cairo_region_num_rectangles (region);
-  for (i = 0; i < n; i++)
+  for (i = 0; i < region->n_boxes; i++)
     {
-      cairo_rectangle_int_t rect;
+      const MetaRegionBox *box = &region->boxes[i];
 
-      cairo_region_get_rectangle (region, i, &rect);
       add_expanded_rect (&builder,
-                         rect.x, rect.y, rect.width, rect.height,
+                         box->x1, box->y1, box->x2 - box->x1, box->y2 - box->y1,
                          x_amount, y_amount, flip);
     }
 
-  return meta_region_builder_finish (&builder);
+  builder_finish (&builder, result);
+}
+
+/**
+ * meta_band_region_expand:
+ * @region: a #MetaBandRegion
+ * @x_amount: how far to grow the region to the left and right
+ * @y_amount: how far to grow the region up and down
+ *
+ * Grows every rectangle of @region by the given amounts.
+ */
+void
+meta_band_region_expand (MetaBandRegion *region,
+                         int             x_amount,
+                         int             y_amount)
+{
+  MetaBandRegion result;
+
+  /* Growing horizontally only keeps the bands where they are, so it
+   * only needs the rectangles that now touch within each band merged,
+   * and then the bands that have become the same as the one above.
+   * That is written over the region itself, never ahead of where it
+   * is read. */
+  if (y_amount == 0)
+    {
+      BoxWriter writer;
+      int band_y1 = 0;
+      int i;
+
+      writer.boxes = region->boxes;
+      writer.size = region->size;
+      writer.n_boxes = 0;
+      writer.prev_band = -1;
+      writer.cur_band = 0;
+
+      for (i = 0; i < region->n_boxes; i++)
+        {
+          MetaRegionBox box = region->boxes[i];
+
+          box.x1 -= x_amount;
+          box.x2 += x_amount;
+
+          if (i == 0 || box.y1 != band_y1)
+            {
+              writer_end_band (&writer);
+              writer_begin_band (&writer);
+              band_y1 = box.y1;
+            }
+
+          if (writer.n_boxes > writer.cur_band &&
+              writer.boxes[writer.n_boxes - 1].x2 >= box.x1)
+            writer.boxes[writer.n_boxes - 1].x2 = MAX (writer.boxes[writer.n_boxes - 1].x2, box.x2);
+          else
+            writer_add (&writer, box.x1, box.y1, box.x2, box.y2);
+        }
+
+      writer_end_band (&writer);
+      region->n_boxes = writer.n_boxes;
+      return;
+    }
+
+  meta_band_region_init (&result);
+  expand_region (region, x_amount, y_amount, FALSE, &result);
+  swap_regions (region, &result);
+  meta_band_region_fini (&result);
 }
 
 /* This computes a (clipped version) of the inverse of the region
  * and expands it by the given amount */
-static cairo_region_t *
-expand_region_inverse (cairo_region_t *region,
-                       int             x_amount,
-                       int             y_amount,
-                       gboolean        flip)
+static void
+expand_region_inverse (const MetaBandRegion *region,
+                       int                   x_amount,
+                       int                   y_amount,
+                       gboolean              flip,
+                       MetaBandRegion       *result)
 {
   MetaRegionBuilder builder;
-  MetaRegionIterator iter;
+  MetaBandRegionIterator iter;
   cairo_rectangle_int_t extents;
 
   int last_x;
 
   meta_region_builder_init (&builder);
 
-  cairo_region_get_extents (region, &extents);
+  meta_band_region_get_extents (region, &extents);
   add_expanded_rect (&builder,
                      extents.x, extents.y - 1, extents.width, 1,
                      x_amount, y_amount, flip);
@@ -249,9 +1093,9 @@ expand_region_inverse (cairo_region_t *region,
                      x_amount, y_amount, flip);
 
   last_x = extents.x;
-  for (meta_region_iterator_init (&iter, region);
-       !meta_region_iterator_at_end (&iter);
-       meta_region_iterator_next (&iter))
+  for (meta_band_region_iterator_init (&iter, region);
+       !meta_band_region_iterator_at_end (&iter);
+       meta_band_region_iterator_next (&iter))
     {
       if (iter.rectangle.x > last_x)
         add_expanded_rect (&builder,
@@ -272,7 +1116,7 @@ expand_region_inverse (cairo_region_t *region,
         last_x = iter.rectangle.x + iter.rectangle.width;
     }
 
-  return meta_region_builder_finish (&builder);
+  builder_finish (&builder, result);
 }
 
 /**
@@ -299,13 +1143,24 @@ meta_make_border_region (cairo_region_t *region,
                          int             y_amount,
                          gboolean        flip)
 {
-  cairo_region_t *border_region;
-  cairo_region_t *inverse_region;
+  MetaBandRegion band_region, border_region, inverse_region;
+  cairo_region_t *result;
 
-  border_region = expand_region (region, x_amount, y_amount, flip);
-  inverse_region = expand_region_inverse (region, x_amount, y_amount, flip);
-  cairo_region_intersect (border_region, inverse_region);
-  cairo_region_destroy (inverse_region);
+  meta_band_region_init (&band_region);
+  meta_band_region_init (&border_region);
+  meta_band_region_init (&inverse_region);
 
-  return border_region;
+  meta_band_region_set_from_cairo (&band_region, region);
+
+  expand_region (&band_region, x_amount, y_amount, flip, &border_region);
+  expand_region_inverse (&band_region, x_amount, y_amount, flip, &inverse_region);
+  meta_band_region_intersect (&border_region, &inverse_region);
+
+  result = meta_band_region_to_cairo (&border_region);
+
+  meta_band_region_fini (&band_region);
+  meta_band_region_fini (&border_region);
+  meta_band_region_fini (&inverse_region);
+
+  return result;
 }
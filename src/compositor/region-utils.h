@@ -61,6 +61,65 @@ struct _MetaRegionIterator {
   cairo_rectangle_int_t next_rectangle;
 };
 
+/**
+ * MetaRegionBox:
+ * @x1: left edge
+ * @y1: top edge
+ * @x2: right edge, exclusive
+ * @y2: bottom edge, exclusive
+ */
+typedef struct _MetaRegionBox MetaRegionBox;
+
+struct _MetaRegionBox {
+  int x1, y1, x2, y2;
+};
+
+/**
+ * MetaBandRegion:
+ * @boxes: the rectangles of the region
+ * @n_boxes: the number of rectangles
+ *
+ * A region laid out the same way as cairo_region_t: the rectangles are
+ * sorted into horizontal bands that don't overlap, from top to bottom,
+ * and within a band from left to right. Unlike with cairo_region_t,
+ * we own the memory: the set operations work in place, and reuse the
+ * memory of the region, so computing a region over and over stops
+ * allocating once it has grown to its working size.
+ *
+ * A #MetaBandRegion on the stack is set up with meta_band_region_init()
+ * and its memory released with meta_band_region_fini().
+ */
+typedef struct _MetaBandRegion MetaBandRegion;
+
+struct _MetaBandRegion {
+  MetaRegionBox *boxes;
+  int n_boxes;
+
+  /*< private >*/
+  int size;
+  MetaRegionBox *spare;
+  int spare_size;
+};
+
+/**
+ * MetaBandRegionIterator:
+ * @region: region being iterated
+ * @rectangle: current rectangle
+ * @line_start: whether the current rectangle starts a horizontal band
+ * @line_end: whether the current rectangle ends a horizontal band
+ *
+ * Like #MetaRegionIterator, for a #MetaBandRegion.
+ */
+typedef struct _MetaBandRegionIterator MetaBandRegionIterator;
+
+struct _MetaBandRegionIterator {
+  const MetaBandRegion *region;
+  cairo_rectangle_int_t rectangle;
+  gboolean line_start;
+  gboolean line_end;
+  int i;
+};
+
 typedef struct _MetaRegionBuilder MetaRegionBuilder;
 
 #define META_REGION_BUILDER_MAX_LEVELS 16
@@ -74,8 +133,10 @@ struct _MetaRegionBuilder {
    * |c  |   |ab |
    * |d  |c  |ab |
    * |e  |   |   |abcd|
+   *
+   * where an empty region is a free slot.
    */
-  cairo_region_t *levels[META_REGION_BUILDER_MAX_LEVELS];
+  MetaBandRegion levels[META_REGION_BUILDER_MAX_LEVELS];
   int n_levels;
 };
 
@@ -92,6 +153,41 @@ void     meta_region_iterator_init      (MetaRegionIterator *iter,
 gboolean meta_region_iterator_at_end    (MetaRegionIterator *iter);
 void     meta_region_iterator_next      (MetaRegionIterator *iter);
 
+void     meta_band_region_init          (MetaBandRegion              *region);
+void     meta_band_region_fini          (MetaBandRegion              *region);
+void     meta_band_region_set_empty     (MetaBandRegion              *region);
+void     meta_band_region_set_rectangle (MetaBandRegion              *region,
+                                         const cairo_rectangle_int_t *rect);
+void     meta_band_region_set_from_cairo (MetaBandRegion             *region,
+                                          cairo_region_t             *cairo_region);
+void     meta_band_region_copy          (MetaBandRegion              *dest,
+                                         const MetaBandRegion        *src);
+cairo_region_t *meta_band_region_to_cairo (const MetaBandRegion      *region);
+
+gboolean meta_band_region_is_empty      (const MetaBandRegion        *region);
+void     meta_band_region_get_extents   (const MetaBandRegion        *region,
+                                         cairo_rectangle_int_t       *extents);
+
+void     meta_band_region_union         (MetaBandRegion              *region,
+                                         const MetaBandRegion        *other);
+void     meta_band_region_union_rectangle (MetaBandRegion            *region,
+                                           const cairo_rectangle_int_t *rect);
+void     meta_band_region_intersect     (MetaBandRegion              *region,
+                                         const MetaBandRegion        *other);
+void     meta_band_region_subtract      (MetaBandRegion              *region,
+                                         const MetaBandRegion        *other);
+void     meta_band_region_translate     (MetaBandRegion              *region,
+                                         int                          dx,
+                                         int                          dy);
+void     meta_band_region_expand        (MetaBandRegion              *region,
+                                         int                          x_amount,
+                                         int                          y_amount);
+
+void     meta_band_region_iterator_init   (MetaBandRegionIterator *iter,
+                                           const MetaBandRegion   *region);
+gboolean meta_band_region_iterator_at_end (MetaBandRegionIterator *iter);
+void     meta_band_region_iterator_next   (MetaBandRegionIterator *iter);
+
 cairo_region_t *meta_make_border_region (cairo_region_t *region,
                                          int             x_amount,
                                          int             y_amount,
@@ -0,0 +1,384 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Mutter band region testing program */
+
+/*
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Every operation on a MetaBandRegion is compared with the same
+ * operation on a cairo_region_t. The rectangles have to be the same
+ * ones, in the same order, not just cover the same area: the band
+ * region is meant to stay in the canonical form of cairo's.
+ */
+
+#include <config.h>
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>      /* To initialize random seed */
+
+#include "region-utils.h"
+
+#define NUM_RANDOM_RUNS 2000
+
+static void
+init_random_ness ()
+{
+  srand(time(NULL));
+}
+
+/* Small rectangles in a small area, so that they overlap and touch a
+ * lot */
+static void
+get_random_rect (cairo_rectangle_int_t *rect)
+{
+  rect->x = rand () % 64;
+  rect->y = rand () % 64;
+  rect->width  = rand () % 24 + 1;
+  rect->height = rand () % 24 + 1;
+}
+
+/* Builds the same random region both ways; also exercises appending,
+ * when the rectangles come in band order */
+static void
+get_random_regions (MetaBandRegion  *band_region,
+                    cairo_region_t **cairo_region)
+{
+  int n_rects = rand () % 8;
+  gboolean in_rows = rand () % 2;
+  int i;
+
+  meta_band_region_set_empty (band_region);
+  *cairo_region = cairo_region_create ();
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+
+      if (in_rows)
+        {
+          /* Rows of one pixel, scanned top to bottom and left to
+           * right, with spans that are often the same as above */
+          rect.y = i / 2;
+          rect.height = 1;
+          rect.x = (i % 2) * 16 + rand () % 2;
+          rect.width = 8 + rand () % 2;
+        }
+      else
+        {
+          get_random_rect (&rect);
+        }
+
+      meta_band_region_union_rectangle (band_region, &rect);
+      cairo_region_union_rectangle (*cairo_region, &rect);
+    }
+}
+
+static void
+assert_same_region (const MetaBandRegion *band_region,
+                    cairo_region_t       *cairo_region)
+{
+  MetaBandRegionIterator iter;
+  cairo_rectangle_int_t band_extents, cairo_extents;
+  int i;
+
+  g_assert_cmpint (band_region->n_boxes, ==, cairo_region_num_rectangles (cairo_region));
+
+  i = 0;
+  for (meta_band_region_iterator_init (&iter, band_region);
+       !meta_band_region_iterator_at_end (&iter);
+       meta_band_region_iterator_next (&iter))
+    {
+      cairo_rectangle_int_t rect;
+
+      cairo_region_get_rectangle (cairo_region, i++, &rect);
+      g_assert_cmpint (iter.rectangle.x, ==, rect.x);
+      g_assert_cmpint (iter.rectangle.y, ==, rect.y);
+      g_assert_cmpint (iter.rectangle.width, ==, rect.width);
+      g_assert_cmpint (iter.rectangle.height, ==, rect.height);
+    }
+  g_assert_cmpint (i, ==, band_region->n_boxes);
+
+  g_assert (meta_band_region_is_empty (band_region) == cairo_region_is_empty (cairo_region));
+
+  if (!cairo_region_is_empty (cairo_region))
+    {
+      meta_band_region_get_extents (band_region, &band_extents);
+      cairo_region_get_extents (cairo_region, &cairo_extents);
+      g_assert (band_extents.x == cairo_extents.x &&
+                band_extents.y == cairo_extents.y &&
+                band_extents.width == cairo_extents.width &&
+                band_extents.height == cairo_extents.height);
+    }
+}
+
+static void
+test_union_rectangle ()
+{
+  MetaBandRegion band_region;
+  cairo_region_t *cairo_region;
+  int i;
+
+  meta_band_region_init (&band_region);
+
+  for (i = 0; i < NUM_RANDOM_RUNS; i++)
+    {
+      get_random_regions (&band_region, &cairo_region);
+      assert_same_region (&band_region, cairo_region);
+      cairo_region_destroy (cairo_region);
+    }
+
+  meta_band_region_fini (&band_region);
+
+  printf ("%s passed.\n", G_STRFUNC);
+}
+
+static void
+test_set_rectangle ()
+{
+  MetaBandRegion band_region;
+  cairo_region_t *cairo_region;
+  cairo_rectangle_int_t rect;
+  int i;
+
+  meta_band_region_init (&band_region);
+
+  for (i = 0; i < NUM_RANDOM_RUNS; i++)
+    {
+      get_random_rect (&rect);
+
+      /* Also empty ones */
+      if (i % 10 == 0)
+        rect.width = 0;
+
+      meta_band_region_set_rectangle (&band_region, &rect);
+      cairo_region = cairo_region_create_rectangle (&rect);
+      assert_same_region (&band_region, cairo_region);
+      cairo_region_destroy (cairo_region);
+    }
+
+  meta_band_region_fini (&band_region);
+
+  printf ("%s passed.\n", G_STRFUNC);
+}
+
+static void
+test_cairo_conversion ()
+{
+  MetaBandRegion band_region, copy;
+  cairo_region_t *cairo_region, *converted;
+  int i;
+
+  meta_band_region_init (&band_region);
+  meta_band_region_init (&copy);
+
+  for (i = 0; i < NUM_RANDOM_RUNS; i++)
+    {
+      get_random_regions (&band_region, &cairo_region);
+
+      meta_band_region_set_from_cairo (&copy, cairo_region);
+      assert_same_region (&copy, cairo_region);
+
+      meta_band_region_copy (&copy, &band_region);
+      assert_same_region (&copy, cairo_region);
+
+      converted = meta_band_region_to_cairo (&band_region);
+      g_assert (cairo_region_equal (converted, cairo_region));
+
+      cairo_region_destroy (converted);
+      cairo_region_destroy (cairo_region);
+    }
+
+  meta_band_region_fini (&band_region);
+  meta_band_region_fini (&copy);
+
+  printf ("%s passed.\n", G_STRFUNC);
+}
+
+static void
+test_set_operations ()
+{
+  MetaBandRegion band_a, band_b, band_result;
+  cairo_region_t *cairo_a, *cairo_b, *cairo_result;
+  int i;
+
+  meta_band_region_init (&band_a);
+  meta_band_region_init (&band_b);
+  meta_band_region_init (&band_result);
+
+  for (i = 0; i < NUM_RANDOM_RUNS; i++)
+    {
+      get_random_regions (&band_a, &cairo_a);
+      get_random_regions (&band_b, &cairo_b);
+
+      meta_band_region_copy (&band_result, &band_a);
+      meta_band_region_union (&band_result, &band_b);
+      cairo_result = cairo_region_copy (cairo_a);
+      cairo_region_union (cairo_result, cairo_b);
+      assert_same_region (&band_result, cairo_result);
+      cairo_region_destroy (cairo_result);
+
+      meta_band_region_copy (&band_result, &band_a);
+      meta_band_region_intersect (&band_result, &band_b);
+      cairo_result = cairo_region_copy (cairo_a);
+      cairo_region_intersect (cairo_result, cairo_b);
+      assert_same_region (&band_result, cairo_result);
+      cairo_region_destroy (cairo_result);
+
+      meta_band_region_copy (&band_result, &band_a);
+      meta_band_region_subtract (&band_result, &band_b);
+      cairo_result = cairo_region_copy (cairo_a);
+      cairo_region_subtract (cairo_result, cairo_b);
+      assert_same_region (&band_result, cairo_result);
+      cairo_region_destroy (cairo_result);
+
+      /* With itself */
+      meta_band_region_copy (&band_result, &band_a);
+      meta_band_region_subtract (&band_result, &band_result);
+      g_assert (meta_band_region_is_empty (&band_result));
+
+      cairo_region_destroy (cairo_a);
+      cairo_region_destroy (cairo_b);
+    }
+
+  meta_band_region_fini (&band_a);
+  meta_band_region_fini (&band_b);
+  meta_band_region_fini (&band_result);
+
+  printf ("%s passed.\n", G_STRFUNC);
+}
+
+static void
+test_translate ()
+{
+  MetaBandRegion band_region;
+  cairo_region_t *cairo_region;
+  int i;
+
+  meta_band_region_init (&band_region);
+
+  for (i = 0; i < NUM_RANDOM_RUNS; i++)
+    {
+      int dx = rand () % 200 - 100;
+      int dy = rand () % 200 - 100;
+
+      get_random_regions (&band_region, &cairo_region);
+
+      meta_band_region_translate (&band_region, dx, dy);
+      cairo_region_translate (cairo_region, dx, dy);
+      assert_same_region (&band_region, cairo_region);
+
+      cairo_region_destroy (cairo_region);
+    }
+
+  meta_band_region_fini (&band_region);
+
+  printf ("%s passed.\n", G_STRFUNC);
+}
+
+static void
+test_expand ()
+{
+  MetaBandRegion band_region;
+  cairo_region_t *cairo_region, *expanded;
+  int i, j;
+
+  meta_band_region_init (&band_region);
+
+  for (i = 0; i < NUM_RANDOM_RUNS; i++)
+    {
+      int x_amount = rand () % 8;
+      /* Growing only horizontally has its own path */
+      int y_amount = i % 2 ? 0 : rand () % 8;
+
+      get_random_regions (&band_region, &cairo_region);
+
+      expanded = cairo_region_create ();
+      for (j = 0; j < cairo_region_num_rectangles (cairo_region); j++)
+        {
+          cairo_rectangle_int_t rect;
+
+          cairo_region_get_rectangle (cairo_region, j, &rect);
+          rect.x -= x_amount;
+          rect.y -= y_amount;
+          rect.width += 2 * x_amount;
+          rect.height += 2 * y_amount;
+          cairo_region_union_rectangle (expanded, &rect);
+        }
+
+      meta_band_region_expand (&band_region, x_amount, y_amount);
+      assert_same_region (&band_region, expanded);
+
+      cairo_region_destroy (expanded);
+      cairo_region_destroy (cairo_region);
+    }
+
+  meta_band_region_fini (&band_region);
+
+  printf ("%s passed.\n", G_STRFUNC);
+}
+
+static void
+test_region_builder ()
+{
+  MetaRegionBuilder builder;
+  cairo_region_t *built, *expected;
+  int i, j;
+
+  for (i = 0; i < NUM_RANDOM_RUNS; i++)
+    {
+      int n_rects = rand () % 40;
+
+      meta_region_builder_init (&builder);
+      expected = cairo_region_create ();
+
+      for (j = 0; j < n_rects; j++)
+        {
+          cairo_rectangle_int_t rect;
+
+          get_random_rect (&rect);
+          meta_region_builder_add_rectangle (&builder,
+                                             rect.x, rect.y, rect.width, rect.height);
+          cairo_region_union_rectangle (expected, &rect);
+        }
+
+      built = meta_region_builder_finish (&builder);
+      g_assert (cairo_region_equal (built, expected));
+
+      cairo_region_destroy (built);
+      cairo_region_destroy (expected);
+    }
+
+  printf ("%s passed.\n", G_STRFUNC);
+}
+
+int
+main()
+{
+  init_random_ness ();
+
+  test_union_rectangle ();
+  test_set_rectangle ();
+  test_cairo_conversion ();
+  test_set_operations ();
+  test_translate ();
+  test_expand ();
+  test_region_builder ();
+
+  printf ("All tests passed.\n");
+  return 0;
+}
@@ -0,0 +1,231 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Mutter shadow blur testing program */
+
+/*
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The vectorized box blur and transpose that shadows are made with
+ * must give exactly the same bytes as the scalar code they replace;
+ * this compares them on random buffers and regions.
+ */
+
+#include <config.h>
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>      /* To initialize random seed */
+
+#include "meta-shadow-factory-private.h"
+
+#define NUM_RANDOM_RUNS 200
+
+static const MetaShadowBlurImpl simd_impls[] = {
+  META_SHADOW_BLUR_SSE2,
+  META_SHADOW_BLUR_AVX2
+};
+
+static void
+init_random_ness ()
+{
+  srand(time(NULL));
+}
+
+/* Widths and heights are odd, so never a multiple of the 16 or 32
+ * columns the vectorized code works on, and at least 32 so that all
+ * implementations can be used */
+static int
+get_random_size (void)
+{
+  return (32 + rand () % 200) | 1;
+}
+
+static guchar *
+new_random_buffer (int width,
+                   int height)
+{
+  guchar *buffer = g_malloc (width * height);
+  int i;
+
+  for (i = 0; i < width * height; i++)
+    buffer[i] = rand () % 256;
+
+  return buffer;
+}
+
+/* A region of up to a few random rectangles inside a width by height
+ * buffer, in coordinates that are offset by x_offset and y_offset */
+static cairo_region_t *
+new_random_region (int width,
+                   int height,
+                   int x_offset,
+                   int y_offset)
+{
+  cairo_region_t *region = cairo_region_create ();
+  int n_rects = 1 + rand () % 4;
+  int i;
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+
+      rect.x = rand () % width;
+      rect.y = rand () % height;
+      rect.width = 1 + rand () % (width - rect.x);
+      rect.height = 1 + rand () % (height - rect.y);
+      rect.x -= x_offset;
+      rect.y -= y_offset;
+
+      cairo_region_union_rectangle (region, &rect);
+    }
+
+  return region;
+}
+
+static void
+check_flip (MetaShadowBlurImpl impl,
+            int                width,
+            int                height)
+{
+  guchar *scalar, *simd;
+
+  scalar = new_random_buffer (width, height);
+  simd = g_memdup (scalar, width * height);
+
+  scalar = meta_shadow_flip_buffer (META_SHADOW_BLUR_SCALAR, scalar, width, height);
+  simd = meta_shadow_flip_buffer (impl, simd, width, height);
+  g_assert (memcmp (scalar, simd, width * height) == 0);
+
+  g_free (scalar);
+  g_free (simd);
+}
+
+static void
+test_flip_buffer ()
+{
+  guint i, j;
+
+  for (i = 0; i < G_N_ELEMENTS (simd_impls); i++)
+    {
+      MetaShadowBlurImpl impl = simd_impls[i];
+
+      if (!meta_shadow_blur_impl_usable (impl, 32, 32, 2))
+        continue;
+
+      /* Whole blocks only, in place and not */
+      check_flip (impl, 32, 32);
+      check_flip (impl, 64, 32);
+
+      for (j = 0; j < NUM_RANDOM_RUNS; j++)
+        {
+          int width = get_random_size ();
+          int height = get_random_size ();
+
+          check_flip (impl, width, height);
+          check_flip (impl, width, width);
+        }
+    }
+
+  printf ("%s passed.\n", G_STRFUNC);
+}
+
+static void
+check_blur (MetaShadowBlurImpl impl,
+            int                width,
+            int                height,
+            int                d)
+{
+  cairo_region_t *row_convolve_region;
+  cairo_region_t *column_convolve_region;
+  guchar *scalar, *simd;
+  int x_offset, y_offset;
+
+  if (!meta_shadow_blur_impl_usable (impl, width, height, d))
+    return;
+
+  x_offset = rand () % 16;
+  y_offset = rand () % 16;
+
+  /* The column region has x and y interchanged */
+  row_convolve_region = new_random_region (width, height, x_offset, y_offset);
+  column_convolve_region = new_random_region (height, width, y_offset, x_offset);
+
+  scalar = new_random_buffer (width, height);
+  simd = g_memdup (scalar, width * height);
+
+  scalar = meta_shadow_blur_buffer (META_SHADOW_BLUR_SCALAR, scalar, width, height,
+                                    row_convolve_region, column_convolve_region,
+                                    x_offset, y_offset, d);
+  simd = meta_shadow_blur_buffer (impl, simd, width, height,
+                                  row_convolve_region, column_convolve_region,
+                                  x_offset, y_offset, d);
+  g_assert (memcmp (scalar, simd, width * height) == 0);
+
+  g_free (scalar);
+  g_free (simd);
+  cairo_region_destroy (row_convolve_region);
+  cairo_region_destroy (column_convolve_region);
+}
+
+static void
+test_blur_buffer ()
+{
+  /* Both parities of small filters, and the largest ones the window
+   * sums still fit 16 bits for */
+  static const int filter_sizes[] = { 1, 2, 3, 4, 5, 8, 21, 64, 127, 254, 255 };
+  guint i, j, k;
+
+  for (i = 0; i < G_N_ELEMENTS (simd_impls); i++)
+    {
+      MetaShadowBlurImpl impl = simd_impls[i];
+
+      if (!meta_shadow_blur_impl_usable (impl, 32, 32, 2))
+        continue;
+
+      for (j = 0; j < G_N_ELEMENTS (filter_sizes); j++)
+        {
+          int d = filter_sizes[j];
+
+          for (k = 0; k < NUM_RANDOM_RUNS / 10; k++)
+            {
+              int width = get_random_size ();
+              int height = get_random_size ();
+
+              check_blur (impl, width, height, d);
+              check_blur (impl, width, width, d);
+            }
+        }
+
+      for (k = 0; k < NUM_RANDOM_RUNS; k++)
+        check_blur (impl, get_random_size (), get_random_size (), 1 + rand () % 255);
+    }
+
+  printf ("%s passed.\n", G_STRFUNC);
+}
+
+int
+main()
+{
+  init_random_ness ();
+
+  test_flip_buffer ();
+  test_blur_buffer ();
+
+  printf ("All tests passed.\n");
+  return 0;
+}
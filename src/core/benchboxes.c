@@ -0,0 +1,291 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Mutter box operation benchmarking program */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Times the work done for each work area recompute (see
+ * workspace.c:ensure_work_areas_validated()) on a few strut and monitor
+ * layouts, once through the list functions of boxes.c and once through
+ * their array variants.
+ */
+
+#include "boxes-private.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_ITERATIONS 20000
+
+typedef struct
+{
+  const char    *name;
+  MetaRectangle  screen;
+  MetaRectangle *monitors;
+  int            n_monitors;
+  GSList        *struts;
+} Layout;
+
+static void
+add_strut (Layout *layout,
+           int x, int y, int width, int height, MetaSide side)
+{
+  MetaStrut *strut;
+
+  strut = g_new (MetaStrut, 1);
+  strut->rect = meta_rect (x, y, width, height);
+  strut->side = side;
+  layout->struts = g_slist_prepend (layout->struts, strut);
+}
+
+static void
+set_monitors (Layout              *layout,
+              const MetaRectangle *monitors,
+              int                  n_monitors)
+{
+  int i;
+
+  layout->monitors = g_memdup (monitors, n_monitors * sizeof (MetaRectangle));
+  layout->n_monitors = n_monitors;
+
+  layout->screen = monitors[0];
+  for (i = 1; i < n_monitors; i++)
+    meta_rectangle_union (&layout->screen, &monitors[i], &layout->screen);
+}
+
+static void
+get_layout (int which, Layout *layout)
+{
+  memset (layout, 0, sizeof (Layout));
+
+  switch (which)
+    {
+    case 0:
+      {
+        /* A laptop with a top bar */
+        MetaRectangle monitors[] = { { 0, 0, 1920, 1080 } };
+
+        layout->name = "single monitor, top bar";
+        set_monitors (layout, monitors, G_N_ELEMENTS (monitors));
+        add_strut (layout,    0,    0, 1920,   32, META_SIDE_TOP);
+      }
+      break;
+    case 1:
+      {
+        /* Side by side monitors of different heights, each with a
+         * panel, and a dock on the left
+         */
+        MetaRectangle monitors[] = { {    0, 0, 1920, 1200 },
+                                     { 1920, 0, 2560, 1440 } };
+
+        layout->name = "two monitors, panels and dock";
+        set_monitors (layout, monitors, G_N_ELEMENTS (monitors));
+        add_strut (layout,    0,    0, 1920,   32, META_SIDE_TOP);
+        add_strut (layout, 1920,    0, 2560,   32, META_SIDE_TOP);
+        add_strut (layout,    0,  300,   64,  600, META_SIDE_LEFT);
+        add_strut (layout, 1920, 1400, 2560,   40, META_SIDE_BOTTOM);
+      }
+      break;
+    case 2:
+      {
+        /* Three monitors, one of them rotated, with panels at the top
+         * and bottom of each and partial docks
+         */
+        MetaRectangle monitors[] = { {    0, 240, 1920, 1080 },
+                                     { 1920,   0, 2560, 1440 },
+                                     { 4480,   0, 1080, 1920 } };
+
+        layout->name = "three monitors, partial struts";
+        set_monitors (layout, monitors, G_N_ELEMENTS (monitors));
+        add_strut (layout,    0,  240, 1920,   28, META_SIDE_TOP);
+        add_strut (layout, 1920,    0, 2560,   28, META_SIDE_TOP);
+        add_strut (layout, 4480,    0, 1080,   28, META_SIDE_TOP);
+        add_strut (layout,  400, 1280, 1120,   40, META_SIDE_BOTTOM);
+        add_strut (layout, 2500, 1380, 1400,   60, META_SIDE_BOTTOM);
+        add_strut (layout, 4480, 1880,  800,   40, META_SIDE_BOTTOM);
+        add_strut (layout,    0,  500,   48,  600, META_SIDE_LEFT);
+        add_strut (layout, 5512,  400,   48, 1100, META_SIDE_RIGHT);
+      }
+      break;
+    case 3:
+      {
+        /* A single big monitor with lots of small partial struts, as
+         * from many docks and desktop widgets along the edges
+         */
+        MetaRectangle monitors[] = { { 0, 0, 3840, 2160 } };
+        int i;
+
+        layout->name = "single monitor, 32 partial struts";
+        set_monitors (layout, monitors, G_N_ELEMENTS (monitors));
+        for (i = 0; i < 8; i++)
+          {
+            add_strut (layout, 100 + 460 * i,    0, 200,  30 + 5 * i,
+                       META_SIDE_TOP);
+            add_strut (layout, 150 + 460 * i, 2120, 250,  40,
+                       META_SIDE_BOTTOM);
+            add_strut (layout,    0, 80 + 250 * i,  40 + 4 * i, 150,
+                       META_SIDE_LEFT);
+            add_strut (layout, 3800, 120 + 250 * i, 40, 120,
+                       META_SIDE_RIGHT);
+          }
+      }
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static void
+free_layout (Layout *layout)
+{
+  g_slist_free_full (layout->struts, g_free);
+  g_free (layout->monitors);
+}
+
+/* Does what ensure_work_areas_validated() does with the list functions,
+ * returning the total number of rectangles and edges found
+ */
+static int
+run_lists (Layout *layout)
+{
+  GList *monitor_rects;
+  GList *result;
+  int    total, i;
+
+  total = 0;
+  for (i = 0; i < layout->n_monitors; i++)
+    {
+      result =
+        meta_rectangle_get_minimal_spanning_set_for_region (
+          &layout->monitors[i],
+          layout->struts);
+      total += g_list_length (result);
+      meta_rectangle_free_list_and_elements (result);
+    }
+
+  result =
+    meta_rectangle_get_minimal_spanning_set_for_region (&layout->screen,
+                                                        layout->struts);
+  total += g_list_length (result);
+  meta_rectangle_free_list_and_elements (result);
+
+  result = meta_rectangle_find_onscreen_edges (&layout->screen,
+                                               layout->struts);
+  total += g_list_length (result);
+  meta_rectangle_free_list_and_elements (result);
+
+  monitor_rects = NULL;
+  for (i = 0; i < layout->n_monitors; i++)
+    monitor_rects = g_list_prepend (monitor_rects, &layout->monitors[i]);
+  result = meta_rectangle_find_nonintersected_monitor_edges (monitor_rects,
+                                                             layout->struts);
+  total += g_list_length (result);
+  meta_rectangle_free_list_and_elements (result);
+  g_list_free (monitor_rects);
+
+  return total;
+}
+
+/* Same as run_lists() with the array variants */
+static int
+run_arrays (Layout *layout)
+{
+  GList  *monitor_rects;
+  GArray *result;
+  int     total, i;
+
+  total = 0;
+  for (i = 0; i < layout->n_monitors; i++)
+    {
+      result =
+        meta_rectangle_get_minimal_spanning_set_for_region_array (
+          &layout->monitors[i],
+          layout->struts);
+      total += result->len;
+      g_array_free (result, TRUE);
+    }
+
+  result =
+    meta_rectangle_get_minimal_spanning_set_for_region_array (&layout->screen,
+                                                              layout->struts);
+  total += result->len;
+  g_array_free (result, TRUE);
+
+  result = meta_rectangle_find_onscreen_edges_array (&layout->screen,
+                                                     layout->struts);
+  total += result->len;
+  g_array_free (result, TRUE);
+
+  monitor_rects = NULL;
+  for (i = 0; i < layout->n_monitors; i++)
+    monitor_rects = g_list_prepend (monitor_rects, &layout->monitors[i]);
+  result =
+    meta_rectangle_find_nonintersected_monitor_edges_array (monitor_rects,
+                                                            layout->struts);
+  total += result->len;
+  g_array_free (result, TRUE);
+  g_list_free (monitor_rects);
+
+  return total;
+}
+
+static double
+time_runs (Layout *layout,
+           int   (*run) (Layout *layout),
+           int    *total)
+{
+  gint64 start;
+  int    i;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < NUM_ITERATIONS; i++)
+    *total = run (layout);
+
+  return (double) (g_get_monotonic_time () - start) / NUM_ITERATIONS;
+}
+
+int
+main (int argc, char **argv)
+{
+  int which;
+
+  printf ("%-36s %8s %12s %12s\n",
+          "layout", "results", "lists (us)", "arrays (us)");
+
+  for (which = 0; which < 4; which++)
+    {
+      Layout layout;
+      int    list_total, array_total;
+      double list_time, array_time;
+
+      get_layout (which, &layout);
+
+      /* Warm up, and make sure both give the same amount of results */
+      g_assert (run_lists (&layout) == run_arrays (&layout));
+
+      list_time  = time_runs (&layout, run_lists,  &list_total);
+      array_time = time_runs (&layout, run_arrays, &array_total);
+      g_assert (list_total == array_total);
+
+      printf ("%-36s %8d %12.2f %12.2f\n",
+              layout.name, list_total, list_time, array_time);
+
+      free_layout (&layout);
+    }
+
+  return 0;
+}
@@ -88,6 +88,14 @@ GList*   meta_rectangle_get_minimal_spanning_set_for_region (
                                          const MetaRectangle *basic_rect,
                                          const GSList        *all_struts);
 
+/* Same as meta_rectangle_get_minimal_spanning_set_for_region(), but
+ * returning a GArray of MetaRectangle, to be freed with
+ * g_array_free (array, TRUE).  The list version is built from this one.
+ */
+GArray*  meta_rectangle_get_minimal_spanning_set_for_region_array (
+                                         const MetaRectangle *basic_rect,
+                                         const GSList        *all_struts);
+
 /* Expand all rectangles in region by the given amount on each side */
 GList*   meta_rectangle_expand_region   (GList               *region,
                                          const int            left_expand,
@@ -202,17 +210,30 @@ GList* meta_rectangle_remove_intersections_with_boxes_from_edges (
                                            GList *edges,
                                            const GSList *rectangles);
 
+/* Same, but working in place on a GArray of MetaEdge; the order of the
+ * edges is not kept.
+ */
+void   meta_rectangle_remove_intersections_with_boxes_from_edge_array (
+                                           GArray *edges,
+                                           const GSList *rectangles);
+
 /* Finds all the edges of an onscreen region, returning a GList* of
- * MetaEdgeRect's.
+ * MetaEdgeRect's, or for the _array variant a GArray of MetaEdge.
  */
 GList* meta_rectangle_find_onscreen_edges (const MetaRectangle *basic_rect,
                                            const GSList        *all_struts);
+GArray* meta_rectangle_find_onscreen_edges_array (
+                                           const MetaRectangle *basic_rect,
+                                           const GSList        *all_struts);
 
 /* Finds edges between adjacent monitors which are not covered by the given
- * struts.
+ * struts; again the _array variant returns a GArray of MetaEdge.
  */
 GList* meta_rectangle_find_nonintersected_monitor_edges (
                                            const GList         *monitor_rects,
                                            const GSList        *all_struts);
+GArray* meta_rectangle_find_nonintersected_monitor_edges_array (
+                                           const GList         *monitor_rects,
+                                           const GSList        *all_struts);
 
 #endif /* META_BOXES_PRIVATE_H */
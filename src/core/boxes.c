@@ -31,6 +31,7 @@
 #include "boxes-private.h"
 #include <meta/util.h>
 #include <X11/Xutil.h>  /* Just for the definition of the various gravities */
+#include <string.h>
 
 /* It would make sense to use GSlice here, but until we clean up the
  * rest of this file and the internal API to use these functions, we
@@ -423,36 +424,86 @@ meta_rectangle_resize_with_gravity (const MetaRectangle *old_rect,
   rect->height = new_height;
 }
 
-/* Not so simple helper function for get_minimal_spanning_set_for_region() */
+/* Turns an array of MetaRectangles or MetaEdges into a list of
+ * individually allocated copies, in the same order, and frees the array.
+ */
 static GList*
-merge_spanning_rects_in_region (GList *region)
+list_from_array (GArray *array)
+{
+  guint  size = g_array_get_element_size (array);
+  GList *ret = NULL;
+  int    i;
+
+  for (i = array->len - 1; i >= 0; i--)
+    ret = g_list_prepend (ret, g_memdup (array->data + i * size, size));
+
+  g_array_free (array, TRUE);
+  return ret;
+}
+
+/* Reverses the order of the MetaRectangles or MetaEdges in array */
+static void
+reverse_array (GArray *array)
+{
+  guint  size = g_array_get_element_size (array);
+  char   temp[sizeof (MetaEdge)];
+  char  *low, *high;
+
+  g_assert (size <= sizeof (temp));
+
+  if (array->len < 2)
+    return;
+
+  low  = array->data;
+  high = array->data + (array->len - 1) * size;
+  while (low < high)
+    {
+      memcpy (temp, low,  size);
+      memcpy (low,  high, size);
+      memcpy (high, temp, size);
+      low  += size;
+      high -= size;
+    }
+}
+
+/* Not so simple helper function for get_minimal_spanning_set_for_region() */
+static void
+merge_spanning_rects_in_region (GArray *region)
 {
   /* NOTE FOR ANY OPTIMIZATION PEOPLE OUT THERE: Please see the
    * documentation of get_minimal_spanning_set_for_region() for performance
    * considerations that also apply to this function.
    */
 
-  GList* compare;
-  compare = region;
+  int compare, other, n_kept;
 
-  if (region == NULL)
+  if (region->len == 0)
     {
       meta_warning ("Region to merge was empty!  Either you have a some "
                     "pathological STRUT list or there's a bug somewhere!\n");
-      return NULL;
+      return;
     }
 
-  while (compare && compare->next)
+  /* Rectangles that are no longer wanted are marked by making them empty,
+   * and only taken out of the array at the end, rather than moving all
+   * the ones after them down each time.
+   */
+  for (compare = 0; compare < (int)region->len; compare++)
     {
-      MetaRectangle *a = compare->data;
-      GList *other = compare->next;
+      MetaRectangle *a = &g_array_index (region, MetaRectangle, compare);
+
+      if (a->width == 0)
+        continue;
 
       g_assert (a->width > 0 && a->height > 0);
 
-      while (other)
+      for (other = compare + 1; other < (int)region->len; other++)
         {
-          MetaRectangle *b = other->data;
-          GList *delete_me = NULL;
+          MetaRectangle *b = &g_array_index (region, MetaRectangle, other);
+          int delete_me = -1;
+
+          if (b->width == 0)
+            continue;
 
           g_assert (b->width > 0 && b->height > 0);
 
@@ -507,30 +558,31 @@ merge_spanning_rects_in_region (GList *region)
                 }
             }
 
-          other = other->next;
-
-          /* Delete any rectangle in the list that is no longer wanted */
-          if (delete_me != NULL)
+          /* Mark any rectangle that is no longer wanted */
+          if (delete_me == other)
+            b->width = 0;
+          else if (delete_me == compare)
             {
-              /* Deleting the rect we compare others to is a little tricker */
-              if (compare == delete_me)
-                {
-                  compare = compare->next;
-                  other = compare->next;
-                  a = compare->data;
-                }
-
-              /* Okay, we can free it now */
-              g_free (delete_me->data);
-              region = g_list_delete_link (region, delete_me);
+              /* Deleting the rect we compare others to is a little
+               * tricker; carry on comparing with the next one left.
+               */
+              a->width = 0;
+              do
+                compare++;
+              while (g_array_index (region, MetaRectangle, compare).width == 0);
+              a = &g_array_index (region, MetaRectangle, compare);
+              other = compare;
             }
-
         }
-
-      compare = compare->next;
     }
 
-  return region;
+  /* Now take the deleted rectangles out */
+  n_kept = 0;
+  for (compare = 0; compare < (int)region->len; compare++)
+    if (g_array_index (region, MetaRectangle, compare).width != 0)
+      g_array_index (region, MetaRectangle, n_kept++) =
+        g_array_index (region, MetaRectangle, compare);
+  g_array_set_size (region, n_kept);
 }
 
 /* Simple helper function for get_minimal_spanning_set_for_region()... */
@@ -590,23 +642,39 @@ GList*
 meta_rectangle_get_minimal_spanning_set_for_region (
   const MetaRectangle *basic_rect,
   const GSList  *all_struts)
+{
+  return list_from_array (
+    meta_rectangle_get_minimal_spanning_set_for_region_array (basic_rect,
+                                                              all_struts));
+}
+
+/**
+ * meta_rectangle_get_minimal_spanning_set_for_region_array: (skip)
+ *
+ * Like meta_rectangle_get_minimal_spanning_set_for_region(), but returns
+ * a #GArray of #MetaRectangle.
+ */
+GArray*
+meta_rectangle_get_minimal_spanning_set_for_region_array (
+  const MetaRectangle *basic_rect,
+  const GSList        *all_struts)
 {
   /* NOTE FOR OPTIMIZERS: This function *might* be somewhat slow,
    * especially due to the call to merge_spanning_rects_in_region() (which
-   * is O(n^2) where n is the size of the list generated in this function).
-   * This is made more onerous due to the fact that it involves a fair
-   * number of memory allocation and deallocation calls.  However, n is 1
-   * for default installations of Gnome (because partial struts aren't used
-   * by default and only partial struts increase the size of the spanning
-   * set generated).  With one partial strut, n will be 2 or 3.  With 2
-   * partial struts, n will probably be 4 or 5.  So, n probably isn't large
-   * enough to make this worth bothering.  Further, it is only called from
-   * workspace.c:ensure_work_areas_validated (at least as of the time of
-   * writing this comment), which in turn should only be called if the
-   * strut list changes or the screen or monitor size changes.  If it ever
-   * does show up on profiles (most likely because people start using
-   * ridiculously huge numbers of partial struts), possible optimizations
-   * include:
+   * is O(n^2) where n is the size of the set generated in this function).
+   * The set is kept in arrays that are reused from strut to strut, so at
+   * least this no longer makes a memory allocation per rectangle.
+   * However, n is 1 for default installations of Gnome (because partial
+   * struts aren't used by default and only partial struts increase the
+   * size of the spanning set generated).  With one partial strut, n will
+   * be 2 or 3.  With 2 partial struts, n will probably be 4 or 5.  So, n
+   * probably isn't large enough to make this worth bothering.  Further,
+   * it is only called from workspace.c:ensure_work_areas_validated (at
+   * least as of the time of writing this comment), which in turn should
+   * only be called if the strut list changes or the screen or monitor
+   * size changes.  If it ever does show up on profiles (most likely
+   * because people start using ridiculously huge numbers of partial
+   * struts), possible optimizations include:
    *
    * (1) rewrite merge_spanning_rects_in_region() to be O(n) or O(nlogn).
    *     I'm not totally sure it's possible, but with a couple copies of
@@ -627,10 +695,11 @@ meta_rectangle_get_minimal_spanning_set_for_region (
    *     URL splitting.)
    */
 
-  GList         *ret;
-  GList         *tmp_list;
+  GArray        *ret;
+  GArray        *old;
   const GSList  *strut_iter;
-  MetaRectangle *temp_rect;
+  MetaRectangle  temp_rect;
+  int            i;
 
   /* The algorithm is basically as follows:
    *   Initialize rectangle_set to basic_rect
@@ -641,80 +710,82 @@ meta_rectangle_get_minimal_spanning_set_for_region (
    *       - Remove the old (pre-split) rectangle from the rectangle_set,
    *         and replace it with the new rectangles generated from the
    *         splitting
+   *
+   * The rectangle_set is kept last to first, so that the new rectangles
+   * can be appended, and reversed before sorting; this keeps ties in the
+   * sort, and so the result of the merging, as they have always been.
    */
 
-  temp_rect = g_new (MetaRectangle, 1);
-  *temp_rect = *basic_rect;
-  ret = g_list_prepend (NULL, temp_rect);
+  ret = g_array_new (FALSE, FALSE, sizeof (MetaRectangle));
+  old = g_array_new (FALSE, FALSE, sizeof (MetaRectangle));
+  g_array_append_val (ret, *basic_rect);
 
   for (strut_iter = all_struts; strut_iter; strut_iter = strut_iter->next)
     {
-      GList *rect_iter;
       MetaStrut *strut = (MetaStrut*)strut_iter->data;
       MetaRectangle *strut_rect = &strut->rect;
+      GArray *tmp_array;
+
+      /* Split the rectangles from the last strut into ret */
+      tmp_array = old;
+      old = ret;
+      ret = tmp_array;
+      g_array_set_size (ret, 0);
 
-      tmp_list = ret;
-      ret = NULL;
-      rect_iter = tmp_list;
-      while (rect_iter)
+      for (i = old->len - 1; i >= 0; i--)
         {
-          MetaRectangle *rect = (MetaRectangle*) rect_iter->data;
+          MetaRectangle *rect = &g_array_index (old, MetaRectangle, i);
 
           if (!meta_rectangle_overlap (strut_rect, rect) ||
               !check_strut_align (strut, basic_rect))
-            ret = g_list_prepend (ret, rect);
+            g_array_append_val (ret, *rect);
           else
             {
               /* If there is area in rect left of strut */
               if (BOX_LEFT (*rect) < BOX_LEFT (*strut_rect))
                 {
-                  temp_rect = g_new (MetaRectangle, 1);
-                  *temp_rect = *rect;
-                  temp_rect->width = BOX_LEFT (*strut_rect) - BOX_LEFT (*rect);
-                  ret = g_list_prepend (ret, temp_rect);
+                  temp_rect = *rect;
+                  temp_rect.width = BOX_LEFT (*strut_rect) - BOX_LEFT (*rect);
+                  g_array_append_val (ret, temp_rect);
                 }
               /* If there is area in rect right of strut */
               if (BOX_RIGHT (*rect) > BOX_RIGHT (*strut_rect))
                 {
                   int new_x;
-                  temp_rect = g_new (MetaRectangle, 1);
-                  *temp_rect = *rect;
+                  temp_rect = *rect;
                   new_x = BOX_RIGHT (*strut_rect);
-                  temp_rect->width = BOX_RIGHT(*rect) - new_x;
-                  temp_rect->x = new_x;
-                  ret = g_list_prepend (ret, temp_rect);
+                  temp_rect.width = BOX_RIGHT(*rect) - new_x;
+                  temp_rect.x = new_x;
+                  g_array_append_val (ret, temp_rect);
                 }
               /* If there is area in rect above strut */
               if (BOX_TOP (*rect) < BOX_TOP (*strut_rect))
                 {
-                  temp_rect = g_new (MetaRectangle, 1);
-                  *temp_rect = *rect;
-                  temp_rect->height = BOX_TOP (*strut_rect) - BOX_TOP (*rect);
-                  ret = g_list_prepend (ret, temp_rect);
+                  temp_rect = *rect;
+                  temp_rect.height = BOX_TOP (*strut_rect) - BOX_TOP (*rect);
+                  g_array_append_val (ret, temp_rect);
                 }
               /* If there is area in rect below strut */
               if (BOX_BOTTOM (*rect) > BOX_BOTTOM (*strut_rect))
                 {
                   int new_y;
-                  temp_rect = g_new (MetaRectangle, 1);
-                  *temp_rect = *rect;
+                  temp_rect = *rect;
                   new_y = BOX_BOTTOM (*strut_rect);
-                  temp_rect->height = BOX_BOTTOM (*rect) - new_y;
-                  temp_rect->y = new_y;
-                  ret = g_list_prepend (ret, temp_rect);
+                  temp_rect.height = BOX_BOTTOM (*rect) - new_y;
+                  temp_rect.y = new_y;
+                  g_array_append_val (ret, temp_rect);
                 }
-              g_free (rect);
             }
-          rect_iter = rect_iter->next;
         }
-      g_list_free (tmp_list);
     }
+  g_array_free (old, TRUE);
 
   /* Sort by maximal area, just because I feel like it... */
-  ret = g_list_sort (ret, compare_rect_areas);
+  reverse_array (ret);
+  g_array_sort (ret, compare_rect_areas);
 
-  /* Merge rectangles if possible so that the list really is minimal */
-  ret = merge_spanning_rects_in_region (ret);
+  /* Merge rectangles if possible so that the set really is minimal */
+  merge_spanning_rects_in_region (ret);
 
   return ret;
 }
@@ -1240,163 +1311,129 @@ meta_rectangle_edge_aligns (const MetaRectangle *rect, const MetaEdge *edge)
     }
 }
 
-static GList*
-get_rect_minus_overlap (const GList   *rect_in_list,
-                        MetaRectangle *overlap)
+/* Puts the parts of rect that are outside of overlap in leftover, which
+ * must have room for four rectangles, and returns how many there are.
+ */
+static int
+get_rect_minus_overlap (const MetaRectangle *rect,
+                        const MetaRectangle *overlap,
+                        MetaRectangle       *leftover)
 {
-  MetaRectangle *temp;
-  MetaRectangle *rect = rect_in_list->data;
-  GList *ret = NULL;
+  int n_leftover = 0;
 
   if (BOX_LEFT (*rect) < BOX_LEFT (*overlap))
     {
-      temp = g_new (MetaRectangle, 1);
-      *temp = *rect;
-      temp->width = BOX_LEFT (*overlap) - BOX_LEFT (*rect);
-      ret = g_list_prepend (ret, temp);
+      leftover[n_leftover] = *rect;
+      leftover[n_leftover].width = BOX_LEFT (*overlap) - BOX_LEFT (*rect);
+      n_leftover++;
     }
   if (BOX_RIGHT (*rect) > BOX_RIGHT (*overlap))
     {
-      temp = g_new (MetaRectangle, 1);
-      *temp = *rect;
-      temp->x = BOX_RIGHT (*overlap);
-      temp->width = BOX_RIGHT (*rect) - BOX_RIGHT (*overlap);
-      ret = g_list_prepend (ret, temp);
+      leftover[n_leftover] = *rect;
+      leftover[n_leftover].x = BOX_RIGHT (*overlap);
+      leftover[n_leftover].width = BOX_RIGHT (*rect) - BOX_RIGHT (*overlap);
+      n_leftover++;
     }
   if (BOX_TOP (*rect) < BOX_TOP (*overlap))
     {
-      temp = g_new (MetaRectangle, 1);
-      temp->x      = overlap->x;
-      temp->width  = overlap->width;
-      temp->y      = BOX_TOP (*rect);
-      temp->height = BOX_TOP (*overlap) - BOX_TOP (*rect);
-      ret = g_list_prepend (ret, temp);
+      leftover[n_leftover].x      = overlap->x;
+      leftover[n_leftover].width  = overlap->width;
+      leftover[n_leftover].y      = BOX_TOP (*rect);
+      leftover[n_leftover].height = BOX_TOP (*overlap) - BOX_TOP (*rect);
+      n_leftover++;
     }
   if (BOX_BOTTOM (*rect) > BOX_BOTTOM (*overlap))
     {
-      temp = g_new (MetaRectangle, 1);
-      temp->x      = overlap->x;
-      temp->width  = overlap->width;
-      temp->y      = BOX_BOTTOM (*overlap);
-      temp->height = BOX_BOTTOM (*rect) - BOX_BOTTOM (*overlap);
-      ret = g_list_prepend (ret, temp);
+      leftover[n_leftover].x      = overlap->x;
+      leftover[n_leftover].width  = overlap->width;
+      leftover[n_leftover].y      = BOX_BOTTOM (*overlap);
+      leftover[n_leftover].height = BOX_BOTTOM (*rect) - BOX_BOTTOM (*overlap);
+      n_leftover++;
     }
 
-  return ret;
+  return n_leftover;
 }
 
-static GList*
-replace_rect_with_list (GList *old_element,
-                        GList *new_list)
+static void
+replace_rect_with_rects (GArray              *rects,
+                         int                  index,
+                         const MetaRectangle *new_rects,
+                         int                  n_new_rects)
 {
-  GList *ret;
-  g_assert (old_element != NULL);
-
-  if (!new_list)
-    {
-      /* If there is no new list, just remove the old_element */
-      ret = g_list_remove_link (old_element, old_element);
-    }
-  else
-    {
-      /* Fix up the prev and next pointers everywhere */
-      ret = new_list;
-      if (old_element->prev)
-        {
-          old_element->prev->next = new_list;
-          new_list->prev = old_element->prev;
-        }
-      if (old_element->next)
-        {
-          GList *tmp = g_list_last (new_list);
-          old_element->next->prev = tmp;
-          tmp->next = old_element->next;
-        }
-    }
-
-  /* Free the old_element and return the appropriate "next" point */
-  g_free (old_element->data);
-  g_list_free_1 (old_element);
-  return ret;
+  g_array_remove_index (rects, index);
+  g_array_insert_vals (rects, index, new_rects, n_new_rects);
 }
 
 /* Make a copy of the strut list, make sure that copy only contains parts
  * of the old_struts that intersect with the region rect, and then do some
  * magic to make all the new struts disjoint (okay, we we break up struts
  * that aren't disjoint in a way that the overlapping part is only included
- * once, so it's not really magic...).
+ * once, so it's not really magic...).  The struts are returned last to
+ * first, in an array of MetaRectangle.
  */
-static GList*
-get_disjoint_strut_rect_list_in_region (const GSList        *old_struts,
-                                        const MetaRectangle *region)
+static GArray*
+get_disjoint_strut_rects_in_region (const GSList        *old_struts,
+                                    const MetaRectangle *region)
 {
-  GList *strut_rects;
-  GList *tmp;
+  GArray *strut_rects;
+  int     tmp, compare;
 
   /* First, copy the list */
-  strut_rects = NULL;
+  strut_rects = g_array_new (FALSE, FALSE, sizeof (MetaRectangle));
   while (old_struts)
     {
       MetaRectangle *cur = &((MetaStrut*)old_struts->data)->rect;
-      MetaRectangle *copy = g_new (MetaRectangle, 1);
-      *copy = *cur;
-      if (meta_rectangle_intersect (copy, region, copy))
-        strut_rects = g_list_prepend (strut_rects, copy);
-      else
-        g_free (copy);
+      MetaRectangle  copy;
+      if (meta_rectangle_intersect (cur, region, &copy))
+        g_array_append_val (strut_rects, copy);
 
       old_struts = old_struts->next;
     }
 
-  /* Now, loop over the list and check for intersections, fixing things up
-   * where they do intersect.
+  /* Now, loop over the struts and check for intersections, fixing things
+   * up where they do intersect.
    */
-  tmp = strut_rects;
-  while (tmp)
+  for (tmp = strut_rects->len - 1; tmp >= 0; tmp--)
     {
-      GList *compare;
-
-      MetaRectangle *cur = tmp->data;
-
-      compare = tmp->next;
-      while (compare)
+      for (compare = tmp - 1; compare >= 0; compare--)
         {
-          MetaRectangle *comp = compare->data;
-          MetaRectangle overlap;
-
-          if (meta_rectangle_intersect (cur, comp, &overlap))
-            {
-              /* Get a list of rectangles for each strut that don't overlap
-               * the intersection region.
-               */
-              GList *cur_leftover  = get_rect_minus_overlap (tmp,  &overlap);
-              GList *comp_leftover = get_rect_minus_overlap (compare, &overlap);
-
-              /* Add the intersection region to cur_leftover */
-              MetaRectangle *overlap_allocated = g_new (MetaRectangle, 1);
-              *overlap_allocated = overlap;
-              cur_leftover = g_list_prepend (cur_leftover, overlap_allocated);
-
-              /* Fix up tmp, compare, and cur -- maybe struts too */
-              if (strut_rects == tmp)
-                {
-                  strut_rects = replace_rect_with_list (tmp, cur_leftover);
-                  tmp = strut_rects;
-                }
-              else
-                tmp   = replace_rect_with_list (tmp,     cur_leftover);
-              compare = replace_rect_with_list (compare, comp_leftover);
-
-              if (compare == NULL)
-                break;
-
-              cur = tmp->data;
-            }
-
-          compare = compare->next;
+          MetaRectangle *cur  = &g_array_index (strut_rects, MetaRectangle, tmp);
+          MetaRectangle *comp = &g_array_index (strut_rects, MetaRectangle,
+                                                compare);
+          MetaRectangle  overlap;
+          MetaRectangle  cur_leftover[5];
+          MetaRectangle  comp_leftover[4];
+          int            n_cur_leftover, n_comp_leftover;
+
+          if (!meta_rectangle_intersect (cur, comp, &overlap))
+            continue;
+
+          /* Get the rectangles for each strut that don't overlap the
+           * intersection region.
+           */
+          n_cur_leftover  = get_rect_minus_overlap (cur,  &overlap,
+                                                    cur_leftover);
+          n_comp_leftover = get_rect_minus_overlap (comp, &overlap,
+                                                    comp_leftover);
+
+          /* Add the intersection region to cur_leftover, last so that it
+           * is the one we carry on comparing with.
+           */
+          cur_leftover[n_cur_leftover++] = overlap;
+
+          /* Fix up tmp and compare; comp comes first, so tmp moves */
+          replace_rect_with_rects (strut_rects, compare,
+                                   comp_leftover, n_comp_leftover);
+          tmp += n_comp_leftover - 1;
+          replace_rect_with_rects (strut_rects, tmp,
+                                   cur_leftover, n_cur_leftover);
+          tmp += n_cur_leftover - 1;
+
+          /* Carry on after the first of what is left of comp, or if
+           * nothing is, after the strut that followed it.
+           */
+          compare += n_comp_leftover - 1;
         }
-
-      tmp = tmp->next;
     }
 
   return strut_rects;
@@ -1564,63 +1601,61 @@ rectangle_and_edge_intersection (const MetaRectangle *rect,
   return intersect;
 }
 
-/* Add all edges of the given rect to cur_edges and return the result.  If
+/* Add all edges of the given rect to the end of cur_edges.  If
  * rect_is_internal is false, the side types are switched (LEFT<->RIGHT and
  * TOP<->BOTTOM).
  */
-static GList*
-add_edges (GList               *cur_edges,
+static void
+add_edges (GArray              *cur_edges,
            const MetaRectangle *rect,
            gboolean             rect_is_internal)
 {
-  MetaEdge *temp_edge;
+  MetaEdge temp_edge;
   int i;
 
   for (i=0; i<4; i++)
     {
-      temp_edge = g_new (MetaEdge, 1);
-      temp_edge->rect = *rect;
+      temp_edge.rect = *rect;
       switch (i)
         {
         case 0:
-          temp_edge->side_type =
+          temp_edge.side_type =
             rect_is_internal ? META_SIDE_LEFT : META_SIDE_RIGHT;
-          temp_edge->rect.width = 0;
+          temp_edge.rect.width = 0;
           break;
         case 1:
-          temp_edge->side_type =
+          temp_edge.side_type =
             rect_is_internal ? META_SIDE_RIGHT : META_SIDE_LEFT;
-          temp_edge->rect.x     += temp_edge->rect.width;
-          temp_edge->rect.width  = 0;
+          temp_edge.rect.x     += temp_edge.rect.width;
+          temp_edge.rect.width  = 0;
           break;
         case 2:
-          temp_edge->side_type =
+          temp_edge.side_type =
             rect_is_internal ? META_SIDE_TOP : META_SIDE_BOTTOM;
-          temp_edge->rect.height = 0;
+          temp_edge.rect.height = 0;
           break;
         case 3:
-          temp_edge->side_type =
+          temp_edge.side_type =
             rect_is_internal ? META_SIDE_BOTTOM : META_SIDE_TOP;
-          temp_edge->rect.y      += temp_edge->rect.height;
-          temp_edge->rect.height  = 0;
+          temp_edge.rect.y      += temp_edge.rect.height;
+          temp_edge.rect.height  = 0;
           break;
         }
-      temp_edge->edge_type = META_EDGE_SCREEN;
-      cur_edges = g_list_prepend (cur_edges, temp_edge);
+      temp_edge.edge_type = META_EDGE_SCREEN;
+      g_array_append_val (cur_edges, temp_edge);
     }
-
-  return cur_edges;
 }
 
 /* Remove any part of old_edge that intersects remove and add any resulting
- * edges to cur_list.  Return cur_list when finished.
+ * edges to the end of cur_edges.  old_edge must not point into cur_edges,
+ * which may get reallocated.
  */
-static GList*
-split_edge (GList *cur_list,
+static void
+split_edge (GArray         *cur_edges,
             const MetaEdge *old_edge,
             const MetaEdge *remove)
 {
-  MetaEdge *temp_edge;
+  MetaEdge temp_edge;
   switch (old_edge->side_type)
     {
     case META_SIDE_LEFT:
@@ -1628,20 +1663,18 @@ split_edge (GList *cur_list,
       g_assert (meta_rectangle_vert_overlap (&old_edge->rect, &remove->rect));
       if (BOX_TOP (old_edge->rect)  < BOX_TOP (remove->rect))
         {
-          temp_edge = g_new (MetaEdge, 1);
-          *temp_edge = *old_edge;
-          temp_edge->rect.height = BOX_TOP (remove->rect)
-                                 - BOX_TOP (old_edge->rect);
-          cur_list = g_list_prepend (cur_list, temp_edge);
+          temp_edge = *old_edge;
+          temp_edge.rect.height = BOX_TOP (remove->rect)
+                                - BOX_TOP (old_edge->rect);
+          g_array_append_val (cur_edges, temp_edge);
         }
       if (BOX_BOTTOM (old_edge->rect) > BOX_BOTTOM (remove->rect))
         {
-          temp_edge = g_new (MetaEdge, 1);
-          *temp_edge = *old_edge;
-          temp_edge->rect.y      = BOX_BOTTOM (remove->rect);
-          temp_edge->rect.height = BOX_BOTTOM (old_edge->rect)
-                                 - BOX_BOTTOM (remove->rect);
-          cur_list = g_list_prepend (cur_list, temp_edge);
+          temp_edge = *old_edge;
+          temp_edge.rect.y      = BOX_BOTTOM (remove->rect);
+          temp_edge.rect.height = BOX_BOTTOM (old_edge->rect)
+                                - BOX_BOTTOM (remove->rect);
+          g_array_append_val (cur_edges, temp_edge);
         }
       break;
     case META_SIDE_TOP:
@@ -1649,35 +1682,32 @@ split_edge (GList *cur_list,
       g_assert (meta_rectangle_horiz_overlap (&old_edge->rect, &remove->rect));
       if (BOX_LEFT (old_edge->rect)  < BOX_LEFT (remove->rect))
         {
-          temp_edge = g_new (MetaEdge, 1);
-          *temp_edge = *old_edge;
-          temp_edge->rect.width = BOX_LEFT (remove->rect)
-                                - BOX_LEFT (old_edge->rect);
-          cur_list = g_list_prepend (cur_list, temp_edge);
+          temp_edge = *old_edge;
+          temp_edge.rect.width = BOX_LEFT (remove->rect)
+                               - BOX_LEFT (old_edge->rect);
+          g_array_append_val (cur_edges, temp_edge);
         }
       if (BOX_RIGHT (old_edge->rect) > BOX_RIGHT (remove->rect))
         {
-          temp_edge = g_new (MetaEdge, 1);
-          *temp_edge = *old_edge;
-          temp_edge->rect.x     = BOX_RIGHT (remove->rect);
-          temp_edge->rect.width = BOX_RIGHT (old_edge->rect)
-                                - BOX_RIGHT (remove->rect);
-          cur_list = g_list_prepend (cur_list, temp_edge);
+          temp_edge = *old_edge;
+          temp_edge.rect.x     = BOX_RIGHT (remove->rect);
+          temp_edge.rect.width = BOX_RIGHT (old_edge->rect)
+                               - BOX_RIGHT (remove->rect);
+          g_array_append_val (cur_edges, temp_edge);
         }
       break;
     default:
       g_assert_not_reached ();
     }
-
-  return cur_list;
 }
 
 /* Split up edge and remove preliminary edges from strut_edges depending on
- * if and how rect and edge intersect.
+ * if and how rect and edge intersect.  As with split_edge(), edge must not
+ * point into edge_splits.
  */
 static void
-fix_up_edges (MetaRectangle *rect,         MetaEdge *edge,
-              GList         **strut_edges, GList    **edge_splits,
+fix_up_edges (MetaRectangle *rect,         const MetaEdge *edge,
+              GArray        *strut_edges,  GArray         *edge_splits,
               gboolean      *edge_needs_removal)
 {
   MetaEdge overlap;
@@ -1689,33 +1719,29 @@ fix_up_edges (MetaRectangle *rect,         MetaEdge *edge,
   if (handle_type == 0 || handle_type == 1)
     {
       /* Put the result of removing overlap from edge into edge_splits */
-      *edge_splits = split_edge (*edge_splits, edge, &overlap);
+      split_edge (edge_splits, edge, &overlap);
       *edge_needs_removal = TRUE;
     }
 
   if (handle_type == -1 || handle_type == 1)
     {
       /* Remove the overlap from strut_edges */
-      /* First, loop over the edges of the strut */
-      GList *tmp = *strut_edges;
-      while (tmp)
+      /* First, loop over the edges of the strut, from the last so that
+       * the new ones split off at the end are not looked at again.
+       */
+      int i;
+      for (i = strut_edges->len - 1; i >= 0; i--)
         {
-          MetaEdge *cur = tmp->data;
+          MetaEdge cur = g_array_index (strut_edges, MetaEdge, i);
           /* If this is the edge that overlaps, then we need to split it */
-          if (edges_overlap (cur, &overlap))
+          if (edges_overlap (&cur, &overlap))
             {
-              GList *delete_me = tmp;
-
               /* Split this edge into some new ones */
-              *strut_edges = split_edge (*strut_edges, cur, &overlap);
+              split_edge (strut_edges, &cur, &overlap);
 
               /* Delete the old one */
-              tmp = tmp->next;
-              g_free (cur);
-              *strut_edges = g_list_delete_link (*strut_edges, delete_me);
+              g_array_remove_index (strut_edges, i);
             }
-          else
-            tmp = tmp->next;
         }
     }
 }
@@ -1730,6 +1756,47 @@ GList*
 meta_rectangle_remove_intersections_with_boxes_from_edges (
   GList        *edges,
   const GSList *rectangles)
+{
+  GArray *edge_array;
+  GList  *edge_iter;
+  GList  *ret;
+  int     i;
+
+  /* The array variant works from the end of the array where this used to
+   * work from the head of the list, so copy the edges in last to first to
+   * get them back in the order they always came in.
+   */
+  edge_array = g_array_sized_new (FALSE, FALSE, sizeof (MetaEdge),
+                                  g_list_length (edges));
+  g_array_set_size (edge_array, g_list_length (edges));
+  i = edge_array->len;
+  for (edge_iter = edges; edge_iter; edge_iter = edge_iter->next)
+    g_array_index (edge_array, MetaEdge, --i) = *(MetaEdge*) edge_iter->data;
+  meta_rectangle_free_list_and_elements (edges);
+
+  meta_rectangle_remove_intersections_with_boxes_from_edge_array (edge_array,
+                                                                  rectangles);
+
+  ret = NULL;
+  for (i = 0; i < (int)edge_array->len; i++)
+    ret = g_list_prepend (ret,
+                          g_memdup (&g_array_index (edge_array, MetaEdge, i),
+                                    sizeof (MetaEdge)));
+  g_array_free (edge_array, TRUE);
+
+  return ret;
+}
+
+/**
+ * meta_rectangle_remove_intersections_with_boxes_from_edge_array: (skip)
+ *
+ * Like meta_rectangle_remove_intersections_with_boxes_from_edges(), but
+ * works on a #GArray of #MetaEdge in place.
+ */
+void
+meta_rectangle_remove_intersections_with_boxes_from_edge_array (
+  GArray       *edges,
+  const GSList *rectangles)
 {
   const GSList *rect_iter;
   const int opposing = 1;
@@ -1739,16 +1806,19 @@ meta_rectangle_remove_intersections_with_boxes_from_edges (
   while (rect_iter)
     {
       MetaRectangle *rect = rect_iter->data;
-      GList *edge_iter = edges;
-      while (edge_iter)
+      int i;
+
+      /* Go from the last edge, so that the pieces split off and added to
+       * the end are not looked at again.
+       */
+      for (i = edges->len - 1; i >= 0; i--)
         {
-          MetaEdge *edge = edge_iter->data;
+          MetaEdge edge = g_array_index (edges, MetaEdge, i);
           MetaEdge overlap;
           int      handle;
-          gboolean edge_iter_advanced = FALSE;
 
           /* If this edge overlaps with this rect... */
-          if (rectangle_and_edge_intersection (rect, edge, &overlap, &handle))
+          if (rectangle_and_edge_intersection (rect, &edge, &overlap, &handle))
             {
 
               /* "Intersections" where the edges touch but are opposite
@@ -1765,28 +1835,17 @@ meta_rectangle_remove_intersections_with_boxes_from_edges (
                */
               if (handle != opposing)
                 {
-                  /* Keep track of this edge so we can delete it below */
-                  GList *delete_me = edge_iter;
-                  edge_iter = edge_iter->next;
-                  edge_iter_advanced = TRUE;
-
-                  /* Split the edge and add the result to beginning of edges */
-                  edges = split_edge (edges, edge, &overlap);
+                  /* Split the edge and add the result to the end of edges */
+                  split_edge (edges, &edge, &overlap);
 
-                  /* Now free the edge... */
-                  g_free (edge);
-                  edges = g_list_delete_link (edges, delete_me);
+                  /* Now remove the edge... */
+                  g_array_remove_index (edges, i);
                 }
             }
-
-          if (!edge_iter_advanced)
-            edge_iter = edge_iter->next;
         }
 
       rect_iter = rect_iter->next;
     }
-
-  return edges;
 }
 
 /**
@@ -1798,10 +1857,24 @@ GList*
 meta_rectangle_find_onscreen_edges (const MetaRectangle *basic_rect,
                                     const GSList        *all_struts)
 {
-  GList        *ret;
-  GList        *fixed_strut_rects;
-  GList        *edge_iter;
-  const GList  *strut_rect_iter;
+  return list_from_array (
+    meta_rectangle_find_onscreen_edges_array (basic_rect, all_struts));
+}
+
+/**
+ * meta_rectangle_find_onscreen_edges_array: (skip)
+ *
+ * Like meta_rectangle_find_onscreen_edges(), but returns a #GArray of
+ * #MetaEdge.
+ */
+GArray*
+meta_rectangle_find_onscreen_edges_array (const MetaRectangle *basic_rect,
+                                          const GSList        *all_struts)
+{
+  GArray       *ret;
+  GArray       *fixed_strut_rects;
+  GArray       *new_strut_edges;
+  int           strut_index, edge_index;
 
   /* The algorithm is basically as follows:
    *   Make sure the struts are disjoint
@@ -1816,62 +1889,58 @@ meta_rectangle_find_onscreen_edges (const MetaRectangle *basic_rect,
    *         edge_set and the preliminary edge for the strut will need to
    *         be split
    *     Add any remaining "preliminary" strut edges to the edge_set
+   *
+   * Like the struts, the edge_set is kept last to first until it is
+   * sorted; new edges are appended, and the loops go from the end so as
+   * not to look at them again.
    */
 
   /* Make sure the struts are disjoint */
   fixed_strut_rects =
-    get_disjoint_strut_rect_list_in_region (all_struts, basic_rect);
+    get_disjoint_strut_rects_in_region (all_struts, basic_rect);
 
-  /* Start off the list with the edges of basic_rect */
-  ret = add_edges (NULL, basic_rect, TRUE);
+  /* Start off the set with the edges of basic_rect */
+  ret = g_array_new (FALSE, FALSE, sizeof (MetaEdge));
+  add_edges (ret, basic_rect, TRUE);
 
-  strut_rect_iter = fixed_strut_rects;
-  while (strut_rect_iter)
+  new_strut_edges = g_array_new (FALSE, FALSE, sizeof (MetaEdge));
+  for (strut_index = fixed_strut_rects->len - 1;
+       strut_index >= 0;
+       strut_index--)
     {
-      MetaRectangle *strut_rect = (MetaRectangle*) strut_rect_iter->data;
+      MetaRectangle *strut_rect = &g_array_index (fixed_strut_rects,
+                                                  MetaRectangle,
+                                                  strut_index);
 
       /* Get the new possible edges we may need to add from the strut */
-      GList *new_strut_edges = add_edges (NULL, strut_rect, FALSE);
+      g_array_set_size (new_strut_edges, 0);
+      add_edges (new_strut_edges, strut_rect, FALSE);
 
-      edge_iter = ret;
-      while (edge_iter)
+      for (edge_index = ret->len - 1; edge_index >= 0; edge_index--)
         {
-          MetaEdge *cur_edge = edge_iter->data;
-          GList *splits_of_cur_edge = NULL;
+          MetaEdge cur_edge = g_array_index (ret, MetaEdge, edge_index);
           gboolean edge_needs_removal = FALSE;
 
-          fix_up_edges (strut_rect,       cur_edge,
-                        &new_strut_edges, &splits_of_cur_edge,
+          /* The split parts of the edge, if any, go at the end of ret */
+          fix_up_edges (strut_rect,      &cur_edge,
+                        new_strut_edges, ret,
                         &edge_needs_removal);
 
+          /* Delete the old edge */
           if (edge_needs_removal)
-            {
-              /* Delete the old edge */
-              GList *delete_me = edge_iter;
-              edge_iter = edge_iter->next;
-              g_free (cur_edge);
-              ret = g_list_delete_link (ret, delete_me);
-
-              /* Add the new split parts of the edge */
-              ret = g_list_concat (splits_of_cur_edge, ret);
-            }
-          else
-            {
-              edge_iter = edge_iter->next;
-            }
-
-          /* edge_iter was already advanced above */
+            g_array_remove_index (ret, edge_index);
         }
 
-      ret = g_list_concat (new_strut_edges, ret);
-      strut_rect_iter = strut_rect_iter->next;
+      g_array_append_vals (ret, new_strut_edges->data, new_strut_edges->len);
     }
+  g_array_free (new_strut_edges, TRUE);
 
-  /* Sort the list */
-  ret = g_list_sort (ret, meta_rectangle_edge_cmp);
+  /* Sort the edges */
+  reverse_array (ret);
+  g_array_sort (ret, meta_rectangle_edge_cmp);
 
-  /* Free the fixed struts list */
-  meta_rectangle_free_list_and_elements (fixed_strut_rects);
+  /* Free the fixed struts */
+  g_array_free (fixed_strut_rects, TRUE);
 
   return ret;
 }
@@ -1884,18 +1953,37 @@ GList*
 meta_rectangle_find_nonintersected_monitor_edges (
                                     const GList         *monitor_rects,
                                     const GSList        *all_struts)
+{
+  return list_from_array (
+    meta_rectangle_find_nonintersected_monitor_edges_array (monitor_rects,
+                                                            all_struts));
+}
+
+/**
+ * meta_rectangle_find_nonintersected_monitor_edges_array: (skip)
+ *
+ * Like meta_rectangle_find_nonintersected_monitor_edges(), but returns a
+ * #GArray of #MetaEdge.
+ */
+GArray*
+meta_rectangle_find_nonintersected_monitor_edges_array (
+                                    const GList         *monitor_rects,
+                                    const GSList        *all_struts)
 {
   /* This function cannot easily be merged with
    * meta_rectangle_find_onscreen_edges() because real screen edges
    * and strut edges both are of the type "there ain't anything
    * immediately on the other side"; monitor edges are different.
    */
-  GList *ret;
+  GArray *ret;
   const GList  *cur;
   GSList *temp_rects;
 
-  /* Initialize the return list to be empty */
-  ret = NULL;
+  /* Initialize the edges to be empty; like in
+   * meta_rectangle_find_onscreen_edges_array() they are kept last to first
+   * until sorted.
+   */
+  ret = g_array_new (FALSE, FALSE, sizeof (MetaEdge));
 
   /* start of ret with all the edges of monitors that are adjacent to
    * another monitor.
@@ -1940,15 +2028,15 @@ meta_rectangle_find_nonintersected_monitor_edges (
                 {
                   /* We need a left edge for the monitor on the right, and
                    * a right edge for the monitor on the left.  Just fill
-                   * up the edges and stick 'em on the list.
+                   * up the edges and stick 'em on the array.
                    */
-                  MetaEdge *new_edge  = g_new (MetaEdge, 1);
+                  MetaEdge new_edge;
 
-                  new_edge->rect = meta_rect (x, y, width, height);
-                  new_edge->side_type = side_type;
-                  new_edge->edge_type = META_EDGE_MONITOR;
+                  new_edge.rect = meta_rect (x, y, width, height);
+                  new_edge.side_type = side_type;
+                  new_edge.edge_type = META_EDGE_MONITOR;
 
-                  ret = g_list_prepend (ret, new_edge);
+                  g_array_append_val (ret, new_edge);
                 }
             }
 
@@ -1983,15 +2071,15 @@ meta_rectangle_find_nonintersected_monitor_edges (
                 {
                   /* We need a top edge for the monitor on the bottom, and
                    * a bottom edge for the monitor on the top.  Just fill
-                   * up the edges and stick 'em on the list.
+                   * up the edges and stick 'em on the array.
                    */
-                  MetaEdge *new_edge = g_new (MetaEdge, 1);
+                  MetaEdge new_edge;
 
-                  new_edge->rect = meta_rect (x, y, width, height);
-                  new_edge->side_type = side_type;
-                  new_edge->edge_type = META_EDGE_MONITOR;
+                  new_edge.rect = meta_rect (x, y, width, height);
+                  new_edge.side_type = side_type;
+                  new_edge.edge_type = META_EDGE_MONITOR;
 
-                  ret = g_list_prepend (ret, new_edge);
+                  g_array_append_val (ret, new_edge);
                 }
             }
 
@@ -2004,12 +2092,13 @@ meta_rectangle_find_nonintersected_monitor_edges (
   for (; all_struts; all_struts = all_struts->next)
     temp_rects = g_slist_prepend (temp_rects,
                                   &((MetaStrut*)all_struts->data)->rect);
-  ret = meta_rectangle_remove_intersections_with_boxes_from_edges (ret,
-                                                                   temp_rects);
+  meta_rectangle_remove_intersections_with_boxes_from_edge_array (ret,
+                                                                  temp_rects);
   g_slist_free (temp_rects);
 
-  /* Sort the list */
-  ret = g_list_sort (ret, meta_rectangle_edge_cmp);
+  /* Sort the edges */
+  reverse_array (ret);
+  g_array_sort (ret, meta_rectangle_edge_cmp);
 
   return ret;
 }
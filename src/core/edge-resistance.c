@@ -20,6 +20,7 @@
  */
 
 #include <config.h>
+#include <string.h>
 #include "edge-resistance.h"
 #include "boxes-private.h"
 #include "display-private.h"
@@ -47,12 +48,28 @@ struct ResistanceDataForAnEdge
 };
 typedef struct ResistanceDataForAnEdge ResistanceDataForAnEdge;
 
+/* The edges of a window as left visible by the windows above it.
+ * These are kept in the workspace from one grab to the next, and only
+ * worked out again when the window or the windows above it touching
+ * it have changed.
+ */
+struct WindowEdges
+{
+  /* The frame of the window, clipped to the screen */
+  MetaRectangle  rect;
+  /* The frames of the windows above touching rect, bottom to top */
+  GArray        *obscuring;
+  /* The MetaEdges left, last to first */
+  GArray        *edges;
+};
+typedef struct WindowEdges WindowEdges;
+
 struct MetaEdgeResistanceData
 {
-  GArray *left_edges;
-  GArray *right_edges;
-  GArray *top_edges;
-  GArray *bottom_edges;
+  MetaEdgeIndex left_edges;
+  MetaEdgeIndex right_edges;
+  MetaEdgeIndex top_edges;
+  MetaEdgeIndex bottom_edges;
 
   ResistanceDataForAnEdge left_data;
   ResistanceDataForAnEdge right_data;
@@ -168,6 +185,174 @@ find_index_of_edge_near_position (const GArray *edges,
     }
 }
 
+/* The extent of an edge along the other axis than its position */
+static void
+get_edge_span (const MetaEdge *edge,
+               int            *start,
+               int            *end)
+{
+  if (edge->side_type == META_SIDE_LEFT ||
+      edge->side_type == META_SIDE_RIGHT)
+    {
+      *start = BOX_TOP (edge->rect);
+      *end   = BOX_BOTTOM (edge->rect);
+    }
+  else
+    {
+      *start = BOX_LEFT (edge->rect);
+      *end   = BOX_RIGHT (edge->rect);
+    }
+}
+
+void
+meta_edge_index_build (MetaEdgeIndex *index)
+{
+  int len = index->edges->len;
+  int i, node;
+
+  index->n_leaves = 1;
+  while (index->n_leaves < len)
+    index->n_leaves *= 2;
+
+  index->span_start = g_new (int, 2 * index->n_leaves);
+  index->span_end   = g_new (int, 2 * index->n_leaves);
+
+  for (i = 0; i < index->n_leaves; i++)
+    {
+      node = index->n_leaves + i;
+      if (i < len)
+        get_edge_span (g_array_index (index->edges, MetaEdge*, i),
+                       &index->span_start[node],
+                       &index->span_end[node]);
+      else
+        {
+          index->span_start[node] = G_MAXINT;
+          index->span_end[node]   = G_MININT;
+        }
+    }
+
+  for (node = index->n_leaves - 1; node > 0; node--)
+    {
+      index->span_start[node] = MIN (index->span_start[2 * node],
+                                     index->span_start[2 * node + 1]);
+      index->span_end[node]   = MAX (index->span_end[2 * node],
+                                     index->span_end[2 * node + 1]);
+    }
+}
+
+void
+meta_edge_index_free (MetaEdgeIndex *index)
+{
+  g_array_free (index->edges, TRUE);
+  g_free (index->span_start);
+  g_free (index->span_end);
+  index->edges = NULL;
+  index->span_start = NULL;
+  index->span_end = NULL;
+}
+
+static int
+find_edge_in_subtree (const MetaEdgeIndex *index,
+                      int                  node,
+                      int                  first,
+                      int                  last,
+                      int                  from,
+                      int                  low,
+                      int                  high,
+                      gboolean             forward)
+{
+  int mid, found;
+
+  /* Skip subtrees entirely on the wrong side of from, or without any
+   * edge reaching far enough along the other axis
+   */
+  if ((forward && last < from) || (!forward && first > from))
+    return -1;
+  if (index->span_start[node] > high || index->span_end[node] < low)
+    return -1;
+
+  if (node >= index->n_leaves)
+    return first;
+
+  mid = first + (last - first) / 2;
+  if (forward)
+    {
+      found = find_edge_in_subtree (index, 2 * node, first, mid,
+                                    from, low, high, forward);
+      if (found < 0)
+        found = find_edge_in_subtree (index, 2 * node + 1, mid + 1, last,
+                                      from, low, high, forward);
+    }
+  else
+    {
+      found = find_edge_in_subtree (index, 2 * node + 1, mid + 1, last,
+                                    from, low, high, forward);
+      if (found < 0)
+        found = find_edge_in_subtree (index, 2 * node, first, mid,
+                                      from, low, high, forward);
+    }
+
+  return found;
+}
+
+int
+meta_edge_index_find_next_in_span (const MetaEdgeIndex *index,
+                                   int                  from,
+                                   int                  low,
+                                   int                  high,
+                                   gboolean             forward)
+{
+  if (from < 0 || from >= (int)index->edges->len)
+    return -1;
+
+  return find_edge_in_subtree (index, 1, 0, index->n_leaves - 1,
+                               from, low, high, forward);
+}
+
+/* Like meta_edge_index_find_next_in_span(), for edges that
+ * meta_rectangle_edge_aligns() with either old_rect or new_rect.
+ */
+static int
+find_next_aligned_edge (const MetaEdgeIndex *index,
+                        int                  from,
+                        const MetaRectangle *old_rect,
+                        const MetaRectangle *new_rect,
+                        gboolean             horizontal,
+                        gboolean             forward)
+{
+  int old_found, new_found;
+
+  if (horizontal)
+    {
+      old_found = meta_edge_index_find_next_in_span (index, from,
+                                                     BOX_TOP (*old_rect),
+                                                     BOX_BOTTOM (*old_rect),
+                                                     forward);
+      new_found = meta_edge_index_find_next_in_span (index, from,
+                                                     BOX_TOP (*new_rect),
+                                                     BOX_BOTTOM (*new_rect),
+                                                     forward);
+    }
+  else
+    {
+      old_found = meta_edge_index_find_next_in_span (index, from,
+                                                     BOX_LEFT (*old_rect),
+                                                     BOX_RIGHT (*old_rect),
+                                                     forward);
+      new_found = meta_edge_index_find_next_in_span (index, from,
+                                                     BOX_LEFT (*new_rect),
+                                                     BOX_RIGHT (*new_rect),
+                                                     forward);
+    }
+
+  if (old_found < 0)
+    return new_found;
+  if (new_found < 0)
+    return old_found;
+
+  return forward ? MIN (old_found, new_found) : MAX (old_found, new_found);
+}
+
 static gboolean
 points_on_same_side (int ref, int pt1, int pt2)
 {
@@ -175,7 +360,7 @@ points_on_same_side (int ref, int pt1, int pt2)
 }
 
 static int
-find_nearest_position (const GArray        *edges,
+find_nearest_position (const MetaEdgeIndex *index,
                        int                  position,
                        int                  old_position,
                        const MetaRectangle *new_rect,
@@ -187,10 +372,12 @@ find_nearest_position (const GArray        *edges,
    * actual value.  Also, we ignore any edges that aren't relevant
    * given the horizontal/vertical position of new_rect.
    */
+  const GArray *edges = index->edges;
   int low, high, mid;
   int compare;
   MetaEdge *edge;
   int best, best_dist, i;
+  int span_low, span_high;
   gboolean edges_align;
 
   /* Initialize mid, edge, & compare in the off change that the array only
@@ -240,19 +427,34 @@ find_nearest_position (const GArray        *edges,
         }
     }
 
+  /* The rest of the edges have to overlap new_rect along the other
+   * axis, as meta_rectangle_vert_overlap() or
+   * meta_rectangle_horiz_overlap() would have it; that is, share more
+   * than an end point with it.
+   */
+  if (horizontal)
+    {
+      span_low  = BOX_TOP (*new_rect) + 1;
+      span_high = BOX_BOTTOM (*new_rect) - 1;
+    }
+  else
+    {
+      span_low  = BOX_LEFT (*new_rect) + 1;
+      span_high = BOX_RIGHT (*new_rect) - 1;
+    }
+
   /* Now start searching higher than mid */
-  for (i = mid + 1; i < (int)edges->len; i++)
+  for (i = meta_edge_index_find_next_in_span (index, mid + 1,
+                                              span_low, span_high, TRUE);
+       i >= 0;
+       i = meta_edge_index_find_next_in_span (index, i + 1,
+                                              span_low, span_high, TRUE))
     {
       edge = g_array_index (edges, MetaEdge*, i);
       compare = horizontal ? edge->rect.x : edge->rect.y;
 
-      edges_align = horizontal ?
-        meta_rectangle_vert_overlap (&edge->rect, new_rect) :
-        meta_rectangle_horiz_overlap (&edge->rect, new_rect);
-
-      if (edges_align &&
-          (!only_forward ||
-           !points_on_same_side (position, compare, old_position)))
+      if (!only_forward ||
+          !points_on_same_side (position, compare, old_position))
         {
           int dist = ABS (compare - position);
           if (dist < best_dist)
@@ -265,18 +467,17 @@ find_nearest_position (const GArray        *edges,
     }
 
   /* Now start searching lower than mid */
-  for (i = mid-1; i >= 0; i--)
+  for (i = meta_edge_index_find_next_in_span (index, mid - 1,
+                                              span_low, span_high, FALSE);
+       i >= 0;
+       i = meta_edge_index_find_next_in_span (index, i - 1,
+                                              span_low, span_high, FALSE))
     {
       edge = g_array_index (edges, MetaEdge*, i);
       compare = horizontal ? edge->rect.x : edge->rect.y;
 
-      edges_align = horizontal ?
-        meta_rectangle_vert_overlap (&edge->rect, new_rect) :
-        meta_rectangle_horiz_overlap (&edge->rect, new_rect);
-
-      if (edges_align &&
-          (!only_forward ||
-           !points_on_same_side (position, compare, old_position)))
+      if (!only_forward ||
+          !points_on_same_side (position, compare, old_position))
         {
           int dist = ABS (compare - position);
           if (dist < best_dist)
@@ -326,12 +527,13 @@ apply_edge_resistance (MetaWindow                *window,
                        int                        new_pos,
                        const MetaRectangle       *old_rect,
                        const MetaRectangle       *new_rect,
-                       GArray                    *edges,
+                       const MetaEdgeIndex       *index,
                        ResistanceDataForAnEdge   *resistance_data,
                        GSourceFunc                timeout_func,
                        gboolean                   xdir,
                        gboolean                   keyboard_op)
 {
+  const GArray *edges = index->edges;
   int i, begin, end;
   int last_edge;
   gboolean increasing = new_pos > old_pos;
@@ -377,27 +579,18 @@ apply_edge_resistance (MetaWindow                *window,
   begin = CLAMP (begin, 0, last_edge);
   end   = CLAMP (end,   0, last_edge);
 
-  /* Loop over all these edges we're moving past/to. */
-  i = begin;
-  while ((increasing  && i <= end) ||
-         (!increasing && i >= end))
+  /* Loop over all these edges we're moving past/to; only the ones
+   * that align with the window are relevant, so skip the others.
+   */
+  i = find_next_aligned_edge (index, begin, old_rect, new_rect,
+                              xdir, increasing);
+  while (i >= 0 &&
+         ((increasing  && i <= end) ||
+          (!increasing && i >= end)))
     {
-      gboolean  edges_align;
       MetaEdge *edge = g_array_index (edges, MetaEdge*, i);
       int       compare = xdir ? edge->rect.x : edge->rect.y;
 
-      /* Find out if this edge is relevant */
-      edges_align = meta_rectangle_edge_aligns (new_rect, edge)  ||
-                    meta_rectangle_edge_aligns (old_rect, edge);
-
-      /* Nothing to do unless the edges align */
-      if (!edges_align)
-        {
-          /* Go to the next edge in the range */
-          i += increment;
-          continue;
-        }
-
       /* Rest is easier to read if we split on keyboard vs. mouse op */
       if (keyboard_op)
         {
@@ -488,7 +681,8 @@ apply_edge_resistance (MetaWindow                *window,
         }
 
       /* Go to the next edge in the range */
-      i += increment;
+      i = find_next_aligned_edge (index, i + increment, old_rect, new_rect,
+                                  xdir, increasing);
     }
 
   return new_pos;
@@ -498,7 +692,7 @@ static int
 apply_edge_snapping (int                  old_pos,
                      int                  new_pos,
                      const MetaRectangle *new_rect,
-                     GArray              *edges,
+                     const MetaEdgeIndex *edges,
                      gboolean             xdir,
                      gboolean             keyboard_op)
 {
@@ -566,28 +760,28 @@ apply_edge_resistance_to_each_side (MetaDisplay         *display,
       new_left   = apply_edge_snapping (BOX_LEFT (*old_outer),
                                         BOX_LEFT (*new_outer),
                                         new_outer,
-                                        edge_data->left_edges,
+                                        &edge_data->left_edges,
                                         TRUE,
                                         keyboard_op);
 
       new_right  = apply_edge_snapping (BOX_RIGHT (*old_outer),
                                         BOX_RIGHT (*new_outer),
                                         new_outer,
-                                        edge_data->right_edges,
+                                        &edge_data->right_edges,
                                         TRUE,
                                         keyboard_op);
 
       new_top    = apply_edge_snapping (BOX_TOP (*old_outer),
                                         BOX_TOP (*new_outer),
                                         new_outer,
-                                        edge_data->top_edges,
+                                        &edge_data->top_edges,
                                         FALSE,
                                         keyboard_op);
 
       new_bottom = apply_edge_snapping (BOX_BOTTOM (*old_outer),
                                         BOX_BOTTOM (*new_outer),
                                         new_outer,
-                                        edge_data->bottom_edges,
+                                        &edge_data->bottom_edges,
                                         FALSE,
                                         keyboard_op);
     }
@@ -605,7 +799,7 @@ apply_edge_resistance_to_each_side (MetaDisplay         *display,
                                               BOX_LEFT (*new_outer),
                                               old_outer,
                                               new_outer,
-                                              edge_data->left_edges,
+                                              &edge_data->left_edges,
                                               &edge_data->left_data,
                                               timeout_func,
                                               TRUE,
@@ -615,7 +809,7 @@ apply_edge_resistance_to_each_side (MetaDisplay         *display,
                                               BOX_RIGHT (*new_outer),
                                               old_outer,
                                               new_outer,
-                                              edge_data->right_edges,
+                                              &edge_data->right_edges,
                                               &edge_data->right_data,
                                               timeout_func,
                                               TRUE,
@@ -634,7 +828,7 @@ apply_edge_resistance_to_each_side (MetaDisplay         *display,
                                               BOX_TOP (*new_outer),
                                               old_outer,
                                               new_outer,
-                                              edge_data->top_edges,
+                                              &edge_data->top_edges,
                                               &edge_data->top_data,
                                               timeout_func,
                                               FALSE,
@@ -644,7 +838,7 @@ apply_edge_resistance_to_each_side (MetaDisplay         *display,
                                               BOX_BOTTOM (*new_outer),
                                               old_outer,
                                               new_outer,
-                                              edge_data->bottom_edges,
+                                              &edge_data->bottom_edges,
                                               &edge_data->bottom_data,
                                               timeout_func,
                                               FALSE,
@@ -670,70 +864,18 @@ apply_edge_resistance_to_each_side (MetaDisplay         *display,
 void
 meta_display_cleanup_edges (MetaDisplay *display)
 {
-  guint i,j;
   MetaEdgeResistanceData *edge_data = display->grab_edge_resistance_data;
-  GHashTable *edges_to_be_freed;
 
   if (edge_data == NULL) /* Not currently cached */
     return;
 
-  /* We first need to clean out any window edges */
-  edges_to_be_freed = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-                                             g_free, NULL);
-  for (i = 0; i < 4; i++)
-    {
-      GArray *tmp = NULL;
-      MetaSide side;
-      switch (i)
-        {
-        case 0:
-          tmp = edge_data->left_edges;
-          side = META_SIDE_LEFT;
-          break;
-        case 1:
-          tmp = edge_data->right_edges;
-          side = META_SIDE_RIGHT;
-          break;
-        case 2:
-          tmp = edge_data->top_edges;
-          side = META_SIDE_TOP;
-          break;
-        case 3:
-          tmp = edge_data->bottom_edges;
-          side = META_SIDE_BOTTOM;
-          break;
-        default:
-          g_assert_not_reached ();
-        }
-
-      for (j = 0; j < tmp->len; j++)
-        {
-          MetaEdge *edge = g_array_index (tmp, MetaEdge*, j);
-          if (edge->edge_type == META_EDGE_WINDOW &&
-              edge->side_type == side)
-            {
-              /* The same edge will appear in two arrays, and we can't free
-               * it yet we still need to compare edge->side_type for the other
-               * array that it is in.  So store it in a hash table for later
-               * freeing.  Could also do this in a simple linked list.
-               */
-              g_hash_table_insert (edges_to_be_freed, edge, edge);
-            }
-        }
-    }
-
-  /* Now free all the window edges (the key destroy function is g_free) */
-  g_hash_table_destroy (edges_to_be_freed);
-
-  /* Now free the arrays and data */
-  g_array_free (edge_data->left_edges, TRUE);
-  g_array_free (edge_data->right_edges, TRUE);
-  g_array_free (edge_data->top_edges, TRUE);
-  g_array_free (edge_data->bottom_edges, TRUE);
-  edge_data->left_edges = NULL;
-  edge_data->right_edges = NULL;
-  edge_data->top_edges = NULL;
-  edge_data->bottom_edges = NULL;
+  /* Free the arrays and data; the window edges belong to the workspace,
+   * and the monitor and screen edges to its work areas.
+   */
+  meta_edge_index_free (&edge_data->left_edges);
+  meta_edge_index_free (&edge_data->right_edges);
+  meta_edge_index_free (&edge_data->top_edges);
+  meta_edge_index_free (&edge_data->bottom_edges);
 
   /* Cleanup the timeouts */
   if (edge_data->left_data.timeout_setup   &&
@@ -763,10 +905,60 @@ stupid_sort_requiring_extra_pointer_dereference (gconstpointer a,
 }
 
 static void
-cache_edges (MetaDisplay *display,
-             GList *window_edges,
-             GList *monitor_edges,
-             GList *screen_edges)
+count_edge (const MetaEdge *edge,
+            int            *num_left,
+            int            *num_right,
+            int            *num_top,
+            int            *num_bottom)
+{
+  switch (edge->side_type)
+    {
+    case META_SIDE_LEFT:
+      (*num_left)++;
+      break;
+    case META_SIDE_RIGHT:
+      (*num_right)++;
+      break;
+    case META_SIDE_TOP:
+      (*num_top)++;
+      break;
+    case META_SIDE_BOTTOM:
+      (*num_bottom)++;
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static void
+add_edge (MetaEdgeResistanceData *edge_data,
+          MetaEdge               *edge)
+{
+  switch (edge->side_type)
+    {
+    case META_SIDE_LEFT:
+    case META_SIDE_RIGHT:
+      g_array_append_val (edge_data->left_edges.edges, edge);
+      g_array_append_val (edge_data->right_edges.edges, edge);
+      break;
+    case META_SIDE_TOP:
+    case META_SIDE_BOTTOM:
+      g_array_append_val (edge_data->top_edges.edges, edge);
+      g_array_append_val (edge_data->bottom_edges.edges, edge);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+/* window_edges is a list of MetaEdge pointers; monitor_edges and
+ * screen_edges are arrays of MetaEdge, as the workspace keeps them.
+ */
+static void
+cache_edges (MetaDisplay  *display,
+             GList        *window_edges,
+             GArray       *monitor_edges,
+             GArray       *screen_edges)
 {
   MetaEdgeResistanceData *edge_data;
   GList *tmp;
@@ -780,21 +972,32 @@ cache_edges (MetaDisplay *display,
   if (meta_is_verbose())
     {
       int max_edges = MAX (MAX( g_list_length (window_edges),
-                                g_list_length (monitor_edges)),
-                           g_list_length (screen_edges));
+                                monitor_edges->len),
+                           screen_edges->len);
       char big_buffer[(EDGE_LENGTH+2)*max_edges];
+      GList *edge_list;
 
       meta_rectangle_edge_list_to_string (window_edges, ", ", big_buffer);
       meta_topic (META_DEBUG_EDGE_RESISTANCE,
                   "Window edges for resistance  : %s\n", big_buffer);
 
-      meta_rectangle_edge_list_to_string (monitor_edges, ", ", big_buffer);
+      edge_list = NULL;
+      for (i = (int)monitor_edges->len - 1; i >= 0; i--)
+        edge_list = g_list_prepend (edge_list,
+                                    &g_array_index (monitor_edges, MetaEdge, i));
+      meta_rectangle_edge_list_to_string (edge_list, ", ", big_buffer);
       meta_topic (META_DEBUG_EDGE_RESISTANCE,
                   "Monitor edges for resistance: %s\n", big_buffer);
+      g_list_free (edge_list);
 
-      meta_rectangle_edge_list_to_string (screen_edges, ", ", big_buffer);
+      edge_list = NULL;
+      for (i = (int)screen_edges->len - 1; i >= 0; i--)
+        edge_list = g_list_prepend (edge_list,
+                                    &g_array_index (screen_edges, MetaEdge, i));
+      meta_rectangle_edge_list_to_string (edge_list, ", ", big_buffer);
       meta_topic (META_DEBUG_EDGE_RESISTANCE,
                   "Screen edges for resistance  : %s\n", big_buffer);
+      g_list_free (edge_list);
     }
 #endif
 
@@ -802,47 +1005,14 @@ cache_edges (MetaDisplay *display,
    * 1st: Get the total number of each kind of edge
    */
   num_left = num_right = num_top = num_bottom = 0;
-  for (i = 0; i < 3; i++)
-    {
-      tmp = NULL;
-      switch (i)
-        {
-        case 0:
-          tmp = window_edges;
-          break;
-        case 1:
-          tmp = monitor_edges;
-          break;
-        case 2:
-          tmp = screen_edges;
-          break;
-        default:
-          g_assert_not_reached ();
-        }
-
-      while (tmp)
-        {
-          MetaEdge *edge = tmp->data;
-          switch (edge->side_type)
-            {
-            case META_SIDE_LEFT:
-              num_left++;
-              break;
-            case META_SIDE_RIGHT:
-              num_right++;
-              break;
-            case META_SIDE_TOP:
-              num_top++;
-              break;
-            case META_SIDE_BOTTOM:
-              num_bottom++;
-              break;
-            default:
-              g_assert_not_reached ();
-            }
-          tmp = tmp->next;
-        }
-    }
+  for (tmp = window_edges; tmp; tmp = tmp->next)
+    count_edge (tmp->data, &num_left, &num_right, &num_top, &num_bottom);
+  for (i = 0; i < (int)monitor_edges->len; i++)
+    count_edge (&g_array_index (monitor_edges, MetaEdge, i),
+                &num_left, &num_right, &num_top, &num_bottom);
+  for (i = 0; i < (int)screen_edges->len; i++)
+    count_edge (&g_array_index (screen_edges, MetaEdge, i),
+                &num_left, &num_right, &num_top, &num_bottom);
 
   /*
    * 2nd: Allocate the edges
@@ -850,65 +1020,32 @@ cache_edges (MetaDisplay *display,
   g_assert (display->grab_edge_resistance_data == NULL);
   display->grab_edge_resistance_data = g_new0 (MetaEdgeResistanceData, 1);
   edge_data = display->grab_edge_resistance_data;
-  edge_data->left_edges   = g_array_sized_new (FALSE,
-                                               FALSE,
-                                               sizeof(MetaEdge*),
-                                               num_left + num_right);
-  edge_data->right_edges  = g_array_sized_new (FALSE,
-                                               FALSE,
-                                               sizeof(MetaEdge*),
-                                               num_left + num_right);
-  edge_data->top_edges    = g_array_sized_new (FALSE,
-                                               FALSE,
-                                               sizeof(MetaEdge*),
-                                               num_top + num_bottom);
-  edge_data->bottom_edges = g_array_sized_new (FALSE,
-                                               FALSE,
-                                               sizeof(MetaEdge*),
-                                               num_top + num_bottom);
+  edge_data->left_edges.edges   = g_array_sized_new (FALSE,
+                                                     FALSE,
+                                                     sizeof(MetaEdge*),
+                                                     num_left + num_right);
+  edge_data->right_edges.edges  = g_array_sized_new (FALSE,
+                                                     FALSE,
+                                                     sizeof(MetaEdge*),
+                                                     num_left + num_right);
+  edge_data->top_edges.edges    = g_array_sized_new (FALSE,
+                                                     FALSE,
+                                                     sizeof(MetaEdge*),
+                                                     num_top + num_bottom);
+  edge_data->bottom_edges.edges = g_array_sized_new (FALSE,
+                                                     FALSE,
+                                                     sizeof(MetaEdge*),
+                                                     num_top + num_bottom);
 
   /*
    * 3rd: Add the edges to the arrays
    */
-  for (i = 0; i < 3; i++)
-    {
-      tmp = NULL;
-      switch (i)
-        {
-        case 0:
-          tmp = window_edges;
-          break;
-        case 1:
-          tmp = monitor_edges;
-          break;
-        case 2:
-          tmp = screen_edges;
-          break;
-        default:
-          g_assert_not_reached ();
-        }
-
-      while (tmp)
-        {
-          MetaEdge *edge = tmp->data;
-          switch (edge->side_type)
-            {
-            case META_SIDE_LEFT:
-            case META_SIDE_RIGHT:
-              g_array_append_val (edge_data->left_edges, edge);
-              g_array_append_val (edge_data->right_edges, edge);
-              break;
-            case META_SIDE_TOP:
-            case META_SIDE_BOTTOM:
-              g_array_append_val (edge_data->top_edges, edge);
-              g_array_append_val (edge_data->bottom_edges, edge);
-              break;
-            default:
-              g_assert_not_reached ();
-            }
-          tmp = tmp->next;
-        }
-    }
+  for (tmp = window_edges; tmp; tmp = tmp->next)
+    add_edge (edge_data, tmp->data);
+  for (i = 0; i < (int)monitor_edges->len; i++)
+    add_edge (edge_data, &g_array_index (monitor_edges, MetaEdge, i));
+  for (i = 0; i < (int)screen_edges->len; i++)
+    add_edge (edge_data, &g_array_index (screen_edges, MetaEdge, i));
 
   /*
    * 4th: Sort the arrays (FIXME: This is kinda dumb since the arrays were
@@ -916,14 +1053,23 @@ cache_edges (MetaDisplay *display,
    * avoided this sort by sticking them into the array with some simple
    * merging of the lists).
    */
-  g_array_sort (display->grab_edge_resistance_data->left_edges,
+  g_array_sort (edge_data->left_edges.edges,
                 stupid_sort_requiring_extra_pointer_dereference);
-  g_array_sort (display->grab_edge_resistance_data->right_edges,
+  g_array_sort (edge_data->right_edges.edges,
                 stupid_sort_requiring_extra_pointer_dereference);
-  g_array_sort (display->grab_edge_resistance_data->top_edges,
+  g_array_sort (edge_data->top_edges.edges,
                 stupid_sort_requiring_extra_pointer_dereference);
-  g_array_sort (display->grab_edge_resistance_data->bottom_edges,
+  g_array_sort (edge_data->bottom_edges.edges,
                 stupid_sort_requiring_extra_pointer_dereference);
+
+  /*
+   * 5th: Index the arrays, for finding the edges that line up with the
+   * window quickly
+   */
+  meta_edge_index_build (&edge_data->left_edges);
+  meta_edge_index_build (&edge_data->right_edges);
+  meta_edge_index_build (&edge_data->top_edges);
+  meta_edge_index_build (&edge_data->bottom_edges);
 }
 
 static void
@@ -942,19 +1088,129 @@ initialize_grab_edge_resistance_data (MetaDisplay *display)
   edge_data->bottom_data.keyboard_buildup = 0;
 }
 
+static void
+window_edges_free (WindowEdges *window_edges)
+{
+  g_array_free (window_edges->obscuring, TRUE);
+  g_array_free (window_edges->edges, TRUE);
+  g_free (window_edges);
+}
+
+/* Whether two rectangles intersect or merely touch; a box touching an
+ * edge of a window can still cut it.
+ */
+static gboolean
+rectangles_touch (const MetaRectangle *rect1,
+                  const MetaRectangle *rect2)
+{
+  return BOX_LEFT (*rect1) <= BOX_RIGHT (*rect2)  &&
+         BOX_LEFT (*rect2) <= BOX_RIGHT (*rect1)  &&
+         BOX_TOP (*rect1)  <= BOX_BOTTOM (*rect2) &&
+         BOX_TOP (*rect2)  <= BOX_BOTTOM (*rect1);
+}
+
+/* Works out the edges of a window at rect, less the portions covered
+ * by the obscuring windows; takes ownership of obscuring.
+ */
+static WindowEdges *
+window_edges_new (const MetaRectangle *rect,
+                  GArray              *obscuring)
+{
+  WindowEdges *window_edges;
+  GArray *new_edges;
+  GSList *obscuring_rects;
+  MetaEdge new_edge;
+  int i;
+
+  /* The edges are appended last to first, which is the order that
+   * meta_rectangle_remove_intersections_with_boxes_from_edge_array()
+   * works in.
+   */
+  new_edges = g_array_sized_new (FALSE, FALSE, sizeof (MetaEdge), 4);
+
+  /* Left side of this window is resistance for the right edge of
+   * the window being moved.
+   */
+  new_edge.rect = *rect;
+  new_edge.rect.width = 0;
+  new_edge.side_type = META_SIDE_RIGHT;
+  new_edge.edge_type = META_EDGE_WINDOW;
+  g_array_append_val (new_edges, new_edge);
+
+  /* Right side of this window is resistance for the left edge of
+   * the window being moved.
+   */
+  new_edge.rect = *rect;
+  new_edge.rect.x += new_edge.rect.width;
+  new_edge.rect.width = 0;
+  new_edge.side_type = META_SIDE_LEFT;
+  new_edge.edge_type = META_EDGE_WINDOW;
+  g_array_append_val (new_edges, new_edge);
+
+  /* Top side of this window is resistance for the bottom edge of
+   * the window being moved.
+   */
+  new_edge.rect = *rect;
+  new_edge.rect.height = 0;
+  new_edge.side_type = META_SIDE_BOTTOM;
+  new_edge.edge_type = META_EDGE_WINDOW;
+  g_array_append_val (new_edges, new_edge);
+
+  /* Top side of this window is resistance for the bottom edge of
+   * the window being moved.
+   */
+  new_edge.rect = *rect;
+  new_edge.rect.y += new_edge.rect.height;
+  new_edge.rect.height = 0;
+  new_edge.side_type = META_SIDE_TOP;
+  new_edge.edge_type = META_EDGE_WINDOW;
+  g_array_append_val (new_edges, new_edge);
+
+  /* Remove edge portions overlapped by the windows above */
+  obscuring_rects = NULL;
+  for (i = obscuring->len - 1; i >= 0; i--)
+    obscuring_rects = g_slist_prepend (obscuring_rects,
+                                       &g_array_index (obscuring, MetaRectangle, i));
+
+  meta_rectangle_remove_intersections_with_boxes_from_edge_array (
+    new_edges,
+    obscuring_rects);
+  g_slist_free (obscuring_rects);
+
+  window_edges = g_new (WindowEdges, 1);
+  window_edges->rect = *rect;
+  window_edges->obscuring = obscuring;
+  window_edges->edges = new_edges;
+
+  return window_edges;
+}
+
+/* Whether the edges worked out earlier still hold for a window at rect
+ * with the given obscuring windows.
+ */
+static gboolean
+window_edges_unchanged (const WindowEdges   *window_edges,
+                        const MetaRectangle *rect,
+                        const GArray        *obscuring)
+{
+  return meta_rectangle_equal (&window_edges->rect, rect) &&
+         window_edges->obscuring->len == obscuring->len &&
+         memcmp (window_edges->obscuring->data, obscuring->data,
+                 obscuring->len * sizeof (MetaRectangle)) == 0;
+}
+
 static void
 compute_resistance_and_snapping_edges (MetaDisplay *display)
 {
+  MetaWorkspace *workspace = display->screen->active_workspace;
   GList *stacked_windows;
   GList *cur_window_iter;
   GList *edges;
-  /* Lists of window positions (rects) and their relative stacking positions */
-  int stack_position;
-  GSList *obscuring_windows, *window_stacking;
-  /* The portions of the above lists that still remain at the stacking position
-   * in the layer that we are working on
-   */
-  GSList *rem_windows, *rem_win_stacking;
+  /* The relevant windows and their positions (rects), bottom to top */
+  GPtrArray *windows;
+  GArray *rects;
+  GHashTable *old_window_edges;
+  guint i, j;
 
   g_assert (display->grab_window != NULL);
   meta_topic (META_DEBUG_WINDOW_OPS,
@@ -966,151 +1222,102 @@ compute_resistance_and_snapping_edges (MetaDisplay *display)
    */
   stacked_windows =
     meta_stack_list_windows (display->screen->stack,
-                             display->screen->active_workspace);
+                             workspace);
 
   /*
-   * 2nd: we need to separate that stacked list into a list of windows that
-   * can obscure other edges.  To make sure we only have windows obscuring
-   * those below it instead of going both ways, we also need to keep a
-   * counter list.  Messy, I know.
+   * 2nd: we need the positions of the windows that can obscure other
+   * edges.  Windows only obscure the edges of those below them.
    */
-  obscuring_windows = window_stacking = NULL;
-  cur_window_iter = stacked_windows;
-  stack_position = 0;
-  while (cur_window_iter != NULL)
+  windows = g_ptr_array_new ();
+  rects = g_array_new (FALSE, FALSE, sizeof (MetaRectangle));
+  for (cur_window_iter = stacked_windows;
+       cur_window_iter != NULL;
+       cur_window_iter = cur_window_iter->next)
     {
       MetaWindow *cur_window = cur_window_iter->data;
       if (WINDOW_EDGES_RELEVANT (cur_window, display))
         {
-          MetaRectangle *new_rect;
-          new_rect = g_new (MetaRectangle, 1);
-          meta_window_get_frame_rect (cur_window, new_rect);
-          obscuring_windows = g_slist_prepend (obscuring_windows, new_rect);
-          window_stacking =
-            g_slist_prepend (window_stacking, GINT_TO_POINTER (stack_position));
+          MetaRectangle rect;
+          meta_window_get_frame_rect (cur_window, &rect);
+          g_ptr_array_add (windows, cur_window);
+          g_array_append_val (rects, rect);
         }
-
-      stack_position++;
-      cur_window_iter = cur_window_iter->next;
     }
-  /* Put 'em in bottom to top order */
-  rem_windows = obscuring_windows = g_slist_reverse (obscuring_windows);
-  rem_win_stacking = window_stacking = g_slist_reverse (window_stacking);
+  g_list_free (stacked_windows);
 
   /*
    * 3rd: loop over the windows again, this time getting the edges from
-   * them and removing intersections with the relevant obscuring_windows &
-   * obscuring_docks.
+   * them less the intersections with the windows above.  The edges of
+   * a window only need to be worked out again if the window, or the
+   * windows above it that touch it, changed since the last time; the
+   * others are kept in the workspace.
    */
+  old_window_edges = workspace->window_edges;
+  workspace->window_edges =
+    g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                           NULL, (GDestroyNotify) window_edges_free);
+
   edges = NULL;
-  stack_position = 0;
-  cur_window_iter = stacked_windows;
-  while (cur_window_iter != NULL)
+  for (i = 0; i < windows->len; i++)
     {
-      MetaRectangle  cur_rect;
-      MetaWindow    *cur_window = cur_window_iter->data;
-      meta_window_get_frame_rect (cur_window, &cur_rect);
+      MetaWindow    *cur_window = g_ptr_array_index (windows, i);
+      WindowEdges   *window_edges = NULL;
+      MetaRectangle  reduced;
+      GArray        *obscuring;
 
-      /* Check if we want to use this window's edges for edge
-       * resistance (note that dock edges are considered screen edges
-       * which are handled separately
+      /* Note that dock edges are considered screen edges which are
+       * handled separately
        */
-      if (WINDOW_EDGES_RELEVANT (cur_window, display) &&
-          cur_window->type != META_WINDOW_DOCK)
-        {
-          GList *new_edges;
-          MetaEdge *new_edge;
-          MetaRectangle reduced;
+      if (cur_window->type == META_WINDOW_DOCK)
+        continue;
 
-          /* We don't care about snapping to any portion of the window that
-           * is offscreen (we also don't care about parts of edges covered
-           * by other windows or DOCKS, but that's handled below).
-           */
-          meta_rectangle_intersect (&cur_rect,
-                                    &display->screen->rect,
-                                    &reduced);
-
-          new_edges = NULL;
+      /* We don't care about snapping to any portion of the window that
+       * is offscreen (we also don't care about parts of edges covered
+       * by other windows or DOCKS, but that's handled below).
+       */
+      meta_rectangle_intersect (&g_array_index (rects, MetaRectangle, i),
+                                &display->screen->rect,
+                                &reduced);
 
-          /* Left side of this window is resistance for the right edge of
-           * the window being moved.
-           */
-          new_edge = g_new (MetaEdge, 1);
-          new_edge->rect = reduced;
-          new_edge->rect.width = 0;
-          new_edge->side_type = META_SIDE_RIGHT;
-          new_edge->edge_type = META_EDGE_WINDOW;
-          new_edges = g_list_prepend (new_edges, new_edge);
-
-          /* Right side of this window is resistance for the left edge of
-           * the window being moved.
-           */
-          new_edge = g_new (MetaEdge, 1);
-          new_edge->rect = reduced;
-          new_edge->rect.x += new_edge->rect.width;
-          new_edge->rect.width = 0;
-          new_edge->side_type = META_SIDE_LEFT;
-          new_edge->edge_type = META_EDGE_WINDOW;
-          new_edges = g_list_prepend (new_edges, new_edge);
-
-          /* Top side of this window is resistance for the bottom edge of
-           * the window being moved.
-           */
-          new_edge = g_new (MetaEdge, 1);
-          new_edge->rect = reduced;
-          new_edge->rect.height = 0;
-          new_edge->side_type = META_SIDE_BOTTOM;
-          new_edge->edge_type = META_EDGE_WINDOW;
-          new_edges = g_list_prepend (new_edges, new_edge);
-
-          /* Top side of this window is resistance for the bottom edge of
-           * the window being moved.
-           */
-          new_edge = g_new (MetaEdge, 1);
-          new_edge->rect = reduced;
-          new_edge->rect.y += new_edge->rect.height;
-          new_edge->rect.height = 0;
-          new_edge->side_type = META_SIDE_TOP;
-          new_edge->edge_type = META_EDGE_WINDOW;
-          new_edges = g_list_prepend (new_edges, new_edge);
-
-          /* Update the remaining windows to only those at a higher
-           * stacking position than this one.
-           */
-          while (rem_win_stacking &&
-                 stack_position >= GPOINTER_TO_INT (rem_win_stacking->data))
-            {
-              rem_windows      = rem_windows->next;
-              rem_win_stacking = rem_win_stacking->next;
-            }
+      obscuring = g_array_new (FALSE, FALSE, sizeof (MetaRectangle));
+      for (j = i + 1; j < rects->len; j++)
+        {
+          MetaRectangle *rect = &g_array_index (rects, MetaRectangle, j);
+          if (rectangles_touch (rect, &reduced))
+            g_array_append_val (obscuring, *rect);
+        }
 
-          /* Remove edge portions overlapped by rem_windows and rem_docks */
-          new_edges =
-            meta_rectangle_remove_intersections_with_boxes_from_edges (
-              new_edges,
-              rem_windows);
+      if (old_window_edges)
+        window_edges = g_hash_table_lookup (old_window_edges, cur_window);
 
-          /* Save the new edges */
-          edges = g_list_concat (new_edges, edges);
+      if (window_edges &&
+          window_edges_unchanged (window_edges, &reduced, obscuring))
+        {
+          g_hash_table_steal (old_window_edges, cur_window);
+          g_array_free (obscuring, TRUE);
         }
+      else
+        window_edges = window_edges_new (&reduced, obscuring);
+
+      g_hash_table_insert (workspace->window_edges, cur_window, window_edges);
 
-      stack_position++;
-      cur_window_iter = cur_window_iter->next;
+      /* Save the new edges; being last to first, prepending them one by
+       * one puts them in order.
+       */
+      for (j = 0; j < window_edges->edges->len; j++)
+        edges = g_list_prepend (edges,
+                                &g_array_index (window_edges->edges,
+                                                MetaEdge, j));
     }
 
   /*
-   * 4th: Free the extra memory not needed and sort the list
-   */
-  g_list_free (stacked_windows);
-  /* Free the memory used by the obscuring windows/docks lists */
-  g_slist_free (window_stacking);
-  /* FIXME: Shouldn't there be a helper function to make this one line of code
-   * to free a list instead of four ugly ones?
+   * 4th: Free the extra memory not needed and sort the list; edges of
+   * windows that are gone go with the old table
    */
-  g_slist_foreach (obscuring_windows,
-                   (void (*)(gpointer,gpointer))&g_free, /* ew, for ugly */
-                   NULL);
-  g_slist_free (obscuring_windows);
+  if (old_window_edges)
+    g_hash_table_destroy (old_window_edges);
+  g_ptr_array_free (windows, TRUE);
+  g_array_free (rects, TRUE);
 
   /* Sort the list.  FIXME: Should I bother with this sorting?  I just
    * sort again later in cache_edges() anyway...
@@ -1119,13 +1326,13 @@ compute_resistance_and_snapping_edges (MetaDisplay *display)
 
   /*
    * 5th: Cache the combination of these edges with the onscreen and
-   * monitor edges in an array for quick access.  Free the edges since
-   * they've been cached elsewhere.
+   * monitor edges in an array for quick access.  The edges themselves
+   * stay with the workspace.
    */
   cache_edges (display,
                edges,
-               display->screen->active_workspace->monitor_edges,
-               display->screen->active_workspace->screen_edges);
+               workspace->monitor_edges,
+               workspace->screen_edges);
   g_list_free (edges);
 
   /*
@@ -23,6 +23,41 @@
 #define META_EDGE_RESISTANCE_H
 
 #include "window-private.h"
+#include "boxes-private.h"
+
+/* The edges of one side type, sorted by position, along with a tree
+ * over them holding how far along the other axis the edges in each
+ * subtree reach.  The tree lets us find the next edge in either
+ * direction that lines up with a window, without looking at all of
+ * the edges in between; see meta_edge_index_find_next_in_span().
+ */
+typedef struct _MetaEdgeIndex MetaEdgeIndex;
+struct _MetaEdgeIndex
+{
+  /* MetaEdge pointers */
+  GArray *edges;
+
+  /* Node n has children 2n and 2n+1; edge i is at node n_leaves+i */
+  int     n_leaves;
+  int    *span_start;
+  int    *span_end;
+};
+
+/* Builds the tree over index->edges, which must be set already */
+void        meta_edge_index_build (MetaEdgeIndex *index);
+
+/* Frees the tree along with index->edges, but not the edges in it */
+void        meta_edge_index_free  (MetaEdgeIndex *index);
+
+/* Returns the index of the first edge, starting at from and going
+ * forward or backward through the array, whose extent along the other
+ * axis shares a point with [low, high]; or -1 if there is none.
+ */
+int         meta_edge_index_find_next_in_span (const MetaEdgeIndex *index,
+                                               int                  from,
+                                               int                  low,
+                                               int                  high,
+                                               gboolean             forward);
 
 void        meta_window_edge_resistance_for_move   (MetaWindow  *window,
                                                     int         *new_x,
@@ -71,11 +71,15 @@
  * no longer pending b) if necessary, drop the predicted stacking
  * order to recompute it at the next opportunity.
  *
+ * The stacks are kept as arrays along with a reverse mapping from
+ * window to position, so that windows are found without searching.
+ * The predicted stack starts out sharing the verified stack, and is
+ * only copied once a prediction actually changes it; the mapping of
+ * the copy is only built once a window is looked up in it.
+ *
  * Possible optimizations:
- *  Keep the stacks as an array + reverse-mapping hash table to avoid
- *    linear lookups.
- *  Keep the stacks as a GList + reverse-mapping hash table to avoid
- *    linear lookups and to make restacking constant-time.
+ *  Keep the stacks as a GList + reverse-mapping hash table to make
+ *    restacking constant-time.
  */
 
 typedef union _MetaStackOp MetaStackOp;
@@ -138,6 +142,38 @@ union _MetaStackOp
   } lower_below;
 };
 
+/* A stack of windows, bottom to top, along with an index from each
+ * window to its position, so that windows can be found without
+ * searching the stack. A stack can be shared between the verified
+ * and predicted views of the tracker, and is only copied when one of
+ * them is about to change it; see stack_make_writable().
+ *
+ * Copying a stack only copies the array of windows; the index is
+ * built the first time a window is looked up in the stack, and kept
+ * up to date from then on.
+ */
+typedef struct
+{
+  guint64 window;
+  int position;
+} StackEntry;
+
+typedef struct
+{
+  int ref_count;
+
+  GArray *windows;
+
+  /* The StackEntry of each position, and the entries keyed by their
+   * window; both NULL until the index is built */
+  GPtrArray *entries;
+  GHashTable *index;
+
+  /* The memory of the entries: the block the index was built with,
+   * and one for each window added since */
+  GPtrArray *entry_blocks;
+} WindowStack;
+
 struct _MetaStackTracker
 {
   MetaScreen *screen;
@@ -149,7 +185,7 @@ struct _MetaStackTracker
 
   /* A combined stack containing X and Wayland windows but without
    * any unverified operations applied. */
-  GArray *verified_stack;
+  WindowStack *verified_stack;
 
   /* This is a queue of requests we've made to change the stacking order,
    * where we haven't yet gotten a reply back from the server.
@@ -160,7 +196,7 @@ struct _MetaStackTracker
    * on the unverified_predictions we've made subsequent to
    * verified_stack.
    */
-  GArray *predicted_stack;
+  WindowStack *predicted_stack;
 
   /* Idle function used to sync the compositor's view of the window
    * stack up with our best guess before a frame is drawn.
@@ -168,6 +204,196 @@ struct _MetaStackTracker
   guint sync_stack_later;
 };
 
+static WindowStack *
+stack_new (guint size)
+{
+  WindowStack *stack = g_slice_new0 (WindowStack);
+
+  stack->ref_count = 1;
+  stack->windows = g_array_sized_new (FALSE, FALSE, sizeof (guint64), size);
+
+  return stack;
+}
+
+static void
+stack_drop_index (WindowStack *stack)
+{
+  if (stack->index == NULL)
+    return;
+
+  g_hash_table_destroy (stack->index);
+  g_ptr_array_free (stack->entries, TRUE);
+  g_ptr_array_free (stack->entry_blocks, TRUE);
+  stack->index = NULL;
+  stack->entries = NULL;
+  stack->entry_blocks = NULL;
+}
+
+static void
+stack_build_index (WindowStack *stack)
+{
+  guint len = stack->windows->len;
+  StackEntry *block = g_new (StackEntry, MAX (len, 1));
+  guint i;
+
+  stack->entries = g_ptr_array_sized_new (len);
+  /* The key is the window of the entry itself */
+  stack->index = g_hash_table_new (g_int64_hash, g_int64_equal);
+  stack->entry_blocks = g_ptr_array_new_with_free_func (g_free);
+  g_ptr_array_add (stack->entry_blocks, block);
+
+  for (i = 0; i < len; i++)
+    {
+      StackEntry *entry = &block[i];
+
+      entry->window = g_array_index (stack->windows, guint64, i);
+      entry->position = i;
+      g_ptr_array_add (stack->entries, entry);
+      g_hash_table_insert (stack->index, &entry->window, entry);
+    }
+}
+
+static WindowStack *
+stack_ref (WindowStack *stack)
+{
+  stack->ref_count++;
+
+  return stack;
+}
+
+static void
+stack_unref (WindowStack *stack)
+{
+  if (--stack->ref_count > 0)
+    return;
+
+  stack_drop_index (stack);
+  g_array_free (stack->windows, TRUE);
+  g_slice_free (WindowStack, stack);
+}
+
+static void
+stack_append (WindowStack *stack,
+              guint64      window)
+{
+  g_array_append_val (stack->windows, window);
+
+  if (stack->index != NULL)
+    {
+      StackEntry *entry = g_new (StackEntry, 1);
+
+      entry->window = window;
+      entry->position = stack->windows->len - 1;
+
+      g_ptr_array_add (stack->entry_blocks, entry);
+      g_ptr_array_add (stack->entries, entry);
+      g_hash_table_insert (stack->index, &entry->window, entry);
+    }
+}
+
+static WindowStack *
+stack_copy (WindowStack *stack)
+{
+  WindowStack *copy = stack_new (stack->windows->len);
+
+  g_array_append_vals (copy->windows, stack->windows->data, stack->windows->len);
+
+  return copy;
+}
+
+/* Makes sure *stack isn't shared before it is changed */
+static void
+stack_make_writable (WindowStack **stack)
+{
+  if ((*stack)->ref_count > 1)
+    {
+      WindowStack *copy = stack_copy (*stack);
+
+      stack_unref (*stack);
+      *stack = copy;
+    }
+}
+
+/* Brings the positions of the entries from first to last up to date */
+static void
+stack_renumber (WindowStack *stack,
+                int          first,
+                int          last)
+{
+  int i;
+
+  if (stack->index == NULL)
+    return;
+
+  for (i = first; i <= last; i++)
+    ((StackEntry *) g_ptr_array_index (stack->entries, i))->position = i;
+}
+
+static void
+stack_remove (WindowStack *stack,
+              int          position)
+{
+  g_array_remove_index (stack->windows, position);
+
+  if (stack->index != NULL)
+    {
+      StackEntry *entry = g_ptr_array_index (stack->entries, position);
+
+      g_hash_table_remove (stack->index, &entry->window);
+      g_ptr_array_remove_index (stack->entries, position);
+      stack_renumber (stack, position, stack->windows->len - 1);
+    }
+}
+
+/* Moves the window at old_pos to new_pos, shifting the windows in
+ * between by one */
+static void
+stack_move (WindowStack *stack,
+            int          old_pos,
+            int          new_pos)
+{
+  guint64 *windows = (guint64 *) stack->windows->data;
+  guint64 window = windows[old_pos];
+
+  if (old_pos < new_pos)
+    memmove (&windows[old_pos], &windows[old_pos + 1],
+             (new_pos - old_pos) * sizeof (guint64));
+  else
+    memmove (&windows[new_pos + 1], &windows[new_pos],
+             (old_pos - new_pos) * sizeof (guint64));
+  windows[new_pos] = window;
+
+  if (stack->index != NULL)
+    {
+      gpointer *entries = stack->entries->pdata;
+      gpointer entry = entries[old_pos];
+
+      if (old_pos < new_pos)
+        memmove (&entries[old_pos], &entries[old_pos + 1],
+                 (new_pos - old_pos) * sizeof (gpointer));
+      else
+        memmove (&entries[new_pos + 1], &entries[new_pos],
+                 (old_pos - new_pos) * sizeof (gpointer));
+      entries[new_pos] = entry;
+
+      stack_renumber (stack, MIN (old_pos, new_pos), MAX (old_pos, new_pos));
+    }
+}
+
+static int
+find_window (WindowStack *stack,
+             guint64      window)
+{
+  StackEntry *entry;
+
+  if (stack->index == NULL)
+    stack_build_index (stack);
+
+  entry = g_hash_table_lookup (stack->index, &window);
+
+  return entry ? entry->position : -1;
+}
+
 static inline const char *
 get_window_desc (MetaStackTracker *tracker,
                  guint64           window)
@@ -218,14 +444,14 @@ meta_stack_op_dump (MetaStackTracker *tracker,
 
 static void
 stack_dump (MetaStackTracker *tracker,
-            GArray           *stack)
+            WindowStack      *stack)
 {
   guint i;
 
   meta_push_no_msg_prefix ();
-  for (i = 0; i < stack->len; i++)
+  for (i = 0; i < stack->windows->len; i++)
     {
-      guint64 window = g_array_index (stack, guint64, i);
+      guint64 window = g_array_index (stack->windows, guint64, i);
       meta_topic (META_DEBUG_STACK, "  %s", get_window_desc (tracker, window));
     }
   meta_topic (META_DEBUG_STACK, "\n");
@@ -263,30 +489,15 @@ meta_stack_op_free (MetaStackOp *op)
   g_slice_free (MetaStackOp, op);
 }
 
-static int
-find_window (GArray  *window_stack,
-             guint64  window)
-{
-  guint i;
-
-  for (i = 0; i < window_stack->len; i++)
-    {
-      guint64 current = g_array_index (window_stack, guint64, i);
-      if (current == window)
-        return i;
-    }
-
-  return -1;
-}
-
 /* Returns TRUE if stack was changed */
 static gboolean
-move_window_above (GArray    *stack,
-                   guint64    window,
-                   int        old_pos,
-                   int        above_pos,
-                   ApplyFlags apply_flags)
+move_window_above (WindowStack **stackp,
+                   guint64       window,
+                   int           old_pos,
+                   int           above_pos,
+                   ApplyFlags    apply_flags)
 {
+  WindowStack *stack;
   int i;
   gboolean can_restack_this_window =
     (apply_flags & NO_RESTACK_X_WINDOWS) == 0  || !META_STACK_ID_IS_X11 (window);
@@ -297,26 +508,29 @@ move_window_above (GArray    *stack,
         {
           gboolean found_x_window = FALSE;
           for (i = old_pos + 1; i <= above_pos; i++)
-            if (META_STACK_ID_IS_X11 (g_array_index (stack, guint64, i)))
+            if (META_STACK_ID_IS_X11 (g_array_index ((*stackp)->windows, guint64, i)))
               found_x_window = TRUE;
 
           if (!found_x_window)
             return FALSE;
         }
 
+      stack = *stackp;
+
       for (i = old_pos; i < above_pos; i++)
         {
           if (!can_restack_this_window &&
-              META_STACK_ID_IS_X11 (g_array_index (stack, guint64, i + 1)))
+              META_STACK_ID_IS_X11 (g_array_index (stack->windows, guint64, i + 1)))
             break;
-
-          g_array_index (stack, guint64, i) =
-            g_array_index (stack, guint64, i + 1);
         }
 
-      g_array_index (stack, guint64, i) = window;
+      if (i == old_pos)
+        return FALSE;
+
+      stack_make_writable (stackp);
+      stack_move (*stackp, old_pos, i);
 
-      return i != old_pos;
+      return TRUE;
     }
   else if (old_pos > above_pos + 1)
     {
@@ -324,26 +538,29 @@ move_window_above (GArray    *stack,
         {
           gboolean found_x_window = FALSE;
           for (i = above_pos + 1; i < old_pos; i++)
-            if (META_STACK_ID_IS_X11 (g_array_index (stack, guint64, i)))
+            if (META_STACK_ID_IS_X11 (g_array_index ((*stackp)->windows, guint64, i)))
               found_x_window = TRUE;
 
           if (!found_x_window)
             return FALSE;
         }
 
+      stack = *stackp;
+
       for (i = old_pos; i > above_pos + 1; i--)
         {
           if (!can_restack_this_window &&
-              META_STACK_ID_IS_X11 (g_array_index (stack, guint64, i - 1)))
+              META_STACK_ID_IS_X11 (g_array_index (stack->windows, guint64, i - 1)))
             break;
-
-          g_array_index (stack, guint64, i) =
-            g_array_index (stack, guint64, i - 1);
         }
 
-      g_array_index (stack, guint64, i) = window;
+      if (i == old_pos)
+        return FALSE;
+
+      stack_make_writable (stackp);
+      stack_move (*stackp, old_pos, i);
 
-      return i != old_pos;
+      return TRUE;
     }
   else
     return FALSE;
@@ -353,7 +570,7 @@ move_window_above (GArray    *stack,
 static gboolean
 meta_stack_op_apply (MetaStackTracker *tracker,
                      MetaStackOp      *op,
-		     GArray           *stack,
+		     WindowStack     **stack,
                      ApplyFlags        apply_flags)
 {
   switch (op->any.type)
@@ -364,7 +581,7 @@ meta_stack_op_apply (MetaStackTracker *tracker,
             (apply_flags & NO_RESTACK_X_WINDOWS) != 0)
           return FALSE;
 
-	int old_pos = find_window (stack, op->add.window);
+	int old_pos = find_window (*stack, op->add.window);
 	if (old_pos >= 0)
 	  {
 	    g_warning ("STACK_OP_ADD: window %s already in stack",
@@ -372,7 +589,8 @@ meta_stack_op_apply (MetaStackTracker *tracker,
 	    return FALSE;
 	  }
 
-	g_array_append_val (stack, op->add.window);
+        stack_make_writable (stack);
+	stack_append (*stack, op->add.window);
 	return TRUE;
       }
     case STACK_OP_REMOVE:
@@ -381,7 +599,7 @@ meta_stack_op_apply (MetaStackTracker *tracker,
             (apply_flags & NO_RESTACK_X_WINDOWS) != 0)
           return FALSE;
 
-	int old_pos = find_window (stack, op->remove.window);
+	int old_pos = find_window (*stack, op->remove.window);
 	if (old_pos < 0)
 	  {
 	    g_warning ("STACK_OP_REMOVE: window %s not in stack",
@@ -389,12 +607,13 @@ meta_stack_op_apply (MetaStackTracker *tracker,
 	    return FALSE;
 	  }
 
-	g_array_remove_index (stack, old_pos);
+        stack_make_writable (stack);
+	stack_remove (*stack, old_pos);
 	return TRUE;
       }
     case STACK_OP_RAISE_ABOVE:
       {
-	int old_pos = find_window (stack, op->raise_above.window);
+	int old_pos = find_window (*stack, op->raise_above.window);
 	int above_pos;
 	if (old_pos < 0)
 	  {
@@ -405,7 +624,7 @@ meta_stack_op_apply (MetaStackTracker *tracker,
 
         if (op->raise_above.sibling)
 	  {
-	    above_pos = find_window (stack, op->raise_above.sibling);
+	    above_pos = find_window (*stack, op->raise_above.sibling);
 	    if (above_pos < 0)
 	      {
 		g_warning ("STACK_OP_RAISE_ABOVE: sibling window %s not in stack",
@@ -423,7 +642,7 @@ meta_stack_op_apply (MetaStackTracker *tracker,
       }
     case STACK_OP_LOWER_BELOW:
       {
-	int old_pos = find_window (stack, op->lower_below.window);
+	int old_pos = find_window (*stack, op->lower_below.window);
 	int above_pos;
 	if (old_pos < 0)
 	  {
@@ -434,7 +653,7 @@ meta_stack_op_apply (MetaStackTracker *tracker,
 
         if (op->lower_below.sibling)
 	  {
-	    int below_pos = find_window (stack, op->lower_below.sibling);
+	    int below_pos = find_window (*stack, op->lower_below.sibling);
 	    if (below_pos < 0)
 	      {
 		g_warning ("STACK_OP_LOWER_BELOW: sibling window %s not in stack",
@@ -446,7 +665,7 @@ meta_stack_op_apply (MetaStackTracker *tracker,
 	  }
 	else
 	  {
-	    above_pos = stack->len - 1;
+	    above_pos = (*stack)->windows->len - 1;
 	  }
 
 	return move_window_above (stack, op->lower_below.window, old_pos, above_pos,
@@ -458,18 +677,6 @@ meta_stack_op_apply (MetaStackTracker *tracker,
   return FALSE;
 }
 
-static GArray *
-copy_stack (GArray *stack)
-{
-  GArray *copy = g_array_sized_new (FALSE, FALSE, sizeof (guint64), stack->len);
-
-  g_array_set_size (copy, stack->len);
-
-  memcpy (copy->data, stack->data, sizeof (guint64) * stack->len);
-
-  return copy;
-}
-
 static void
 query_xserver_stack (MetaStackTracker *tracker)
 {
@@ -485,11 +692,10 @@ query_xserver_stack (MetaStackTracker *tracker)
               screen->xroot,
               &ignored1, &ignored2, &children, &n_children);
 
-  tracker->verified_stack = g_array_sized_new (FALSE, FALSE, sizeof (guint64), n_children);
-  g_array_set_size (tracker->verified_stack, n_children);
+  tracker->verified_stack = stack_new (n_children);
 
   for (i = 0; i < n_children; i++)
-    g_array_index (tracker->verified_stack, guint64, i) = children[i];
+    stack_append (tracker->verified_stack, children[i]);
 
   XFree (children);
 }
@@ -517,9 +723,9 @@ meta_stack_tracker_free (MetaStackTracker *tracker)
   if (tracker->sync_stack_later)
     meta_later_remove (tracker->sync_stack_later);
 
-  g_array_free (tracker->verified_stack, TRUE);
+  stack_unref (tracker->verified_stack);
   if (tracker->predicted_stack)
-    g_array_free (tracker->predicted_stack, TRUE);
+    stack_unref (tracker->predicted_stack);
 
   g_queue_foreach (tracker->unverified_predictions, (GFunc)meta_stack_op_free, NULL);
   g_queue_free (tracker->unverified_predictions);
@@ -541,7 +747,15 @@ stack_tracker_apply_prediction (MetaStackTracker *tracker,
   if (op->any.serial == 0 &&
       tracker->unverified_predictions->length == 0)
     {
-      if (meta_stack_op_apply (tracker, op, tracker->verified_stack, APPLY_DEFAULT))
+      /* With nothing to predict, the predicted stack can only be the
+       * verified one; don't keep a copy of it around to change too. */
+      if (tracker->predicted_stack)
+        {
+          stack_unref (tracker->predicted_stack);
+          tracker->predicted_stack = NULL;
+        }
+
+      if (meta_stack_op_apply (tracker, op, &tracker->verified_stack, APPLY_DEFAULT))
         meta_stack_tracker_queue_sync_stack (tracker);
 
       free_at_end = TRUE;
@@ -550,11 +764,11 @@ stack_tracker_apply_prediction (MetaStackTracker *tracker,
     {
       meta_stack_op_dump (tracker, op, "Predicting: ", "\n");
       g_queue_push_tail (tracker->unverified_predictions, op);
-    }
 
-  if (!tracker->predicted_stack ||
-      meta_stack_op_apply (tracker, op, tracker->predicted_stack, APPLY_DEFAULT))
-    meta_stack_tracker_queue_sync_stack (tracker);
+      if (!tracker->predicted_stack ||
+          meta_stack_op_apply (tracker, op, &tracker->predicted_stack, APPLY_DEFAULT))
+        meta_stack_tracker_queue_sync_stack (tracker);
+    }
 
   if (free_at_end)
     meta_stack_op_free (op);
@@ -647,7 +861,7 @@ stack_tracker_event_received (MetaStackTracker *tracker,
       if (queued_op->any.serial >= op->any.serial)
 	break;
 
-      meta_stack_op_apply (tracker, queued_op, tracker->verified_stack,
+      meta_stack_op_apply (tracker, queued_op, &tracker->verified_stack,
                            NO_RESTACK_X_WINDOWS);
 
       g_queue_pop_head (tracker->unverified_predictions);
@@ -660,7 +874,7 @@ stack_tracker_event_received (MetaStackTracker *tracker,
    * triggered it, we do the X restacking here, and then any residual
    * local-only Wayland stacking below.
    */
-  if (meta_stack_op_apply (tracker, op, tracker->verified_stack,
+  if (meta_stack_op_apply (tracker, op, &tracker->verified_stack,
                            IGNORE_NOOP_X_RESTACK))
     need_sync = TRUE;
 
@@ -675,7 +889,7 @@ stack_tracker_event_received (MetaStackTracker *tracker,
       if (queued_op->any.serial > op->any.serial)
 	break;
 
-      meta_stack_op_apply (tracker, queued_op, tracker->verified_stack,
+      meta_stack_op_apply (tracker, queued_op, &tracker->verified_stack,
                            NO_RESTACK_X_WINDOWS);
 
       g_queue_pop_head (tracker->unverified_predictions);
@@ -687,7 +901,7 @@ stack_tracker_event_received (MetaStackTracker *tracker,
     {
       if (tracker->predicted_stack)
         {
-          g_array_free (tracker->predicted_stack, TRUE);
+          stack_unref (tracker->predicted_stack);
           tracker->predicted_stack = NULL;
         }
 
@@ -763,6 +977,28 @@ meta_stack_tracker_configure_event (MetaStackTracker    *tracker,
   stack_tracker_event_received (tracker, &op);
 }
 
+static WindowStack *
+get_current_stack (MetaStackTracker *tracker)
+{
+  if (tracker->unverified_predictions->length == 0)
+    return tracker->verified_stack;
+
+  if (tracker->predicted_stack == NULL)
+    {
+      GList *l;
+
+      /* Shared with verified_stack until a prediction changes it */
+      tracker->predicted_stack = stack_ref (tracker->verified_stack);
+      for (l = tracker->unverified_predictions->head; l; l = l->next)
+        {
+          MetaStackOp *op = l->data;
+          meta_stack_op_apply (tracker, op, &tracker->predicted_stack, APPLY_DEFAULT);
+        }
+    }
+
+  return tracker->predicted_stack;
+}
+
 /**
  * meta_stack_tracker_get_stack:
  * @tracker: a #MetaStackTracker
@@ -785,33 +1021,12 @@ meta_stack_tracker_get_stack (MetaStackTracker *tracker,
                               guint64         **windows,
 			      int              *n_windows)
 {
-  GArray *stack;
-
-  if (tracker->unverified_predictions->length == 0)
-    {
-      stack = tracker->verified_stack;
-    }
-  else
-    {
-      if (tracker->predicted_stack == NULL)
-        {
-          GList *l;
-
-          tracker->predicted_stack = copy_stack (tracker->verified_stack);
-          for (l = tracker->unverified_predictions->head; l; l = l->next)
-            {
-              MetaStackOp *op = l->data;
-              meta_stack_op_apply (tracker, op, tracker->predicted_stack, APPLY_DEFAULT);
-            }
-        }
-
-      stack = tracker->predicted_stack;
-    }
+  WindowStack *stack = get_current_stack (tracker);
 
   if (windows)
-    *windows = (guint64 *)stack->data;
+    *windows = (guint64 *)stack->windows->data;
   if (n_windows)
-    *n_windows = stack->len;
+    *n_windows = stack->windows->len;
 }
 
 /**
@@ -912,25 +1127,21 @@ static Window
 find_x11_sibling_downwards (MetaStackTracker *tracker,
                             guint64           sibling)
 {
+  WindowStack *stack;
   guint64 *windows;
-  int n_windows;
   int i;
 
   if (META_STACK_ID_IS_X11 (sibling))
     return (Window)sibling;
 
-  meta_stack_tracker_get_stack (tracker,
-                                &windows, &n_windows);
+  stack = get_current_stack (tracker);
+  windows = (guint64 *)stack->windows->data;
 
   /* NB: Children are in order from bottom to top and we
    * want to search downwards for the nearest X window.
    */
 
-  for (i = n_windows - 1; i >= 0; i--)
-    if (windows[i] == sibling)
-      break;
-
-  for (; i >= 0; i--)
+  for (i = find_window (stack, sibling); i >= 0; i--)
     {
       if (META_STACK_ID_IS_X11 (windows[i]))
         return (Window)windows[i];
@@ -943,6 +1154,7 @@ static Window
 find_x11_sibling_upwards (MetaStackTracker *tracker,
                           guint64           sibling)
 {
+  WindowStack *stack;
   guint64 *windows;
   int n_windows;
   int i;
@@ -950,12 +1162,13 @@ find_x11_sibling_upwards (MetaStackTracker *tracker,
   if (META_STACK_ID_IS_X11 (sibling))
     return (Window)sibling;
 
-  meta_stack_tracker_get_stack (tracker,
-                                &windows, &n_windows);
+  stack = get_current_stack (tracker);
+  windows = (guint64 *)stack->windows->data;
+  n_windows = stack->windows->len;
 
-  for (i = 0; i < n_windows; i++)
-    if (windows[i] == sibling)
-      break;
+  i = find_window (stack, sibling);
+  if (i < 0)
+    return None;
 
   for (; i < n_windows; i++)
     {
@@ -966,7 +1179,8 @@ find_x11_sibling_upwards (MetaStackTracker *tracker,
   return None;
 }
 
-static void
+/* Returns TRUE if a request had to be sent to the X server */
+static gboolean
 meta_stack_tracker_lower_below (MetaStackTracker *tracker,
                                 guint64           window,
                                 guint64           sibling)
@@ -998,9 +1212,12 @@ meta_stack_tracker_lower_below (MetaStackTracker *tracker,
   meta_stack_tracker_record_lower_below (tracker,
                                          window, sibling,
                                          serial);
+
+  return serial != 0;
 }
 
-static void
+/* Returns TRUE if a request had to be sent to the X server */
+static gboolean
 meta_stack_tracker_raise_above (MetaStackTracker *tracker,
                                 guint64           window,
                                 guint64           sibling)
@@ -1031,6 +1248,8 @@ meta_stack_tracker_raise_above (MetaStackTracker *tracker,
 
   meta_stack_tracker_record_raise_above (tracker, window,
                                          sibling, serial);
+
+  return serial != 0;
 }
 
 void
@@ -1040,17 +1259,87 @@ meta_stack_tracker_lower (MetaStackTracker *tracker,
   meta_stack_tracker_raise_above (tracker, window, None);
 }
 
-void
+/* Given the position of each window of a new stack in the current
+ * stack, or -1 if it is not there, finds the longest sequence of
+ * windows that are already stacked in the new order with respect to
+ * each other, and marks them in @kept. Those can stay where they are,
+ * and moving every other window next to its new neighbour gets the
+ * new stack with the fewest moves.
+ */
+static void
+find_ordered_windows (const int *positions,
+                      int        n_windows,
+                      gboolean  *kept)
+{
+  /* ends[n] is the window ending the lowest ordered sequence of n + 1
+   * windows found so far; prev[i] is the window before i in the
+   * sequence it ends. */
+  int *ends = g_new (int, n_windows);
+  int *prev = g_new (int, n_windows);
+  int n_ends = 0;
+  int i;
+
+  for (i = 0; i < n_windows; i++)
+    {
+      int low, high;
+
+      kept[i] = FALSE;
+
+      if (positions[i] < 0)
+        continue;
+
+      low = 0;
+      high = n_ends;
+      while (low < high)
+        {
+          int mid = (low + high) / 2;
+
+          if (positions[ends[mid]] < positions[i])
+            low = mid + 1;
+          else
+            high = mid;
+        }
+
+      prev[i] = low > 0 ? ends[low - 1] : -1;
+      ends[low] = i;
+      if (low == n_ends)
+        n_ends++;
+    }
+
+  for (i = n_ends > 0 ? ends[n_ends - 1] : -1; i >= 0; i = prev[i])
+    kept[i] = TRUE;
+
+  g_free (ends);
+  g_free (prev);
+}
+
+/**
+ * meta_stack_tracker_restack_managed:
+ * @tracker: a #MetaStackTracker
+ * @managed: the managed windows that aren't hidden, bottom to top
+ * @n_managed: the number of windows in @managed
+ *
+ * Restacks the managed windows into the given order, leaving the
+ * other windows alone. Only the windows that are out of order with
+ * respect to the others are moved.
+ *
+ * Return value: the number of restacking requests sent to the X server
+ */
+int
 meta_stack_tracker_restack_managed (MetaStackTracker *tracker,
                                     const guint64    *managed,
                                     int               n_managed)
 {
+  WindowStack *stack;
   guint64 *windows;
   int n_windows;
-  int old_pos, new_pos;
+  int *positions;
+  gboolean *kept;
+  int top_pos, guard_pos, i;
+  int n_requests = 0;
 
   if (n_managed == 0)
-    return;
+    return 0;
 
   meta_stack_tracker_get_stack (tracker, &windows, &n_windows);
 
@@ -1059,63 +1348,71 @@ meta_stack_tracker_restack_managed (MetaStackTracker *tracker,
    * the top of the X stack; we instead move it above all managed windows (or
    * above the guard window if there are no non-hidden managed windows.)
    */
-  old_pos = n_windows - 1;
-  for (old_pos = n_windows - 1; old_pos >= 0; old_pos--)
+  for (top_pos = n_windows - 1; top_pos >= 0; top_pos--)
     {
-      MetaWindow *old_window = meta_display_lookup_stack_id (tracker->screen->display, windows[old_pos]);
+      MetaWindow *old_window = meta_display_lookup_stack_id (tracker->screen->display, windows[top_pos]);
       if ((old_window && !old_window->override_redirect && !old_window->unmanaging) ||
-          windows[old_pos] == tracker->screen->guard_window)
+          windows[top_pos] == tracker->screen->guard_window)
         break;
     }
-  g_assert (old_pos >= 0);
-
-  new_pos = n_managed - 1;
-  if (managed[new_pos] != windows[old_pos])
-    {
-      /* Move the first managed window in the new stack above all managed windows */
-      meta_stack_tracker_raise_above (tracker, managed[new_pos], windows[old_pos]);
-      meta_stack_tracker_get_stack (tracker, &windows, &n_windows);
-      /* Moving managed[new_pos] above windows[old_pos], moves the window at old_pos down by one */
-    }
+  g_assert (top_pos >= 0);
 
-  old_pos--;
-  new_pos--;
+  /* Windows below the guard window were hidden, and have to be moved
+   * up wherever they go.
+   */
+  for (guard_pos = top_pos; guard_pos >= 0; guard_pos--)
+    if (windows[guard_pos] == tracker->screen->guard_window)
+      break;
 
-  while (old_pos >= 0 && new_pos >= 0)
+  stack = get_current_stack (tracker);
+  positions = g_new (int, n_managed);
+  for (i = 0; i < n_managed; i++)
     {
-      if (windows[old_pos] == tracker->screen->guard_window)
-        break;
+      int position = find_window (stack, managed[i]);
 
-      if (windows[old_pos] == managed[new_pos])
-        {
-          old_pos--;
-          new_pos--;
-          continue;
-        }
+      if (position > guard_pos && position <= top_pos)
+        positions[i] = position;
+      else
+        positions[i] = -1;
+    }
 
-      MetaWindow *old_window = meta_display_lookup_stack_id (tracker->screen->display, windows[old_pos]);
-      if (!old_window || old_window->override_redirect || old_window->unmanaging)
-        {
-          old_pos--;
-          continue;
-        }
+  kept = g_new (gboolean, n_managed);
+  find_ordered_windows (positions, n_managed, kept);
 
-      meta_stack_tracker_lower_below (tracker, managed[new_pos], managed[new_pos + 1]);
-      meta_stack_tracker_get_stack (tracker, &windows, &n_windows);
-      /* Moving managed[new_pos] above windows[old_pos] moves the window at old_pos down by one,
-       * we'll examine it again to see if it matches the next new window */
-      old_pos--;
-      new_pos--;
+  /* Going from the top down, each window that has to move is put just
+   * below the window that ends up above it, which is in place by then.
+   */
+  i = n_managed - 1;
+  if (!kept[i] && managed[i] != windows[top_pos])
+    {
+      if (meta_stack_tracker_raise_above (tracker, managed[i], windows[top_pos]))
+        n_requests++;
     }
 
-  while (new_pos > 0)
+  for (i = n_managed - 2; i >= 0; i--)
     {
-      meta_stack_tracker_lower_below (tracker, managed[new_pos], managed[new_pos - 1]);
-      new_pos--;
+      if (kept[i])
+        continue;
+
+      if (meta_stack_tracker_lower_below (tracker, managed[i], managed[i + 1]))
+        n_requests++;
     }
+
+  g_free (positions);
+  g_free (kept);
+
+  return n_requests;
 }
 
-void
+/**
+ * meta_stack_tracker_restack_at_bottom:
+ * @tracker: a #MetaStackTracker
+ * @new_order: the windows to put at the bottom of the stack, bottom to top
+ * @n_new_order: the number of windows in @new_order
+ *
+ * Return value: the number of restacking requests sent to the X server
+ */
+int
 meta_stack_tracker_restack_at_bottom (MetaStackTracker *tracker,
                                       const guint64    *new_order,
                                       int               n_new_order)
@@ -1123,6 +1420,7 @@ meta_stack_tracker_restack_at_bottom (MetaStackTracker *tracker,
   guint64 *windows;
   int n_windows;
   int pos;
+  int n_requests = 0;
 
   meta_stack_tracker_get_stack (tracker, &windows, &n_windows);
 
@@ -1130,12 +1428,14 @@ meta_stack_tracker_restack_at_bottom (MetaStackTracker *tracker,
     {
       if (pos >= n_windows || windows[pos] != new_order[pos])
         {
-          if (pos == 0)
-            meta_stack_tracker_lower (tracker, new_order[pos]);
-          else
-            meta_stack_tracker_raise_above (tracker, new_order[pos], new_order[pos - 1]);
+          guint64 sibling = pos > 0 ? new_order[pos - 1] : None;
+
+          if (meta_stack_tracker_raise_above (tracker, new_order[pos], sibling))
+            n_requests++;
 
           meta_stack_tracker_get_stack (tracker, &windows, &n_windows);
         }
     }
+
+  return n_requests;
 }
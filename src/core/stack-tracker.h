@@ -57,10 +57,10 @@ void meta_stack_tracker_record_remove          (MetaStackTracker *tracker,
 void meta_stack_tracker_lower           (MetaStackTracker *tracker,
                                          guint64           window);
 
-void meta_stack_tracker_restack_managed (MetaStackTracker *tracker,
+int  meta_stack_tracker_restack_managed (MetaStackTracker *tracker,
                                          const guint64    *windows,
                                          int               n_windows);
-void meta_stack_tracker_restack_at_bottom (MetaStackTracker *tracker,
+int  meta_stack_tracker_restack_at_bottom (MetaStackTracker *tracker,
                                            const guint64    *new_order,
                                            int               n_new_order);
 
@@ -35,6 +35,7 @@
 #include <meta/workspace.h>
 
 #include <X11/Xatom.h>
+#include <string.h>
 
 #include "x11/group-private.h"
 
@@ -61,6 +62,68 @@ static void stack_do_resort           (MetaStack *stack);
 
 static void stack_ensure_sorted (MetaStack *stack);
 
+static void link_window   (MetaStack  *stack,
+                           MetaWindow *window);
+static void unlink_window (MetaStack  *stack,
+                           MetaWindow *window);
+
+/* The stacking constraints of a window in the stack, persistent
+ * across syncs; see "Stacking constraints" below */
+typedef struct
+{
+  /* Windows this one has to be above: its transient parent, or the
+   * members of the group it is transient for */
+  GSList *below;
+  /* Windows that have to be above this one */
+  GSList *above;
+
+  /* Guards against cycles when walking the constraints */
+  unsigned int visiting : 1;
+} ConstraintNode;
+
+static void
+constraint_node_free (ConstraintNode *node)
+{
+  g_slist_free (node->below);
+  g_slist_free (node->above);
+  g_slice_free (ConstraintNode, node);
+}
+
+static void
+queue_window (GList      **windows,
+              MetaWindow  *window)
+{
+  if (!g_list_find (*windows, window))
+    *windows = g_list_prepend (*windows, window);
+}
+
+/* Windows transient for @window may be in their layer only because
+ * of it, and windows transient for a whole group may be in theirs
+ * because of any window that was in the group */
+static void
+queue_relayer_transients (MetaStack  *stack,
+                          MetaWindow *window)
+{
+  ConstraintNode *node;
+  GSList *tmp;
+  GList *l;
+
+  node = g_hash_table_lookup (stack->constraints, window);
+  if (node == NULL)
+    return;
+
+  for (tmp = node->above; tmp != NULL; tmp = tmp->next)
+    queue_window (&stack->relayer_windows, tmp->data);
+
+  for (l = stack->sorted; l != NULL; l = l->next)
+    {
+      MetaWindow *w = l->data;
+
+      if (w != window && WINDOW_TRANSIENT_FOR_WHOLE_GROUP (w))
+        queue_window (&stack->relayer_windows, w);
+    }
+}
+
 MetaStack*
 meta_stack_new (MetaScreen *screen)
 {
@@ -75,12 +138,22 @@ meta_stack_new (MetaScreen *screen)
   stack->added = NULL;
   stack->removed = NULL;
 
+  stack->constraints = g_hash_table_new_full (NULL, NULL, NULL,
+                                              (GDestroyNotify) constraint_node_free);
+  stack->relayer_windows = NULL;
+  stack->constrain_windows = NULL;
+  stack->resort_windows = NULL;
+
   stack->freeze_count = 0;
   stack->n_positions = 0;
 
+  stack->client_list_stacking = NULL;
+  stack->n_syncs = 0;
+  stack->n_sync_requests = 0;
+
   stack->need_resort = FALSE;
-  stack->need_relayer = FALSE;
   stack->need_constrain = FALSE;
+  stack->need_client_list = TRUE;
 
   return stack;
 }
@@ -94,6 +167,14 @@ meta_stack_free (MetaStack *stack)
   g_list_free (stack->added);
   g_list_free (stack->removed);
 
+  g_hash_table_destroy (stack->constraints);
+  g_list_free (stack->relayer_windows);
+  g_list_free (stack->constrain_windows);
+  g_list_free (stack->resort_windows);
+
+  if (stack->client_list_stacking)
+    g_array_free (stack->client_list_stacking, TRUE);
+
   g_free (stack);
 }
 
@@ -116,6 +197,9 @@ meta_stack_add (MetaStack  *stack,
               "Window %s has stack_position initialized to %d\n",
               window->desc, window->stack_position);
 
+  g_hash_table_insert (stack->constraints, window, g_slice_new0 (ConstraintNode));
+  link_window (stack, window);
+
   stack_sync_to_xserver (stack);
   meta_stack_update_window_tile_matches (stack, window->screen->active_workspace);
 }
@@ -138,10 +222,18 @@ meta_stack_remove (MetaStack  *stack,
   window->stack_position = -1;
   stack->n_positions -= 1;
 
+  queue_relayer_transients (stack, window);
+  unlink_window (stack, window);
+  g_hash_table_remove (stack->constraints, window);
+
   /* We don't know if it's been moved from "added" to "stack" yet */
   stack->added = g_list_remove (stack->added, window);
   stack->sorted = g_list_remove (stack->sorted, window);
 
+  stack->relayer_windows = g_list_remove (stack->relayer_windows, window);
+  stack->constrain_windows = g_list_remove (stack->constrain_windows, window);
+  stack->resort_windows = g_list_remove (stack->resort_windows, window);
+
   /* Remember the window ID to remove it from the stack array.
    * The macro is safe to use: Window is guaranteed to be 32 bits, and
    * GUINT_TO_POINTER says it only works on 32 bits.
@@ -160,7 +252,7 @@ void
 meta_stack_update_layer (MetaStack  *stack,
                          MetaWindow *window)
 {
-  stack->need_relayer = TRUE;
+  queue_window (&stack->relayer_windows, window);
 
   stack_sync_to_xserver (stack);
   meta_stack_update_window_tile_matches (stack, window->screen->active_workspace);
@@ -170,7 +262,16 @@ void
 meta_stack_update_transient (MetaStack  *stack,
                              MetaWindow *window)
 {
-  stack->need_constrain = TRUE;
+  if (WINDOW_IN_STACK (window))
+    {
+      queue_relayer_transients (stack, window);
+      unlink_window (stack, window);
+      link_window (stack, window);
+      /* It may have been promoted to its layer by a window it is no
+       * longer transient for */
+      queue_window (&stack->relayer_windows, window);
+      queue_window (&stack->constrain_windows, window);
+    }
 
   stack_sync_to_xserver (stack);
   meta_stack_update_window_tile_matches (stack, window->screen->active_workspace);
@@ -490,8 +591,117 @@ compare_window_position (void *a,
  * that they appear, we will apply them correctly. Note that the
  * graph MAY have cycles, so we have to guard against that.
  *
+ * Which windows constrain which is kept in stack->constraints, and
+ * updated as windows are added, removed, or change transiency. Most
+ * changes to the stack - raising or lowering a window, changing its
+ * layer - can only break the constraints of the window itself and
+ * of the windows transient for it, so then we only walk the graph
+ * from that window, rather than reapply everything.
  */
 
+/* Whether the stacking constraints keep @window above @other */
+static gboolean
+window_must_be_above (MetaWindow *window,
+                      MetaWindow *other)
+{
+  if (WINDOW_TRANSIENT_FOR_WHOLE_GROUP (window))
+    {
+      MetaGroup *group = meta_window_get_group (window);
+
+      /* Transients for the group are constrained only above
+       * non-transient-type windows in their group */
+      return (group != NULL &&
+              meta_window_get_group (other) == group &&
+              window->screen == other->screen &&
+              !other->override_redirect &&
+              !WINDOW_HAS_TRANSIENT_TYPE (other));
+    }
+  else
+    {
+      return window->transient_for == other;
+    }
+}
+
+static void
+link_constraint (MetaStack  *stack,
+                 MetaWindow *above,
+                 MetaWindow *below)
+{
+  ConstraintNode *above_node, *below_node;
+
+  above_node = g_hash_table_lookup (stack->constraints, above);
+  below_node = g_hash_table_lookup (stack->constraints, below);
+
+  if (above_node == NULL || below_node == NULL ||
+      g_slist_find (above_node->below, below))
+    return;
+
+  meta_topic (META_DEBUG_STACK, "Constraining %s above %s\n",
+              above->desc, below->desc);
+
+  above_node->below = g_slist_prepend (above_node->below, below);
+  below_node->above = g_slist_prepend (below_node->above, above);
+}
+
+static void
+link_window_with_list (MetaStack  *stack,
+                       MetaWindow *window,
+                       GList      *windows)
+{
+  GList *tmp;
+
+  for (tmp = windows; tmp != NULL; tmp = tmp->next)
+    {
+      MetaWindow *w = tmp->data;
+
+      if (w == window)
+        continue;
+
+      if (window_must_be_above (window, w))
+        link_constraint (stack, window, w);
+      if (window_must_be_above (w, window))
+        link_constraint (stack, w, window);
+    }
+}
+
+/* Adds the constraints between @window and the rest of the stack */
+static void
+link_window (MetaStack  *stack,
+             MetaWindow *window)
+{
+  link_window_with_list (stack, window, stack->sorted);
+  link_window_with_list (stack, window, stack->added);
+}
+
+static void
+unlink_window (MetaStack  *stack,
+               MetaWindow *window)
+{
+  ConstraintNode *node;
+  GSList *tmp;
+
+  node = g_hash_table_lookup (stack->constraints, window);
+  if (node == NULL)
+    return;
+
+  for (tmp = node->below; tmp != NULL; tmp = tmp->next)
+    {
+      ConstraintNode *below_node = g_hash_table_lookup (stack->constraints, tmp->data);
+      below_node->above = g_slist_remove (below_node->above, window);
+    }
+
+  for (tmp = node->above; tmp != NULL; tmp = tmp->next)
+    {
+      ConstraintNode *above_node = g_hash_table_lookup (stack->constraints, tmp->data);
+      above_node->below = g_slist_remove (above_node->below, window);
+    }
+
+  g_slist_free (node->below);
+  node->below = NULL;
+  g_slist_free (node->above);
+  node->above = NULL;
+}
+
 typedef struct Constraint Constraint;
 
 struct Constraint
@@ -557,7 +767,8 @@ add_constraint (Constraint **constraints,
 }
 
 static void
-create_constraints (Constraint **constraints,
+create_constraints (MetaStack   *stack,
+                    Constraint **constraints,
                     GList       *windows)
 {
   GList *tmp;
@@ -566,8 +777,11 @@ create_constraints (Constraint **constraints,
   while (tmp != NULL)
     {
       MetaWindow *w = tmp->data;
+      ConstraintNode *node;
+      GSList *tmp2;
 
-      if (!WINDOW_IN_STACK (w))
+      node = g_hash_table_lookup (stack->constraints, w);
+      if (node == NULL)
         {
           meta_topic (META_DEBUG_STACK, "Window %s not in the stack, not constraining it\n",
                       w->desc);
@@ -575,67 +789,8 @@ create_constraints (Constraint **constraints,
           continue;
         }
 
-      if (WINDOW_TRANSIENT_FOR_WHOLE_GROUP (w))
-        {
-          GSList *group_windows;
-          GSList *tmp2;
-          MetaGroup *group;
-
-          group = meta_window_get_group (w);
-
-          if (group != NULL)
-            group_windows = meta_group_list_windows (group);
-          else
-            group_windows = NULL;
-
-          tmp2 = group_windows;
-
-          while (tmp2 != NULL)
-            {
-              MetaWindow *group_window = tmp2->data;
-
-              if (!WINDOW_IN_STACK (group_window) ||
-                  w->screen != group_window->screen ||
-                  group_window->override_redirect)
-                {
-                  tmp2 = tmp2->next;
-                  continue;
-                }
-
-#if 0
-              /* old way of doing it */
-              if (!(meta_window_is_ancestor_of_transient (w, group_window)) &&
-                  !WINDOW_TRANSIENT_FOR_WHOLE_GROUP (group_window))  /* note */;/*note*/
-#else
-              /* better way I think, so transient-for-group are constrained
-               * only above non-transient-type windows in their group
-               */
-              if (!WINDOW_HAS_TRANSIENT_TYPE (group_window))
-#endif
-                {
-                  meta_topic (META_DEBUG_STACK, "Constraining %s above %s as it's transient for its group\n",
-                              w->desc, group_window->desc);
-                  add_constraint (constraints, w, group_window);
-                }
-
-              tmp2 = tmp2->next;
-            }
-
-          g_slist_free (group_windows);
-        }
-      else if (w->transient_for != NULL)
-        {
-          MetaWindow *parent;
-
-          parent = w->transient_for;
-
-          if (parent && WINDOW_IN_STACK (parent))
-            {
-              meta_topic (META_DEBUG_STACK, "Constraining %s above %s due to transiency\n",
-                          w->desc, parent->desc);
-              add_constraint (constraints, w, parent);
-            }
-        }
+      for (tmp2 = node->below; tmp2 != NULL; tmp2 = tmp2->next)
+        add_constraint (constraints, w, tmp2->data);
 
       tmp = tmp->next;
     }
@@ -722,6 +877,7 @@ ensure_above (MetaWindow *above,
 		  "Promoting window %s from layer %u to %u due to contraint\n",
 		  above->desc, above->layer, below->layer);
       above->layer = below->layer;
+      queue_window (&above->screen->stack->resort_windows, above);
     }
 
   if (above->stack_position < below->stack_position)
@@ -796,6 +952,68 @@ apply_constraints (Constraint **constraints,
   g_slist_free (heads);
 }
 
+static gint
+compare_stack_position_descending (gconstpointer a,
+                                   gconstpointer b)
+{
+  const MetaWindow *window_a = a;
+  const MetaWindow *window_b = b;
+
+  return window_b->stack_position - window_a->stack_position;
+}
+
+/* Keeps the windows transient for @window above it, and so on up the
+ * graph. The transients are placed directly above @window from the
+ * topmost one down, which keeps their order. */
+static void
+constrain_transients (MetaStack  *stack,
+                      MetaWindow *window)
+{
+  ConstraintNode *node;
+  GSList *transients, *tmp;
+
+  node = g_hash_table_lookup (stack->constraints, window);
+  if (node == NULL || node->visiting || node->above == NULL)
+    return;
+
+  node->visiting = TRUE;
+
+  transients = g_slist_sort (g_slist_copy (node->above),
+                             compare_stack_position_descending);
+
+  for (tmp = transients; tmp != NULL; tmp = tmp->next)
+    {
+      ensure_above (tmp->data, window);
+      constrain_transients (stack, tmp->data);
+    }
+
+  g_slist_free (transients);
+
+  node->visiting = FALSE;
+}
+
+/* Reapplies the constraints that moving @window, or changing its
+ * layer, may have broken: those keeping it above other windows, and
+ * those keeping other windows above it. Moving a window up only
+ * shifts the windows it passes down by one, so the constraints
+ * between those still hold. */
+static void
+constrain_window (MetaStack  *stack,
+                  MetaWindow *window)
+{
+  ConstraintNode *node;
+  GSList *tmp;
+
+  node = g_hash_table_lookup (stack->constraints, window);
+  if (node == NULL)
+    return;
+
+  for (tmp = node->below; tmp != NULL; tmp = tmp->next)
+    ensure_above (window, tmp->data);
+
+  constrain_transients (stack, window);
+}
+
 /**
  * stack_do_window_deletions:
  *
@@ -834,6 +1052,7 @@ stack_do_window_deletions (MetaStack *stack)
           if (xwindow == g_array_index (stack->xwindows, Window, i))
             {
               g_array_remove_index (stack->xwindows, i);
+              stack->need_client_list = TRUE;
               goto next;
             }
         }
@@ -864,6 +1083,7 @@ stack_do_window_additions (MetaStack *stack)
 
       old_size = stack->xwindows->len;
       g_array_set_size (stack->xwindows, old_size + n_added);
+      stack->need_client_list = TRUE;
 
       end = &g_array_index (stack->xwindows, Window, old_size);
 
@@ -889,15 +1109,54 @@ stack_do_window_additions (MetaStack *stack)
           tmp = tmp->next;
         }
 
-      stack->need_resort = TRUE; /* may not be needed as we add to top */
-      stack->need_constrain = TRUE;
-      stack->need_relayer = TRUE;
+      /* The new windows are at the top, which at most breaks the
+       * constraints of windows transient for them */
+      for (tmp = stack->added; tmp != NULL; tmp = tmp->next)
+        {
+          queue_window (&stack->relayer_windows, tmp->data);
+          queue_window (&stack->constrain_windows, tmp->data);
+          queue_window (&stack->resort_windows, tmp->data);
+        }
     }
 
   g_list_free (stack->added);
   stack->added = NULL;
 }
 
+static void
+relayer_window (MetaStack  *stack,
+                MetaWindow *window)
+{
+  MetaStackLayer old_layer;
+  ConstraintNode *node;
+  GSList *tmp;
+
+  old_layer = window->layer;
+
+  compute_layer (window);
+
+  if (window->layer == old_layer)
+    return;
+
+  meta_topic (META_DEBUG_STACK,
+              "Window %s moved from layer %u to %u\n",
+              window->desc, old_layer, window->layer);
+
+  queue_window (&stack->constrain_windows, window);
+  queue_window (&stack->resort_windows, window);
+
+  /* Its transients may only have been in their layer because of it;
+   * constraining them again promotes them as needed */
+  node = g_hash_table_lookup (stack->constraints, window);
+  if (node == NULL || node->visiting)
+    return;
+
+  node->visiting = TRUE;
+  for (tmp = node->above; tmp != NULL; tmp = tmp->next)
+    relayer_window (stack, tmp->data);
+  node->visiting = FALSE;
+}
+
 /**
  * stack_do_relayer:
  *
@@ -907,42 +1166,47 @@ static void
 stack_do_relayer (MetaStack *stack)
 {
   GList *tmp;
+  GSList *groups;
 
-  if (!stack->need_relayer)
+  if (stack->relayer_windows == NULL)
     return;
 
   meta_topic (META_DEBUG_STACK,
-              "Recomputing layers\n");
-
-  tmp = stack->sorted;
+              "Recomputing layers of %u windows\n",
+              g_list_length (stack->relayer_windows));
 
-  while (tmp != NULL)
+  /* Besides the windows themselves, the layers of fullscreen windows
+   * depend on which window has focus, and those of windows transient
+   * for their groups on all of these.
+   */
+  groups = NULL;
+  for (tmp = stack->sorted; tmp != NULL; tmp = tmp->next)
     {
-      MetaWindow *w;
-      MetaStackLayer old_layer;
+      MetaWindow *w = tmp->data;
+      MetaGroup *group;
 
-      w = tmp->data;
-      old_layer = w->layer;
+      if (!w->fullscreen && !g_list_find (stack->relayer_windows, w))
+        continue;
 
-      compute_layer (w);
+      group = meta_window_get_group (w);
+      if (group != NULL && !g_slist_find (groups, group))
+        groups = g_slist_prepend (groups, group);
 
-      if (w->layer != old_layer)
-        {
-          meta_topic (META_DEBUG_STACK,
-                      "Window %s moved from layer %u to %u\n",
-                      w->desc, old_layer, w->layer);
-          stack->need_resort = TRUE;
-          stack->need_constrain = TRUE;
-          /* don't need to constrain as constraining
-           * purely operates in terms of stack_position
-           * not layer
-           */
-        }
+      relayer_window (stack, w);
+    }
 
-      tmp = tmp->next;
+  for (tmp = stack->sorted; tmp != NULL; tmp = tmp->next)
+    {
+      MetaWindow *w = tmp->data;
+
+      if (WINDOW_TRANSIENT_FOR_WHOLE_GROUP (w) &&
+          g_slist_find (groups, meta_window_get_group (w)))
+        relayer_window (stack, w);
     }
 
-  stack->need_relayer = FALSE;
+  g_slist_free (groups);
+  g_list_free (stack->relayer_windows);
+  stack->relayer_windows = NULL;
 }
 
 /**
@@ -955,11 +1219,29 @@ static void
 stack_do_constrain (MetaStack *stack)
 {
   Constraint **constraints;
-
-  /* It'd be nice if this were all faster, probably */
+  GList *windows, *tmp;
 
   if (!stack->need_constrain)
-    return;
+    {
+      if (stack->constrain_windows == NULL)
+        return;
+
+      meta_topic (META_DEBUG_STACK,
+                  "Reapplying constraints of %u windows\n",
+                  g_list_length (stack->constrain_windows));
+
+      /* Windows moved while constraining are already taken care of */
+      windows = g_list_reverse (stack->constrain_windows);
+      stack->constrain_windows = NULL;
+
+      for (tmp = windows; tmp != NULL; tmp = tmp->next)
+        constrain_window (stack, tmp->data);
+
+      g_list_free (windows);
+      g_list_free (stack->constrain_windows);
+      stack->constrain_windows = NULL;
+      return;
+    }
 
   meta_topic (META_DEBUG_STACK,
               "Reapplying constraints\n");
@@ -967,7 +1249,7 @@ stack_do_constrain (MetaStack *stack)
   constraints = g_new0 (Constraint*,
                         stack->n_positions);
 
-  create_constraints (constraints, stack->sorted);
+  create_constraints (stack, constraints, stack->sorted);
 
   graph_constraints (constraints, stack->n_positions);
 
@@ -976,6 +1258,8 @@ stack_do_constrain (MetaStack *stack)
   free_constraints (constraints, stack->n_positions);
   g_free (constraints);
 
+  g_list_free (stack->constrain_windows);
+  stack->constrain_windows = NULL;
   stack->need_constrain = FALSE;
 }
 
@@ -987,8 +1271,42 @@ stack_do_constrain (MetaStack *stack)
 static void
 stack_do_resort (MetaStack *stack)
 {
+  GList *tmp, *moved;
+
   if (!stack->need_resort)
-    return;
+    {
+      if (stack->resort_windows == NULL)
+        return;
+
+      meta_topic (META_DEBUG_STACK,
+                  "Moving %u windows in the stack list\n",
+                  g_list_length (stack->resort_windows));
+
+      /* Other windows only had their stack_position shifted along
+       * with their neighbours, so without the windows that moved or
+       * changed layer, the list is still sorted.
+       */
+      moved = NULL;
+      for (tmp = stack->resort_windows; tmp != NULL; tmp = tmp->next)
+        {
+          GList *link = g_list_find (stack->sorted, tmp->data);
+
+          if (link != NULL)
+            {
+              stack->sorted = g_list_delete_link (stack->sorted, link);
+              moved = g_list_prepend (moved, tmp->data);
+            }
+        }
+
+      for (tmp = moved; tmp != NULL; tmp = tmp->next)
+        stack->sorted = g_list_insert_sorted (stack->sorted, tmp->data,
+                                              (GCompareFunc) compare_window_position);
+
+      g_list_free (moved);
+      g_list_free (stack->resort_windows);
+      stack->resort_windows = NULL;
+      return;
+    }
 
   meta_topic (META_DEBUG_STACK,
               "Sorting stack list\n");
@@ -996,6 +1314,8 @@ stack_do_resort (MetaStack *stack)
   stack->sorted = g_list_sort (stack->sorted,
                                (GCompareFunc) compare_window_position);
 
+  g_list_free (stack->resort_windows);
+  stack->resort_windows = NULL;
   stack->need_resort = FALSE;
 }
 
@@ -1024,14 +1344,10 @@ stack_ensure_sorted (MetaStack *stack)
  * stack_sync_to_server:
  *
  * Order the windows on the X server to be the same as in our structure.
- * We do this using XRestackWindows if we don't know the previous order,
- * or XConfigureWindow on a few particular windows if we do and can figure
- * out the minimum set of changes.  After that, we set __NET_CLIENT_LIST
- * and __NET_CLIENT_LIST_STACKING.
- *
- * FIXME: Now that we have a good view of the stacking order on the server
- * with MetaStackTracker it should be possible to do a simpler and better
- * job of computing the minimal set of stacking requests needed.
+ * MetaStackTracker knows the current order on the server, and only
+ * restacks the windows that are out of order.  After that, we set
+ * __NET_CLIENT_LIST and __NET_CLIENT_LIST_STACKING, if they changed;
+ * every client watching them wakes up when they are set.
  */
 static void
 stack_sync_to_xserver (MetaStack *stack)
@@ -1040,6 +1356,7 @@ stack_sync_to_xserver (MetaStack *stack)
   GArray *all_root_children_stacked; /* wayland OR x11 */
   GList *tmp;
   GArray *x11_hidden_stack_ids;
+  int n_requests;
 
   /* Bail out if frozen */
   if (stack->freeze_count > 0)
@@ -1112,31 +1429,59 @@ stack_sync_to_xserver (MetaStack *stack)
   meta_topic (META_DEBUG_STACK, "Restacking %u windows\n",
               all_root_children_stacked->len);
 
-  meta_stack_tracker_restack_managed (stack->screen->stack_tracker,
-                                      (guint64 *)all_root_children_stacked->data,
-                                      all_root_children_stacked->len);
-  meta_stack_tracker_restack_at_bottom (stack->screen->stack_tracker,
-                                        (guint64 *)x11_hidden_stack_ids->data,
-                                        x11_hidden_stack_ids->len);
+  n_requests =
+    meta_stack_tracker_restack_managed (stack->screen->stack_tracker,
+                                        (guint64 *)all_root_children_stacked->data,
+                                        all_root_children_stacked->len);
+  n_requests +=
+    meta_stack_tracker_restack_at_bottom (stack->screen->stack_tracker,
+                                          (guint64 *)x11_hidden_stack_ids->data,
+                                          x11_hidden_stack_ids->len);
 
   /* Sync _NET_CLIENT_LIST and _NET_CLIENT_LIST_STACKING */
 
-  XChangeProperty (stack->screen->display->xdisplay,
-                   stack->screen->xroot,
-                   stack->screen->display->atom__NET_CLIENT_LIST,
-                   XA_WINDOW,
-                   32, PropModeReplace,
-                   (unsigned char *)stack->xwindows->data,
-                   stack->xwindows->len);
-  XChangeProperty (stack->screen->display->xdisplay,
-                   stack->screen->xroot,
-                   stack->screen->display->atom__NET_CLIENT_LIST_STACKING,
-                   XA_WINDOW,
-                   32, PropModeReplace,
-                   (unsigned char *)x11_stacked->data,
-                   x11_stacked->len);
-
-  g_array_free (x11_stacked, TRUE);
+  if (stack->need_client_list)
+    {
+      XChangeProperty (stack->screen->display->xdisplay,
+                       stack->screen->xroot,
+                       stack->screen->display->atom__NET_CLIENT_LIST,
+                       XA_WINDOW,
+                       32, PropModeReplace,
+                       (unsigned char *)stack->xwindows->data,
+                       stack->xwindows->len);
+      stack->need_client_list = FALSE;
+      n_requests++;
+    }
+
+  if (stack->client_list_stacking == NULL ||
+      stack->client_list_stacking->len != x11_stacked->len ||
+      memcmp (stack->client_list_stacking->data, x11_stacked->data,
+              x11_stacked->len * sizeof (Window)) != 0)
+    {
+      XChangeProperty (stack->screen->display->xdisplay,
+                       stack->screen->xroot,
+                       stack->screen->display->atom__NET_CLIENT_LIST_STACKING,
+                       XA_WINDOW,
+                       32, PropModeReplace,
+                       (unsigned char *)x11_stacked->data,
+                       x11_stacked->len);
+
+      if (stack->client_list_stacking)
+        g_array_free (stack->client_list_stacking, TRUE);
+      stack->client_list_stacking = x11_stacked;
+      n_requests++;
+    }
+  else
+    g_array_free (x11_stacked, TRUE);
+
+  stack->n_syncs++;
+  stack->n_sync_requests += n_requests;
+
+  meta_topic (META_DEBUG_STACK,
+              "Stack synced with %d requests; %u requests in %u syncs\n",
+              n_requests, stack->n_sync_requests, stack->n_syncs);
+
+  g_array_free (x11_hidden_stack_ids, TRUE);
   g_array_free (all_root_children_stacked, TRUE);
 }
 
@@ -1512,8 +1857,8 @@ meta_window_set_stack_position_no_sync (MetaWindow *window,
       return;
     }
 
-  window->screen->stack->need_resort = TRUE;
-  window->screen->stack->need_constrain = TRUE;
+  queue_window (&window->screen->stack->constrain_windows, window);
+  queue_window (&window->screen->stack->resort_windows, window);
 
   if (position < window->stack_position)
     {
@@ -93,6 +93,23 @@ struct _MetaStack
    */
   int freeze_count;
 
+  /**
+   * The stacking constraints between the windows in the stack, which
+   * window has to be kept above which; kept up to date as windows are
+   * added, removed, or change transiency.
+   */
+  GHashTable *constraints;
+
+  /**
+   * Windows in need of having their layers recalculated, their
+   * positions recalculated with respect to transiency, or their place
+   * in "sorted" updated. Only these are looked at unless the whole
+   * stack needs it.
+   */
+  GList *relayer_windows;
+  GList *constrain_windows;
+  GList *resort_windows;
+
   /**
    * The last-known stack of all windows, bottom to top.  We cache it here
    * so that subsequent times we'll be able to do incremental moves.
@@ -105,20 +122,32 @@ struct _MetaStack
    */
   gint n_positions;
 
-  /** Is the stack in need of re-sorting? */
-  unsigned int need_resort : 1;
+  /**
+   * The contents of _NET_CLIENT_LIST_STACKING as we last set it, so
+   * that we only set it again when the stacking of the windows changes.
+   */
+  GArray *client_list_stacking;
 
   /**
-   * Are the windows in the stack in need of having their
-   * layers recalculated?
+   * How many times the stack was synced to the X server, and how many
+   * requests that took.
    */
-  unsigned int need_relayer : 1;
+  guint n_syncs;
+  guint n_sync_requests;
+
+  /** Is the stack in need of re-sorting? */
+  unsigned int need_resort : 1;
 
   /**
    * Are the windows in the stack in need of having their positions
    * recalculated with respect to transiency (parent and child windows)?
    */
   unsigned int need_constrain : 1;
+
+  /**
+   * Were windows added or removed since _NET_CLIENT_LIST was last set?
+   */
+  unsigned int need_client_list : 1;
 };
 
 /**
@@ -163,10 +192,10 @@ void       meta_stack_remove    (MetaStack      *stack,
 /**
  * meta_stack_update_layer:
  * @stack: The stack to recalculate
- * @window: Dummy parameter
+ * @window: The window whose layer may have changed
  *
- * Recalculates the correct layer for all windows in the stack,
- * and moves them about accordingly.
+ * Recalculates the correct layer for @window, and for the windows
+ * whose layer depends on it, and moves them about accordingly.
  *
  */
 void       meta_stack_update_layer    (MetaStack      *stack,
@@ -175,12 +204,11 @@ void       meta_stack_update_layer    (MetaStack      *stack,
 /**
  * meta_stack_update_transient:
  * @stack: The stack to recalculate
- * @window: Dummy parameter
- *
- * Recalculates the correct stacking order for all windows in the stack
- * according to their transience, and moves them about accordingly.
+ * @window: The window whose transiency, type or group changed
  *
- * FIXME: What's with the dummy parameter?
+ * Updates the stacking constraints between @window and the other
+ * windows in the stack, which must be called once the change has been
+ * made, and moves them about accordingly.
  */
 void       meta_stack_update_transient (MetaStack     *stack,
                                         MetaWindow    *window);
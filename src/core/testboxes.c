@@ -20,6 +20,7 @@
  */
 
 #include "boxes-private.h"
+#include "edge-resistance.h"
 #include <glib.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -316,10 +317,8 @@ get_screen_edges (int which)
 }
 
 static GList*
-get_monitor_edges (int which_monitor_set, int which_strut_set)
+get_monitor_rects (int which_monitor_set)
 {
-  GList *ret;
-  GSList *struts;
   GList *xins;
 
   xins = NULL;
@@ -344,7 +343,17 @@ get_monitor_edges (int which_monitor_set, int which_strut_set)
       break;
     }
 
-  ret = NULL;
+  return xins;
+}
+
+static GList*
+get_monitor_edges (int which_monitor_set, int which_strut_set)
+{
+  GList *ret;
+  GSList *struts;
+  GList *xins;
+
+  xins = get_monitor_rects (which_monitor_set);
 
   struts = get_strut_list (which_strut_set);
   ret = meta_rectangle_find_nonintersected_monitor_edges (xins, struts);
@@ -1226,6 +1235,436 @@ test_find_nonintersected_monitor_edges ()
   printf ("%s passed.\n", G_STRFUNC);
 }
 
+/* Up to a few struts of random thickness and extent along the sides of
+ * the 1600x1200 screen, plus now and then one in the middle
+ */
+static GSList*
+get_random_struts ()
+{
+  GSList *struts;
+  MetaRectangle screen, rect;
+  int num_struts = rand () % 6;
+  int i;
+
+  screen = meta_rect (0, 0, 1600, 1200);
+  struts = NULL;
+  for (i = 0; i < num_struts; i++)
+    {
+      MetaSide side = 1 << (rand () % 4);
+      int thickness = rand () % 100 + 1;
+      int start = rand () % 800;
+      int length = rand () % 1600 + 1;
+
+      switch (side)
+        {
+        case META_SIDE_LEFT:
+          rect = meta_rect (0, start, thickness, length);
+          break;
+        case META_SIDE_RIGHT:
+          rect = meta_rect (1600 - thickness, start, thickness, length);
+          break;
+        case META_SIDE_TOP:
+          rect = meta_rect (start, 0, length, thickness);
+          break;
+        case META_SIDE_BOTTOM:
+          rect = meta_rect (start, 1200 - thickness, length, thickness);
+          break;
+        default:
+          g_assert_not_reached ();
+        }
+
+      meta_rectangle_intersect (&rect, &screen, &rect);
+      struts = g_slist_prepend (struts,
+                                new_meta_strut (rect.x, rect.y,
+                                                rect.width, rect.height,
+                                                side));
+    }
+
+  if (rand () % 4 == 0)
+    struts = g_slist_prepend (struts,
+                              new_meta_strut (rand () % 1400, rand () % 1000,
+                                              200, 200, 0));
+
+  return struts;
+}
+
+/* Lists the MetaRectangles or MetaEdges of array in order, without
+ * copying them
+ */
+static GList*
+list_array_elements (GArray *array)
+{
+  guint  size = g_array_get_element_size (array);
+  GList *ret = NULL;
+  int    i;
+
+  for (i = array->len - 1; i >= 0; i--)
+    ret = g_list_prepend (ret, array->data + i * size);
+
+  return ret;
+}
+
+static void
+verify_array_matches_list (GArray   *array,
+                           GList    *list,
+                           gboolean  edges)
+{
+  GList *array_list = list_array_elements (array);
+
+  if (edges)
+    verify_edge_lists_are_equal (array_list, list);
+  else
+    verify_lists_are_equal (array_list, list);
+
+  g_list_free (array_list);
+}
+
+static void
+test_array_variants ()
+{
+  MetaRectangle basic_rect;
+  GSList *struts;
+  GList *xins;
+  GList *list;
+  GArray *array;
+  int i, j;
+
+  basic_rect = meta_rect (0, 0, 1600, 1200);
+
+  for (i = 0; i < NUM_RANDOM_RUNS / 10; i++)
+    {
+      GSList *windows;
+      GList *edge_iter;
+
+      /* The fixed strut lists the other tests use first, then random
+       * ones
+       */
+      if (i <= 6)
+        struts = get_strut_list (i);
+      else
+        struts = get_random_struts ();
+      xins = get_monitor_rects (i % 4);
+
+      /* Same regions... */
+      list = meta_rectangle_get_minimal_spanning_set_for_region (&basic_rect,
+                                                                 struts);
+      array =
+        meta_rectangle_get_minimal_spanning_set_for_region_array (&basic_rect,
+                                                                  struts);
+      verify_array_matches_list (array, list, FALSE);
+      meta_rectangle_free_list_and_elements (list);
+      g_array_free (array, TRUE);
+
+      /* ...same monitor edges... */
+      list = meta_rectangle_find_nonintersected_monitor_edges (xins, struts);
+      array = meta_rectangle_find_nonintersected_monitor_edges_array (xins,
+                                                                      struts);
+      verify_array_matches_list (array, list, TRUE);
+      meta_rectangle_free_list_and_elements (list);
+      g_array_free (array, TRUE);
+
+      /* ...and same screen edges, in the same order */
+      list = meta_rectangle_find_onscreen_edges (&basic_rect, struts);
+      array = meta_rectangle_find_onscreen_edges_array (&basic_rect, struts);
+      verify_array_matches_list (array, list, TRUE);
+      g_array_free (array, TRUE);
+
+      /* Cutting those with a few windows.  The array variant works from
+       * the end of the array where the list one works from the head of
+       * the list, so it is given the edges last to first, and its
+       * results are last to first too.
+       */
+      windows = NULL;
+      for (j = rand () % 5; j > 0; j--)
+        {
+          MetaRectangle *window = g_new (MetaRectangle, 1);
+          get_random_rect (window);
+          windows = g_slist_prepend (windows, window);
+        }
+
+      array = g_array_new (FALSE, FALSE, sizeof (MetaEdge));
+      for (edge_iter = g_list_last (list); edge_iter; edge_iter = edge_iter->prev)
+        g_array_append_vals (array, edge_iter->data, 1);
+
+      list = meta_rectangle_remove_intersections_with_boxes_from_edges (list,
+                                                                        windows);
+      meta_rectangle_remove_intersections_with_boxes_from_edge_array (array,
+                                                                      windows);
+      list = g_list_reverse (list);
+      verify_array_matches_list (array, list, TRUE);
+      meta_rectangle_free_list_and_elements (list);
+      g_array_free (array, TRUE);
+
+      g_slist_free_full (windows, g_free);
+      meta_rectangle_free_list_and_elements (xins);
+      free_strut_list (struts);
+    }
+
+  printf ("%s passed.\n", G_STRFUNC);
+}
+
+/* Appends the edges of a window at rect, as edge resistance has them:
+ * the left side of a window resists the right edge of the window being
+ * moved, and so on
+ */
+static void
+append_window_edges (GArray              *edges,
+                     const MetaRectangle *rect)
+{
+  MetaEdge edge;
+
+  edge.edge_type = META_EDGE_WINDOW;
+
+  edge.rect = *rect;
+  edge.rect.width = 0;
+  edge.side_type = META_SIDE_RIGHT;
+  g_array_append_val (edges, edge);
+
+  edge.rect = *rect;
+  edge.rect.x += rect->width;
+  edge.rect.width = 0;
+  edge.side_type = META_SIDE_LEFT;
+  g_array_append_val (edges, edge);
+
+  edge.rect = *rect;
+  edge.rect.height = 0;
+  edge.side_type = META_SIDE_BOTTOM;
+  g_array_append_val (edges, edge);
+
+  edge.rect = *rect;
+  edge.rect.y += rect->height;
+  edge.rect.height = 0;
+  edge.side_type = META_SIDE_TOP;
+  g_array_append_val (edges, edge);
+}
+
+/* The screen, monitor and window edges of a workspace with the given
+ * struts and monitors and a few random windows.  The windows are on a
+ * coarse grid, so that many edges end exactly where others do.
+ */
+static GArray*
+get_workspace_edges (int which_strut_set,
+                     int which_monitor_set,
+                     int num_windows)
+{
+  MetaRectangle basic_rect;
+  GSList *struts;
+  GList *xins;
+  GArray *edges, *monitor_edges;
+  int i;
+
+  basic_rect = meta_rect (0, 0, 1600, 1200);
+  struts = get_strut_list (which_strut_set);
+  xins = get_monitor_rects (which_monitor_set);
+
+  edges = meta_rectangle_find_onscreen_edges_array (&basic_rect, struts);
+  monitor_edges = meta_rectangle_find_nonintersected_monitor_edges_array (xins,
+                                                                          struts);
+  g_array_append_vals (edges, monitor_edges->data, monitor_edges->len);
+
+  for (i = 0; i < num_windows; i++)
+    {
+      MetaRectangle rect;
+
+      rect.x = rand () % 16 * 100;
+      rect.y = rand () % 12 * 100;
+      rect.width  = (rand () % 8 + 1) * 100;
+      rect.height = (rand () % 6 + 1) * 100;
+      append_window_edges (edges, &rect);
+    }
+
+  g_array_free (monitor_edges, TRUE);
+  meta_rectangle_free_list_and_elements (xins);
+  free_strut_list (struts);
+
+  return edges;
+}
+
+static int
+compare_edge_pointers (gconstpointer a,
+                       gconstpointer b)
+{
+  const MetaEdge * const *a_edge = a;
+  const MetaEdge * const *b_edge = b;
+  return meta_rectangle_edge_cmp_ignore_type (*a_edge, *b_edge);
+}
+
+/* Sets up index over the vertical or horizontal edges of edges, sorted
+ * by position, the way edge resistance does at the start of a grab
+ */
+static void
+build_edge_index (MetaEdgeIndex *index,
+                  GArray        *edges,
+                  gboolean       vertical)
+{
+  guint i;
+
+  index->edges = g_array_new (FALSE, FALSE, sizeof (MetaEdge*));
+  for (i = 0; i < edges->len; i++)
+    {
+      MetaEdge *edge = &g_array_index (edges, MetaEdge, i);
+      gboolean edge_vertical = edge->side_type == META_SIDE_LEFT ||
+                               edge->side_type == META_SIDE_RIGHT;
+
+      if (edge_vertical == vertical)
+        g_array_append_val (index->edges, edge);
+    }
+  g_array_sort (index->edges, compare_edge_pointers);
+
+  meta_edge_index_build (index);
+}
+
+static void
+get_edge_span (const MetaEdge *edge,
+               int            *start,
+               int            *end)
+{
+  if (edge->side_type == META_SIDE_LEFT ||
+      edge->side_type == META_SIDE_RIGHT)
+    {
+      *start = BOX_TOP (edge->rect);
+      *end   = BOX_BOTTOM (edge->rect);
+    }
+  else
+    {
+      *start = BOX_LEFT (edge->rect);
+      *end   = BOX_RIGHT (edge->rect);
+    }
+}
+
+/* What meta_edge_index_find_next_in_span() should find, looking at each
+ * edge in turn
+ */
+static int
+find_next_edge_in_span_linearly (const GArray *edges,
+                                 int           from,
+                                 int           low,
+                                 int           high,
+                                 gboolean      forward)
+{
+  int i;
+
+  for (i = from; i >= 0 && i < (int)edges->len; i += forward ? 1 : -1)
+    {
+      int start, end;
+
+      get_edge_span (g_array_index (edges, MetaEdge*, i), &start, &end);
+      if (start <= high && end >= low)
+        return i;
+    }
+
+  return -1;
+}
+
+static void
+verify_edge_index_finds (const MetaEdgeIndex *index,
+                         int                  from,
+                         int                  low,
+                         int                  high)
+{
+  gboolean forward;
+
+  for (forward = FALSE; forward <= TRUE; forward++)
+    {
+      int code, answer;
+
+      code = meta_edge_index_find_next_in_span (index, from, low, high, forward);
+      answer = find_next_edge_in_span_linearly (index->edges,
+                                                from, low, high, forward);
+      if (code != answer)
+        g_error ("Searching %s from %d of %u edges for span %d-%d found "
+                 "edge %d instead of %d\n",
+                 forward ? "forward" : "backward", from, index->edges->len,
+                 low, high, code, answer);
+    }
+}
+
+static void
+verify_edge_index (const MetaEdgeIndex *index)
+{
+  int len = index->edges->len;
+  int i;
+
+  for (i = 0; i < NUM_RANDOM_RUNS / 100; i++)
+    {
+      int from = rand () % (len + 2) - 1;
+      int low, high;
+
+      /* Any span, including the empty ones edge resistance looks for
+       * with windows a pixel wide
+       */
+      low = rand () % 1300 - 50;
+      high = low + rand () % 600 - 2;
+      verify_edge_index_finds (index, from, low, high);
+
+      if (len == 0)
+        continue;
+
+      /* Spans ending exactly where an edge starts or starting exactly
+       * where it ends, and ones a pixel short of it
+       */
+      get_edge_span (g_array_index (index->edges, MetaEdge*, rand () % len),
+                     &low, &high);
+      verify_edge_index_finds (index, from, high, high + rand () % 300);
+      verify_edge_index_finds (index, from, low - rand () % 300, low);
+      verify_edge_index_finds (index, from, high + 1, high + 1 + rand () % 300);
+      verify_edge_index_finds (index, from, low - 1 - rand () % 300, low - 1);
+      verify_edge_index_finds (index, from, low, low);
+      verify_edge_index_finds (index, from, high, high);
+    }
+}
+
+static void
+test_edge_index ()
+{
+  MetaEdgeIndex vertical_index, horizontal_index;
+  GArray *edges;
+  int i;
+
+  /* Each time around is a switch to another workspace: as in a grab
+   * there, the indices are built anew over the edges of that workspace,
+   * after those of the old one have been freed.  Going from many edges
+   * to few and back also changes the size of the trees.
+   */
+  for (i = 0; i < NUM_RANDOM_RUNS / 100; i++)
+    {
+      int num_windows;
+
+      switch (i % 4)
+        {
+        case 0:
+          num_windows = 0;
+          break;
+        case 1:
+          num_windows = rand () % 4;
+          break;
+        default:
+          num_windows = rand () % 100;
+          break;
+        }
+
+      edges = get_workspace_edges (rand () % 7, rand () % 4, num_windows);
+      build_edge_index (&vertical_index, edges, TRUE);
+      build_edge_index (&horizontal_index, edges, FALSE);
+
+      verify_edge_index (&vertical_index);
+      verify_edge_index (&horizontal_index);
+
+      meta_edge_index_free (&vertical_index);
+      meta_edge_index_free (&horizontal_index);
+      g_array_free (edges, TRUE);
+    }
+
+  /* No edges at all */
+  edges = g_array_new (FALSE, FALSE, sizeof (MetaEdge));
+  build_edge_index (&vertical_index, edges, TRUE);
+  verify_edge_index (&vertical_index);
+  meta_edge_index_free (&vertical_index);
+  g_array_free (edges, TRUE);
+
+  printf ("%s passed.\n", G_STRFUNC);
+}
+
 static void
 test_gravity_resize ()
 {
@@ -1400,6 +1839,8 @@ main()
   /* And now the functions dealing with edges more than boxes */
   test_find_onscreen_edges ();
   test_find_nonintersected_monitor_edges ();
+  test_array_variants ();
+  test_edge_index ();
 
   /* And now the misfit functions that don't quite fit in anywhere else... */
   test_gravity_resize ();
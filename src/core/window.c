@@ -5053,6 +5053,8 @@ meta_window_type_changed (MetaWindow *window)
     meta_window_destroy_frame (window);
 
   /* update stacking constraints */
+  if (!window->override_redirect)
+    meta_stack_update_transient (window->screen->stack, window);
   meta_window_update_layer (window);
 
   meta_window_grab_keys (window);
@@ -7508,10 +7510,6 @@ meta_window_set_transient_for (MetaWindow *window,
         }
     }
 
-  /* update stacking constraints */
-  if (!window->override_redirect)
-    meta_stack_update_transient (window->screen->stack, window);
-
   /* We know this won't create a reference cycle because we check for loops */
   g_clear_object (&window->transient_for);
   window->transient_for = parent ? g_object_ref (parent) : NULL;
@@ -7525,6 +7523,10 @@ meta_window_set_transient_for (MetaWindow *window,
       window->xtransient_for != window->xgroup_leader)
     meta_window_group_leader_changed (window);
 
+  /* update stacking constraints */
+  if (!window->override_redirect)
+    meta_stack_update_transient (window->screen->stack, window);
+
   if (!window->constructing && !window->override_redirect)
     meta_window_queue (window, META_QUEUE_MOVE_RESIZE);
 
@@ -59,8 +59,11 @@ struct _MetaWorkspace
   GList  *screen_region;
   GList  **monitor_region;
   gint n_monitor_regions;
-  GList  *screen_edges;
-  GList  *monitor_edges;
+  GArray *screen_edges;
+  GArray *monitor_edges;
+  /* The edges of each window as last used for edge resistance; see
+   * edge-resistance.c */
+  GHashTable *window_edges;
   GSList *builtin_struts;
   GSList *all_struts;
   guint work_areas_invalid : 1;
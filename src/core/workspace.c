@@ -198,6 +198,7 @@ meta_workspace_new (MetaScreen *screen)
   workspace->monitor_region = NULL;
   workspace->screen_edges = NULL;
   workspace->monitor_edges = NULL;
+  workspace->window_edges = NULL;
   workspace->list_containing_self = g_list_prepend (NULL, workspace);
 
   workspace->builtin_struts = NULL;
@@ -284,6 +285,9 @@ meta_workspace_remove (MetaWorkspace *workspace)
 
   workspace_free_builtin_struts (workspace);
 
+  if (workspace->window_edges)
+    g_hash_table_destroy (workspace->window_edges);
+
   /* screen.c:update_num_workspaces(), which calls us, removes windows from
    * workspaces first, which can cause the workareas on the workspace to be
    * invalidated (and hence for struts/regions/edges to be freed).
@@ -298,8 +302,8 @@ meta_workspace_remove (MetaWorkspace *workspace)
         meta_rectangle_free_list_and_elements (workspace->monitor_region[i]);
       g_free (workspace->monitor_region);
       meta_rectangle_free_list_and_elements (workspace->screen_region);
-      meta_rectangle_free_list_and_elements (workspace->screen_edges);
-      meta_rectangle_free_list_and_elements (workspace->monitor_edges);
+      g_array_free (workspace->screen_edges, TRUE);
+      g_array_free (workspace->monitor_edges, TRUE);
     }
 
   g_object_unref (workspace);
@@ -708,8 +712,8 @@ meta_workspace_invalidate_work_area (MetaWorkspace *workspace)
     meta_rectangle_free_list_and_elements (workspace->monitor_region[i]);
   g_free (workspace->monitor_region);
   meta_rectangle_free_list_and_elements (workspace->screen_region);
-  meta_rectangle_free_list_and_elements (workspace->screen_edges);
-  meta_rectangle_free_list_and_elements (workspace->monitor_edges);
+  g_array_free (workspace->screen_edges, TRUE);
+  g_array_free (workspace->monitor_edges, TRUE);
   workspace->monitor_region = NULL;
   workspace->screen_region = NULL;
   workspace->screen_edges = NULL;
@@ -904,14 +908,15 @@ ensure_work_areas_validated (MetaWorkspace *workspace)
   g_assert (workspace->screen_edges    == NULL);
   g_assert (workspace->monitor_edges  == NULL);
   workspace->screen_edges =
-    meta_rectangle_find_onscreen_edges (&workspace->screen->rect,
-                                        workspace->all_struts);
+    meta_rectangle_find_onscreen_edges_array (&workspace->screen->rect,
+                                              workspace->all_struts);
   tmp = NULL;
   for (i = 0; i < workspace->screen->n_monitor_infos; i++)
     tmp = g_list_prepend (tmp, &workspace->screen->monitor_infos[i].rect);
   workspace->monitor_edges =
-    meta_rectangle_find_nonintersected_monitor_edges (tmp,
-                                                       workspace->all_struts);
+    meta_rectangle_find_nonintersected_monitor_edges_array (
+      tmp,
+      workspace->all_struts);
   g_list_free (tmp);
 
   /* We're all done, YAAY!  Record that everything has been validated. */
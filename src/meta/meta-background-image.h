@@ -68,9 +68,13 @@ MetaBackgroundImageCache *meta_background_image_cache_get_default (void);
 
 GType meta_background_image_cache_get_type (void);
 
-MetaBackgroundImage *meta_background_image_cache_load  (MetaBackgroundImageCache *cache,
-                                                        const char               *filename);
-void                 meta_background_image_cache_purge (MetaBackgroundImageCache *cache,
-                                                        const char               *filename);
+MetaBackgroundImage *meta_background_image_cache_load          (MetaBackgroundImageCache *cache,
+                                                                const char               *filename);
+MetaBackgroundImage *meta_background_image_cache_load_for_size (MetaBackgroundImageCache *cache,
+                                                                const char               *filename,
+                                                                int                       width,
+                                                                int                       height);
+void                 meta_background_image_cache_purge         (MetaBackgroundImageCache *cache,
+                                                                const char               *filename);
 
 #endif /* __META_BACKGROUND_IMAGE_H__ */
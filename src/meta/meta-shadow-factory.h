@@ -81,4 +81,12 @@ void meta_shadow_factory_get_params (MetaShadowFactory *factory,
                                      gboolean           focused,
                                      MetaShadowParams  *params);
 
+void  meta_shadow_factory_set_max_released_size (MetaShadowFactory *factory,
+                                                 gsize              max_size);
+gsize meta_shadow_factory_get_texture_memory    (MetaShadowFactory *factory);
+void  meta_shadow_factory_get_cache_stats       (MetaShadowFactory *factory,
+                                                 guint             *n_hits,
+                                                 guint             *n_revived,
+                                                 guint             *n_misses);
+
 #endif /* __META_SHADOW_FACTORY_H__ */
@@ -67,7 +67,7 @@ process_line (const char *line)
 
       if (argc  < 2)
         {
-          g_print ("usage: create <id> [override|csd]");
+          g_print ("usage: create <id> [override|csd|dialog]");
           goto out;
         }
 
@@ -79,12 +79,15 @@ process_line (const char *line)
 
       gboolean override = FALSE;
       gboolean csd = FALSE;
+      gboolean dialog = FALSE;
       for (i = 2; i < argc; i++)
         {
           if (strcmp (argv[i], "override") == 0)
             override = TRUE;
           if (strcmp (argv[i], "csd") == 0)
             csd = TRUE;
+          if (strcmp (argv[i], "dialog") == 0)
+            dialog = TRUE;
         }
 
       if (override && csd)
@@ -103,6 +106,11 @@ process_line (const char *line)
           gtk_widget_show (headerbar);
         }
 
+      /* A dialog that isn't transient for any window is transient
+       * for its whole group */
+      if (dialog)
+        gtk_window_set_type_hint (GTK_WINDOW (window), GDK_WINDOW_TYPE_HINT_DIALOG);
+
       gtk_window_set_default_size (GTK_WINDOW (window), 100, 100);
 
       gchar *title = g_strdup_printf ("test/%s/%s", client_id, argv[1]);
@@ -126,6 +134,25 @@ process_line (const char *line)
         }
 
     }
+  else if (strcmp (argv[0], "set_parent") == 0)
+    {
+      if (argc != 3)
+        {
+          g_print ("usage: set_parent <window-id> <parent-id>");
+          goto out;
+        }
+
+      GtkWidget *window = lookup_window (argv[1]);
+      if (!window)
+        goto out;
+
+      GtkWidget *parent_window = lookup_window (argv[2]);
+      if (!parent_window)
+        goto out;
+
+      gtk_window_set_transient_for (GTK_WINDOW (window),
+                                    GTK_WINDOW (parent_window));
+    }
   else if (strcmp (argv[0], "show") == 0)
     {
       if (argc != 2)
@@ -196,6 +223,22 @@ process_line (const char *line)
 
       gdk_window_lower (gtk_widget_get_window (window));
     }
+  else if (strcmp (argv[0], "make_above") == 0)
+    {
+      if (argc != 3 ||
+          (strcmp (argv[2], "true") != 0 && strcmp (argv[2], "false") != 0))
+        {
+          g_print ("usage: make_above <id> [true|false]");
+          goto out;
+        }
+
+      GtkWidget *window = lookup_window (argv[1]);
+      if (!window)
+        goto out;
+
+      gtk_window_set_keep_above (GTK_WINDOW (window),
+                                 strcmp (argv[2], "true") == 0);
+    }
   else if (strcmp (argv[0], "destroy") == 0)
     {
       if (argc != 2)
@@ -754,8 +754,9 @@ test_case_do (TestCase *test,
     {
       if (!(argc == 2 ||
             (argc == 3 && strcmp (argv[2], "override") == 0) ||
-            (argc == 3 && strcmp (argv[2], "csd") == 0)))
-        BAD_COMMAND("usage: %s <client-id>/<window-id > [override|csd]", argv[0]);
+            (argc == 3 && strcmp (argv[2], "csd") == 0) ||
+            (argc == 3 && strcmp (argv[2], "dialog") == 0)))
+        BAD_COMMAND("usage: %s <client-id>/<window-id > [override|csd|dialog]", argv[0]);
 
       TestClient *client;
       const char *window_id;
@@ -768,6 +769,39 @@ test_case_do (TestCase *test,
                            NULL))
         return FALSE;
     }
+  else if (strcmp (argv[0], "set_parent") == 0)
+    {
+      if (argc != 3)
+        BAD_COMMAND("usage: %s <client-id>/<window-id> <parent-window-id>", argv[0]);
+
+      TestClient *client;
+      const char *window_id;
+      if (!test_case_parse_window_id (test, argv[1], &client, &window_id, error))
+        return FALSE;
+
+      if (!test_client_do (client, error,
+                           "set_parent", window_id,
+                           argv[2],
+                           NULL))
+        return FALSE;
+    }
+  else if (strcmp (argv[0], "make_above") == 0)
+    {
+      if (argc != 3 ||
+          (strcmp (argv[2], "true") != 0 && strcmp (argv[2], "false") != 0))
+        BAD_COMMAND("usage: %s <client-id>/<window-id> [true|false]", argv[0]);
+
+      TestClient *client;
+      const char *window_id;
+      if (!test_case_parse_window_id (test, argv[1], &client, &window_id, error))
+        return FALSE;
+
+      if (!test_client_do (client, error,
+                           "make_above", window_id,
+                           argv[2],
+                           NULL))
+        return FALSE;
+    }
   else if (strcmp (argv[0], "show") == 0 ||
            strcmp (argv[0], "hide") == 0 ||
            strcmp (argv[0], "activate") == 0 ||
@@ -75,6 +75,9 @@ struct _MetaWaylandCompositor
   GHashTable *outputs;
   struct wl_list frame_callbacks;
 
+  /* Surfaces with SHM damage waiting for the next paint */
+  struct wl_list pending_uploads;
+
   MetaXWaylandManager xwayland_manager;
 
   MetaWaylandSeat *seat;
@@ -0,0 +1,329 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/*
+ * Copyright (C) 2014 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+/*
+ * Copying large SHM updates off the main thread
+ *
+ * Reading a big SHM buffer and uploading it to GL can take several
+ * milliseconds, which we don't want to spend in the middle of handling
+ * client requests. Instead, the damaged parts of the buffer are copied
+ * to staging memory by a worker thread, and only the GL upload from
+ * there is done on the main thread, before the next paint.
+ *
+ * The worker reads the client's memory pool directly, and the pool can
+ * be resized (and so moved) or destroyed by client requests. So copies
+ * are only started after we are done dispatching client requests, and
+ * we wait for them all to be done before dispatching again, and before
+ * flushing clients, since a client whose flush fails is destroyed. Each copy
+ * also holds a reference on its buffer until it has been uploaded, so
+ * that the buffer isn't released to the client before then.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <wayland-server.h>
+
+#include "meta-wayland-shm-copy.h"
+#include "meta-wayland-private.h"
+
+struct _MetaWaylandShmCopy
+{
+  MetaWaylandBuffer *buffer;
+  struct wl_shm_buffer *shm_buffer;
+
+  CoglPixelFormat format;
+  CoglTextureComponents components;
+  int bytes_per_pixel;
+
+  cairo_rectangle_int_t *boxes;
+  int n_boxes;
+
+  /* The boxes one after the other, each with rows of
+   * box.width * bytes_per_pixel bytes */
+  guchar *data;
+
+  GMutex mutex;
+  GCond cond;
+  gboolean started;
+  gboolean done;
+};
+
+static GThreadPool *copy_pool;
+
+/* Copies that were created while dispatching client requests */
+static GQueue queued_copies = G_QUEUE_INIT;
+/* Copies that have been given to the worker threads */
+static GQueue running_copies = G_QUEUE_INIT;
+
+static gboolean
+get_cogl_format (uint32_t               shm_format,
+                 CoglPixelFormat       *format,
+                 CoglTextureComponents *components)
+{
+  switch (shm_format)
+    {
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+    case WL_SHM_FORMAT_ARGB8888:
+      *format = COGL_PIXEL_FORMAT_ARGB_8888_PRE;
+      *components = COGL_TEXTURE_COMPONENTS_RGBA;
+      return TRUE;
+    case WL_SHM_FORMAT_XRGB8888:
+      *format = COGL_PIXEL_FORMAT_ARGB_8888;
+      *components = COGL_TEXTURE_COMPONENTS_RGB;
+      return TRUE;
+#else
+    case WL_SHM_FORMAT_ARGB8888:
+      *format = COGL_PIXEL_FORMAT_BGRA_8888_PRE;
+      *components = COGL_TEXTURE_COMPONENTS_RGBA;
+      return TRUE;
+    case WL_SHM_FORMAT_XRGB8888:
+      *format = COGL_PIXEL_FORMAT_BGRA_8888;
+      *components = COGL_TEXTURE_COMPONENTS_RGB;
+      return TRUE;
+#endif
+    default:
+      return FALSE;
+    }
+}
+
+static void
+copy_boxes (MetaWaylandShmCopy *copy)
+{
+  const guchar *src_data;
+  guchar *dst;
+  int stride;
+  int i, y;
+
+  stride = wl_shm_buffer_get_stride (copy->shm_buffer);
+  dst = copy->data;
+
+  wl_shm_buffer_begin_access (copy->shm_buffer);
+
+  src_data = wl_shm_buffer_get_data (copy->shm_buffer);
+
+  for (i = 0; i < copy->n_boxes; i++)
+    {
+      cairo_rectangle_int_t *box = &copy->boxes[i];
+      int row_size = box->width * copy->bytes_per_pixel;
+      const guchar *src = src_data + box->y * stride + box->x * copy->bytes_per_pixel;
+
+      for (y = 0; y < box->height; y++)
+        {
+          memcpy (dst, src, row_size);
+          src += stride;
+          dst += row_size;
+        }
+    }
+
+  wl_shm_buffer_end_access (copy->shm_buffer);
+}
+
+static void
+copy_thread_func (gpointer data,
+                  gpointer user_data)
+{
+  MetaWaylandShmCopy *copy = data;
+
+  copy_boxes (copy);
+
+  g_mutex_lock (&copy->mutex);
+  copy->done = TRUE;
+  g_cond_signal (&copy->cond);
+  g_mutex_unlock (&copy->mutex);
+}
+
+static void
+wait_for_copy (MetaWaylandShmCopy *copy)
+{
+  g_mutex_lock (&copy->mutex);
+  while (!copy->done)
+    g_cond_wait (&copy->cond, &copy->mutex);
+  g_mutex_unlock (&copy->mutex);
+}
+
+/**
+ * meta_wayland_shm_copy_new:
+ * @buffer: an SHM buffer
+ * @boxes: the parts of @buffer to copy, within its bounds
+ * @n_boxes: the number of @boxes
+ *
+ * Creates a copy of parts of @buffer that will be made on a worker
+ * thread once the current client requests have been dispatched. The
+ * copy holds a reference on @buffer until meta_wayland_shm_copy_finish().
+ *
+ * Return value: the new copy, or %NULL if the buffer's format isn't
+ *   supported
+ */
+MetaWaylandShmCopy *
+meta_wayland_shm_copy_new (MetaWaylandBuffer     *buffer,
+                           cairo_rectangle_int_t *boxes,
+                           int                    n_boxes)
+{
+  struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get (buffer->resource);
+  MetaWaylandShmCopy *copy;
+  CoglPixelFormat format;
+  CoglTextureComponents components;
+  gsize size;
+  int i;
+
+  if (!get_cogl_format (wl_shm_buffer_get_format (shm_buffer), &format, &components))
+    return NULL;
+
+  copy = g_slice_new0 (MetaWaylandShmCopy);
+  copy->buffer = buffer;
+  copy->shm_buffer = shm_buffer;
+  copy->format = format;
+  copy->components = components;
+  copy->bytes_per_pixel = 4;
+  copy->boxes = g_memdup (boxes, n_boxes * sizeof (cairo_rectangle_int_t));
+  copy->n_boxes = n_boxes;
+
+  size = 0;
+  for (i = 0; i < n_boxes; i++)
+    size += (gsize) boxes[i].width * boxes[i].height * copy->bytes_per_pixel;
+  copy->data = g_malloc (size);
+
+  g_mutex_init (&copy->mutex);
+  g_cond_init (&copy->cond);
+
+  meta_wayland_buffer_ref (buffer);
+
+  g_queue_push_tail (&queued_copies, copy);
+
+  return copy;
+}
+
+CoglTextureComponents
+meta_wayland_shm_copy_get_components (MetaWaylandShmCopy *copy)
+{
+  return copy->components;
+}
+
+/**
+ * meta_wayland_shm_copy_finish:
+ * @copy: a #MetaWaylandShmCopy
+ * @upload: whether to upload the copied data to the buffer's texture
+ *
+ * Waits for @copy to be done, uploads it if @upload is %TRUE and the
+ * buffer is still in use, then drops the reference on the buffer and
+ * frees @copy. If the copy hasn't been started yet, it is done right
+ * away on the calling thread.
+ *
+ * Return value: the number of bytes uploaded
+ */
+gsize
+meta_wayland_shm_copy_finish (MetaWaylandShmCopy *copy,
+                              gboolean            upload)
+{
+  MetaWaylandBuffer *buffer = copy->buffer;
+  gsize uploaded = 0;
+  int i;
+
+  if (!copy->started)
+    {
+      g_queue_remove (&queued_copies, copy);
+
+      if (upload)
+        copy_boxes (copy);
+    }
+  else
+    {
+      wait_for_copy (copy);
+      g_queue_remove (&running_copies, copy);
+    }
+
+  /* If we hold the last reference, the texture is about to go away */
+  if (upload && buffer->texture != NULL && buffer->ref_count > 1)
+    {
+      const guchar *data = copy->data;
+
+      for (i = 0; i < copy->n_boxes; i++)
+        {
+          cairo_rectangle_int_t *box = &copy->boxes[i];
+          int rowstride = box->width * copy->bytes_per_pixel;
+
+          cogl_texture_set_region (buffer->texture,
+                                   0, 0,
+                                   box->x, box->y,
+                                   box->width, box->height,
+                                   box->width, box->height,
+                                   copy->format,
+                                   rowstride,
+                                   data);
+
+          data += rowstride * box->height;
+          uploaded += rowstride * box->height;
+        }
+    }
+
+  meta_wayland_buffer_unref (buffer);
+
+  g_mutex_clear (&copy->mutex);
+  g_cond_clear (&copy->cond);
+  g_free (copy->boxes);
+  g_free (copy->data);
+  g_slice_free (MetaWaylandShmCopy, copy);
+
+  return uploaded;
+}
+
+/**
+ * meta_wayland_shm_copy_start_queued:
+ *
+ * Hands the copies created while dispatching client requests to the
+ * worker threads. Must only be called when we are done dispatching.
+ */
+void
+meta_wayland_shm_copy_start_queued (void)
+{
+  MetaWaylandShmCopy *copy;
+
+  if (g_queue_is_empty (&queued_copies))
+    return;
+
+  if (copy_pool == NULL)
+    copy_pool = g_thread_pool_new (copy_thread_func, NULL, 2, FALSE, NULL);
+
+  while ((copy = g_queue_pop_head (&queued_copies)))
+    {
+      copy->started = TRUE;
+      g_queue_push_tail (&running_copies, copy);
+      g_thread_pool_push (copy_pool, copy, NULL);
+    }
+}
+
+/**
+ * meta_wayland_shm_copy_wait_all:
+ *
+ * Waits for all the copies running on worker threads, so that client
+ * requests can change the memory pools they read from, and clients can
+ * be destroyed.
+ */
+void
+meta_wayland_shm_copy_wait_all (void)
+{
+  GList *l;
+
+  for (l = running_copies.head; l; l = l->next)
+    wait_for_copy (l->data);
+}
@@ -0,0 +1,40 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/*
+ * Copyright (C) 2014 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef META_WAYLAND_SHM_COPY_H
+#define META_WAYLAND_SHM_COPY_H
+
+#include <cairo.h>
+#include <cogl/cogl.h>
+
+#include "meta-wayland-types.h"
+
+MetaWaylandShmCopy    *meta_wayland_shm_copy_new            (MetaWaylandBuffer     *buffer,
+                                                             cairo_rectangle_int_t *boxes,
+                                                             int                    n_boxes);
+CoglTextureComponents  meta_wayland_shm_copy_get_components (MetaWaylandShmCopy    *copy);
+gsize                  meta_wayland_shm_copy_finish         (MetaWaylandShmCopy    *copy,
+                                                             gboolean               upload);
+
+void                   meta_wayland_shm_copy_start_queued   (void);
+void                   meta_wayland_shm_copy_wait_all       (void);
+
+#endif /* META_WAYLAND_SHM_COPY_H */
@@ -26,6 +26,7 @@
 #include <clutter/wayland/clutter-wayland-compositor.h>
 #include <clutter/wayland/clutter-wayland-surface.h>
 #include <cogl/cogl-wayland-server.h>
+#include <gdk/gdk.h> /* for gdk_rectangle_union() */
 
 #include <glib.h>
 #include <sys/time.h>
@@ -42,6 +43,7 @@
 #include "xdg-shell-server-protocol.h"
 
 #include "meta-wayland-private.h"
+#include "meta-wayland-shm-copy.h"
 #include "meta-xwayland-private.h"
 #include "meta-wayland-seat.h"
 #include "meta-wayland-keyboard.h"
@@ -72,6 +74,29 @@ typedef struct
   struct wl_listener sibling_destroy_listener;
 } MetaWaylandSubsurfacePlacementOp;
 
+static void
+surface_queue_uploads (MetaWaylandSurface *surface)
+{
+  if (wl_list_empty (&surface->upload_link))
+    wl_list_insert (&surface->compositor->pending_uploads, &surface->upload_link);
+}
+
+static void
+surface_discard_uploads (MetaWaylandSurface *surface)
+{
+  g_clear_pointer (&surface->pending_upload, cairo_region_destroy);
+
+  /* This also drops the copy's reference on the buffer */
+  if (surface->shm_copy)
+    {
+      meta_wayland_shm_copy_finish (surface->shm_copy, FALSE);
+      surface->shm_copy = NULL;
+    }
+
+  wl_list_remove (&surface->upload_link);
+  wl_list_init (&surface->upload_link);
+}
+
 static void
 surface_set_buffer (MetaWaylandSurface *surface,
                     MetaWaylandBuffer  *buffer)
@@ -79,6 +104,9 @@ surface_set_buffer (MetaWaylandSurface *surface,
   if (surface->buffer == buffer)
     return;
 
+  /* Pending damage was for the old buffer */
+  surface_discard_uploads (surface);
+
   if (surface->buffer)
     {
       wl_list_remove (&surface->buffer_destroy_listener.link);
@@ -102,22 +130,264 @@ surface_handle_buffer_destroy (struct wl_listener *listener, void *data)
   surface_set_buffer (surface, NULL);
 }
 
+/* Uploading a rectangle has a fixed cost on top of the pixels it copies;
+ * we count it as this many pixels when deciding whether to upload the
+ * bounding box of two rectangles rather than each of them. */
+#define UPLOAD_CALL_COST 4096
+
+/* With more rectangles than this, we just upload the extents */
+#define MAX_PLANNED_UPLOADS 32
+
+/* Damage at least this big is copied out of the SHM buffer on a worker
+ * thread, see meta-wayland-shm-copy.c */
+#define ASYNC_COPY_MIN_BYTES (256 * 1024)
+
+static gint64
+rect_area (cairo_rectangle_int_t *rect)
+{
+  return (gint64) rect->width * rect->height;
+}
+
+/* Fills @boxes with rectangles covering @region, merging rectangles as
+ * long as uploading the extra pixels costs less than the upload it saves.
+ * Returns the number of rectangles. */
+static int
+plan_uploads (cairo_region_t        *region,
+              cairo_rectangle_int_t  boxes[MAX_PLANNED_UPLOADS])
+{
+  int n_boxes;
+  int i, j;
+
+  n_boxes = cairo_region_num_rectangles (region);
+  if (n_boxes > MAX_PLANNED_UPLOADS)
+    {
+      cairo_region_get_extents (region, &boxes[0]);
+      return 1;
+    }
+
+  for (i = 0; i < n_boxes; i++)
+    cairo_region_get_rectangle (region, i, &boxes[i]);
+
+  while (n_boxes > 1)
+    {
+      cairo_rectangle_int_t best_union;
+      gint64 best_cost = UPLOAD_CALL_COST;
+      int best_i = -1, best_j = -1;
+
+      for (i = 0; i < n_boxes; i++)
+        for (j = i + 1; j < n_boxes; j++)
+          {
+            cairo_rectangle_int_t u;
+            gint64 cost;
+
+            gdk_rectangle_union (&boxes[i], &boxes[j], &u);
+            cost = rect_area (&u) - rect_area (&boxes[i]) - rect_area (&boxes[j]);
+
+            if (cost < best_cost)
+              {
+                best_cost = cost;
+                best_union = u;
+                best_i = i;
+                best_j = j;
+              }
+          }
+
+      if (best_i < 0)
+        break;
+
+      boxes[best_i] = best_union;
+      boxes[best_j] = boxes[--n_boxes];
+    }
+
+  return n_boxes;
+}
+
+/**
+ * meta_wayland_surface_flush_uploads:
+ * @surface: a #MetaWaylandSurface
+ *
+ * Uploads the SHM damage committed since the last paint to the texture
+ * of the surface's buffer, in as few pieces as is worthwhile.
+ */
+void
+meta_wayland_surface_flush_uploads (MetaWaylandSurface *surface)
+{
+  struct wl_shm_buffer *shm_buffer;
+  cairo_rectangle_int_t boxes[MAX_PLANNED_UPLOADS];
+  int bytes_per_pixel;
+  int i, n_boxes, n_rects;
+
+  if (surface->shm_copy)
+    {
+      surface->uploaded_bytes += meta_wayland_shm_copy_finish (surface->shm_copy, TRUE);
+      surface->shm_copy = NULL;
+    }
+
+  if (surface->pending_upload == NULL)
+    {
+      surface_discard_uploads (surface);
+      return;
+    }
+
+  shm_buffer = wl_shm_buffer_get (surface->buffer->resource);
+  bytes_per_pixel = (wl_shm_buffer_get_stride (shm_buffer) /
+                     MAX (wl_shm_buffer_get_width (shm_buffer), 1));
+
+  n_rects = cairo_region_num_rectangles (surface->pending_upload);
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+      cairo_region_get_rectangle (surface->pending_upload, i, &rect);
+      surface->damaged_bytes += rect_area (&rect) * bytes_per_pixel;
+    }
+  surface->n_damage_rects += n_rects;
+
+  n_boxes = plan_uploads (surface->pending_upload, boxes);
+  for (i = 0; i < n_boxes; i++)
+    {
+      cairo_rectangle_int_t *box = &boxes[i];
+
+      cogl_wayland_texture_set_region_from_shm_buffer (surface->buffer->texture,
+                                                       box->x, box->y,
+                                                       box->width, box->height,
+                                                       shm_buffer,
+                                                       box->x, box->y, 0, NULL);
+      surface->uploaded_bytes += rect_area (box) * bytes_per_pixel;
+    }
+  surface->n_uploads += n_boxes;
+
+  surface_discard_uploads (surface);
+}
+
+/**
+ * meta_wayland_surface_get_upload_stats:
+ * @surface: a #MetaWaylandSurface
+ * @n_damage_rects: (out) (allow-none): number of damage rectangles
+ * @n_uploads: (out) (allow-none): number of uploads done for them
+ * @damaged_bytes: (out) (allow-none): bytes of SHM data damaged
+ * @uploaded_bytes: (out) (allow-none): bytes actually uploaded
+ *
+ * Gets totals over the lifetime of @surface that show how well damage
+ * is coalesced. Damage that is overwritten before the next paint, or
+ * that arrives with a newly attached buffer, isn't uploaded at all.
+ */
+void
+meta_wayland_surface_get_upload_stats (MetaWaylandSurface *surface,
+                                       guint              *n_damage_rects,
+                                       guint              *n_uploads,
+                                       guint64            *damaged_bytes,
+                                       guint64            *uploaded_bytes)
+{
+  if (n_damage_rects)
+    *n_damage_rects = surface->n_damage_rects;
+  if (n_uploads)
+    *n_uploads = surface->n_uploads;
+  if (damaged_bytes)
+    *damaged_bytes = surface->damaged_bytes;
+  if (uploaded_bytes)
+    *uploaded_bytes = surface->uploaded_bytes;
+}
+
+static gboolean
+surface_is_cursor (MetaWaylandSurface *surface)
+{
+  return surface == surface->compositor->seat->pointer.cursor_surface;
+}
+
+/* Starts copying @region of the surface's SHM buffer on a worker thread,
+ * if it is big enough to be worth it. */
+static gboolean
+surface_start_copy (MetaWaylandSurface *surface,
+                    cairo_region_t     *region)
+{
+  cairo_rectangle_int_t boxes[MAX_PLANNED_UPLOADS];
+  MetaWaylandShmCopy *copy;
+  gint64 n_bytes;
+  int i, n_boxes, n_rects;
+
+  /* The cursor is updated right away, there is no paint to wait for */
+  if (surface->shm_copy != NULL || surface_is_cursor (surface))
+    return FALSE;
+
+  n_boxes = plan_uploads (region, boxes);
+
+  n_bytes = 0;
+  for (i = 0; i < n_boxes; i++)
+    n_bytes += rect_area (&boxes[i]) * 4;
+
+  if (n_bytes < ASYNC_COPY_MIN_BYTES)
+    return FALSE;
+
+  copy = meta_wayland_shm_copy_new (surface->buffer, boxes, n_boxes);
+  if (copy == NULL)
+    return FALSE;
+
+  surface->shm_copy = copy;
+  surface_queue_uploads (surface);
+
+  n_rects = cairo_region_num_rectangles (region);
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+      cairo_region_get_rectangle (region, i, &rect);
+      surface->damaged_bytes += rect_area (&rect) * 4;
+    }
+  surface->n_damage_rects += n_rects;
+  surface->n_uploads += n_boxes;
+
+  return TRUE;
+}
+
+/* Creates an empty texture for a newly attached SHM buffer, and starts
+ * copying the whole buffer on a worker thread to fill it in. */
+static gboolean
+surface_import_shm_async (MetaWaylandSurface *surface,
+                          MetaWaylandBuffer  *buffer)
+{
+  CoglContext *ctx = clutter_backend_get_cogl_context (clutter_get_default_backend ());
+  struct wl_shm_buffer *shm_buffer;
+  cairo_region_t *region;
+  cairo_rectangle_int_t rect;
+  CoglTexture *texture;
+  gboolean started;
+
+  shm_buffer = wl_shm_buffer_get (buffer->resource);
+  if (shm_buffer == NULL)
+    return FALSE;
+
+  rect.x = 0;
+  rect.y = 0;
+  rect.width = wl_shm_buffer_get_width (shm_buffer);
+  rect.height = wl_shm_buffer_get_height (shm_buffer);
+
+  region = cairo_region_create_rectangle (&rect);
+  started = surface_start_copy (surface, region);
+  cairo_region_destroy (region);
+
+  if (!started)
+    return FALSE;
+
+  texture = COGL_TEXTURE (cogl_texture_2d_new_with_size (ctx, rect.width, rect.height));
+  cogl_texture_set_components (texture,
+                               meta_wayland_shm_copy_get_components (surface->shm_copy));
+  buffer->texture = texture;
+
+  return TRUE;
+}
+
 static void
 surface_process_damage (MetaWaylandSurface *surface,
-                        cairo_region_t *region)
+                        cairo_region_t *region,
+                        gboolean        needs_upload)
 {
   int i, n_rectangles;
   cairo_rectangle_int_t buffer_rect;
   int scale = surface->scale;
-  CoglTexture *texture;
-  struct wl_shm_buffer *shm_buffer;
 
   /* Damage without a buffer makes no sense so ignore that, otherwise we would crash */
   if (!surface->buffer)
     return;
 
-  texture = surface->buffer->texture;
-
   buffer_rect.x = 0;
   buffer_rect.y = 0;
   buffer_rect.width = cogl_texture_get_width (surface->buffer->texture);
@@ -127,18 +397,26 @@ surface_process_damage (MetaWaylandSurface *surface,
      just modify it here to avoid a copy */
   cairo_region_intersect_rectangle (region, &buffer_rect);
 
-  n_rectangles = cairo_region_num_rectangles (region);
+  /* SHM contents are copied to the texture just before the next paint,
+   * so that all the damage committed until then is uploaded in one go.
+   * The client can't touch the buffer before we release it. */
+  if (needs_upload && wl_shm_buffer_get (surface->buffer->resource) &&
+      !surface_start_copy (surface, region))
+    {
+      if (surface->pending_upload == NULL)
+        surface->pending_upload = cairo_region_create ();
 
-  shm_buffer = wl_shm_buffer_get (surface->buffer->resource);
+      cairo_region_union (surface->pending_upload, region);
+      surface_queue_uploads (surface);
+    }
+
+  n_rectangles = cairo_region_num_rectangles (region);
 
   for (i = 0; i < n_rectangles; i++)
     {
       cairo_rectangle_int_t rect;
       cairo_region_get_rectangle (region, i, &rect);
 
-      if (shm_buffer)
-        cogl_wayland_texture_set_region_from_shm_buffer (texture, rect.x, rect.y, rect.width, rect.height, shm_buffer, rect.x, rect.y, 0, NULL);
-
       meta_surface_actor_process_damage (surface->surface_actor,
                                          rect.x * scale, rect.y * scale, rect.width * scale, rect.height * scale);
     }
@@ -399,6 +677,7 @@ commit_pending_state (MetaWaylandSurface      *surface,
                       MetaWaylandPendingState *pending)
 {
   MetaWaylandCompositor *compositor = surface->compositor;
+  gboolean new_texture = FALSE;
 
   /* If this surface is a subsurface in in synchronous mode, commit
    * has a special-case and should not apply the pending state immediately.
@@ -414,11 +693,20 @@ commit_pending_state (MetaWaylandSurface      *surface,
 
   if (pending->newly_attached)
     {
+      /* The old buffer may be released to the client below; if its
+       * texture stays around for someone else, it needs to be up to date */
+      if (surface->buffer != pending->buffer && surface->buffer != NULL &&
+          surface->buffer->ref_count > (surface->shm_copy ? 2 : 1))
+        meta_wayland_surface_flush_uploads (surface);
+
       surface_set_buffer (surface, pending->buffer);
 
       if (pending->buffer)
         {
-          ensure_buffer_texture (pending->buffer);
+          /* A new texture has all of the buffer's contents already */
+          new_texture = (pending->buffer->texture == NULL);
+          if (!new_texture || !surface_import_shm_async (surface, pending->buffer))
+            ensure_buffer_texture (pending->buffer);
           meta_surface_actor_wayland_set_texture (META_SURFACE_ACTOR_WAYLAND (surface->surface_actor), pending->buffer->texture);
         }
     }
@@ -427,7 +715,7 @@ commit_pending_state (MetaWaylandSurface      *surface,
     surface->scale = pending->scale;
 
   if (!cairo_region_is_empty (pending->damage))
-    surface_process_damage (surface, pending->damage);
+    surface_process_damage (surface, pending->damage, !new_texture);
 
   if (pending->opaque_region)
     {
@@ -441,7 +729,11 @@ commit_pending_state (MetaWaylandSurface      *surface,
     }
 
   if (surface == compositor->seat->pointer.cursor_surface)
-    cursor_surface_commit (surface, pending);
+    {
+      /* The cursor is updated right away, there is no paint to wait for */
+      meta_wayland_surface_flush_uploads (surface);
+      cursor_surface_commit (surface, pending);
+    }
   else if (surface->window)
     toplevel_surface_commit (surface, pending);
   else if (surface->subsurface.resource)
@@ -690,6 +982,7 @@ wl_surface_destructor (struct wl_resource *resource)
     destroy_window (surface);
 
   surface_set_buffer (surface, NULL);
+  surface_discard_uploads (surface);
   pending_state_destroy (&surface->pending);
 
   g_object_unref (surface->surface_actor);
@@ -716,6 +1009,7 @@ meta_wayland_surface_create (MetaWaylandCompositor *compositor,
   wl_resource_set_implementation (surface->resource, &meta_wayland_wl_surface_interface, surface, wl_surface_destructor);
 
   surface->buffer_destroy_listener.notify = surface_handle_buffer_destroy;
+  wl_list_init (&surface->upload_link);
   surface->surface_actor = g_object_ref_sink (meta_surface_actor_wayland_new (surface));
 
   pending_state_init (&surface->pending);
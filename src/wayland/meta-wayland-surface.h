@@ -92,6 +92,21 @@ struct _MetaWaylandSurface
   MetaWaylandBuffer *buffer;
   struct wl_listener buffer_destroy_listener;
 
+  /* SHM damage, in buffer coordinates, that is uploaded to the buffer's
+   * texture before the next paint; see meta_wayland_surface_flush_uploads() */
+  cairo_region_t *pending_upload;
+  struct wl_list upload_link;
+
+  /* Large SHM damage being copied on a worker thread, uploaded from
+   * the copy before the next paint */
+  MetaWaylandShmCopy *shm_copy;
+
+  /* Totals for meta_wayland_surface_get_upload_stats() */
+  guint n_damage_rects;
+  guint n_uploads;
+  guint64 damaged_bytes;
+  guint64 uploaded_bytes;
+
   GList *subsurfaces;
 
   struct {
@@ -138,6 +153,13 @@ void                meta_wayland_surface_configure_notify (MetaWaylandSurface *s
                                                            int                 height,
                                                            MetaWaylandSerial  *sent_serial);
 
+void                meta_wayland_surface_flush_uploads (MetaWaylandSurface *surface);
+void                meta_wayland_surface_get_upload_stats (MetaWaylandSurface *surface,
+                                                           guint              *n_damage_rects,
+                                                           guint              *n_uploads,
+                                                           guint64            *damaged_bytes,
+                                                           guint64            *uploaded_bytes);
+
 void                meta_wayland_surface_ping (MetaWaylandSurface *surface,
                                                guint32             serial);
 void                meta_wayland_surface_delete (MetaWaylandSurface *surface);
@@ -33,6 +33,7 @@ typedef struct _MetaWaylandDataDevice MetaWaylandDataDevice;
 
 typedef struct _MetaWaylandBuffer MetaWaylandBuffer;
 typedef struct _MetaWaylandBufferReference MetaWaylandBufferReference;
+typedef struct _MetaWaylandShmCopy MetaWaylandShmCopy;
 
 typedef struct _MetaWaylandSurface MetaWaylandSurface;
 
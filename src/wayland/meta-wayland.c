@@ -40,6 +40,7 @@
 #include <meta/meta-backend.h>
 
 #include "meta-wayland-private.h"
+#include "meta-wayland-shm-copy.h"
 #include "meta-xwayland-private.h"
 #include "meta-window-actor-private.h"
 #include "meta-wayland-seat.h"
@@ -77,6 +78,10 @@ wayland_event_source_prepare (GSource *base, int *timeout)
 
   *timeout = -1;
 
+  /* A client whose connection fails to flush is destroyed, and its
+   * SHM pools unmapped, so running copies must be done first */
+  meta_wayland_shm_copy_wait_all ();
+
   wl_display_flush_clients (source->display);
 
   return FALSE;
@@ -97,8 +102,14 @@ wayland_event_source_dispatch (GSource *base,
   WaylandEventSource *source = (WaylandEventSource *)base;
   struct wl_event_loop *loop = wl_display_get_event_loop (source->display);
 
+  /* Client requests can resize or destroy the SHM pools that running
+   * copies read from */
+  meta_wayland_shm_copy_wait_all ();
+
   wl_event_loop_dispatch (loop, 0);
 
+  meta_wayland_shm_copy_start_queued ();
+
   return TRUE;
 }
 
@@ -274,6 +285,23 @@ const static struct wl_compositor_interface meta_wayland_compositor_interface =
   wl_compositor_create_region
 };
 
+/**
+ * meta_wayland_compositor_upload_damage:
+ * @compositor: the #MetaWaylandCompositor
+ *
+ * Uploads the damage that SHM clients committed since the last paint.
+ * This is called before painting, so that several commits of a surface
+ * within one frame result in a single upload.
+ */
+void
+meta_wayland_compositor_upload_damage (MetaWaylandCompositor *compositor)
+{
+  MetaWaylandSurface *surface, *next;
+
+  wl_list_for_each_safe (surface, next, &compositor->pending_uploads, upload_link)
+    meta_wayland_surface_flush_uploads (surface);
+}
+
 void
 meta_wayland_compositor_paint_finished (MetaWaylandCompositor *compositor)
 {
@@ -376,6 +404,7 @@ meta_wayland_compositor_init (MetaWaylandCompositor *compositor)
 {
   memset (compositor, 0, sizeof (MetaWaylandCompositor));
   wl_list_init (&compositor->frame_callbacks);
+  wl_list_init (&compositor->pending_uploads);
 }
 
 void
@@ -42,6 +42,7 @@ void                    meta_wayland_compositor_repick          (MetaWaylandComp
 void                    meta_wayland_compositor_set_input_focus (MetaWaylandCompositor *compositor,
                                                                  MetaWindow            *window);
 
+void                    meta_wayland_compositor_upload_damage   (MetaWaylandCompositor *compositor);
 void                    meta_wayland_compositor_paint_finished  (MetaWaylandCompositor *compositor);
 
 const char             *meta_wayland_get_wayland_display_name   (MetaWaylandCompositor *compositor);